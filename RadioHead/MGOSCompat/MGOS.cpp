@@ -99,6 +99,14 @@ uint32_t millis(void)
   return (uint32_t)mgos_uptime_micros()/1000;
 }
 
+/**
+ * @brief Get the number of elapsed microseconds since the last boot.
+ */
+uint32_t micros(void)
+{
+  return (uint32_t)mgos_uptime_micros();
+}
+
 /**
  * @brief Provide a delay in milliseconds.
  * @param ms The number of Milli Seconds to delay.
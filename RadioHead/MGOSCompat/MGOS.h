@@ -91,6 +91,7 @@ extern "C" {
   void digitalWrite(unsigned char pin, unsigned char value);
   uint8_t digitalRead(uint8_t pin);
   uint32_t millis(void);
+  uint32_t micros(void);
   void delay (unsigned long ms);
   long random(long min, long max);
   void attachInterrupt(uint8_t pin, void (*handler)(void), int rh_mode);
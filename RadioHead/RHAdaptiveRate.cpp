@@ -0,0 +1,420 @@
+// RHAdaptiveRate.cpp
+//
+// Copyright (C) 2014 Mike McCauley
+// $Id: RHAdaptiveRate.cpp,v 1.1 2019/09/06 04:40:40 mikem Exp $
+
+#include <RHAdaptiveRate.h>
+#include <RHReliableDatagram.h>
+
+// Slowest first. Spreading factor 7 at 125kHz is the home rate, as RH_RF95::Bw125Cr45Sf128
+static const RHAdaptiveRate::Rate DEFAULT_RATES[] =
+{
+    { 12, 125000 },
+    { 11, 125000 },
+    { 10, 125000 },
+    {  9, 125000 },
+    {  8, 125000 },
+    {  7, 125000 },
+    {  7, 250000 },
+};
+#define DEFAULT_HOME 5
+
+RHAdaptiveRate::RHAdaptiveRate(RHGenericDriver& driver, int8_t maxPower, int8_t minPower)
+    :
+    _driver(driver),
+    _rates(DEFAULT_RATES),
+    _count(sizeof(DEFAULT_RATES) / sizeof(DEFAULT_RATES[0])),
+    _home(DEFAULT_HOME),
+    _maxPower(maxPower),
+    _minPower(minPower),
+    _margin(RH_ADR_MARGIN),
+    _hysteresis(RH_ADR_HYSTERESIS),
+    _silence(RH_ADR_SILENCE),
+    _appliedRate(0xff),
+    _appliedPower(-128),
+    _rateChanges(0),
+    _lastPoll(0)
+{
+    memset(_peers, 0, sizeof(_peers));
+    _held.valid = false;
+}
+
+void RHAdaptiveRate::setRates(const Rate* rates, uint8_t count, uint8_t home)
+{
+    if (!count || home >= count)
+	return;
+    _rates = rates;
+    _count = count;
+    _home = home;
+    _appliedRate = 0xff;
+    // Indexes into the old table mean nothing now
+    memset(_peers, 0, sizeof(_peers));
+}
+
+void RHAdaptiveRate::setMargin(int8_t margin, int8_t hysteresis)
+{
+    _margin = margin;
+    _hysteresis = hysteresis;
+}
+
+void RHAdaptiveRate::setSilence(unsigned long silence)
+{
+    _silence = silence;
+}
+
+RHAdaptiveRate::Rate RHAdaptiveRate::rate(uint8_t address)
+{
+    Peer* peer = findPeer(address, false);
+    return _rates[peer ? peer->rate : _home];
+}
+
+int8_t RHAdaptiveRate::power(uint8_t address)
+{
+    Peer* peer = findPeer(address, false);
+    return peer ? peer->power : _maxPower;
+}
+
+uint16_t RHAdaptiveRate::rateChanges()
+{
+    return _rateChanges;
+}
+
+void RHAdaptiveRate::prepare(uint8_t address)
+{
+    poll();
+    Peer* peer = address == RH_BROADCAST_ADDRESS ? NULL : findPeer(address, false);
+    if (!peer)
+    {
+	apply(_home, _maxPower);
+	return;
+    }
+    // Not before an ACK: the sender is waiting for it, and would time out during the exchange
+    if (peer->propose && !(_driver.txHeaderFlags() & RH_FLAGS_ACK))
+	exchange(peer);
+    apply(peer->rate, peer->power);
+}
+
+bool RHAdaptiveRate::received(const uint8_t* buf, uint8_t len)
+{
+    uint8_t from = _driver.headerFrom();
+    bool control = _driver.headerFlags() & RH_FLAGS_ADR;
+    if (_driver.headerTo() == RH_BROADCAST_ADDRESS)
+	return control; // Sent at the home rate, and not about our link
+
+    Peer* peer = findPeer(from, true);
+    peer->heard = millis();
+    peer->failures = 0;
+
+    // The SNR is measured at whatever rate the radio is set to
+    uint8_t measured = _appliedRate == 0xff ? _home : _appliedRate;
+    int16_t snr = _driver.lastSNR();
+    if (snr >= RH_ADR_SNR_SATURATION)
+    {
+	int16_t estimate = _driver.lastRssi() - RH_ADR_NOISE_FLOOR_125
+	    - bandwidthRatio(_rates[measured].bandwidth, 125000);
+	if (estimate > snr)
+	    snr = estimate;
+    }
+    snr = snrAt(snr, measured, peer->rate);
+    peer->snr[peer->next] = snr > 127 ? 127 : snr < -128 ? -128 : snr;
+    peer->next = (peer->next + 1) % RH_ADR_HISTORY;
+    if (peer->samples < RH_ADR_HISTORY)
+	peer->samples++;
+
+    if (!control)
+    {
+	evaluate(peer);
+	return false;
+    }
+    if (buf && len >= RH_ADR_MESSAGE_LEN && buf[0] == RH_ADR_MESSAGE_TYPE_REQUEST)
+	answer(peer, buf);
+    // A late answer to one of our requests, which exchange() has given up on, is ignored
+    return true;
+}
+
+void RHAdaptiveRate::linkFailed(uint8_t address)
+{
+    Peer* peer = findPeer(address, false);
+    if (!peer)
+	return;
+    peer->power = _maxPower;
+    if (++peer->failures >= RH_ADR_MAX_FAILURES)
+    {
+	goHome(peer);
+	peer->failures = 0;
+	// Listen where the peer will look for us. Else, if we only answer, we never hear it again
+	apply(_home, _maxPower);
+    }
+}
+
+void RHAdaptiveRate::poll()
+{
+    unsigned long now = millis();
+    if (now - _lastPoll < 1000)
+	return;
+    _lastPoll = now;
+
+    uint8_t i;
+    for (i = 0; i < RH_ADR_PEERS; i++)
+    {
+	Peer* peer = &_peers[i];
+	if (peer->valid && peer->rate != _home && now - peer->heard > _silence)
+	{
+	    goHome(peer);
+	    // Listen where the peer will look for us
+	    apply(_home, _maxPower);
+	}
+    }
+}
+
+bool RHAdaptiveRate::held()
+{
+    return _held.valid;
+}
+
+bool RHAdaptiveRate::takeHeld(uint8_t* buf, uint8_t* len, uint8_t* from, uint8_t* to, uint8_t* id, uint8_t* flags)
+{
+    if (!_held.valid)
+	return false;
+    if (buf && len)
+    {
+	if (*len > _held.len)
+	    *len = _held.len;
+	memcpy(buf, _held.data, *len);
+    }
+    if (from)  *from =  _held.from;
+    if (to)    *to =    _held.to;
+    if (id)    *id =    _held.id;
+    if (flags) *flags = _held.flags;
+    _held.valid = false;
+    return true;
+}
+
+RHAdaptiveRate::Peer* RHAdaptiveRate::findPeer(uint8_t address, bool create)
+{
+    Peer* oldest = &_peers[0];
+    uint8_t i;
+    for (i = 0; i < RH_ADR_PEERS; i++)
+    {
+	Peer* peer = &_peers[i];
+	if (peer->valid && peer->address == address)
+	    return peer;
+	if (oldest->valid && (!peer->valid || peer->heard - oldest->heard > 0x80000000UL))
+	    oldest = peer; // Free, or heard from before oldest
+    }
+    if (!create)
+	return NULL;
+
+    memset(oldest, 0, sizeof(*oldest));
+    oldest->valid = true;
+    oldest->address = address;
+    oldest->rate = _home;
+    oldest->power = _maxPower;
+    oldest->peerPower = _maxPower;
+    oldest->heard = millis();
+    return oldest;
+}
+
+void RHAdaptiveRate::evaluate(Peer* peer)
+{
+    if (peer->propose || peer->samples < RH_ADR_HISTORY)
+	return;
+
+    int16_t snr = meanSNR(peer);
+    int16_t now = margin(snr, peer->rate, peer->rate);
+    if (now >= -_hysteresis && now < RH_ADR_POWER_STEP + _hysteresis)
+	return; // Close enough
+
+    // The fastest rate the peer could reach us at, turning its power up if need be
+    uint8_t rate = _count;
+    while (--rate > 0 && margin(snr, peer->rate, rate) + _maxPower - peer->peerPower < 0)
+	;
+    // Then trade any margin left for power, in whole steps
+    int16_t spare = margin(snr, peer->rate, rate);
+    int16_t steps = spare >= 0 ? spare / RH_ADR_POWER_STEP : -((RH_ADR_POWER_STEP - 1 - spare) / RH_ADR_POWER_STEP);
+    int8_t power = clampPower(peer->peerPower - steps * RH_ADR_POWER_STEP);
+    if (rate == peer->rate && power == peer->peerPower)
+	return;
+
+    peer->propose = true;
+    peer->proposedRate = rate;
+    peer->proposedPower = power;
+}
+
+uint8_t RHAdaptiveRate::acceptable(Peer* peer, uint8_t rate)
+{
+    if (rate <= peer->rate || !peer->samples)
+	return rate; // Slower is always safe, and with no samples we have no reason to object
+    int16_t snr = meanSNR(peer);
+    while (rate > peer->rate && margin(snr, peer->rate, rate) + _maxPower - peer->peerPower < 0)
+	rate--;
+    return rate;
+}
+
+void RHAdaptiveRate::exchange(Peer* peer)
+{
+    peer->propose = false;
+    uint8_t oldRate = peer->rate;
+    uint8_t attempt;
+    for (attempt = 0; attempt < 2; attempt++)
+    {
+	// First at the old rate. If the answer is lost the peer may have changed, so then try at the new one
+	uint8_t tryRate = attempt ? peer->proposedRate : oldRate;
+	apply(tryRate, peer->power);
+	if (!sendControl(peer->address, RH_ADR_MESSAGE_TYPE_REQUEST, peer->proposedRate, peer->proposedPower))
+	    return;
+
+	unsigned long start = millis();
+	unsigned long timeout = RH_ADR_ANSWER_TIMEOUT + 2 * _driver.timeOnAir(RH_ADR_MESSAGE_LEN) / 1000;
+	unsigned long elapsed;
+	while ((elapsed = millis() - start) < timeout)
+	{
+	    if (!_driver.waitAvailableTimeout(timeout - elapsed))
+		break;
+	    // Receive straight into the holding buffer while it is free, in case this is for the application
+	    uint8_t control[RH_ADR_MESSAGE_LEN];
+	    uint8_t* buf = _held.valid ? control : _held.data;
+	    uint8_t len = _held.valid ? sizeof(control) : sizeof(_held.data);
+	    if (!_driver.recv(buf, &len))
+		continue;
+	    if (!(_driver.headerFlags() & RH_FLAGS_ADR))
+	    {
+		// Keep it for the application. If one is already kept, this one is lost
+		if (buf == _held.data)
+		{
+		    _held.valid = true;
+		    _held.from = _driver.headerFrom();
+		    _held.to = _driver.headerTo();
+		    _held.id = _driver.headerId();
+		    _held.flags = _driver.headerFlags();
+		    _held.len = len;
+		}
+		continue;
+	    }
+	    // Control messages for other links are dropped. Their senders will try again
+	    if (_driver.headerFrom() != peer->address || len < RH_ADR_MESSAGE_LEN)
+		continue;
+	    if (buf[0] == RH_ADR_MESSAGE_TYPE_REQUEST)
+	    {
+		// We both had the same idea. Theirs wins
+		answer(peer, buf);
+		return;
+	    }
+	    if (buf[0] == RH_ADR_MESSAGE_TYPE_ANSWER)
+	    {
+		peer->heard = millis();
+		peer->peerPower = peer->proposedPower;
+		setRate(peer, buf[1] < _count ? buf[1] : tryRate);
+		if (peer->rate != oldRate)
+		    _rateChanges++;
+		return;
+	    }
+	}
+	if (peer->proposedRate == oldRate)
+	    break; // The peer cannot have changed rate
+    }
+    // No answer: carry on as before. evaluate() will propose again after the next message from the peer
+}
+
+bool RHAdaptiveRate::sendControl(uint8_t address, uint8_t type, uint8_t rate, int8_t power)
+{
+    uint8_t buf[RH_ADR_MESSAGE_LEN];
+    buf[0] = type;
+    buf[1] = rate;
+    buf[2] = (uint8_t)power;
+    _driver.setHeaderTo(address);
+    _driver.setHeaderFlags(RH_FLAGS_ADR);
+    bool ret = _driver.send(buf, sizeof(buf)) && _driver.waitPacketSent();
+    _driver.setHeaderFlags(RH_FLAGS_NONE, RH_FLAGS_ADR);
+    return ret;
+}
+
+void RHAdaptiveRate::answer(Peer* peer, const uint8_t* buf)
+{
+    peer->propose = false; // Whatever we were going to propose is based on the old rate
+    peer->power = clampPower((int8_t)buf[2]);
+    uint8_t rate = buf[1] < _count ? acceptable(peer, buf[1]) : peer->rate;
+    // Answer at the rate the request came at
+    apply(peer->rate, peer->power);
+    sendControl(peer->address, RH_ADR_MESSAGE_TYPE_ANSWER, rate, peer->power);
+    if (rate != peer->rate)
+    {
+	setRate(peer, rate);
+	_rateChanges++;
+    }
+    else
+	peer->samples = 0; // The peer power may have changed
+    // Listen for the peer at the new rate
+    apply(peer->rate, peer->power);
+}
+
+void RHAdaptiveRate::setRate(Peer* peer, uint8_t rate)
+{
+    peer->rate = rate;
+    peer->samples = 0;
+    peer->next = 0;
+}
+
+void RHAdaptiveRate::goHome(Peer* peer)
+{
+    setRate(peer, _home);
+    peer->power = _maxPower;
+    peer->peerPower = _maxPower;
+    peer->propose = false;
+}
+
+void RHAdaptiveRate::apply(uint8_t rate, int8_t power)
+{
+    if (rate != _appliedRate && _driver.setLoRaRate(_rates[rate].spreadingFactor, _rates[rate].bandwidth))
+	_appliedRate = rate;
+    if (power != _appliedPower && _driver.setTransmitPower(power))
+	_appliedPower = power;
+}
+
+int16_t RHAdaptiveRate::snrAt(int16_t snr, uint8_t from, uint8_t to)
+{
+    // A wider bandwidth lets in more noise
+    return snr - bandwidthRatio(_rates[to].bandwidth, _rates[from].bandwidth);
+}
+
+int16_t RHAdaptiveRate::margin(int16_t snr, uint8_t from, uint8_t rate)
+{
+    // Demodulation floor of LoRa: -7.5dB at spreading factor 7, 2.5dB lower for each step up
+    int16_t floor = -5 - (5 * (_rates[rate].spreadingFactor - 6)) / 2;
+    return snrAt(snr, from, rate) - floor - _margin;
+}
+
+int8_t RHAdaptiveRate::meanSNR(Peer* peer)
+{
+    // Not the best, which with fading is several dB above what the link usually has
+    int16_t sum = 0;
+    uint8_t i;
+    for (i = 0; i < peer->samples; i++)
+	sum += peer->snr[i];
+    return peer->samples ? sum / peer->samples : 0;
+}
+
+int8_t RHAdaptiveRate::clampPower(int16_t power)
+{
+    if (power > _maxPower)
+	return _maxPower;
+    if (power < _minPower)
+	return _minPower;
+    return power;
+}
+
+int16_t RHAdaptiveRate::bandwidthRatio(uint32_t bandwidth, uint32_t reference)
+{
+    int16_t ratio = 0;
+    while (bandwidth >= reference * 2)
+    {
+	reference *= 2;
+	ratio += 3;
+    }
+    while (bandwidth * 2 <= reference)
+    {
+	bandwidth *= 2;
+	ratio -= 3;
+    }
+    return ratio;
+}
@@ -0,0 +1,377 @@
+// RHAdaptiveRate.h
+// Author: Mike McCauley (mikem@airspayce.com)
+// Copyright (C) 2014 Mike McCauley
+// $Id: RHAdaptiveRate.h,v 1.1 2019/09/06 04:40:40 mikem Exp $
+
+#ifndef RHAdaptiveRate_h
+#define RHAdaptiveRate_h
+
+#include <RHGenericDriver.h>
+
+// The reserved FLAGS header bit that marks an RHAdaptiveRate control message
+#define RH_FLAGS_ADR 0x10
+
+// Types of control message, in the first octet
+#define RH_ADR_MESSAGE_TYPE_REQUEST 1
+#define RH_ADR_MESSAGE_TYPE_ANSWER  2
+
+// Length of a control message: the type, the index of the rate, and a transmitter power in dBm
+#define RH_ADR_MESSAGE_LEN 3
+
+// Maximum number of peers whose links are tracked. When there are more, the peer heard from
+// least recently is forgotten
+#ifndef RH_ADR_PEERS
+ #if defined(__AVR__)
+  #define RH_ADR_PEERS 4
+ #else
+  #define RH_ADR_PEERS 16
+ #endif
+#endif
+
+// Number of SNR samples kept for each peer. A change is only considered after this many
+// messages have been received from the peer since the last change
+#ifndef RH_ADR_HISTORY
+ #if defined(__AVR__)
+  #define RH_ADR_HISTORY 4
+ #else
+  #define RH_ADR_HISTORY 8
+ #endif
+#endif
+
+// Default margin in dB that the SNR of a link must have over the demodulation floor of its rate,
+// to allow for fading. LoRaWAN network servers typically use 10
+#ifndef RH_ADR_MARGIN
+#define RH_ADR_MARGIN 10
+#endif
+
+// Default hysteresis in dB. The rate and power are left alone while the margin is within
+// this much of the ideal
+#ifndef RH_ADR_HYSTERESIS
+#define RH_ADR_HYSTERESIS 3
+#endif
+
+// Size of the transmitter power steps in dB
+#ifndef RH_ADR_POWER_STEP
+#define RH_ADR_POWER_STEP 3
+#endif
+
+// Default time in milliseconds without hearing from a peer, after which the link with it
+// goes back to the home rate
+#ifndef RH_ADR_SILENCE
+#define RH_ADR_SILENCE 600000
+#endif
+
+// Number of consecutive failures to deliver to a peer after which the link with it goes back
+// to the home rate
+#ifndef RH_ADR_MAX_FAILURES
+#define RH_ADR_MAX_FAILURES 2
+#endif
+
+// Time in milliseconds to wait for the answer to a request, on top of twice its time on air
+#ifndef RH_ADR_ANSWER_TIMEOUT
+#define RH_ADR_ANSWER_TIMEOUT 100
+#endif
+
+// Longest message for the application that can be kept when it arrives during a control exchange.
+// Must be at least the maximum message length of the driver
+#ifndef RH_ADR_HELD_MESSAGE_LEN
+#define RH_ADR_HELD_MESSAGE_LEN 255
+#endif
+
+// LoRa receivers report SNRs up to about this, however strong the signal. Above it, the SNR is
+// estimated from the RSSI instead
+#define RH_ADR_SNR_SATURATION 8
+
+// Noise floor in dBm of a receiver in 125kHz: -174 + 10log10(125000) + 6dB noise figure
+#define RH_ADR_NOISE_FLOOR_125 -117
+
+/////////////////////////////////////////////////////////////////////
+/// \class RHAdaptiveRate RHAdaptiveRate.h <RHAdaptiveRate.h>
+/// \brief Adaptive data rate: chooses the LoRa spreading factor, bandwidth and transmitter power of each link
+///
+/// A LoRa link configured once with setModemConfig() uses the same spreading factor and power whether
+/// the peer is 5m away or at the edge of range. Each step down in spreading factor halves the time on air,
+/// and so the energy and the share of the channel each message takes. RHAdaptiveRate picks the fastest rate and
+/// lowest power that each link can carry, in the manner of LoRaWAN ADR.
+///
+/// It keeps the last RH_ADR_HISTORY SNRs of the messages received from each peer (estimated from the RSSI when
+/// the SNR is too high for the receiver to measure). When their mean is more than RH_ADR_POWER_STEP
+/// plus the hysteresis above the demodulation floor of the current rate plus the margin, it asks the peer to
+/// use a faster rate, and then to turn its power down in steps of RH_ADR_POWER_STEP dB. When the mean is more
+/// than the hysteresis below, it asks the peer to turn its power up, and then to use a slower rate.
+///
+/// Both ends of a link must use the same rate, so changes are agreed in a control exchange before the next
+/// message other than an ACK is sent to the peer. The proposer sends a request with the new rate and the power it would like
+/// the peer to transmit at, and the peer answers at the old rate with the rate it agrees to: the one
+/// requested, or a slower one if its own measurements do not support it. Then both change. If the answer is
+/// lost, the proposer tries again at the new rate, in case the peer has already changed. Control messages
+/// are marked with the reserved RH_FLAGS_ADR header flag, and are not given to the application.
+/// One other message that arrives while the proposer waits for the answer is kept, and RHDatagram gives
+/// it to the application after the exchange. Its SNR is not used, as the rate is changing.
+///
+/// If a link fails anyway, it goes back to the home rate (the one the radio was configured with) at full
+/// power: at the sending end after RH_ADR_MAX_FAILURES messages in a row are not delivered (as reported by
+/// RHReliableDatagram), and at the receiving end when nothing is heard from the peer for the silence time.
+/// Set that to more than the longest time between messages on a link, or links will keep going back to the
+/// home rate. Broadcasts are always sent at the home rate and full power.
+///
+/// A radio can only listen at one rate at a time, so this suits point to point links, and stars where the
+/// hub polls each node in turn and waits for its reply. Nodes listen at the rate of the link they last sent on.
+/// It is not suitable for meshes, where nodes must hear their neighbours at any time.
+///
+/// Give it to RHDatagram::setAdaptiveRate() (or that of any manager derived from it) on every node, with the same
+/// table of rates. The driver must support RHGenericDriver::setLoRaRate() and RHGenericDriver::setTransmitPower():
+/// RH_RF95 and RH_Sim do.
+///
+/// \code
+/// RH_RF95 driver;
+/// RHReliableDatagram manager(driver, CLIENT_ADDRESS);
+/// RHAdaptiveRate adr(driver, 20);
+/// ...
+/// manager.init();
+/// driver.setTxPower(20);
+/// manager.setAdaptiveRate(&adr);
+/// \endcode
+class RHAdaptiveRate
+{
+public:
+    /// A rate that links can use
+    typedef struct
+    {
+	uint8_t       spreadingFactor; ///< Spreading factor, 6 to 12
+	uint32_t      bandwidth;       ///< Bandwidth in Hz
+    } Rate;
+
+    /// Constructor. Uses the default table of rates: spreading factors 12 down to 7 at 125kHz, then
+    /// 7 at 250kHz. The home rate is spreading factor 7 at 125kHz, as RH_RF95::Bw125Cr45Sf128
+    /// \param[in] driver The driver, the same one the manager uses
+    /// \param[in] maxPower The highest transmitter power in dBm, used at the home rate. The radio should
+    /// be configured with this
+    /// \param[in] minPower The lowest transmitter power in dBm. The default suits the PA_BOOST
+    /// output of RH_RF95
+    RHAdaptiveRate(RHGenericDriver& driver, int8_t maxPower, int8_t minPower = 5);
+
+    /// Sets the table of rates links can use. All nodes must use the same table
+    /// \param[in] rates The rates, from the slowest to the fastest. Not copied: must remain valid
+    /// \param[in] count The number of rates
+    /// \param[in] home The index of the home rate, the one the radio is configured with at init()
+    void          setRates(const Rate* rates, uint8_t count, uint8_t home);
+
+    /// Sets how much margin links must have over the demodulation floor of their rate
+    /// \param[in] margin The margin in dB. Defaults to RH_ADR_MARGIN
+    /// \param[in] hysteresis The hysteresis in dB. Defaults to RH_ADR_HYSTERESIS
+    void          setMargin(int8_t margin, int8_t hysteresis = RH_ADR_HYSTERESIS);
+
+    /// Sets how long a peer can be silent before the link goes back to the home rate
+    /// \param[in] silence The time in milliseconds. Defaults to RH_ADR_SILENCE
+    void          setSilence(unsigned long silence);
+
+    /// Returns the rate of the link with a peer
+    /// \param[in] address The address of the peer
+    /// \return The rate, or the home rate if the peer is not known
+    Rate          rate(uint8_t address);
+
+    /// Returns the transmitter power used for a peer
+    /// \param[in] address The address of the peer
+    /// \return The power in dBm
+    int8_t        power(uint8_t address);
+
+    /// Returns the number of changes of rate agreed with peers, proposed by either end
+    /// \return The count
+    uint16_t      rateChanges();
+
+    /// Called by RHDatagram before it sends a message. Agrees any change of rate with the peer,
+    /// unless the message is an ACK (RH_FLAGS_ACK), then sets the rate and power for it
+    /// \param[in] address The address the message is to be sent to
+    void          prepare(uint8_t address);
+
+    /// Called by RHDatagram with each message it receives. Measures the SNR and answers control messages
+    /// \param[in] buf The payload, maybe truncated
+    /// \param[in] len The length of buf
+    /// \return true if it was a control message, and should not be given to the application
+    bool          received(const uint8_t* buf, uint8_t len);
+
+    /// Called by RHReliableDatagram when a message could not be delivered. Turns the power up to the maximum,
+    /// and goes back to the home rate after RH_ADR_MAX_FAILURES in a row
+    /// \param[in] address The address of the peer
+    void          linkFailed(uint8_t address);
+
+    /// Called by RHDatagram while waiting for messages. Sends links that have been silent too long back
+    /// to the home rate
+    void          poll();
+
+    /// Returns whether a message for the application that arrived during a control exchange is waiting
+    /// to be collected with takeHeld()
+    /// \return true if there is one
+    bool          held();
+
+    /// Called by RHDatagram to collect the message kept during a control exchange, if there is one
+    /// \param[in] buf Location to copy the message to
+    /// \param[in,out] len Available space in buf. Set to the number of octets copied
+    /// \param[in] from If present and not NULL, the FROM header is copied here
+    /// \param[in] to If present and not NULL, the TO header is copied here
+    /// \param[in] id If present and not NULL, the ID header is copied here
+    /// \param[in] flags If present and not NULL, the FLAGS header is copied here
+    /// \return true if there was a message, which is no longer held
+    bool          takeHeld(uint8_t* buf, uint8_t* len, uint8_t* from = NULL, uint8_t* to = NULL,
+			   uint8_t* id = NULL, uint8_t* flags = NULL);
+
+protected:
+    /// What is known about the link with a peer
+    typedef struct
+    {
+	bool          valid;                ///< Whether this entry is in use
+	uint8_t       address;              ///< Address of the peer
+	uint8_t       rate;                 ///< Index of the rate of the link
+	int8_t        power;                ///< Our transmitter power to the peer in dBm
+	int8_t        peerPower;            ///< The transmitter power we asked the peer to use in dBm
+	int8_t        snr[RH_ADR_HISTORY];  ///< SNR of recent messages from the peer, at the bandwidth of the rate
+	uint8_t       samples;              ///< Number of valid samples in snr
+	uint8_t       next;                 ///< Where the next sample goes in snr
+	bool          propose;              ///< Whether to propose proposedRate and proposedPower
+	uint8_t       proposedRate;         ///< Index of the rate to propose
+	int8_t        proposedPower;        ///< Transmitter power to propose in dBm
+	uint8_t       failures;             ///< Messages not delivered in a row
+	unsigned long heard;                ///< millis() when a message was last received from the peer
+    } Peer;
+
+    /// A message for the application kept during a control exchange
+    typedef struct
+    {
+	bool          valid;                ///< Whether there is a message
+	uint8_t       from;                 ///< FROM header
+	uint8_t       to;                   ///< TO header
+	uint8_t       id;                   ///< ID header
+	uint8_t       flags;                ///< FLAGS header
+	uint8_t       len;                  ///< Length of the payload
+	uint8_t       data[RH_ADR_HELD_MESSAGE_LEN]; ///< The payload
+    } HeldMessage;
+
+    /// Finds the entry of a peer
+    /// \param[in] address The address of the peer
+    /// \param[in] create Whether to make a new entry if there is none
+    /// \return The entry, or NULL
+    Peer*         findPeer(uint8_t address, bool create);
+
+    /// Looks at the SNR samples of a peer, and decides whether to propose a change
+    /// \param[in] peer The peer
+    void          evaluate(Peer* peer);
+
+    /// Works out which rate to agree to when a peer asks for one
+    /// \param[in] peer The peer
+    /// \param[in] rate Index of the requested rate
+    /// \return Index of the rate to agree to: the requested one, or the fastest slower one our samples support
+    uint8_t       acceptable(Peer* peer, uint8_t rate);
+
+    /// Proposes the change decided by evaluate() to a peer, and waits for the answer
+    /// \param[in] peer The peer
+    void          exchange(Peer* peer);
+
+    /// Sends a control message to a peer and waits for it to be sent
+    /// \param[in] address The address of the peer
+    /// \param[in] type RH_ADR_MESSAGE_TYPE_REQUEST or RH_ADR_MESSAGE_TYPE_ANSWER
+    /// \param[in] rate Index of a rate
+    /// \param[in] power A transmitter power in dBm
+    /// \return true if it was sent
+    bool          sendControl(uint8_t address, uint8_t type, uint8_t rate, int8_t power);
+
+    /// Answers a request from a peer, at the current rate, then changes to the agreed rate and power
+    /// \param[in] peer The peer
+    /// \param[in] buf The request
+    void          answer(Peer* peer, const uint8_t* buf);
+
+    /// Changes the rate of a link, and starts collecting SNR samples again
+    /// \param[in] peer The peer
+    /// \param[in] rate Index of the new rate
+    void          setRate(Peer* peer, uint8_t rate);
+
+    /// Sends a link back to the home rate and full power
+    /// \param[in] peer The peer
+    void          goHome(Peer* peer);
+
+    /// Sets the rate and power of the radio, if they are not already set
+    /// \param[in] rate Index of the rate
+    /// \param[in] power Transmitter power in dBm
+    void          apply(uint8_t rate, int8_t power);
+
+    /// Returns the SNR a signal would have at another rate, allowing for the noise in its bandwidth
+    /// \param[in] snr The SNR at rate from in dB
+    /// \param[in] from Index of the rate it was measured at
+    /// \param[in] to Index of the other rate
+    /// \return The SNR at rate to in dB
+    int16_t       snrAt(int16_t snr, uint8_t from, uint8_t to);
+
+    /// Returns the margin a link would have at a rate, over the demodulation floor of the rate plus
+    /// the margin set by setMargin()
+    /// \param[in] snr The SNR at rate from in dB
+    /// \param[in] from Index of the rate it was measured at
+    /// \param[in] rate Index of the rate
+    /// \return The margin in dB. Negative if the link would not be reliable at the rate
+    int16_t       margin(int16_t snr, uint8_t from, uint8_t rate);
+
+    /// Returns the mean of the recent SNRs of a peer
+    /// \param[in] peer The peer
+    /// \return The SNR in dB
+    int8_t        meanSNR(Peer* peer);
+
+    /// Clamps a transmitter power to the allowed range
+    /// \param[in] power The power in dBm
+    /// \return The clamped power in dBm
+    int8_t        clampPower(int16_t power);
+
+    /// Returns the difference in dB between two bandwidths, 3dB for each doubling
+    /// \param[in] bandwidth The bandwidth in Hz
+    /// \param[in] reference The reference bandwidth in Hz
+    /// \return How many dB bandwidth is above reference
+    static int16_t bandwidthRatio(uint32_t bandwidth, uint32_t reference);
+
+private:
+    /// The driver
+    RHGenericDriver& _driver;
+
+    /// The rates, slowest first
+    const Rate*   _rates;
+
+    /// Number of rates
+    uint8_t       _count;
+
+    /// Index of the home rate
+    uint8_t       _home;
+
+    /// Highest transmitter power in dBm
+    int8_t        _maxPower;
+
+    /// Lowest transmitter power in dBm
+    int8_t        _minPower;
+
+    /// Margin in dB
+    int8_t        _margin;
+
+    /// Hysteresis in dB
+    int8_t        _hysteresis;
+
+    /// Silence before a link goes back to the home rate in milliseconds
+    unsigned long _silence;
+
+    /// Index of the rate the radio is set to, 0xff if not known
+    uint8_t       _appliedRate;
+
+    /// Transmitter power the radio is set to, -128 if not known
+    int8_t        _appliedPower;
+
+    /// Number of changes of rate
+    uint16_t      _rateChanges;
+
+    /// millis() when poll() last looked for silent peers
+    unsigned long _lastPoll;
+
+    /// The peers
+    Peer          _peers[RH_ADR_PEERS];
+
+    /// Message received during a control exchange
+    HeldMessage   _held;
+};
+
+/// @example simulator_adr.pde
+
+#endif
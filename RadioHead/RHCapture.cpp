@@ -0,0 +1,111 @@
+// RHCapture.cpp
+//
+// Copyright (C) 2014 Mike McCauley
+// $Id: RHCapture.cpp,v 1.1 2019/09/06 04:40:40 mikem Exp $
+
+#include <RHCapture.h>
+
+// Stores a number little-endian
+static void putLE(uint8_t* p, uint32_t value, uint8_t len)
+{
+    while (len--)
+    {
+	*p++ = value & 0xff;
+	value >>= 8;
+    }
+}
+
+#if defined(RH_CAPTURE_HAVE_FILE)
+RHPcapCapture::RHPcapCapture(FILE* file)
+    : _file(file),
+      _begun(false)
+{
+}
+
+RHPcapCapture::RHPcapCapture()
+    : _file(NULL),
+      _begun(false)
+{
+}
+#elif defined(ARDUINO)
+RHPcapCapture::RHPcapCapture(Print& out)
+    : _out(&out),
+      _begun(false)
+{
+}
+
+RHPcapCapture::RHPcapCapture()
+    : _out(NULL),
+      _begun(false)
+{
+}
+#else
+RHPcapCapture::RHPcapCapture()
+    : _begun(false)
+{
+}
+#endif
+
+void RHPcapCapture::begin()
+{
+    if (_begun)
+	return;
+    _begun = true;
+    uint8_t header[RH_PCAP_FILE_HEADER_LEN];
+    putLE(header,      0xa1b2c3d4, 4); // Magic: microsecond timestamps
+    putLE(header + 4,  2, 2);          // Version 2.4
+    putLE(header + 6,  4, 2);
+    putLE(header + 8,  0, 4);          // Timestamps are UTC
+    putLE(header + 12, 0, 4);          // Accuracy of timestamps
+    putLE(header + 16, RH_CAPTURE_HEADER_LEN + RH_CAPTURE_MAX_PAYLOAD_LEN, 4); // Snap length
+    putLE(header + 20, RH_CAPTURE_LINKTYPE, 4);
+    write(header, sizeof(header));
+    flush();
+}
+
+void RHPcapCapture::capture(uint8_t direction, int16_t rssi, int8_t snr, uint8_t to, uint8_t from,
+			    uint8_t id, uint8_t flags, const uint8_t* data, uint8_t len)
+{
+    begin();
+    unsigned long now = millis();
+    uint8_t header[RH_PCAP_RECORD_HEADER_LEN + RH_CAPTURE_HEADER_LEN];
+    putLE(header,      now / 1000, 4);
+    putLE(header + 4,  (now % 1000) * 1000, 4);
+    putLE(header + 8,  RH_CAPTURE_HEADER_LEN + len, 4); // Captured length
+    putLE(header + 12, RH_CAPTURE_HEADER_LEN + len, 4); // Original length
+    uint8_t* p = header + RH_PCAP_RECORD_HEADER_LEN;
+    p[0] = RH_CAPTURE_VERSION;
+    p[1] = direction;
+    putLE(p + 2, (uint16_t)rssi, 2);
+    p[4] = (uint8_t)snr;
+    p[5] = 0;
+    p[6] = to;
+    p[7] = from;
+    p[8] = id;
+    p[9] = flags;
+    write(header, sizeof(header));
+    write(data, len);
+    flush();
+}
+
+void RHPcapCapture::write(const uint8_t* data, uint16_t len)
+{
+#if defined(RH_CAPTURE_HAVE_FILE)
+    if (_file)
+	fwrite(data, 1, len, _file);
+#elif defined(ARDUINO)
+    if (_out)
+	_out->write(data, len);
+#else
+    (void)data;
+    (void)len;
+#endif
+}
+
+void RHPcapCapture::flush()
+{
+#if defined(RH_CAPTURE_HAVE_FILE)
+    if (_file)
+	fflush(_file);
+#endif
+}
@@ -0,0 +1,138 @@
+// RHCapture.h
+// Author: Mike McCauley (mikem@airspayce.com)
+// Copyright (C) 2014 Mike McCauley
+// $Id: RHCapture.h,v 1.1 2019/09/06 04:40:40 mikem Exp $
+
+#ifndef RHCapture_h
+#define RHCapture_h
+
+#include <RadioHead.h>
+#if (RH_PLATFORM == RH_PLATFORM_UNIX) || (RH_PLATFORM == RH_PLATFORM_RASPI)
+ #include <stdio.h>
+ #define RH_CAPTURE_HAVE_FILE
+#endif
+
+// Directions of captured messages
+#define RH_CAPTURE_RX 0
+#define RH_CAPTURE_TX 1
+
+// pcap link type for RadioHead captures: LINKTYPE_USER0, the first of the link types
+// reserved for private use. In Wireshark, decode it with a user DLT
+#define RH_CAPTURE_LINKTYPE 147
+
+// Version of the RadioHead pseudo-header at the start of each captured packet
+#define RH_CAPTURE_VERSION 1
+
+// Length of the RadioHead pseudo-header: version, direction, RSSI (2 octets, little-endian),
+// SNR, reserved, TO, FROM, ID, FLAGS
+#define RH_CAPTURE_HEADER_LEN 10
+
+// Length of a pcap file header and of a pcap record header
+#define RH_PCAP_FILE_HEADER_LEN 24
+#define RH_PCAP_RECORD_HEADER_LEN 16
+
+// Largest payload that can be captured
+#define RH_CAPTURE_MAX_PAYLOAD_LEN 255
+
+/////////////////////////////////////////////////////////////////////
+/// \class RHCapture RHCapture.h <RHCapture.h>
+/// \brief Abstract base class for recording the messages a driver sends and receives
+///
+/// Give an instance to RHGenericDriver::setCapture(), and the driver calls capture() with each
+/// message it sends, and each message the application receives with recv(). Drivers that support capture
+/// are RH_RF95, RH_NRF51, RH_TCP, RH_Serial and RH_Sim.
+///
+/// capture() is called in the same context as send() and recv(), never from an interrupt handler,
+/// so it may write to a file, SD card or serial port. It does hold up the caller while it does so.
+class RHCapture
+{
+public:
+    /// Called with each message sent or received
+    /// \param[in] direction RH_CAPTURE_RX or RH_CAPTURE_TX
+    /// \param[in] rssi RSSI of a received message in dBm, 0 for a sent message
+    /// \param[in] snr SNR of a received message in dB, if the driver measures it, else 0
+    /// \param[in] to TO header
+    /// \param[in] from FROM header
+    /// \param[in] id ID header
+    /// \param[in] flags FLAGS header
+    /// \param[in] data The payload
+    /// \param[in] len Length of the payload
+    virtual void capture(uint8_t direction, int16_t rssi, int8_t snr, uint8_t to, uint8_t from,
+			 uint8_t id, uint8_t flags, const uint8_t* data, uint8_t len) = 0;
+};
+
+/////////////////////////////////////////////////////////////////////
+/// \class RHPcapCapture RHCapture.h <RHCapture.h>
+/// \brief Records messages in the pcap file format
+///
+/// Writes a pcap file header, then a record for each message, time stamped with millis().
+/// Each record holds a RadioHead pseudo-header of RH_CAPTURE_HEADER_LEN octets (version, direction,
+/// RSSI, SNR and the TO, FROM, ID and FLAGS headers) followed by the payload. All numbers are
+/// little-endian. The link type is RH_CAPTURE_LINKTYPE.
+///
+/// On Linux, writes to a stdio FILE, and flushes it after each message, so the capture survives a crash.
+/// On Arduino, writes to any Print, such as Serial or an SD card File.
+/// On other platforms, subclass it and implement write().
+/// RH_Replay can feed a capture back into a RadioHead stack on Linux.
+///
+/// \code
+/// RH_RF95 driver;
+/// File file = SD.open("capture.pcap", FILE_WRITE);
+/// RHPcapCapture capture(file);
+/// ...
+/// driver.setCapture(&capture);
+/// \endcode
+class RHPcapCapture : public RHCapture
+{
+public:
+#if defined(RH_CAPTURE_HAVE_FILE)
+    /// Constructor
+    /// \param[in] file An open file to write the capture to
+    RHPcapCapture(FILE* file);
+#elif defined(ARDUINO)
+    /// Constructor
+    /// \param[in] out Where to write the capture to
+    RHPcapCapture(Print& out);
+#endif
+
+    /// Constructor for subclasses that implement write()
+    RHPcapCapture();
+
+    /// Writes the pcap file header, if it has not been written already. This is done
+    /// automatically before the first message
+    void begin();
+
+    /// Writes a record for a message
+    /// \param[in] direction RH_CAPTURE_RX or RH_CAPTURE_TX
+    /// \param[in] rssi RSSI in dBm
+    /// \param[in] snr SNR in dB
+    /// \param[in] to TO header
+    /// \param[in] from FROM header
+    /// \param[in] id ID header
+    /// \param[in] flags FLAGS header
+    /// \param[in] data The payload
+    /// \param[in] len Length of the payload
+    virtual void capture(uint8_t direction, int16_t rssi, int8_t snr, uint8_t to, uint8_t from,
+			 uint8_t id, uint8_t flags, const uint8_t* data, uint8_t len);
+
+protected:
+    /// Writes octets of the capture to its destination
+    /// \param[in] data The octets
+    /// \param[in] len Number of octets
+    virtual void write(const uint8_t* data, uint16_t len);
+
+    /// Called after each complete record. Flushes the file on Linux
+    virtual void flush();
+
+private:
+#if defined(RH_CAPTURE_HAVE_FILE)
+    FILE*  _file;
+#elif defined(ARDUINO)
+    Print* _out;
+#endif
+
+    /// true once the file header has been written
+    bool   _begun;
+};
+
+#endif
@@ -4,11 +4,13 @@
 // $Id: RHDatagram.cpp,v 1.6 2014/05/23 02:20:17 mikem Exp $
 
 #include <RHDatagram.h>
+#include <RHAdaptiveRate.h>
 
 RHDatagram::RHDatagram(RHGenericDriver& driver, uint8_t thisAddress) 
     :
     _driver(driver),
-    _thisAddress(thisAddress)
+    _thisAddress(thisAddress),
+    _adaptiveRate(NULL)
 {
 }
 
@@ -32,14 +34,21 @@ void RHDatagram::setThisAddress(uint8_t thisAddress)
 
 bool RHDatagram::sendto(uint8_t* buf, uint8_t len, uint8_t address)
 {
+    if (_adaptiveRate)
+	_adaptiveRate->prepare(address); // May exchange control messages first
     setHeaderTo(address);
     return _driver.send(buf, len);
 }
 
 bool RHDatagram::recvfrom(uint8_t* buf, uint8_t* len, uint8_t* from, uint8_t* to, uint8_t* id, uint8_t* flags)
 {
+    // A message that arrived while the rate controller was agreeing a change comes first
+    if (_adaptiveRate && _adaptiveRate->takeHeld(buf, len, from, to, id, flags))
+	return true;
     if (_driver.recv(buf, len))
     {
+	if (_adaptiveRate && _adaptiveRate->received(buf, len ? *len : 0))
+	    return false; // Control message, already dealt with
 	if (from)  *from =  headerFrom();
 	if (to)    *to =    headerTo();
 	if (id)    *id =    headerId();
@@ -51,11 +60,19 @@ bool RHDatagram::recvfrom(uint8_t* buf, uint8_t* len, uint8_t* from, uint8_t* to
 
 bool RHDatagram::available()
 {
+    if (_adaptiveRate)
+    {
+	_adaptiveRate->poll();
+	if (_adaptiveRate->held())
+	    return true;
+    }
     return _driver.available();
 }
 
 void RHDatagram::waitAvailable()
 {
+    if (_adaptiveRate && _adaptiveRate->held())
+	return;
     _driver.waitAvailable();
 }
 
@@ -71,6 +88,12 @@ bool RHDatagram::waitPacketSent(uint16_t timeout)
 
 bool RHDatagram::waitAvailableTimeout(uint16_t timeout)
 {
+    if (_adaptiveRate)
+    {
+	_adaptiveRate->poll();
+	if (_adaptiveRate->held())
+	    return true;
+    }
     return _driver.waitAvailableTimeout(timeout);
 }
 
@@ -119,5 +142,29 @@ uint8_t RHDatagram::headerFlags()
     return _driver.headerFlags();
 }
 
+RHGenericDriver& RHDatagram::driver()
+{
+    return _driver;
+}
 
+void RHDatagram::resetStats()
+{
+    _driver.resetStats();
+}
 
+void RHDatagram::writeStats(RHStatsWriter& writer)
+{
+    _driver.writeStats(writer);
+}
+
+uint16_t RHDatagram::serializeStats(uint8_t* buf, uint16_t len)
+{
+    RHStatsWriter writer(buf, len);
+    writeStats(writer);
+    return writer.length();
+}
+
+void RHDatagram::setAdaptiveRate(RHAdaptiveRate* adaptiveRate)
+{
+    _adaptiveRate = adaptiveRate;
+}
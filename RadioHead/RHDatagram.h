@@ -8,6 +8,8 @@
 
 #include <RHGenericDriver.h>
 
+class RHAdaptiveRate;
+
 // This is the maximum possible message size for radios supported by RadioHead.
 // Not all radios support this length, and many are much smaller
 #define RH_MAX_MESSAGE_LEN 255
@@ -151,12 +153,44 @@ public:
     /// \return The address of this node
     uint8_t         thisAddress();
 
+    /// Returns the driver this manager sends and receives with
+    /// \return Reference to the driver
+    RHGenericDriver& driver();
+
+    /// Resets the statistics of this manager and of the layers below it, down to the driver
+    virtual void    resetStats();
+
+    /// Writes the statistics of this manager and of the layers below it, down to the driver,
+    /// as sections in the format described in RHStatsWriter. Subclasses add their own sections
+    /// after those of their base class.
+    /// \param[in] writer Where to write them
+    virtual void    writeStats(RHStatsWriter& writer);
+
+    /// Writes the statistics of this manager and of the layers below it in a compact binary
+    /// format that can be sent in a message or dumped over a serial port, and decoded with RHStatsReader.
+    /// Sections that do not fit in len are left out.
+    /// \param[out] buf Where to write the statistics
+    /// \param[in] len Size of buf in octets
+    /// \return The number of octets written
+    uint16_t        serializeStats(uint8_t* buf, uint16_t len);
+
+    /// Sets an adaptive data rate controller to choose the rate and transmitter power of each link.
+    /// It then sees every message sent and received, and control messages between controllers
+    /// are not returned by recvfrom(). See RHAdaptiveRate
+    /// \param[in] adaptiveRate The controller, or NULL to stop adapting. The radio is left at the last rate
+    void            setAdaptiveRate(RHAdaptiveRate* adaptiveRate);
+
 protected:
     /// The Driver we are to use
     RHGenericDriver&        _driver;
 
     /// The address of this node
     uint8_t         _thisAddress;
+
+    /// The adaptive data rate controller, if any
+    RHAdaptiveRate* _adaptiveRate;
 };
 
+/// @example simulator_stats.pde
+
 #endif
@@ -0,0 +1,111 @@
+// RHDutyCycle.cpp
+//
+// Copyright (C) 2014 Mike McCauley
+// $Id: RHDutyCycle.cpp,v 1.1 2019/09/06 04:40:40 mikem Exp $
+
+#include <RHDutyCycle.h>
+
+// The budget of each band is kept as credit: the milliseconds of waiting that earned the airtime
+// available. That way topping it up is exact however often it is done. Each millisecond of credit
+// is worth limit / 10 microseconds of airtime.
+
+RHDutyCycle::RHDutyCycle(uint32_t window)
+    : _window(window)
+{
+    clear();
+}
+
+bool RHDutyCycle::setLimit(uint32_t low, uint32_t high, uint16_t limit)
+{
+    Band* band = NULL;
+    uint8_t i;
+    for (i = 0; i < RH_DUTY_CYCLE_BANDS; i++)
+    {
+	if (_bands[i].limit && _bands[i].low == low && _bands[i].high == high)
+	{
+	    band = &_bands[i];
+	    break;
+	}
+	if (!band && !_bands[i].limit)
+	    band = &_bands[i];
+    }
+    if (!band)
+	return limit == 0;
+    if (!band->limit)
+    {
+	// A new band starts with no credit, so its airtime can never be more than the limit
+	// times the time since it was set
+	band->low = low;
+	band->high = high;
+	band->credit = 0;
+	band->updated = millis();
+    }
+    else
+	topUp(band); // The credit earned so far was earned at the old limit
+    band->limit = limit > 10000 ? 10000 : limit;
+    return true;
+}
+
+void RHDutyCycle::clear()
+{
+    memset(_bands, 0, sizeof(_bands));
+}
+
+RHDutyCycle::Band* RHDutyCycle::findBand(uint32_t channel)
+{
+    uint8_t i;
+    for (i = 0; i < RH_DUTY_CYCLE_BANDS; i++)
+    {
+	Band* band = &_bands[i];
+	if (!band->limit || channel < band->low || channel > band->high)
+	    continue;
+	topUp(band);
+	return band;
+    }
+    return NULL;
+}
+
+void RHDutyCycle::topUp(Band* band)
+{
+    unsigned long now = millis();
+    uint32_t elapsed = now - band->updated;
+    band->credit = elapsed < _window - band->credit ? band->credit + elapsed : _window;
+    band->updated = now;
+}
+
+uint32_t RHDutyCycle::cost(const Band* band, uint32_t airtime)
+{
+    // airtime * 10 / limit, rounded up, without overflow
+    uint32_t credit = (airtime / band->limit) * 10
+	+ ((airtime % band->limit) * 10 + band->limit - 1) / band->limit;
+    return credit < _window ? credit : _window;
+}
+
+uint32_t RHDutyCycle::available(uint32_t channel)
+{
+    Band* band = findBand(channel);
+    if (!band)
+	return 0xffffffff;
+    return (band->credit / 10) * band->limit + (band->credit % 10) * band->limit / 10;
+}
+
+uint32_t RHDutyCycle::timeUntil(uint32_t channel, uint32_t airtime)
+{
+    Band* band = findBand(channel);
+    if (!band)
+	return 0;
+    uint32_t needed = cost(band, airtime);
+    return needed > band->credit ? needed - band->credit : 0;
+}
+
+bool RHDutyCycle::spend(uint32_t channel, uint32_t airtime)
+{
+    Band* band = findBand(channel);
+    if (!band)
+	return true;
+    uint32_t needed = cost(band, airtime);
+    if (needed > band->credit)
+	return false;
+    band->credit -= needed;
+    return true;
+}
@@ -0,0 +1,130 @@
+// RHDutyCycle.h
+// Author: Mike McCauley (mikem@airspayce.com)
+// Copyright (C) 2014 Mike McCauley
+// $Id: RHDutyCycle.h,v 1.1 2019/09/06 04:40:40 mikem Exp $
+
+#ifndef RHDutyCycle_h
+#define RHDutyCycle_h
+
+#include <RadioHead.h>
+
+// Maximum number of bands with duty cycle limits in an RHDutyCycle
+#ifndef RH_DUTY_CYCLE_BANDS
+ #if defined(__AVR__)
+  #define RH_DUTY_CYCLE_BANDS 3
+ #else
+  #define RH_DUTY_CYCLE_BANDS 8
+ #endif
+#endif
+
+// Default period in milliseconds over which the duty cycle is averaged. ETSI EN 300 220
+// uses one hour. Must be no more than 4294967 (about 71 minutes)
+#ifndef RH_DUTY_CYCLE_WINDOW
+#define RH_DUTY_CYCLE_WINDOW 3600000
+#endif
+
+/////////////////////////////////////////////////////////////////////
+/// \class RHDutyCycle RHDutyCycle.h <RHDutyCycle.h>
+/// \brief Airtime budget that keeps transmissions within duty cycle limits
+///
+/// Regulations such as ETSI EN 300 220 in the EU 868 MHz band limit the proportion of time a
+/// device may transmit in each sub-band, for example 1% in 868.0 to 868.6 MHz. RHDutyCycle keeps a
+/// token bucket of airtime for each band you give a limit for. Each bucket fills at the limit
+/// (10 ms per second for 1%), up to the limit times the window (36 seconds for 1% of one hour),
+/// and each message sent takes its time on air out of it. A message may only be sent when there is
+/// enough airtime in the bucket for it, so bursts are allowed after a quiet period. Buckets start
+/// empty, so the airtime used since a limit was set is never more than the limit times the time
+/// since then. The window only limits the size of bursts: any one window can hold the burst of a full
+/// bucket as well as the airtime that refills it, up to twice the limit.
+///
+/// Give it to a driver that can calculate the time on air of its messages (RH_RF95 and RH_Sim) with
+/// RHGenericDriver::setDutyCycle(). The driver then refuses to send() a message that would exceed the
+/// budget, and RHGenericDriver::canSend() and RHGenericDriver::timeUntilSend() tell you when it
+/// will be able to. RHReliableDatagram and RHMesh use them to wait for the budget instead of failing.
+///
+/// Bands are ranges of channel numbers, as defined by the driver: for RH_RF95 they are
+/// frequencies in kHz, for RH_Sim the simulator channel. Transmissions on channels outside all bands
+/// are not limited.
+///
+/// \code
+/// RH_RF95 driver;
+/// RHDutyCycle budget;
+/// ...
+/// budget.setLimit(868000, 868600, 100);  // g1: 1%
+/// budget.setLimit(868700, 869200, 10);   // g2: 0.1%
+/// budget.setLimit(869400, 869650, 1000); // g3: 10%
+/// driver.setDutyCycle(&budget);
+/// \endcode
+class RHDutyCycle
+{
+public:
+    /// Constructor. There are no limits until you call setLimit()
+    /// \param[in] window The period in milliseconds over which the duty cycle is averaged.
+    /// Limits the burst of airtime allowed after a quiet period
+    RHDutyCycle(uint32_t window = RH_DUTY_CYCLE_WINDOW);
+
+    /// Sets the duty cycle limit for a band of channels, replacing any limit for exactly the same band.
+    /// A new band starts with an empty budget, which fills at the limit. A replaced band keeps the
+    /// budget it has
+    /// \param[in] low The lowest channel in the band
+    /// \param[in] high The highest channel in the band
+    /// \param[in] limit The maximum duty cycle, in units of 0.01%: 100 is 1%. 0 removes the limit
+    /// \return true if the limit was set, false if there are already RH_DUTY_CYCLE_BANDS bands
+    bool     setLimit(uint32_t low, uint32_t high, uint16_t limit);
+
+    /// Removes all limits
+    void     clear();
+
+    /// Returns the airtime left in the budget of a channel
+    /// \param[in] channel The channel
+    /// \return Airtime in microseconds, or 0xffffffff if the channel has no limit
+    uint32_t available(uint32_t channel);
+
+    /// Returns how long until the budget of a channel has enough airtime for a transmission
+    /// \param[in] channel The channel
+    /// \param[in] airtime The time on air of the transmission in microseconds
+    /// \return Time to wait in milliseconds, 0 if it can be sent now
+    uint32_t timeUntil(uint32_t channel, uint32_t airtime);
+
+    /// Takes the airtime of a transmission out of the budget of a channel, if there is enough
+    /// \param[in] channel The channel
+    /// \param[in] airtime The time on air of the transmission in microseconds
+    /// \return true if it may be sent now, false if there is not enough airtime, and nothing was taken
+    bool     spend(uint32_t channel, uint32_t airtime);
+
+protected:
+    /// The budget of a band
+    typedef struct
+    {
+	uint32_t      low;     ///< Lowest channel
+	uint32_t      high;    ///< Highest channel
+	uint16_t      limit;   ///< Duty cycle in 0.01%, 0 if not in use
+	uint32_t      credit;  ///< Airtime available, as the milliseconds of waiting that earned it
+	unsigned long updated; ///< millis() when credit was last topped up
+    } Band;
+
+    /// Finds the band of a channel, and tops up its airtime for the time since it was last updated
+    /// \param[in] channel The channel
+    /// \return The band, or NULL if the channel has no limit
+    Band*    findBand(uint32_t channel);
+
+    /// Tops up the airtime of a band for the time since it was last updated, up to the window
+    /// \param[in] band The band
+    void     topUp(Band* band);
+
+    /// Converts airtime to the credit a band needs to send it. Never more than the window,
+    /// so even messages longer than the whole budget can be sent when the bucket is full
+    /// \param[in] band The band
+    /// \param[in] airtime The time on air in microseconds
+    /// \return The credit in milliseconds
+    uint32_t cost(const Band* band, uint32_t airtime);
+
+private:
+    /// The bands
+    Band     _bands[RH_DUTY_CYCLE_BANDS];
+
+    /// Averaging period in milliseconds
+    uint32_t _window;
+};
+
+#endif
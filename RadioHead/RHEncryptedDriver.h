@@ -177,6 +177,10 @@ public:
     /// \return The FLAGS header
     virtual uint8_t        headerFlags() { return _driver.headerFlags();};
 
+    /// Returns the FLAGS header that will be sent with the next message
+    /// \return The FLAGS header
+    virtual uint8_t        txHeaderFlags() { return _driver.txHeaderFlags();};
+
     /// Returns the most recent RSSI (Receiver Signal Strength Indicator).
     /// Usually it is the RSSI of the last received message, which is measured when the preamble is received.
     /// If you called readRssi() more recently, it will return that more recent value.
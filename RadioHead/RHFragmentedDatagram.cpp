@@ -0,0 +1,337 @@
+// RHFragmentedDatagram.cpp
+//
+// Define addressed datagram for messages larger than the driver can carry
+//
+// Part of the Arduino RH library for operating with HopeRF RH compatible transceivers
+// (see http://www.hoperf.com)
+//
+// Author: Mike McCauley (mikem@airspayce.com)
+// Copyright (C) 2011 Mike McCauley
+// $Id: RHFragmentedDatagram.cpp,v 1.1 2019/09/06 04:40:40 mikem Exp $
+
+#include <RHFragmentedDatagram.h>
+
+////////////////////////////////////////////////////////////////////
+// Constructors
+RHFragmentedDatagram::RHFragmentedDatagram(RHGenericDriver& driver, uint8_t thisAddress)
+    : RHDatagram(driver, thisAddress)
+{
+    _timeout = RH_FRAGMENT_DEFAULT_TIMEOUT;
+    _retries = RH_FRAGMENT_DEFAULT_RETRIES;
+    _lastMessageId = 0;
+    _retransmissions = 0;
+    _txBuf = NULL;
+    _reassemblyBuf = _pool;
+    _reassemblyLen = RH_FRAGMENT_MAX_MESSAGE_LEN;
+    memset(_reassemblies, 0, sizeof(_reassemblies));
+}
+
+////////////////////////////////////////////////////////////////////
+// Public methods
+void RHFragmentedDatagram::setTimeout(uint16_t timeout)
+{
+    _timeout = timeout;
+}
+
+////////////////////////////////////////////////////////////////////
+void RHFragmentedDatagram::setRetries(uint8_t retries)
+{
+    _retries = retries;
+}
+
+////////////////////////////////////////////////////////////////////
+void RHFragmentedDatagram::setReassemblyBuffer(uint8_t* buf, uint16_t len)
+{
+    _reassemblyBuf = buf;
+    _reassemblyLen = len / RH_FRAGMENT_REASSEMBLIES;
+    memset(_reassemblies, 0, sizeof(_reassemblies));
+}
+
+////////////////////////////////////////////////////////////////////
+uint8_t* RHFragmentedDatagram::reassemblyBuffer(uint8_t index)
+{
+    return _reassemblyBuf + (uint32_t)index * _reassemblyLen;
+}
+
+////////////////////////////////////////////////////////////////////
+bool RHFragmentedDatagram::sendtoWait(uint8_t* buf, uint16_t len, uint8_t address)
+{
+    uint8_t maxLen = _driver.maxMessageLength();
+    if (maxLen <= RH_FRAGMENT_HEADER_LEN)
+	return false;
+    // Split into the fewest fragments that fit, all nearly the same size.
+    // The bitmap in the acknowledgement has to fit in one message too
+    uint16_t maxFragmentLen = maxLen - RH_FRAGMENT_HEADER_LEN;
+    uint16_t count = len ? (len + maxFragmentLen - 1) / maxFragmentLen : 1;
+    if (count > RH_FRAGMENT_MAX_FRAGMENTS || count > maxFragmentLen * 8)
+	return false;
+
+    _txBuf = buf;
+    _txLen = len;
+    _txTo = address;
+    _txCount = count;
+    _txId = ++_lastMessageId;
+    _txFragmentLen = (len + count - 1) / count;
+    memset(_txAcked, 0, sizeof(_txAcked));
+
+    uint16_t i;
+    if (address == RH_BROADCAST_ADDRESS)
+    {
+	// No acknowledgements, send each fragment once
+	for (i = 0; i < count; i++)
+	    if (!sendFragment(i, false))
+		break;
+	_txBuf = NULL;
+	return i == count;
+    }
+
+    uint16_t nextNew = 0; // Fragments below this have been sent before
+    uint16_t acked = 0;
+    uint8_t retries = 0;
+    while (acked < count)
+    {
+	// Send a window of the lowest fragments that have not been acknowledged,
+	// and ask for an acknowledgement of the last one
+	uint8_t window[RH_FRAGMENT_WINDOW];
+	uint8_t n = 0;
+	for (i = 0; i < count && n < RH_FRAGMENT_WINDOW; i++)
+	    if (!(_txAcked[i / 8] & (1 << (i % 8))))
+		window[n++] = i;
+	for (i = 0; i < n; i++)
+	{
+	    if (window[i] < nextNew)
+		_retransmissions++;
+	    else
+		nextNew = window[i] + 1;
+	    sendFragment(window[i], i == n - 1);
+	}
+	_driver.waitPacketSent();
+
+	// Wait for the acknowledgement, receiving anything else that arrives meanwhile
+	_txAckReceived = false;
+	unsigned long thisSendTime = millis();
+	int32_t timeLeft;
+	while (!_txAckReceived && (timeLeft = _timeout - (millis() - thisSendTime)) > 0)
+	{
+	    if (waitAvailableTimeout(timeLeft))
+		receiveFragment();
+	    YIELD;
+	}
+
+	uint16_t nowAcked = 0;
+	for (i = 0; i < count; i++)
+	    if (_txAcked[i / 8] & (1 << (i % 8)))
+		nowAcked++;
+	if (nowAcked > acked)
+	    retries = 0; // Progress
+	else if (retries++ >= _retries)
+	    break;
+	acked = nowAcked;
+    }
+    _txBuf = NULL;
+    return acked == count;
+}
+
+////////////////////////////////////////////////////////////////////
+bool RHFragmentedDatagram::sendFragment(uint8_t index, bool ackreq)
+{
+    uint8_t frame[RH_MAX_MESSAGE_LEN];
+    frame[0] = RH_FRAGMENT_TYPE_DATA | (ackreq ? RH_FRAGMENT_TYPE_ACKREQ : 0);
+    frame[1] = _txId;
+    frame[2] = index;
+    frame[3] = _txCount;
+    frame[4] = _txLen & 0xff;
+    frame[5] = _txLen >> 8;
+    uint16_t offset = index * _txFragmentLen;
+    uint16_t len = 0;
+    if (offset < _txLen)
+	len = (_txLen - offset) < _txFragmentLen ? (_txLen - offset) : _txFragmentLen;
+    memcpy(frame + RH_FRAGMENT_HEADER_LEN, _txBuf + offset, len);
+    return sendto(frame, RH_FRAGMENT_HEADER_LEN + len, _txTo);
+}
+
+////////////////////////////////////////////////////////////////////
+bool RHFragmentedDatagram::receiveFragment()
+{
+    uint8_t frame[RH_MAX_MESSAGE_LEN];
+    uint8_t len = sizeof(frame);
+    uint8_t from, to, id, flags;
+    if (!RHDatagram::recvfrom(frame, &len, &from, &to, &id, &flags))
+	return false;
+    if (   len < RH_FRAGMENT_HEADER_LEN
+	|| (to != _thisAddress && to != RH_BROADCAST_ADDRESS))
+	return true; // Not one of ours, or someone elses in promiscuous mode
+
+    uint8_t type = frame[0] & ~RH_FRAGMENT_TYPE_ACKREQ;
+    if (type == RH_FRAGMENT_TYPE_DATA)
+    {
+	uint8_t i = findReassembly(from, frame[1]);
+	if (i >= RH_FRAGMENT_REASSEMBLIES)
+	    return true; // No room, the sender will retry
+	Reassembly* r = &_reassemblies[i];
+	uint8_t  index = frame[2];
+	uint8_t  count = frame[3];
+	uint16_t total = frame[4] | (frame[5] << 8);
+	if (count == 0 || index >= count)
+	    return true;
+	uint16_t offset = index * ((total + count - 1) / count);
+	uint16_t dataLen = len - RH_FRAGMENT_HEADER_LEN;
+	if (offset + dataLen > total)
+	    return true;
+
+	if (   r->state == ReassemblyFree
+	    || r->from != from
+	    || r->id != frame[1]
+	    || (r->state == ReassemblyReceiving && (r->count != count || r->len != total)))
+	{
+	    // Start of a new message
+	    if (total > _reassemblyLen)
+	    {
+		r->state = ReassemblyFree;
+		return true; // Too big to reassemble
+	    }
+	    r->state = ReassemblyReceiving;
+	    r->from = from;
+	    r->to = to;
+	    r->id = frame[1];
+	    r->count = count;
+	    r->len = total;
+	    r->received = 0;
+	    memset(r->bitmap, 0, sizeof(r->bitmap));
+	}
+	r->heard = millis();
+	r->flags = flags;
+	if (r->state == ReassemblyReceiving && !(r->bitmap[index / 8] & (1 << (index % 8))))
+	{
+	    memcpy(reassemblyBuffer(i) + offset, frame + RH_FRAGMENT_HEADER_LEN, dataLen);
+	    r->bitmap[index / 8] |= (1 << (index % 8));
+	    if (++r->received == r->count)
+		r->state = ReassemblyComplete;
+	}
+	// Acknowledge everything we have. Includes duplicates of messages already reassembled
+	if ((frame[0] & RH_FRAGMENT_TYPE_ACKREQ) && to == _thisAddress)
+	    sendAck(r);
+    }
+    else if (   type == RH_FRAGMENT_TYPE_ACK
+	     && _txBuf
+	     && to == _thisAddress
+	     && from == _txTo
+	     && frame[1] == _txId
+	     && frame[3] == _txCount)
+    {
+	// Acknowledgement of the message we are sending
+	uint8_t i;
+	for (i = 0; i < (_txCount + 7) / 8 && RH_FRAGMENT_HEADER_LEN + i < len; i++)
+	    _txAcked[i] |= frame[RH_FRAGMENT_HEADER_LEN + i];
+	_txAckReceived = true;
+    }
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////
+uint8_t RHFragmentedDatagram::findReassembly(uint8_t from, uint8_t id)
+{
+    uint8_t i;
+    // Abandon anything that has gone quiet
+    for (i = 0; i < RH_FRAGMENT_REASSEMBLIES; i++)
+	if (   (   _reassemblies[i].state == ReassemblyReceiving
+		|| _reassemblies[i].state == ReassemblyDelivered)
+	    && (millis() - _reassemblies[i].heard) > RH_FRAGMENT_REASSEMBLY_TIMEOUT)
+	    _reassemblies[i].state = ReassemblyFree;
+
+    for (i = 0; i < RH_FRAGMENT_REASSEMBLIES; i++)
+	if (   _reassemblies[i].state != ReassemblyFree
+	    && _reassemblies[i].from == from
+	    && _reassemblies[i].id == id)
+	    return i;
+    // A new message from a sender replaces one it had not finished sending
+    for (i = 0; i < RH_FRAGMENT_REASSEMBLIES; i++)
+	if (_reassemblies[i].state == ReassemblyReceiving && _reassemblies[i].from == from)
+	    return i;
+    for (i = 0; i < RH_FRAGMENT_REASSEMBLIES; i++)
+	if (_reassemblies[i].state == ReassemblyFree)
+	    return i;
+    for (i = 0; i < RH_FRAGMENT_REASSEMBLIES; i++)
+	if (_reassemblies[i].state == ReassemblyDelivered)
+	    return i;
+    return RH_FRAGMENT_REASSEMBLIES;
+}
+
+////////////////////////////////////////////////////////////////////
+void RHFragmentedDatagram::sendAck(Reassembly* r)
+{
+    uint8_t frame[RH_FRAGMENT_HEADER_LEN + sizeof(r->bitmap)];
+    frame[0] = RH_FRAGMENT_TYPE_ACK;
+    frame[1] = r->id;
+    frame[2] = 0;
+    frame[3] = r->count;
+    frame[4] = r->len & 0xff;
+    frame[5] = r->len >> 8;
+    uint8_t bitmapLen = (r->count + 7) / 8;
+    memcpy(frame + RH_FRAGMENT_HEADER_LEN, r->bitmap, bitmapLen);
+    sendto(frame, RH_FRAGMENT_HEADER_LEN + bitmapLen, r->from);
+}
+
+////////////////////////////////////////////////////////////////////
+bool RHFragmentedDatagram::available()
+{
+    receiveFragment();
+    uint8_t i;
+    for (i = 0; i < RH_FRAGMENT_REASSEMBLIES; i++)
+	if (_reassemblies[i].state == ReassemblyComplete)
+	    return true;
+    return false;
+}
+
+////////////////////////////////////////////////////////////////////
+bool RHFragmentedDatagram::recvfromAck(uint8_t* buf, uint16_t* len, uint8_t* from, uint8_t* to, uint8_t* id, uint8_t* flags)
+{
+    if (!available())
+	return false;
+    uint8_t i;
+    for (i = 0; i < RH_FRAGMENT_REASSEMBLIES; i++)
+    {
+	Reassembly* r = &_reassemblies[i];
+	if (r->state != ReassemblyComplete)
+	    continue;
+	if (from)  *from =  r->from;
+	if (to)    *to =    r->to;
+	if (id)    *id =    r->id;
+	if (flags) *flags = r->flags;
+	if (*len > r->len)
+	    *len = r->len;
+	memcpy(buf, reassemblyBuffer(i), *len);
+	// Keep it for a while to acknowledge duplicates
+	r->state = ReassemblyDelivered;
+	return true;
+    }
+    return false;
+}
+
+////////////////////////////////////////////////////////////////////
+bool RHFragmentedDatagram::recvfromAckTimeout(uint8_t* buf, uint16_t* len, uint16_t timeout, uint8_t* from, uint8_t* to, uint8_t* id, uint8_t* flags)
+{
+    unsigned long starttime = millis();
+    int32_t timeLeft;
+    while ((timeLeft = timeout - (millis() - starttime)) > 0)
+    {
+	// A message may have been completed while sendtoWait() was waiting for an acknowledgement
+	if (recvfromAck(buf, len, from, to, id, flags))
+	    return true;
+	waitAvailableTimeout(timeLeft);
+	YIELD;
+    }
+    return false;
+}
+
+////////////////////////////////////////////////////////////////////
+uint32_t RHFragmentedDatagram::retransmissions()
+{
+    return _retransmissions;
+}
+
+////////////////////////////////////////////////////////////////////
+void RHFragmentedDatagram::resetRetransmissions()
+{
+    _retransmissions = 0;
+}
@@ -0,0 +1,268 @@
+// RHFragmentedDatagram.h
+//
+// Author: Mike McCauley (mikem@airspayce.com)
+// Copyright (C) 2011 Mike McCauley
+// $Id: RHFragmentedDatagram.h,v 1.1 2019/09/06 04:40:40 mikem Exp $
+
+#ifndef RHFragmentedDatagram_h
+#define RHFragmentedDatagram_h
+
+#include <RHDatagram.h>
+
+// Length of the fragment header at the start of every message sent by RHFragmentedDatagram
+#define RH_FRAGMENT_HEADER_LEN 6
+
+// Fragment types, in the first octet of the fragment header
+#define RH_FRAGMENT_TYPE_DATA   0x01
+#define RH_FRAGMENT_TYPE_ACK    0x02
+// Set in the type of a data fragment when the sender wants an acknowledgement
+#define RH_FRAGMENT_TYPE_ACKREQ 0x80
+
+// The maximum number of fragments in a message
+#define RH_FRAGMENT_MAX_FRAGMENTS 255
+
+// The largest message that can be reassembled, if you do not supply your own buffer with setReassemblyBuffer()
+#ifndef RH_FRAGMENT_MAX_MESSAGE_LEN
+ #if defined(__AVR__)
+  #define RH_FRAGMENT_MAX_MESSAGE_LEN 256
+ #else
+  #define RH_FRAGMENT_MAX_MESSAGE_LEN 4096
+ #endif
+#endif
+
+// The number of messages that can be reassembled at the same time (from different senders)
+#ifndef RH_FRAGMENT_REASSEMBLIES
+ #if defined(__AVR__)
+  #define RH_FRAGMENT_REASSEMBLIES 1
+ #else
+  #define RH_FRAGMENT_REASSEMBLIES 2
+ #endif
+#endif
+
+// The maximum number of fragments sent before waiting for an acknowledgement
+#ifndef RH_FRAGMENT_WINDOW
+ #if defined(__AVR__)
+  #define RH_FRAGMENT_WINDOW 4
+ #else
+  #define RH_FRAGMENT_WINDOW 8
+ #endif
+#endif
+
+// Default time to wait for an acknowledgement of a window of fragments, in milliseconds
+#define RH_FRAGMENT_DEFAULT_TIMEOUT 500
+
+// Default number of times a window of fragments is retransmitted without any progress before giving up
+#define RH_FRAGMENT_DEFAULT_RETRIES 3
+
+// A partly reassembled message is abandoned if no fragment of it has arrived for this many milliseconds
+#ifndef RH_FRAGMENT_REASSEMBLY_TIMEOUT
+#define RH_FRAGMENT_REASSEMBLY_TIMEOUT 5000
+#endif
+
+/////////////////////////////////////////////////////////////////////
+/// \class RHFragmentedDatagram RHFragmentedDatagram.h <RHFragmentedDatagram.h>
+/// \brief RHDatagram subclass for sending messages larger than the driver can carry,
+/// with windowed acknowledgement and selective retransmission.
+///
+/// Manager class that extends RHDatagram to send messages of up to
+/// 255 * (driver->maxMessageLength() - RH_FRAGMENT_HEADER_LEN) octets (about 62kB with RH_RF95),
+/// such as compressed sensor logs or small images. Works with any RadioHead driver, including the
+/// simulator drivers.
+///
+/// sendtoWait() splits the message into up to RH_FRAGMENT_MAX_FRAGMENTS numbered fragments of
+/// nearly equal size, each no larger than the driver can carry, and sends them in windows of
+/// up to RH_FRAGMENT_WINDOW fragments. The last fragment in each window asks for an acknowledgement, and
+/// the recipient replies with a bitmap of all the fragments it has received so far. The next window
+/// contains only fragments the recipient does not yet have, so lost fragments are retransmitted
+/// without resending the rest. If no acknowledgement arrives within the timeout (see setTimeout()) the
+/// window is sent again, and if there is no progress after the number of retries set by setRetries(),
+/// sendtoWait() gives up. Messages sent to RH_BROADCAST_ADDRESS are sent once, without
+/// acknowledgement, and are only delivered if every fragment arrives.
+///
+/// The recipient reassembles fragments into a buffer from a pool of RH_FRAGMENT_REASSEMBLIES buffers
+/// of RH_FRAGMENT_MAX_MESSAGE_LEN octets, one per sender, or into memory you supply with setReassemblyBuffer().
+/// When all the fragments of a message have arrived, recvfromAck() returns it. A partly reassembled message
+/// is abandoned if nothing more arrives for RH_FRAGMENT_REASSEMBLY_TIMEOUT milliseconds.
+/// Fragments of a message that has already been reassembled are acknowledged again but not delivered twice.
+///
+/// Fragments are received, and acknowledgements sent, only while you are calling available(),
+/// recvfromAck(), recvfromAckTimeout() or sendtoWait(), so you should call one of them frequently.
+/// sendtoWait() keeps receiving fragments from other nodes while it waits for acknowledgements.
+///
+/// The receiver will only reassemble messages from senders using RHFragmentedDatagram. Each message
+/// starts with a header of RH_FRAGMENT_HEADER_LEN octets:
+/// - type: RH_FRAGMENT_TYPE_DATA or RH_FRAGMENT_TYPE_ACK, ORed with RH_FRAGMENT_TYPE_ACKREQ for data fragments
+///   that ask for an acknowledgement
+/// - message ID, distinct for each message sent by a node
+/// - fragment index, from 0
+/// - number of fragments in the message
+/// - total length of the message in octets, least significant octet first
+///
+/// Data fragments are followed by the fragment data, fragment i of a message of length len in count fragments
+/// starting at i * ((len + count - 1) / count). Acknowledgements are followed by a bitmap with
+/// one bit for each fragment, bit 0 of the first octet for fragment 0.
+class RHFragmentedDatagram : public RHDatagram
+{
+public:
+    /// Constructor.
+    /// \param[in] driver The RadioHead driver to use to transport messages.
+    /// \param[in] thisAddress The address to assign to this node. Defaults to 0
+    RHFragmentedDatagram(RHGenericDriver& driver, uint8_t thisAddress = 0);
+
+    /// Sets the maximum time to wait for the acknowledgement of a window of fragments.
+    /// The default is RH_FRAGMENT_DEFAULT_TIMEOUT. It needs to be long enough for the recipient
+    /// to receive the last fragment of the window and transmit an acknowledgement.
+    /// \param[in] timeout The new timeout period in milliseconds
+    void setTimeout(uint16_t timeout);
+
+    /// Sets the number of times a window of fragments is retransmitted without any of its fragments
+    /// being acknowledged before sendtoWait() gives up. The default is RH_FRAGMENT_DEFAULT_RETRIES.
+    /// \param[in] retries The maximum number of retransmissions without progress
+    void setRetries(uint8_t retries);
+
+    /// Supplies the memory used for reassembling received messages, instead of the internal pool.
+    /// The memory is divided equally between the RH_FRAGMENT_REASSEMBLIES reassembly buffers,
+    /// and must remain valid for as long as this instance is used.
+    /// Any messages partly reassembled in the previous buffers are discarded.
+    /// \param[in] buf Pointer to the memory
+    /// \param[in] len Size of the memory in octets
+    void setReassemblyBuffer(uint8_t* buf, uint16_t len);
+
+    /// Sends the message (which may be larger than the driver can carry) to the destination
+    /// node in fragments, and blocks until every fragment has been acknowledged
+    /// or the retries are exhausted.
+    /// \param[in] buf Pointer to the message to send
+    /// \param[in] len Number of octets to send
+    /// \param[in] address The address to send the message to.
+    /// \return true if every fragment was acknowledged, or if address is RH_BROADCAST_ADDRESS and
+    /// every fragment was transmitted. false if the message is too long, or not acknowledged
+    bool sendtoWait(uint8_t* buf, uint16_t len, uint8_t address);
+
+    /// Receives and reassembles any available fragments, sending acknowledgements as required.
+    /// \return true if a completely reassembled message is available to be retrieved with recvfromAck()
+    bool available();
+
+    /// If a completely reassembled message is available for this node, copies it to buf and returns true.
+    /// Receives and acknowledges any available fragments first.
+    /// \param[in] buf Location to copy the received message
+    /// \param[in,out] len Pointer to the available space in buf. Set to the actual number of octets copied.
+    /// \param[in] from If present and not NULL, the referenced uint8_t will be set to the FROM address
+    /// \param[in] to If present and not NULL, the referenced uint8_t will be set to the TO address
+    /// \param[in] id If present and not NULL, the referenced uint8_t will be set to the message ID
+    /// \param[in] flags If present and not NULL, the referenced uint8_t will be set to the FLAGS
+    /// (not just those addressed to this node).
+    /// \return true if a valid message was copied to buf
+    bool recvfromAck(uint8_t* buf, uint16_t* len, uint8_t* from = NULL, uint8_t* to = NULL, uint8_t* id = NULL, uint8_t* flags = NULL);
+
+    /// Similar to recvfromAck(), this will block until a complete message is available or the timeout expires.
+    /// \param[in] buf Location to copy the received message
+    /// \param[in,out] len Pointer to the available space in buf. Set to the actual number of octets copied.
+    /// \param[in] timeout Maximum time to wait in milliseconds
+    /// \param[in] from If present and not NULL, the referenced uint8_t will be set to the FROM address
+    /// \param[in] to If present and not NULL, the referenced uint8_t will be set to the TO address
+    /// \param[in] id If present and not NULL, the referenced uint8_t will be set to the message ID
+    /// \param[in] flags If present and not NULL, the referenced uint8_t will be set to the FLAGS
+    /// (not just those addressed to this node).
+    /// \return true if a valid message was copied to buf
+    bool recvfromAckTimeout(uint8_t* buf, uint16_t* len,  uint16_t timeout, uint8_t* from = NULL, uint8_t* to = NULL, uint8_t* id = NULL, uint8_t* flags = NULL);
+
+    /// Returns the number of fragments retransmitted since starting
+    /// or since the last call to resetRetransmissions().
+    /// \return The number of fragment retransmissions
+    uint32_t retransmissions();
+
+    /// Resets the count of fragment retransmissions to 0.
+    void resetRetransmissions();
+
+protected:
+    /// Receives one message from the driver if available, and handles it as a data fragment or
+    /// an acknowledgement
+    /// \return true if a message was received
+    bool receiveFragment();
+
+    /// Sends one fragment of the message being sent by sendtoWait()
+    /// \param[in] index The index of the fragment
+    /// \param[in] ackreq true if the recipient is to acknowledge it
+    /// \return true if it was transmitted
+    bool sendFragment(uint8_t index, bool ackreq);
+
+private:
+    /// States of a reassembly buffer
+    typedef enum
+    {
+	ReassemblyFree = 0,    ///< Not in use
+	ReassemblyReceiving,   ///< Some fragments have arrived
+	ReassemblyComplete,    ///< All fragments have arrived, not yet collected by recvfromAck()
+	ReassemblyDelivered    ///< Collected. Kept to acknowledge duplicate fragments
+    } ReassemblyState;
+
+    /// A message being reassembled
+    typedef struct
+    {
+	uint8_t       state;    ///< One of ReassemblyState
+	uint8_t       from;     ///< Sender
+	uint8_t       to;       ///< Address it was sent to
+	uint8_t       id;       ///< Message ID from the fragment header
+	uint8_t       flags;    ///< FLAGS header of the most recent fragment
+	uint8_t       count;    ///< Number of fragments in the message
+	uint8_t       received; ///< Number of different fragments received
+	uint16_t      len;      ///< Length of the message
+	unsigned long heard;    ///< millis() when the last fragment arrived
+	uint8_t       bitmap[(RH_FRAGMENT_MAX_FRAGMENTS + 7) / 8]; ///< One bit for each fragment received
+    } Reassembly;
+
+    /// Finds the reassembly buffer for a message, or allocates one if from and id are not known
+    /// \return The index of the reassembly buffer, or RH_FRAGMENT_REASSEMBLIES if there is none available
+    uint8_t findReassembly(uint8_t from, uint8_t id);
+
+    /// Handles a data fragment just received
+    void handleData(uint8_t* frame, uint8_t len);
+
+    /// Handles an acknowledgement just received
+    void handleAck(uint8_t* frame, uint8_t len);
+
+    /// Sends an acknowledgement of the fragments received in a reassembly buffer
+    void sendAck(Reassembly* r);
+
+    /// Returns a pointer to the memory for a reassembly buffer
+    uint8_t* reassemblyBuffer(uint8_t index);
+
+    /// Retransmit timeout (milliseconds)
+    uint16_t _timeout;
+
+    /// Retries without progress
+    uint8_t _retries;
+
+    /// The last message ID sent
+    uint8_t _lastMessageId;
+
+    /// Count of fragment retransmissions
+    uint32_t _retransmissions;
+
+    /// Messages being reassembled
+    Reassembly _reassemblies[RH_FRAGMENT_REASSEMBLIES];
+
+    /// Memory for reassembly, and the size of each reassembly buffer in it
+    uint8_t* _reassemblyBuf;
+    uint16_t _reassemblyLen;
+
+    /// The message being sent by sendtoWait()
+    uint8_t* _txBuf;
+    uint16_t _txLen;
+    uint8_t  _txId;
+    uint8_t  _txTo;
+    uint8_t  _txCount;
+    uint16_t _txFragmentLen;
+    /// Bitmap of the fragments acknowledged so far
+    uint8_t  _txAcked[(RH_FRAGMENT_MAX_FRAGMENTS + 7) / 8];
+    /// Set when an acknowledgement for the message being sent arrives
+    bool     _txAckReceived;
+
+    /// Internal pool of reassembly buffers
+    uint8_t _pool[RH_FRAGMENT_REASSEMBLIES * RH_FRAGMENT_MAX_MESSAGE_LEN];
+};
+
+/// @example simulator_fragmented_datagram_client.pde
+/// @example simulator_fragmented_datagram_server.pde
+
+#endif
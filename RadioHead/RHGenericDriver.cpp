@@ -4,11 +4,14 @@
 // $Id: RHGenericDriver.cpp,v 1.23 2018/02/11 23:57:18 mikem Exp $
 
 #include <RHGenericDriver.h>
+#include <RHCapture.h>
+#include <RHDutyCycle.h>
 
 RHGenericDriver::RHGenericDriver()
     :
     _mode(RHModeInitialising),
     _thisAddress(RH_BROADCAST_ADDRESS),
+    _promiscuous(false),
     _txHeaderTo(RH_BROADCAST_ADDRESS),
     _txHeaderFrom(RH_BROADCAST_ADDRESS),
     _txHeaderId(0),
@@ -16,7 +19,11 @@ RHGenericDriver::RHGenericDriver()
     _rxBad(0),
     _rxGood(0),
     _txGood(0),
-    _cad_timeout(0)
+    _cad_timeout(0),
+    _capture(NULL),
+    _txAirtime(0),
+    _statsSince(0),
+    _dutyCycle(NULL)
 {
 }
 
@@ -151,6 +158,11 @@ uint8_t RHGenericDriver::headerFlags()
     return _rxHeaderFlags;
 }
 
+uint8_t RHGenericDriver::txHeaderFlags()
+{
+    return _txHeaderFlags;
+}
+
 int16_t RHGenericDriver::lastRssi()
 {
     return _lastRssi;
@@ -211,6 +223,121 @@ void RHGenericDriver::setCADTimeout(unsigned long cad_timeout)
     _cad_timeout = cad_timeout;
 }
 
+void RHGenericDriver::setCapture(RHCapture* capture)
+{
+    _capture = capture;
+}
+
+void RHGenericDriver::captureTx(const uint8_t* data, uint8_t len)
+{
+    if (_capture)
+	_capture->capture(RH_CAPTURE_TX, 0, 0, _txHeaderTo, _txHeaderFrom, _txHeaderId, _txHeaderFlags, data, len);
+}
+
+void RHGenericDriver::captureRx(const uint8_t* data, uint8_t len, int8_t snr)
+{
+    if (_capture)
+	_capture->capture(RH_CAPTURE_RX, _lastRssi, snr, _rxHeaderTo, _rxHeaderFrom, _rxHeaderId, _rxHeaderFlags, data, len);
+}
+
+void RHGenericDriver::driverStats(RHDriverStats* stats)
+{
+    stats->rxBad = _rxBad;
+    stats->rxGood = _rxGood;
+    stats->txGood = _txGood;
+    ATOMIC_BLOCK_START;
+    stats->txAirtime = _txAirtime;
+    ATOMIC_BLOCK_END;
+    stats->elapsed = millis() - _statsSince;
+    // In units of 0.01%, without 64 bit arithmetic
+    uint32_t dutyCycle = 0;
+    if (stats->txAirtime < 0xffffffffUL / 10000)
+	dutyCycle = stats->elapsed ? stats->txAirtime * 10000 / stats->elapsed : 0;
+    else if (stats->elapsed >= 10000)
+	dutyCycle = stats->txAirtime / (stats->elapsed / 10000);
+    stats->dutyCycle = dutyCycle > 10000 ? 10000 : dutyCycle;
+}
+
+void RHGenericDriver::resetStats()
+{
+    ATOMIC_BLOCK_START;
+    _txAirtime = 0;
+    ATOMIC_BLOCK_END;
+    _statsSince = millis();
+}
+
+void RHGenericDriver::writeStats(RHStatsWriter& writer)
+{
+    RHDriverStats stats;
+    driverStats(&stats);
+    writer.beginSection(RH_STATS_DRIVER);
+    writer.putVarint(stats.rxBad);
+    writer.putVarint(stats.rxGood);
+    writer.putVarint(stats.txGood);
+    writer.putVarint(stats.txAirtime);
+    writer.putVarint(stats.elapsed);
+    writer.putVarint(stats.dutyCycle);
+    writer.endSection();
+}
+
+uint32_t RHGenericDriver::timeOnAir(uint8_t len)
+{
+    (void)len; // Not used
+    return 0;
+}
+
+int RHGenericDriver::lastSNR()
+{
+    return 0;
+}
+
+bool RHGenericDriver::setLoRaRate(uint8_t spreadingFactor, uint32_t bandwidth)
+{
+    (void)spreadingFactor; // Not used
+    (void)bandwidth; // Not used
+    return false;
+}
+
+bool RHGenericDriver::setTransmitPower(int8_t power)
+{
+    (void)power; // Not used
+    return false;
+}
+
+void RHGenericDriver::setDutyCycle(RHDutyCycle* dutyCycle)
+{
+    _dutyCycle = dutyCycle;
+}
+
+bool RHGenericDriver::canSend(uint8_t len)
+{
+    return timeUntilSend(len) == 0;
+}
+
+uint32_t RHGenericDriver::timeUntilSend(uint8_t len)
+{
+    if (!_dutyCycle)
+	return 0;
+    return _dutyCycle->timeUntil(dutyCycleChannel(), timeOnAir(len));
+}
+
+unsigned long RHGenericDriver::nextSendTime(uint8_t len)
+{
+    return millis() + timeUntilSend(len);
+}
+
+uint32_t RHGenericDriver::dutyCycleChannel()
+{
+    return 0;
+}
+
+bool RHGenericDriver::spendAirtime(uint8_t len)
+{
+    if (!_dutyCycle)
+	return true;
+    return _dutyCycle->spend(dutyCycleChannel(), timeOnAir(len));
+}
+
 #if (RH_PLATFORM == RH_PLATFORM_ARDUINO) && defined(RH_PLATFORM_ATTINY)
 // Tinycore does not have __cxa_pure_virtual, so without this we
 // get linking complaints from the default code generated for pure virtual functions
@@ -7,6 +7,7 @@
 #define RHGenericDriver_h
 
 #include <RadioHead.h>
+#include <RHStats.h>
 
 // Defines bits of the FLAGS header reserved for use by the RadioHead library and 
 // the flags available for use by applications
@@ -17,6 +18,9 @@
 // Default timeout for waitCAD() in ms
 #define RH_CAD_DEFAULT_TIMEOUT            10000
 
+class RHCapture;
+class RHDutyCycle;
+
 /////////////////////////////////////////////////////////////////////
 /// \class RHGenericDriver RHGenericDriver.h <RHGenericDriver.h>
 /// \brief Abstract base class for a RadioHead driver.
@@ -202,6 +206,10 @@ public:
     /// \return The FLAGS header
     virtual uint8_t        headerFlags();
 
+    /// Returns the FLAGS header that will be sent with the next message, as set by setHeaderFlags()
+    /// \return The FLAGS header
+    virtual uint8_t        txHeaderFlags();
+
     /// Returns the most recent RSSI (Receiver Signal Strength Indicator).
     /// Usually it is the RSSI of the last received message, which is measured when the preamble is received.
     /// If you called readRssi() more recently, it will return that more recent value.
@@ -247,7 +255,92 @@ public:
     /// \return The number of packets successfully transmitted
     virtual uint16_t       txGood();
 
+    /// Sets an object to be given a copy of each message this driver sends, and each message
+    /// the application receives with recv(), for example an RHPcapCapture to record them in a pcap file.
+    /// Only supported by some drivers: see RHCapture
+    /// \param[in] capture The capture, or NULL to stop capturing
+    void                   setCapture(RHCapture* capture);
+
+    /// Takes a snapshot of the statistics of this driver: the rxBad(), rxGood() and txGood() counts,
+    /// and the time spent transmitting since resetStats(), for drivers that measure it
+    /// \param[out] stats The snapshot
+    virtual void           driverStats(RHDriverStats* stats);
+
+    /// Resets the time spent transmitting to 0, and starts measuring the duty cycle again from now.
+    /// The rxBad(), rxGood() and txGood() counts are not changed
+    virtual void           resetStats();
+
+    /// Writes the driverStats() as an RH_STATS_DRIVER section. See RHStatsWriter
+    /// \param[in] writer Where to write them
+    virtual void           writeStats(RHStatsWriter& writer);
+
+    /// Returns the time it takes to transmit a message with the current modem settings,
+    /// including the RadioHead headers. Only calculated by some drivers
+    /// \param[in] len The length of the payload in octets
+    /// \return The time on air in microseconds, or 0 if the driver does not know
+    virtual uint32_t       timeOnAir(uint8_t len);
+
+    /// Returns the signal to noise ratio of the last received message, for drivers that measure it
+    /// \return SNR in dB, or 0 if the driver does not measure it
+    virtual int            lastSNR();
+
+    /// Changes the LoRa spreading factor and bandwidth, keeping the other modem settings.
+    /// Only supported by some drivers: see RHAdaptiveRate
+    /// \param[in] spreadingFactor The spreading factor, 6 to 12
+    /// \param[in] bandwidth The bandwidth in Hz
+    /// \return true if the driver supports it and the rate was changed
+    virtual bool           setLoRaRate(uint8_t spreadingFactor, uint32_t bandwidth);
+
+    /// Changes the transmitter power, keeping the other transmitter settings.
+    /// Only supported by some drivers: see RHAdaptiveRate
+    /// \param[in] power The transmitter power in dBm
+    /// \return true if the driver supports it and the power was changed
+    virtual bool           setTransmitPower(int8_t power);
+
+    /// Sets an airtime budget to keep transmissions within duty cycle limits. Once set, send() returns false
+    /// without sending if a message would exceed the budget of the current channel.
+    /// Only supported by drivers that calculate timeOnAir(): see RHDutyCycle
+    /// \param[in] dutyCycle The budget, or NULL to stop enforcing it
+    void                   setDutyCycle(RHDutyCycle* dutyCycle);
+
+    /// Tells whether a message can be sent now without exceeding the airtime budget set by setDutyCycle()
+    /// \param[in] len The length of the payload in octets
+    /// \return true if the message can be sent now
+    bool                   canSend(uint8_t len);
+
+    /// Returns how long until a message can be sent without exceeding the airtime budget set by setDutyCycle()
+    /// \param[in] len The length of the payload in octets
+    /// \return The time to wait in milliseconds, 0 if it can be sent now
+    uint32_t               timeUntilSend(uint8_t len);
+
+    /// Returns when a message can be sent without exceeding the airtime budget set by setDutyCycle()
+    /// \param[in] len The length of the payload in octets
+    /// \return The millis() time from when it can be sent
+    unsigned long          nextSendTime(uint8_t len);
+
 protected:
+    /// Drivers call this with each message they send, after the TX headers have been set
+    /// \param[in] data The payload
+    /// \param[in] len Length of the payload
+    void                captureTx(const uint8_t* data, uint8_t len);
+
+    /// Drivers call this with each message given to the application by recv(), after the RX headers
+    /// and RSSI have been set
+    /// \param[in] data The payload
+    /// \param[in] len Length of the payload
+    /// \param[in] snr SNR in dB, for drivers that measure it
+    void                captureRx(const uint8_t* data, uint8_t len, int8_t snr = 0);
+
+    /// Returns the channel the airtime budget of the next transmission is taken from.
+    /// See RHDutyCycle. Drivers that calculate timeOnAir() override this
+    /// \return The channel. The default is 0
+    virtual uint32_t    dutyCycleChannel();
+
+    /// Drivers that support setDutyCycle() call this in send() before transmitting,
+    /// to take the time on air of the message out of the airtime budget
+    /// \param[in] len Length of the payload
+    /// \return true if the message may be sent, false if it would exceed the budget
+    bool                spendAirtime(uint8_t len);
 
     /// The current transport operating mode
     volatile RHMode     _mode;
@@ -300,6 +393,18 @@ protected:
     /// Channel activity timeout in ms
     unsigned int        _cad_timeout;
 
+    /// Where to record messages sent and received, if anywhere
+    RHCapture*          _capture;
+
+    /// Time spent transmitting in milliseconds, for drivers that measure it
+    volatile uint32_t   _txAirtime;
+
+    /// millis() when the statistics were last reset
+    unsigned long       _statsSince;
+
+    /// Airtime budget to keep to, if any
+    RHDutyCycle*        _dutyCycle;
+
 private:
 
 };
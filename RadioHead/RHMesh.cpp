@@ -13,17 +13,34 @@
 
 #include <RHMesh.h>
 
-uint8_t RHMesh::_tmpMessage[RH_ROUTER_MAX_MESSAGE_LEN];
-
 ////////////////////////////////////////////////////////////////////
 // Constructors
 RHMesh::RHMesh(RHGenericDriver& driver, uint8_t thisAddress) 
     : RHRouter(driver, thisAddress)
 {
+    _arpTimeout = RH_MESH_ARP_TIMEOUT;
+    _asyncDiscovery = false;
+    _lastDiscoveryId = 0;
+    _nextSeenRequest = 0;
+    memset(_discoveries, 0, sizeof(_discoveries));
+    memset(_seenRequests, 0, sizeof(_seenRequests));
+    memset(_queue, 0, sizeof(_queue));
+    _meshStats = RHMeshStats();
 }
 
 ////////////////////////////////////////////////////////////////////
 // Public methods
+bool RHMesh::init()
+{
+    bool ret = RHRouter::init();
+    // Not where we started last time, or other nodes may still remember our requests
+#if (RH_PLATFORM == RH_PLATFORM_RASPI) // use standard library random(), bugs in random(min, max)
+    _lastDiscoveryId = random() & 0xFF;
+#else
+    _lastDiscoveryId = random(0, 256);
+#endif
+    return ret;
+}
 
 ////////////////////////////////////////////////////////////////////
 // Discovers a route to the destination (if necessary), sends and 
@@ -36,55 +53,364 @@ uint8_t RHMesh::sendtoWait(uint8_t* buf, uint8_t len, uint8_t address, uint8_t f
     if (address != RH_BROADCAST_ADDRESS)
     {
 	RoutingTableEntry* route = getRouteTo(address);
+	if (!route && _asyncDiscovery)
+	{
+	    // Queue the message until the route has been discovered
+	    uint8_t i;
+	    for (i = 0; i < RH_MESH_QUEUE_SIZE; i++)
+		if (!_queue[i].valid)
+		    break;
+	    if (i >= RH_MESH_QUEUE_SIZE)
+		_meshStats.queueFull++;
+	    if (i >= RH_MESH_QUEUE_SIZE || !startDiscovery(address))
+		return RH_ROUTER_ERROR_NO_ROUTE;
+	    _queue[i].valid = true;
+	    _queue[i].dest = address;
+	    _queue[i].flags = flags;
+	    _queue[i].len = len;
+	    MeshApplicationMessage* a = (MeshApplicationMessage*)_queue[i].message.data;
+	    a->header.msgType = RH_MESH_MESSAGE_TYPE_APPLICATION;
+	    memcpy(a->data, buf, len);
+	    uint8_t queued = 0;
+	    for (i = 0; i < RH_MESH_QUEUE_SIZE; i++)
+		if (_queue[i].valid)
+		    queued++;
+	    if (queued > _meshStats.queueMax)
+		_meshStats.queueMax = queued;
+	    return RH_ROUTER_ERROR_QUEUED;
+	}
 	if (!route && !doArp(address))
 	    return RH_ROUTER_ERROR_NO_ROUTE;
     }
 
-    // Now have a route. Contruct an application layer message and send it via that route
-    MeshApplicationMessage* a = (MeshApplicationMessage*)&_tmpMessage;
+    // Now have a route. Contruct an application layer message in the transmit buffer 
+    // (unless the caller already put it there) and send it via that route
+    MeshApplicationMessage* a = (MeshApplicationMessage*)_txMessage.data;
     a->header.msgType = RH_MESH_MESSAGE_TYPE_APPLICATION;
-    memcpy(a->data, buf, len);
-    return RHRouter::sendtoWait(_tmpMessage, sizeof(RHMesh::MeshMessageHeader) + len, address, flags);
+    if (buf != a->data)
+	memcpy(a->data, buf, len);
+    return sendInPlaceWait(&_txMessage, sizeof(RHMesh::MeshMessageHeader) + len, address, _thisAddress, flags);
 }
 
 ////////////////////////////////////////////////////////////////////
-bool RHMesh::doArp(uint8_t address)
+uint8_t* RHMesh::txBuffer()
+{
+    return ((MeshApplicationMessage*)_txMessage.data)->data;
+}
+
+////////////////////////////////////////////////////////////////////
+void RHMesh::setArpTimeout(uint16_t timeout)
+{
+    _arpTimeout = timeout;
+}
+
+////////////////////////////////////////////////////////////////////
+void RHMesh::setAsyncDiscovery(bool async)
+{
+    _asyncDiscovery = async;
+}
+
+////////////////////////////////////////////////////////////////////
+bool RHMesh::isDiscovering(uint8_t dest)
+{
+    Discovery* d = findDiscovery(dest);
+    return d && (d->state == DiscoveryActive || d->state == DiscoveryResolved);
+}
+
+////////////////////////////////////////////////////////////////////
+void RHMesh::meshStats(RHMeshStats* stats)
+{
+    *stats = _meshStats;
+    stats->discovering = 0;
+    stats->queued = 0;
+    uint8_t i;
+    for (i = 0; i < RH_MESH_MAX_DISCOVERIES; i++)
+	if (_discoveries[i].state == DiscoveryActive || _discoveries[i].state == DiscoveryResolved)
+	    stats->discovering++;
+    for (i = 0; i < RH_MESH_QUEUE_SIZE; i++)
+	if (_queue[i].valid)
+	    stats->queued++;
+}
+
+////////////////////////////////////////////////////////////////////
+void RHMesh::resetStats()
+{
+    RHRouter::resetStats();
+    _meshStats = RHMeshStats();
+}
+
+////////////////////////////////////////////////////////////////////
+void RHMesh::writeStats(RHStatsWriter& writer)
+{
+    RHRouter::writeStats(writer);
+    RHMeshStats stats;
+    meshStats(&stats);
+    writer.beginSection(RH_STATS_MESH);
+    writer.putVarint(stats.discoveries);
+    writer.putVarint(stats.resolved);
+    writer.putVarint(stats.failed);
+    writer.putVarint(stats.requestsForwarded);
+    writer.putVarint(stats.routeFailuresSent);
+    writer.putVarint(stats.discovering);
+    writer.putVarint(stats.queued);
+    writer.putVarint(stats.queueMax);
+    writer.putVarint(stats.queueFull);
+    writer.putHistogram(stats.discoveryTime);
+    writer.endSection();
+}
+
+////////////////////////////////////////////////////////////////////
+RHMesh::Discovery* RHMesh::findDiscovery(uint8_t dest)
+{
+    uint8_t i;
+    for (i = 0; i < RH_MESH_MAX_DISCOVERIES; i++)
+	if (_discoveries[i].state != DiscoveryFree && _discoveries[i].dest == dest)
+	    return &_discoveries[i];
+    return NULL;
+}
+
+////////////////////////////////////////////////////////////////////
+bool RHMesh::startDiscovery(uint8_t address, uint16_t limit)
+{
+    uint8_t i;
+    Discovery* d = findDiscovery(address);
+    if (d)
+    {
+	if (d->state == DiscoveryActive)
+	    return true; // Already looking
+	if (d->state == DiscoveryFailed && (millis() - d->started) < RH_MESH_DISCOVERY_HOLDOFF)
+	    return false; // Failed recently, dont flood the network again yet
+    }
+    else
+    {
+	// Use a free entry, else one whose holdoff has expired
+	for (i = 0; !d && i < RH_MESH_MAX_DISCOVERIES; i++)
+	    if (_discoveries[i].state == DiscoveryFree)
+		d = &_discoveries[i];
+	for (i = 0; !d && i < RH_MESH_MAX_DISCOVERIES; i++)
+	    if (   _discoveries[i].state == DiscoveryFailed
+		&& (millis() - _discoveries[i].started) >= RH_MESH_DISCOVERY_HOLDOFF)
+		d = &_discoveries[i];
+	if (!d)
+	    return false; // Too many in progress
+    }
+    d->state = DiscoveryActive;
+    d->dest = address;
+    d->limit = limit;
+    d->begun = millis();
+    d->ttl = ringTtl(d, RH_MESH_DISCOVERY_INITIAL_TTL < _max_hops ? RH_MESH_DISCOVERY_INITIAL_TTL : _max_hops);
+    _meshStats.discoveries++;
+    sendDiscoveryRequest(d);
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////
+void RHMesh::sendDiscoveryRequest(Discovery* d)
 {
-    // Need to discover a route
     // Broadcast a route discovery message with nothing in it
-    MeshRouteDiscoveryMessage* p = (MeshRouteDiscoveryMessage*)&_tmpMessage;
+    MeshControlMessage message;
+    MeshRouteDiscoveryMessage* p = (MeshRouteDiscoveryMessage*)message.data;
     p->header.msgType = RH_MESH_MESSAGE_TYPE_ROUTE_DISCOVERY_REQUEST;
     p->destlen = 1; 
-    p->dest = address; // Who we are looking for
-    uint8_t error = RHRouter::sendtoWait((uint8_t*)p, sizeof(RHMesh::MeshMessageHeader) + 2, RH_BROADCAST_ADDRESS);
-    if (error !=  RH_ROUTER_ERROR_NONE)
+    p->dest = d->dest; // Who we are looking for
+    p->id = d->id = ++_lastDiscoveryId;
+    p->ttl = d->ttl;
+    p->metric = 0;
+    d->started = millis();
+    // If this fails, the request will be repeated when it times out
+    sendInPlaceWait((RoutedMessage*)&message, RH_MESH_DISCOVERY_HEADER_LEN, RH_BROADCAST_ADDRESS, _thisAddress);
+}
+
+////////////////////////////////////////////////////////////////////
+uint8_t RHMesh::ringTtl(Discovery* d, uint8_t ttl)
+{
+    // The last ring before the time runs out must reach the whole network
+    if (d->limit && (millis() - d->begun) + 2UL * ttl * RH_MESH_DISCOVERY_HOP_TIMEOUT > d->limit)
+	return _max_hops;
+    return ttl;
+}
+
+////////////////////////////////////////////////////////////////////
+unsigned long RHMesh::ringTimeout(Discovery* d)
+{
+    unsigned long timeout = 2UL * d->ttl * RH_MESH_DISCOVERY_HOP_TIMEOUT;
+    if (d->limit)
+    {
+	unsigned long used = d->started - d->begun;
+	unsigned long left = used < d->limit ? d->limit - used : 0;
+	if (timeout > left)
+	    timeout = left;
+    }
+    return timeout;
+}
+
+////////////////////////////////////////////////////////////////////
+RHMesh::SeenRequest* RHMesh::findSeenRequest(uint8_t source, uint8_t id)
+{
+    // After this the originator has given up on the request, so no copies of it are still
+    // about, and it may be a new one from an originator that has restarted
+    unsigned long lifetime = 2UL * _max_hops * RH_MESH_DISCOVERY_HOP_TIMEOUT;
+    unsigned long now = millis();
+    uint8_t i;
+    for (i = 0; i < RH_MESH_SEEN_REQUESTS; i++)
+    {
+	if (_seenRequests[i].valid && now - _seenRequests[i].heard > lifetime)
+	    _seenRequests[i].valid = false;
+	if (   _seenRequests[i].valid
+	    && _seenRequests[i].source == source
+	    && _seenRequests[i].id == id)
+	    return &_seenRequests[i];
+    }
+    return NULL;
+}
+
+////////////////////////////////////////////////////////////////////
+void RHMesh::rememberRequest(uint8_t source, uint8_t id, uint8_t metric)
+{
+    _seenRequests[_nextSeenRequest].valid = true;
+    _seenRequests[_nextSeenRequest].source = source;
+    _seenRequests[_nextSeenRequest].id = id;
+    _seenRequests[_nextSeenRequest].metric = metric;
+    _seenRequests[_nextSeenRequest].heard = millis();
+    _nextSeenRequest = (_nextSeenRequest + 1) % RH_MESH_SEEN_REQUESTS;
+}
+
+////////////////////////////////////////////////////////////////////
+// Subclasses may want to override
+uint8_t RHMesh::linkCost()
+{
+    // The link is the one the message being processed arrived on
+    int16_t cost = RH_MESH_HOP_COST + interfaceCost(_rxInterface);
+    int16_t rssi = _interfaces[_rxInterface]->driver().lastRssi();
+    if (rssi < RH_MESH_GOOD_RSSI)
+	cost += (RH_MESH_GOOD_RSSI - rssi) / RH_MESH_RSSI_STEP;
+    return cost > RH_MESH_MAX_HOP_COST ? RH_MESH_MAX_HOP_COST : cost;
+}
+
+////////////////////////////////////////////////////////////////////
+uint16_t RHMesh::discoveryTimeLeft(uint16_t limit)
+{
+    uint8_t i;
+    for (i = 0; i < RH_MESH_MAX_DISCOVERIES; i++)
+    {
+	Discovery* d = &_discoveries[i];
+	if (d->state == DiscoveryResolved)
+	    return 0;
+	if (d->state == DiscoveryActive)
+	{
+	    unsigned long elapsed = millis() - d->started;
+	    unsigned long timeout = ringTimeout(d);
+	    if (elapsed >= timeout)
+		return 0;
+	    if (timeout - elapsed < limit)
+		limit = timeout - elapsed;
+	}
+    }
+    return limit;
+}
+
+////////////////////////////////////////////////////////////////////
+uint32_t RHMesh::broadcastDelay(uint8_t len)
+{
+    // Broadcasts go out on every interface, so as soon as any of them can send one
+    uint32_t wait = 0xffffffff;
+    uint8_t i;
+    for (i = 0; i < _interfaceCount; i++)
+    {
+	uint32_t w = _interfaces[i]->driver().timeUntilSend(sizeof(RoutedMessageHeader) + len);
+	if (w < wait)
+	    wait = w;
+    }
+    return _interfaceCount ? wait : 0;
+}
+
+////////////////////////////////////////////////////////////////////
+void RHMesh::pollDiscovery()
+{
+    uint8_t i, j;
+    for (i = 0; i < RH_MESH_MAX_DISCOVERIES; i++)
+    {
+	Discovery* d = &_discoveries[i];
+	if (d->state == DiscoveryResolved)
+	{
+	    // Send everything that was waiting for this route
+	    d->state = DiscoveryFree;
+	    for (j = 0; j < RH_MESH_QUEUE_SIZE; j++)
+	    {
+		QueuedMessage* q = &_queue[j];
+		if (!q->valid || q->dest != d->dest)
+		    continue;
+		q->valid = false;
+		sendInPlaceWait(&q->message, sizeof(RHMesh::MeshMessageHeader) + q->len, q->dest, _thisAddress, q->flags);
+	    }
+	}
+	else if (   d->state == DiscoveryActive
+		 && (millis() - d->started) >= ringTimeout(d))
+	{
+	    if (d->ttl < _max_hops)
+	    {
+		uint32_t wait = broadcastDelay(RH_MESH_DISCOVERY_HEADER_LEN);
+		if (wait)
+		{
+		    // The airtime budget does not allow another request yet. Look again when it does
+		    unsigned long timeout = ringTimeout(d);
+		    d->started = millis() - timeout + (wait < timeout ? wait : timeout);
+		    continue;
+		}
+		// No response. Expand the ring and try again
+		d->ttl = ringTtl(d, d->ttl < _max_hops / 2 ? d->ttl * 2 : _max_hops);
+		sendDiscoveryRequest(d);
+	    }
+	    else
+	    {
+		// No response from the whole network. Give up, and discard anything waiting for it
+		d->state = DiscoveryFailed;
+		d->started = millis();
+		_meshStats.failed++;
+		for (j = 0; j < RH_MESH_QUEUE_SIZE; j++)
+		    if (_queue[j].valid && _queue[j].dest == d->dest)
+			_queue[j].valid = false;
+	    }
+	}
+    }
+}
+
+////////////////////////////////////////////////////////////////////
+bool RHMesh::doArp(uint8_t address)
+{
+    // Need to discover a route, in the time we can block for
+    if (!startDiscovery(address, _arpTimeout))
 	return false;
+    Discovery* d = findDiscovery(address);
     
     // Wait for a reply, which will be unicast back to us
-    // It will contain the complete route to the destination
-    uint8_t messageLen = sizeof(_tmpMessage);
-    // FIXME: timeout should be configurable
+    // It will contain the complete route to the destination, and peekAtMessage will 
+    // add it to the routing table
     unsigned long starttime = millis();
     int32_t timeLeft;
-    while ((timeLeft = RH_MESH_ARP_TIMEOUT - (millis() - starttime)) > 0)
+    while (   d->state == DiscoveryActive
+	   && (timeLeft = _arpTimeout - (millis() - starttime)) > 0)
     {
-	if (waitAvailableTimeout(timeLeft))
+	if (waitAvailableTimeout(discoveryTimeLeft(timeLeft)))
 	{
-	    if (RHRouter::recvfromAck(_tmpMessage, &messageLen))
-	    {
-		if (   messageLen > 1
-		       && p->header.msgType == RH_MESH_MESSAGE_TYPE_ROUTE_DISCOVERY_RESPONSE)
-		{
-		    // Got a reply, now add the next hop to the dest to the routing table
-		    // The first hop taken is the first octet
-		    addRouteTo(address, headerFrom());
-		    return true;
-		}
-	    }
+	    uint8_t* msg;
+	    uint8_t messageLen;
+	    RHRouter::recvfromAckInPlace(&msg, &messageLen);
 	}
+	else
+	    pollDiscovery(); // Maybe expand the ring
 	YIELD;
     }
-    return false;
+    if (d->state == DiscoveryActive)
+    {
+	// Timed out
+	d->state = DiscoveryFailed;
+	d->started = millis();
+	_meshStats.failed++;
+    }
+    bool ret = d->state == DiscoveryResolved;
+    pollDiscovery(); // Send anything that was queued for it
+    return ret;
 }
 
 ////////////////////////////////////////////////////////////////////
@@ -99,16 +425,32 @@ void RHMesh::peekAtMessage(RoutedMessage* message, uint8_t messageLen)
 	// being routed back to the originator here. Want to scrape some routing data out of the response
 	// We can find the routes to all the nodes between here and the responding node
 	MeshRouteDiscoveryMessage* d = (MeshRouteDiscoveryMessage*)message->data;
-	addRouteTo(d->dest, headerFrom());
-	uint8_t numRoutes = messageLen - sizeof(RoutedMessageHeader) - sizeof(MeshMessageHeader) - 2;
+	// Add the cost of the link it just arrived on. If we forward it, the next node gets the 
+	// cost of its route back to the responder
+	uint16_t metric = d->metric + linkCost();
+	d->metric = metric < RH_ROUTER_METRIC_UNKNOWN ? metric : RH_ROUTER_METRIC_UNKNOWN - 1;
+	addRouteIfBetter(d->dest, _rxFrom, d->metric, _rxInterface);
+	if (message->header.dest == _thisAddress)
+	{
+	    // Its the response to our own request
+	    Discovery* disc = findDiscovery(d->dest);
+	    if (disc && disc->state == DiscoveryActive)
+	    {
+		disc->state = DiscoveryResolved;
+		_meshStats.resolved++;
+		_meshStats.discoveryTime.add(millis() - disc->begun);
+	    }
+	}
+	uint8_t numRoutes = messageLen - sizeof(RoutedMessageHeader) - RH_MESH_DISCOVERY_HEADER_LEN;
 	uint8_t i;
 	// Find us in the list of nodes that were traversed to get to the responding node
 	for (i = 0; i < numRoutes; i++)
 	    if (d->route[i] == _thisAddress)
 		break;
 	i++;
+	// The nodes between us and the responder are no further away than the responder
 	while (i < numRoutes)
-	    addRouteTo(d->route[i++], headerFrom());
+	    addRouteIfBetter(d->route[i++], _rxFrom, d->metric, _rxInterface);
     }
     else if (   messageLen > 1 
 	     && m->msgType == RH_MESH_MESSAGE_TYPE_ROUTE_FAILURE)
@@ -122,7 +464,9 @@ void RHMesh::peekAtMessage(RoutedMessage* message, uint8_t messageLen)
 // This is called when a message is to be delivered to the next hop
 uint8_t RHMesh::route(RoutedMessage* message, uint8_t messageLen)
 {
-    uint8_t from = headerFrom(); // Might get clobbered during call to superclass route()
+    // Where the message came from, in case we have to report a failure back that way
+    uint8_t from = _rxFrom;
+    uint8_t fromInterface = _rxInterface;
     uint8_t ret = RHRouter::route(message, messageLen);
     if (   ret == RH_ROUTER_ERROR_NO_ROUTE
 	|| ret == RH_ROUTER_ERROR_UNABLE_TO_DELIVER)
@@ -132,12 +476,14 @@ uint8_t RHMesh::route(RoutedMessage* message, uint8_t messageLen)
 	if (message->header.source != _thisAddress)
 	{
 	    // This is being proxied, so tell the originator about it
-	    MeshRouteFailureMessage* p = (MeshRouteFailureMessage*)&_tmpMessage;
+	    MeshControlMessage failure;
+	    MeshRouteFailureMessage* p = (MeshRouteFailureMessage*)failure.data;
 	    p->header.msgType = RH_MESH_MESSAGE_TYPE_ROUTE_FAILURE;
 	    p->dest = message->header.dest; // Who you were trying to deliver to
 	    // Make sure there is a route back towards whoever sent the original message
-	    addRouteTo(message->header.source, from);
-	    ret = RHRouter::sendtoWait((uint8_t*)p, sizeof(RHMesh::MeshMessageHeader) + 1, message->header.source);
+	    addRouteIfBetter(message->header.source, from, RH_ROUTER_METRIC_UNKNOWN, fromInterface);
+	    sendInPlaceWait((RoutedMessage*)&failure, sizeof(RHMesh::MeshMessageHeader) + 1, message->header.source, _thisAddress);
+	    _meshStats.routeFailuresSent++;
 	}
     }
     return ret;
@@ -154,14 +500,29 @@ bool RHMesh::isPhysicalAddress(uint8_t* address, uint8_t addresslen)
 ////////////////////////////////////////////////////////////////////
 bool RHMesh::recvfromAck(uint8_t* buf, uint8_t* len, uint8_t* source, uint8_t* dest, uint8_t* id, uint8_t* flags)
 {     
-    uint8_t tmpMessageLen = sizeof(_tmpMessage);
+    uint8_t* msg;
+    uint8_t msgLen;
+    if (!recvfromAckInPlace(&msg, &msgLen, source, dest, id, flags))
+	return false;
+    if (*len > msgLen)
+	*len = msgLen;
+    memcpy(buf, msg, *len);
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////
+bool RHMesh::recvfromAckInPlace(uint8_t** buf, uint8_t* len, uint8_t* source, uint8_t* dest, uint8_t* id, uint8_t* flags)
+{     
+    uint8_t* tmpMessage;
+    uint8_t tmpMessageLen;
     uint8_t _source;
     uint8_t _dest;
     uint8_t _id;
     uint8_t _flags;
-    if (RHRouter::recvfromAck(_tmpMessage, &tmpMessageLen, &_source, &_dest, &_id, &_flags))
+    pollDiscovery();
+    if (RHRouter::recvfromAckInPlace(&tmpMessage, &tmpMessageLen, &_source, &_dest, &_id, &_flags))
     {
-	MeshMessageHeader* p = (MeshMessageHeader*)&_tmpMessage;
+	MeshMessageHeader* p = (MeshMessageHeader*)tmpMessage;
 
 	if (   tmpMessageLen >= 1 
 	    && p->msgType == RH_MESH_MESSAGE_TYPE_APPLICATION)
@@ -172,15 +533,12 @@ bool RHMesh::recvfromAck(uint8_t* buf, uint8_t* len, uint8_t* source, uint8_t* d
 	    if (dest)   *dest   = _dest;
 	    if (id)     *id     = _id;
 	    if (flags)  *flags  = _flags;
-	    uint8_t msgLen = tmpMessageLen - sizeof(MeshMessageHeader);
-	    if (*len > msgLen)
-		*len = msgLen;
-	    memcpy(buf, a->data, *len);
-	    
+	    *buf = a->data;
+	    *len = tmpMessageLen - sizeof(MeshMessageHeader);
 	    return true;
 	}
 	else if (   _dest == RH_BROADCAST_ADDRESS 
-		 && tmpMessageLen > 1 
+		 && tmpMessageLen >= RH_MESH_DISCOVERY_HEADER_LEN
 		 && p->msgType == RH_MESH_MESSAGE_TYPE_ROUTE_DISCOVERY_REQUEST)
 	{
 	    MeshRouteDiscoveryMessage* d = (MeshRouteDiscoveryMessage*)p;
@@ -190,40 +548,67 @@ bool RHMesh::recvfromAck(uint8_t* buf, uint8_t* len, uint8_t* source, uint8_t* d
 	    if (_source == _thisAddress)
 		return false;
 	    
-	    uint8_t numRoutes = tmpMessageLen - sizeof(MeshMessageHeader) - 2;
+	    uint8_t numRoutes = tmpMessageLen - RH_MESH_DISCOVERY_HEADER_LEN;
 	    uint8_t i;
 	    // Are we already mentioned?
 	    for (i = 0; i < numRoutes; i++)
 		if (d->route[i] == _thisAddress)
 		    return false; // Already been through us. Discard
 	    
+
+	    // Cost of the path back to the originator, including the link it just arrived on
+	    uint16_t metric = d->metric + linkCost();
+	    if (metric >= RH_ROUTER_METRIC_UNKNOWN)
+		metric = RH_ROUTER_METRIC_UNKNOWN - 1;
 	        
-            addRouteTo(_source, headerFrom()); // The originator needs to be added regardless of node type
+	    // The originator needs to be added regardless of node type. Even if we have seen this request
+	    // before, it may have come by a better path
+            addRouteIfBetter(_source, _rxFrom, metric, _rxInterface);
+
+	    // We rebroadcast each request only once. The destination answers again if 
+	    // a copy arrives by a better path than the ones it has answered
+	    bool forUs = isPhysicalAddress(&d->dest, d->destlen);
+	    SeenRequest* seen = findSeenRequest(_source, d->id);
+	    if (seen && (!forUs || metric >= seen->metric))
+		return false;
+	    if (seen)
+		seen->metric = metric;
+	    else
+		rememberRequest(_source, d->id, metric);
 
 	    // Hasnt been past us yet, record routes back to the earlier nodes
             // No need to waste memory if we are not participating in routing
             if (_isa_router)
             {
 	        for (i = 0; i < numRoutes; i++)
-		    addRouteTo(d->route[i], headerFrom());
+		    addRouteIfBetter(d->route[i], _rxFrom, metric, _rxInterface);
             }
 
-	    if (isPhysicalAddress(&d->dest, d->destlen))
+	    if (forUs)
 	    {
 		// This route discovery is for us. Unicast the whole route back to the originator
 		// as a RH_MESH_MESSAGE_TYPE_ROUTE_DISCOVERY_RESPONSE
 		// We are certain to have a route there, because we just got it
+		// The response accumulates the cost of the path back to us
 		d->header.msgType = RH_MESH_MESSAGE_TYPE_ROUTE_DISCOVERY_RESPONSE;
-		RHRouter::sendtoWait((uint8_t*)d, tmpMessageLen, _source);
+		d->metric = 0;
+		sendInPlaceWait(&_rxMessage, tmpMessageLen, _source, _thisAddress);
 	    }
-	    else if ((i < _max_hops) && _isa_router)
+	    else if ((numRoutes < _max_hops) && _isa_router && d->ttl > 1)
 	    {
-		// Its for someone else, rebroadcast it, after adding ourselves to the list
+		// Its for someone else, rebroadcast it, after adding ourselves to the list.
+		// Unless the airtime budget does not allow it now: by the time it does, the
+		// request will be stale, and other nodes may forward it anyway
+		if (broadcastDelay(tmpMessageLen + 1))
+		    return false;
+		d->ttl--;
+		d->metric = metric;
 		d->route[numRoutes] = _thisAddress;
 		tmpMessageLen++;
 		// Have to impersonate the source
 		// REVISIT: if this fails what can we do?
-		RHRouter::sendtoFromSourceWait(_tmpMessage, tmpMessageLen, RH_BROADCAST_ADDRESS, _source);
+		sendInPlaceWait(&_rxMessage, tmpMessageLen, RH_BROADCAST_ADDRESS, _source);
+		_meshStats.requestsForwarded++;
 	    }
 	}
     }
@@ -237,12 +622,15 @@ bool RHMesh::recvfromAckTimeout(uint8_t* buf, uint8_t* len, uint16_t timeout, ui
     int32_t timeLeft;
     while ((timeLeft = timeout - (millis() - starttime)) > 0)
     {
-	if (waitAvailableTimeout(timeLeft))
+	// Dont sleep past the time a route discovery needs attention
+	if (waitAvailableTimeout(discoveryTimeLeft(timeLeft)))
 	{
 	    if (recvfromAck(buf, len, from, to, id, flags))
 		return true;
 	    YIELD;
 	}
+	else
+	    pollDiscovery();
     }
     return false;
 }
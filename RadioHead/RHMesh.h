@@ -18,6 +18,64 @@
 // Timeout for address resolution in milliecs
 #define RH_MESH_ARP_TIMEOUT 4000
 
+// TTL (maximum hops) of the first route discovery request for a destination. 
+// If there is no response, the request is repeated with the TTL doubled, up to max_hops
+#ifndef RH_MESH_DISCOVERY_INITIAL_TTL
+#define RH_MESH_DISCOVERY_INITIAL_TTL 2
+#endif
+
+// Time in millisecs allowed per hop for a route discovery response to come back.
+// A request with TTL n waits 2 * n * RH_MESH_DISCOVERY_HOP_TIMEOUT before it is repeated,
+// or less if that would take a blocking discovery past its ARP timeout
+#ifndef RH_MESH_DISCOVERY_HOP_TIMEOUT
+#define RH_MESH_DISCOVERY_HOP_TIMEOUT 200
+#endif
+
+// Time in millisecs after a failed route discovery before another will be started for the same destination
+#ifndef RH_MESH_DISCOVERY_HOLDOFF
+#define RH_MESH_DISCOVERY_HOLDOFF 5000
+#endif
+
+// Maximum number of destinations whose routes can be discovered at the same time
+#ifndef RH_MESH_MAX_DISCOVERIES
+#define RH_MESH_MAX_DISCOVERIES 4
+#endif
+
+// Number of recent route discovery requests remembered by each node, so it rebroadcasts each one only once
+#ifndef RH_MESH_SEEN_REQUESTS
+#define RH_MESH_SEEN_REQUESTS 8
+#endif
+
+// Cost of each hop in a route, before any penalty for poor link quality
+#ifndef RH_MESH_HOP_COST
+#define RH_MESH_HOP_COST 4
+#endif
+
+// Links received at or above this RSSI (in dBm) have no link quality penalty
+#ifndef RH_MESH_GOOD_RSSI
+#define RH_MESH_GOOD_RSSI -80
+#endif
+
+// Each this many dB below RH_MESH_GOOD_RSSI adds 1 to the cost of a hop
+#ifndef RH_MESH_RSSI_STEP
+#define RH_MESH_RSSI_STEP 4
+#endif
+
+// Maximum cost of a single hop
+#ifndef RH_MESH_MAX_HOP_COST
+#define RH_MESH_MAX_HOP_COST 32
+#endif
+
+// Number of application messages that can be queued waiting for route discovery
+// when asynchronous discovery is enabled. Each one costs about RH_MESH_MAX_MESSAGE_LEN octets of RAM
+#ifndef RH_MESH_QUEUE_SIZE
+ #if defined(__AVR__)
+  #define RH_MESH_QUEUE_SIZE 1
+ #else
+  #define RH_MESH_QUEUE_SIZE 4
+ #endif
+#endif
+
 /////////////////////////////////////////////////////////////////////
 /// \class RHMesh RHMesh.h <RHMesh.h>
 /// \brief RHRouter subclass for sending addressed, optionally acknowledged datagrams
@@ -46,9 +104,46 @@
 /// otherwise it rebroadcasts the request, after adding itself to the list of nodes visited so 
 /// far by the request.
 ///
+/// Each request carries an ID assigned by the originating node. Every node remembers the originator and ID
+/// of the last RH_MESH_SEEN_REQUESTS requests it has seen, and ignores any request it has seen before, 
+/// so each request is rebroadcast at most once by each node. Requests are forgotten once their originator 
+/// can no longer be waiting for a response, and IDs start at a random value in init(), so the requests of 
+/// a node that has restarted are not ignored. 
 /// If a node receives a RH_MESH_MESSAGE_TYPE_ROUTE_DISCOVERY_REQUEST that already has itself 
-/// listed in the visited nodes, it knows it has already seen and rebroadcast this request, 
-/// and threfore ignores it. This prevents broadcast storms.
+/// listed in the visited nodes, it also ignores it. This prevents broadcast storms.
+///
+/// Route discovery uses an expanding ring search. Each request carries a TTL, the number of hops it
+/// may travel, and is not rebroadcast by a node that receives it with a TTL of 1. The first request 
+/// for a destination has a TTL of RH_MESH_DISCOVERY_INITIAL_TTL. If there is no reply within
+/// 2 * TTL * RH_MESH_DISCOVERY_HOP_TIMEOUT milliseconds, the request is repeated with a new ID and twice 
+/// the TTL, until the TTL reaches max_hops. Nearby destinations are therefore found without flooding 
+/// the whole network. When sendtoWait() blocks for a discovery, all the rings must fit in the ARP timeout
+/// (see setArpTimeout()): if the next ring could not finish in the time left, the request goes to max_hops 
+/// instead, and waits for whatever time is left. So every destination within max_hops can be found, however 
+/// short the timeout. If discovery fails, no new discovery is started for that destination for 
+/// RH_MESH_DISCOVERY_HOLDOFF milliseconds, and sendtoWait() returns RH_ROUTER_ERROR_NO_ROUTE immediately.
+///
+/// Routes are chosen by a metric that combines hop count with link quality. Each hop costs RH_MESH_HOP_COST,
+/// plus 1 for each RH_MESH_RSSI_STEP dB that the RSSI of the received message is below RH_MESH_GOOD_RSSI (see linkCost()).
+/// Route discovery requests accumulate the cost of the path back to the originator, and responses 
+/// accumulate the cost of the path back to the responding node, so every node they pass through learns 
+/// the cost of its routes. A node replaces an existing route whenever it learns of one that is 
+/// better by at least RH_ROUTER_METRIC_HYSTERESIS, even if the existing route still works.
+/// The destination answers every copy of a request that arrives by a better path than those it has
+/// already answered, so the originator ends up with the best route, not just the quickest to respond.
+/// Subclasses can override linkCost() to use other measures of link quality, such as RH_RF95::lastSNR().
+/// If the node has several interfaces (see RHRouter::addInterface()), requests are broadcast on all of them
+/// and the cost of each hop includes the cost of the interface it was heard on (RHRouter::setInterfaceCost()),
+/// so each route records the cheapest interface to reach its destination.
+/// Note that the expanding ring search accepts routes from the first ring that reaches the destination,
+/// so a better route with more hops than that ring is only found if RH_MESH_DISCOVERY_INITIAL_TTL is 
+/// defined large enough to reach it.
+///
+/// By default sendtoWait() blocks for up to RH_MESH_ARP_TIMEOUT (or the time set by setArpTimeout()) 
+/// while discovering a route. If you call setAsyncDiscovery(true), sendtoWait() instead queues the message 
+/// (up to RH_MESH_QUEUE_SIZE messages) and returns RH_ROUTER_ERROR_QUEUED immediately. The message is sent 
+/// when the route is discovered, or discarded if discovery fails. Discovery proceeds while you call
+/// recvfromAck(), recvfromAckTimeout() or pollDiscovery(). 
 /// When a node receives a RH_MESH_MESSAGE_TYPE_ROUTE_DISCOVERY_REQUEST it can use the list of 
 /// nodes aready visited to deduce routes back towards the originating (requesting node). 
 /// This also means that when the destination node of the request is reached, it (and all 
@@ -132,13 +227,19 @@ public:
 	uint8_t             data[RH_MESH_MAX_MESSAGE_LEN]; ///< Application layer payload data
     } MeshApplicationMessage;
 
+    /// Length of the fixed part of a MeshRouteDiscoveryMessage, before the route
+    #define RH_MESH_DISCOVERY_HEADER_LEN (sizeof(RHMesh::MeshMessageHeader) + 5)
+
     /// Signals a route discovery request or reply (At present only supports physical dest addresses of length 1 octet)
     typedef struct
     {
 	MeshMessageHeader   header;  ///< msgType = RH_MESH_MESSAGE_TYPE_ROUTE_DISCOVERY_*
 	uint8_t             destlen; ///< Reserved. Must be 1
 	uint8_t             dest;    ///< The address of the destination node whose route is being sought
-	uint8_t             route[RH_MESH_MAX_MESSAGE_LEN - 2]; ///< List of node addresses visited so far. Length is implcit
+	uint8_t             id;      ///< Request ID assigned by the originator
+	uint8_t             ttl;     ///< Number of hops the request may still travel
+	uint8_t             metric;  ///< Cost of the path travelled so far
+	uint8_t             route[RH_MESH_MAX_MESSAGE_LEN - 5]; ///< List of node addresses visited so far. Length is implcit
     } MeshRouteDiscoveryMessage;
 
     /// Signals a route failure
@@ -153,6 +254,12 @@ public:
     /// \param[in] thisAddress The address to assign to this node. Defaults to 0
     RHMesh(RHGenericDriver& driver, uint8_t thisAddress = 0);
 
+    /// Initialises this instance and the radio module connected to it.
+    /// Overrides the init() function in RHRouter.
+    /// Starts the route discovery request IDs at a random value, so that after a restart this node's
+    /// requests are not mistaken for ones that other nodes have already seen. Call randomSeed() first
+    bool init();
+
     /// Sends a message to the destination node. Initialises the RHRouter message header 
     /// (the SOURCE address is set to the address of this node, HOPS to 0) and calls 
     /// route() which looks up in the routing table the next hop to deliver to.
@@ -169,11 +276,53 @@ public:
     /// \return The result code:
     ///         - RH_ROUTER_ERROR_NONE Message was routed and delivered to the next hop 
     ///           (not necessarily to the final dest address)
-    ///         - RH_ROUTER_ERROR_NO_ROUTE There was no route for dest in the local routing table
+    ///         - RH_ROUTER_ERROR_NO_ROUTE There was no route for dest in the local routing table,
+    ///           and none could be discovered (or, with asynchronous discovery, the queue is full)
     ///         - RH_ROUTER_ERROR_UNABLE_TO_DELIVER Not able to deliver to the next hop 
     ///           (usually because it dod not acknowledge due to being off the air or out of range
+    ///         - RH_ROUTER_ERROR_QUEUED Asynchronous discovery is enabled, and the message has been queued
+    ///           until a route is discovered
     uint8_t sendtoWait(uint8_t* buf, uint8_t len, uint8_t dest, uint8_t flags = 0);
 
+    /// Returns the location of the application payload in the transmit buffer. If the message passed 
+    /// to sendtoWait() is already there, the mesh and router headers are added in place and it is
+    /// sent without being copied. Its contents are undefined after sendtoWait().
+    /// \return Pointer to room for up to RH_MESH_MAX_MESSAGE_LEN octets
+    uint8_t* txBuffer();
+
+    /// Sets how long sendtoWait() will block while discovering a route, when asynchronous 
+    /// discovery is not enabled. Defaults to RH_MESH_ARP_TIMEOUT.
+    /// \param[in] timeout The maximum time in milliseconds
+    void setArpTimeout(uint16_t timeout);
+
+    /// Enables or disables asynchronous route discovery. When enabled, sendtoWait() does not block
+    /// if there is no route to the destination, but queues the message until the route is discovered.
+    /// Disabled by default.
+    /// \param[in] async true to enable asynchronous route discovery
+    void setAsyncDiscovery(bool async);
+
+    /// Advances any route discoveries in progress: repeats requests that have timed out with a larger TTL,
+    /// fails discoveries that have reached max_hops, and sends queued messages whose routes have 
+    /// been discovered. Repeated requests wait for the airtime budget of the driver, if it has one. Called automatically by recvfromAck() and recvfromAckTimeout().
+    void pollDiscovery();
+
+    /// Tests whether a route discovery is in progress for a destination
+    /// \param[in] dest The destination address
+    /// \return true if a route to dest is being discovered
+    bool isDiscovering(uint8_t dest);
+
+    /// Takes a snapshot of the statistics of this mesh: route discoveries started, resolved and failed,
+    /// how long they took, and the number of messages waiting for them
+    /// \param[out] stats The snapshot
+    void meshStats(RHMeshStats* stats);
+
+    /// Resets the statistics of this mesh, and of the router, interfaces and drivers below it
+    virtual void resetStats();
+
+    /// Writes the statistics of the layers below, then the meshStats() as an RH_STATS_MESH section
+    /// \param[in] writer Where to write them
+    virtual void writeStats(RHStatsWriter& writer);
+
     /// Starts the receiver if it is not running already, processes and possibly routes any received messages
     /// addressed to other nodes
     /// and delivers any messages addressed to this node.
@@ -198,6 +347,17 @@ public:
     /// \return true if a valid message was received for this node and copied to buf
     bool recvfromAck(uint8_t* buf, uint8_t* len, uint8_t* source = NULL, uint8_t* dest = NULL, uint8_t* id = NULL, uint8_t* flags = NULL);
 
+    /// Like recvfromAck(), but instead of copying the application message, sets *buf to point at it 
+    /// in the receive buffer. It remains valid until the next call to a receive function.
+    /// \param[out] buf Set to the location of the received message
+    /// \param[out] len Set to the length of the received message
+    /// \param[in] source If present and not NULL, the referenced uint8_t will be set to the SOURCE address
+    /// \param[in] dest If present and not NULL, the referenced uint8_t will be set to the DEST address
+    /// \param[in] id If present and not NULL, the referenced uint8_t will be set to the ID
+    /// \param[in] flags If present and not NULL, the referenced uint8_t will be set to the FLAGS
+    /// \return true if a valid application layer message was received for this node
+    bool recvfromAckInPlace(uint8_t** buf, uint8_t* len, uint8_t* source = NULL, uint8_t* dest = NULL, uint8_t* id = NULL, uint8_t* flags = NULL);
+
     /// Starts the receiver if it is not running already.
     /// Similar to recvfromAck(), this will block until either a valid application layer 
     /// message available for this node
@@ -229,7 +389,7 @@ protected:
     virtual uint8_t route(RoutedMessage* message, uint8_t messageLen);
 
     /// Try to resolve a route for the given address. Blocks while discovering the route
-    /// which may take up to 4000 msec.
+    /// which may take up to RH_MESH_ARP_TIMEOUT msec (see setArpTimeout()).
     /// Virtual so subclasses can override.
     /// \param [in] address The physical address to resolve
     /// \return true if the address was resolved and added to the local routing table
@@ -247,9 +407,127 @@ protected:
     /// \return true if the physical address of this node is identical to address
     virtual bool isPhysicalAddress(uint8_t* address, uint8_t addresslen);
 
+    /// Starts route discovery for a destination, or finds the one already in progress.
+    /// \param [in] address The destination address
+    /// \param [in] limit The time in milliseconds the whole discovery may take, or 0 for no limit. The expanding
+    /// ring search is fitted into it, ending with a request to max_hops. Ignored if a discovery is already in progress
+    /// \return true if a discovery is in progress, false if one could not be started because 
+    /// a recent discovery for address failed, or too many are in progress
+    bool startDiscovery(uint8_t address, uint16_t limit = 0);
+
+    /// Returns the cost of the link the most recently received message arrived on.
+    /// The default is RH_MESH_HOP_COST plus the cost of the interface it arrived on, plus a 
+    /// penalty based on the lastRssi() of that interface's driver.
+    /// Virtual so subclasses can use other measures of link quality.
+    /// \return The cost of the link, from 1 to 254
+    virtual uint8_t linkCost();
+
 private:
-    /// Temporary message buffer
-    static uint8_t _tmpMessage[RH_ROUTER_MAX_MESSAGE_LEN];
+    /// States of a route discovery
+    typedef enum
+    {
+	DiscoveryFree = 0,     ///< Not in use
+	DiscoveryActive,       ///< Waiting for a response
+	DiscoveryResolved,     ///< A response has been received
+	DiscoveryFailed        ///< No response. No new discovery until RH_MESH_DISCOVERY_HOLDOFF has passed
+    } DiscoveryState;
+
+    /// A route discovery in progress (or recently failed)
+    typedef struct
+    {
+	uint8_t       state;    ///< One of DiscoveryState
+	uint8_t       dest;     ///< The destination whose route is being discovered
+	uint8_t       id;       ///< ID of the most recent request
+	uint8_t       ttl;      ///< TTL of the most recent request
+	uint16_t      limit;    ///< Time allowed for the whole discovery in milliseconds, 0 for no limit
+	unsigned long started;  ///< millis() when the most recent request was sent, or when it failed
+	unsigned long begun;    ///< millis() when the first request was sent
+    } Discovery;
+
+    /// A route discovery request seen recently
+    typedef struct
+    {
+	uint8_t       valid;    ///< true if this entry is in use
+	uint8_t       source;   ///< Originator of the request
+	uint8_t       id;       ///< ID of the request
+	uint8_t       metric;   ///< Best cost back to the originator seen for this request
+	unsigned long heard;    ///< millis() when the request was first seen
+    } SeenRequest;
+
+    /// An application message waiting for route discovery
+    typedef struct
+    {
+	uint8_t       valid;    ///< true if this entry is in use
+	uint8_t       dest;     ///< Destination address
+	uint8_t       flags;    ///< Flags to send with it
+	uint8_t       len;      ///< Length of the application payload
+	RoutedMessage message;  ///< The MeshApplicationMessage, with room for the router header, so it can be sent in place
+    } QueuedMessage;
+
+    /// A routed message just big enough for a route discovery request or route failure. These are built
+    /// on the stack so they do not disturb an application message in the transmit buffer
+    typedef struct
+    {
+	RoutedMessageHeader header;   ///< Router header
+	uint8_t             data[RH_MESH_DISCOVERY_HEADER_LEN]; ///< Mesh message
+    } MeshControlMessage;
+
+    /// Finds the route discovery for dest, in any state other than DiscoveryFree
+    Discovery* findDiscovery(uint8_t dest);
+
+    /// Broadcasts a route discovery request for a discovery
+    void sendDiscoveryRequest(Discovery* d);
+
+    /// Chooses the TTL of the next request of a discovery: ttl, or max_hops if a ring of ttl
+    /// could not finish within the time allowed for the discovery
+    uint8_t ringTtl(Discovery* d, uint8_t ttl);
+
+    /// Returns how long the most recent request of a discovery waits for a response: 
+    /// 2 * TTL * RH_MESH_DISCOVERY_HOP_TIMEOUT, or the time left for the discovery if that is less
+    unsigned long ringTimeout(Discovery* d);
+
+    /// Finds a route discovery request in the list of those seen recently. Requests are forgotten
+    /// after 2 * max_hops * RH_MESH_DISCOVERY_HOP_TIMEOUT, the longest that one can wait for a response
+    /// \return The entry, or NULL if it has not been seen
+    SeenRequest* findSeenRequest(uint8_t source, uint8_t id);
+
+    /// Remembers a route discovery request in place of the oldest one seen
+    void rememberRequest(uint8_t source, uint8_t id, uint8_t metric);
+
+    /// Returns how long until the airtime budget of some interface allows a broadcast (see
+    /// RHGenericDriver::setDutyCycle()). Route discovery requests are put off until then
+    /// \param[in] len Length of the mesh message, without the RHRouter header
+    /// \return The time to wait in milliseconds, 0 if it can be broadcast now
+    uint32_t broadcastDelay(uint8_t len);
+
+    /// Returns how long the caller may wait before pollDiscovery() needs to be called
+    /// \param[in] limit The most the caller intends to wait, in milliseconds
+    /// \return the lesser of limit and the time until the next route discovery timeout
+    uint16_t discoveryTimeLeft(uint16_t limit);
+
+    /// How long sendtoWait() blocks for route discovery, in milliseconds
+    uint16_t _arpTimeout;
+
+    /// Whether sendtoWait() queues messages instead of blocking for route discovery
+    bool _asyncDiscovery;
+
+    /// The last route discovery request ID used
+    uint8_t _lastDiscoveryId;
+
+    /// Route discoveries in progress
+    Discovery _discoveries[RH_MESH_MAX_DISCOVERIES];
+
+    /// Recently seen route discovery requests
+    SeenRequest _seenRequests[RH_MESH_SEEN_REQUESTS];
+
+    /// Index of the next entry in _seenRequests to replace
+    uint8_t _nextSeenRequest;
+
+    /// Messages waiting for route discovery
+    QueuedMessage _queue[RH_MESH_QUEUE_SIZE];
+
+    /// Statistics, apart from those measured when a snapshot is taken
+    RHMeshStats _meshStats;
 
 };
 
@@ -12,6 +12,7 @@
 // $Id: RHReliableDatagram.cpp,v 1.18 2018/11/08 02:31:43 mikem Exp $
 
 #include <RHReliableDatagram.h>
+#include <RHAdaptiveRate.h>
 
 ////////////////////////////////////////////////////////////////////
 // Constructors
@@ -22,7 +23,15 @@ RHReliableDatagram::RHReliableDatagram(RHGenericDriver& driver, uint8_t thisAddr
     _lastSequenceNumber = 0;
     _timeout = RH_DEFAULT_TIMEOUT;
     _retries = RH_DEFAULT_RETRIES;
-    memset(_seenIds, 0, sizeof(_seenIds));
+    clearSeenIds();
+    memset(_pending, 0, sizeof(_pending));
+    _sendCallback = NULL;
+    _adaptiveTimeout = true;
+    clearRttEstimates();
+    _ackDelay = 0;
+    memset(_heldAcks, 0, sizeof(_heldAcks));
+    _received.valid = false;
+    _stats = RHReliableStats();
 }
 
 ////////////////////////////////////////////////////////////////////
@@ -32,6 +41,188 @@ void RHReliableDatagram::setTimeout(uint16_t timeout)
     _timeout = timeout;
 }
 
+////////////////////////////////////////////////////////////////////
+void RHReliableDatagram::setAdaptiveTimeout(bool adaptive)
+{
+    _adaptiveTimeout = adaptive;
+}
+
+////////////////////////////////////////////////////////////////////
+bool RHReliableDatagram::rttEstimate(uint8_t address, uint16_t* srtt, uint16_t* rttvar)
+{
+    RttEstimate* e = findRtt(address);
+    if (!e)
+	return false;
+    if (srtt)   *srtt =   e->srtt8 >> 3;
+    if (rttvar) *rttvar = e->rttvar4 >> 2;
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////
+uint16_t RHReliableDatagram::timeoutFor(uint8_t address)
+{
+    RttEstimate* e;
+    if (!_adaptiveTimeout || !(e = findRtt(address)))
+	return _timeout;
+    uint32_t rto = (e->srtt8 >> 3) + e->rttvar4;
+    if (rto < RH_RELIABLE_MIN_TIMEOUT)
+	rto = RH_RELIABLE_MIN_TIMEOUT;
+    if (rto > RH_RELIABLE_MAX_TIMEOUT)
+	rto = RH_RELIABLE_MAX_TIMEOUT;
+    return rto;
+}
+
+////////////////////////////////////////////////////////////////////
+void RHReliableDatagram::clearRttEstimates()
+{
+    memset(_rtt, 0, sizeof(_rtt));
+}
+
+////////////////////////////////////////////////////////////////////
+RHReliableDatagram::RttEstimate* RHReliableDatagram::findRtt(uint8_t address)
+{
+    uint8_t i;
+    for (i = 0; i < RH_RELIABLE_RTT_PEERS; i++)
+	if (_rtt[i].valid && _rtt[i].address == address)
+	    return &_rtt[i];
+    return NULL;
+}
+
+////////////////////////////////////////////////////////////////////
+void RHReliableDatagram::updateRtt(uint8_t address, unsigned long rtt)
+{
+    RttEstimate* e = findRtt(address);
+    if (!e)
+    {
+	// New destination. Use an empty entry, or replace the least recently updated one
+	unsigned long now = millis();
+	uint8_t i;
+	e = &_rtt[0];
+	for (i = 0; i < RH_RELIABLE_RTT_PEERS; i++)
+	{
+	    if (!_rtt[i].valid)
+	    {
+		e = &_rtt[i];
+		break;
+	    }
+	    if ((now - _rtt[i].updated) > (now - e->updated))
+		e = &_rtt[i];
+	}
+	// First measurement: SRTT = R, RTTVAR = R/2
+	e->valid = true;
+	e->address = address;
+	e->srtt8 = rtt << 3;
+	e->rttvar4 = rtt << 1;
+    }
+    else
+    {
+	// RTTVAR = 3/4 RTTVAR + 1/4 |SRTT - R|, SRTT = 7/8 SRTT + 1/8 R
+	int32_t delta = (int32_t)rtt - (int32_t)(e->srtt8 >> 3);
+	e->srtt8 += delta;
+	if (delta < 0)
+	    delta = -delta;
+	e->rttvar4 += delta - (e->rttvar4 >> 2);
+    }
+    e->updated = millis();
+    _stats.ackRtt.add(rtt);
+}
+
+////////////////////////////////////////////////////////////////////
+void RHReliableDatagram::forgetRtt(uint8_t address)
+{
+    // Backed off through every retry without an ACK, so the estimate is probably wrong: the
+    // link may have slowed down. Only a message ACKed first time can measure it again, which
+    // may never happen if the timeout stays too short, so start again from the fixed timeout
+    RttEstimate* e = findRtt(address);
+    if (e)
+	e->valid = false;
+}
+
+////////////////////////////////////////////////////////////////////
+void RHReliableDatagram::clearSeenIds()
+{
+    memset(_seenIds, 0, sizeof(_seenIds));
+}
+
+////////////////////////////////////////////////////////////////////
+RHReliableDatagram::SeenWindow* RHReliableDatagram::findSeen(uint8_t from)
+{
+    uint8_t i;
+    for (i = 0; i < RH_RELIABLE_DEDUP_SOURCES; i++)
+	if (_seenIds[i].valid && _seenIds[i].source == from)
+	    return &_seenIds[i];
+    return NULL;
+}
+
+////////////////////////////////////////////////////////////////////
+bool RHReliableDatagram::isDuplicate(uint8_t from, uint8_t id, uint8_t flags)
+{
+    // A first transmission is new, even if the sender has used its ID before
+    if (RH_ENABLE_EXPLICIT_RETRY_DEDUP && !(flags & RH_FLAGS_RETRY))
+	return false;
+    SeenWindow* w = findSeen(from);
+    if (!w)
+	return false;
+    // How far behind the highest ID received is this one?
+    uint8_t behind = w->highest - id;
+    if (behind >= RH_RELIABLE_DEDUP_WINDOW)
+	return false; // Ahead of the window, or too old and the sender has probably restarted
+    return (w->seen >> behind) & 1;
+}
+
+////////////////////////////////////////////////////////////////////
+void RHReliableDatagram::markSeen(uint8_t from, uint8_t id, uint8_t flags)
+{
+    SeenWindow* w = findSeen(from);
+    if (!w)
+    {
+	// New source. Use an empty entry, or forget the least recently heard source
+	unsigned long now = millis();
+	uint8_t i;
+	w = &_seenIds[0];
+	for (i = 0; i < RH_RELIABLE_DEDUP_SOURCES; i++)
+	{
+	    if (!_seenIds[i].valid)
+	    {
+		w = &_seenIds[i];
+		break;
+	    }
+	    if ((now - _seenIds[i].heard) > (now - w->heard))
+		w = &_seenIds[i];
+	}
+	w->valid = true;
+	w->source = from;
+	w->highest = id;
+	w->seen = 0;
+    }
+
+    int8_t ahead = id - w->highest;
+    uint8_t behind = w->highest - id;
+    if (ahead > 0)
+    {
+	// Newer than anything so far. Slide the window forward
+	w->seen = ahead >= RH_RELIABLE_DEDUP_WINDOW ? 0 : w->seen << ahead;
+	w->highest = id;
+	w->seen |= 1;
+    }
+    else if (RH_ENABLE_EXPLICIT_RETRY_DEDUP && !(flags & RH_FLAGS_RETRY))
+    {
+	// A first transmission at or behind the highest: the sender has restarted its sequence
+	// numbers, so what we saw of the IDs after this one is stale
+	w->seen = behind < RH_RELIABLE_DEDUP_WINDOW ? (w->seen >> behind) | 1 : 1;
+	w->highest = id;
+    }
+    else if (behind < RH_RELIABLE_DEDUP_WINDOW)
+	w->seen |= (uint32_t)1 << behind;
+    else
+    {
+	// Far older than the window: the sender has probably restarted its sequence numbers
+	w->highest = id;
+	w->seen = 1;
+    }
+    w->heard = millis();
+}
+
 ////////////////////////////////////////////////////////////////////
 void RHReliableDatagram::setRetries(uint8_t retries)
 {
@@ -58,7 +249,7 @@ bool RHReliableDatagram::sendtoWait(uint8_t* buf, uint8_t len, uint8_t address)
         // initial send or a retry.
         uint8_t headerFlagsToSet = RH_FLAGS_NONE;
         // Always clear the ACK flag
-        uint8_t headerFlagsToClear = RH_FLAGS_ACK;
+        uint8_t headerFlagsToClear = RH_FLAGS_ACK | RH_FLAGS_ACKLIST;
         if (retries == 1) {
             // On an initial send, clear the RETRY flag in case
             // it was previously set
@@ -69,7 +260,14 @@ bool RHReliableDatagram::sendtoWait(uint8_t* buf, uint8_t len, uint8_t address)
         }
         setHeaderFlags(headerFlagsToSet, headerFlagsToClear);
 
-	sendto(buf, len, address);
+	// Keep to the airtime budget of the driver, if it has one
+	if (!waitCanSend(len))
+	{
+	    if (retries == 1)
+		return false; // Nothing was sent
+	    break;
+	}
+	sendtoWithAcks(buf, len, address);
 	waitPacketSent();
 
 	// Never wait for ACKS to broadcasts:
@@ -78,40 +276,83 @@ bool RHReliableDatagram::sendtoWait(uint8_t* buf, uint8_t len, uint8_t address)
 
 	if (retries > 1)
 	    _retransmissions++;
+	else
+	    _stats.sent++;
 	unsigned long thisSendTime = millis(); // Timeout does not include original transmit time
 
-	// Compute a new timeout, random between _timeout and _timeout*2
-	// This is to prevent collisions on every retransmit
-	// if 2 nodes try to transmit at the same time
-#if (RH_PLATFORM == RH_PLATFORM_RASPI) // use standard library random(), bugs in random(min, max)
-	uint16_t timeout = _timeout + (_timeout * (random() & 0xFF) / 256);
-#else
-	uint16_t timeout = _timeout + (_timeout * random(0, 256) / 256);
-#endif
+	uint16_t timeout = retransmitTimeout(address, retries, len);
 	int32_t timeLeft;
         while ((timeLeft = timeout - (millis() - thisSendTime)) > 0)
 	{
-	    if (waitAvailableTimeout(timeLeft))
+	    // Not our own waitAvailableTimeout(), which would return at once while a message is kept
+	    if (RHDatagram::waitAvailableTimeout(timeLeft))
 	    {
 		uint8_t from, to, id, flags;
-		if (recvfrom(0, 0, &from, &to, &id, &flags)) // Discards the message
+		uint8_t message[RH_MAX_MESSAGE_LEN];
+		uint8_t messageLen = sizeof(message);
+		if (recvfrom(message, &messageLen, &from, &to, &id, &flags))
 		{
-		    // Now have a message: is it our ACK?
-		    if (   from == address 
-			   && to == _thisAddress 
-			   && (flags & RH_FLAGS_ACK) 
-			   && (id == thisSequenceNumber))
+		    // Now have a message: is it our ACK, or does it carry our ACK?
+		    bool acked = false;
+		    uint8_t ackListLen = 0;
+		    if (to == _thisAddress)
 		    {
-			// Its the ACK we are waiting for
-			return true;
+			if (from == address)
+			{
+			    if (flags & RH_FLAGS_ACKLIST)
+			    {
+				uint8_t i;
+				for (i = 1; i < messageLen && i <= message[0]; i++)
+				    if (message[i] == thisSequenceNumber)
+					acked = true;
+			    }
+			    else
+				acked = (flags & RH_FLAGS_ACK) && (id == thisSequenceNumber);
+			}
+			// Maybe ACKs for messages sent by sendtoAsync() too
+			ackListLen = handleAcks(from, id, flags, message, messageLen);
+		    }
+		    else if ((flags & RH_FLAGS_ACKLIST) && messageLen)
+			ackListLen = 1 + message[0];
+		    if (!(flags & RH_FLAGS_ACK))
+		    {
+			if (isDuplicate(from, id, flags))
+			{
+			    // We have already received this one. If it was sent to us, ACK it again
+			    _stats.duplicates++;
+			    if (to == _thisAddress)
+				acknowledge(id, from);
+			}
+			else if (!_received.valid)
+			{
+			    // Keep it for recvfromAck(). It may be the reply that carried our ACK.
+			    // It is acknowledged and marked as seen now, so the sender stops retrying,
+			    // and any retry that crossed our ACK is known as a duplicate.
+			    // If one is already kept, ignore this one, and the sender will retry
+			    markSeen(from, id, flags);
+			    if (to == _thisAddress)
+				acknowledgeReceived(id, from, flags);
+			    if (ackListLen > messageLen)
+				ackListLen = messageLen;
+			    _received.valid = true;
+			    _received.from = from;
+			    _received.to = to;
+			    _received.id = id;
+			    _received.flags = flags & ~RH_FLAGS_ACKLIST;
+			    _received.len = messageLen - ackListLen;
+			    memcpy(_received.data, message + ackListLen, _received.len);
+			}
 		    }
-		    else if (   !(flags & RH_FLAGS_ACK)
-				&& (id == _seenIds[from]))
+		    if (acked)
 		    {
-			// This is a request we have already received. ACK it again
-			acknowledge(id, from);
+			// Its the ACK we are waiting for. Only measure the round trip time
+			// if it was not retransmitted, since we cant tell which one was ACKed
+			if (retries == 1)
+			    updateRtt(address, millis() - thisSendTime);
+			_stats.acksReceived++;
+			countCompletion(retries, true);
+			return true;
 		    }
-		    // Else discard it
 		}
 	    }
 	    // Not the one we are waiting for, maybe keep waiting until timeout exhausted
@@ -121,9 +362,275 @@ bool RHReliableDatagram::sendtoWait(uint8_t* buf, uint8_t len, uint8_t address)
 	YIELD;
     }
     // Retries exhausted
+    countCompletion(retries - 1, false);
+    forgetRtt(address);
+    if (_adaptiveRate)
+	_adaptiveRate->linkFailed(address);
     return false;
 }
 
+////////////////////////////////////////////////////////////////////
+uint8_t RHReliableDatagram::sendtoAsync(uint8_t* buf, uint8_t len, uint8_t address)
+{
+    if (len > _driver.maxMessageLength())
+	return RH_RELIABLE_HANDLE_NONE;
+
+    // Broadcasts are never acknowledged, so just send them
+    if (address == RH_BROADCAST_ADDRESS)
+    {
+	uint8_t id = ++_lastSequenceNumber;
+	setHeaderId(id);
+	setHeaderFlags(RH_FLAGS_NONE, RH_FLAGS_ACK | RH_FLAGS_RETRY | RH_FLAGS_ACKLIST);
+	return sendto(buf, len, address) ? id : RH_RELIABLE_HANDLE_NONE;
+    }
+
+    if (pending(address) >= RH_RELIABLE_WINDOW)
+	return RH_RELIABLE_HANDLE_NONE;
+
+    // Find a free slot, or failing that one whose result was never collected
+    PendingMessage* p = NULL;
+    uint8_t i;
+    for (i = 0; i < RH_RELIABLE_MAX_PENDING; i++)
+    {
+	if (_pending[i].status == RH_RELIABLE_STATUS_UNKNOWN)
+	{
+	    p = &_pending[i];
+	    break;
+	}
+	if (!p && _pending[i].status != RH_RELIABLE_STATUS_PENDING)
+	    p = &_pending[i];
+    }
+    if (!p)
+	return RH_RELIABLE_HANDLE_NONE;
+
+    // The ID is also the handle, so it must not be RH_RELIABLE_HANDLE_NONE
+    // or the same as another message still in flight
+    uint8_t id;
+    do
+    {
+	id = ++_lastSequenceNumber;
+	for (i = 0; i < RH_RELIABLE_MAX_PENDING; i++)
+	    if (_pending[i].status == RH_RELIABLE_STATUS_PENDING && _pending[i].id == id)
+		break;
+    } while (id == RH_RELIABLE_HANDLE_NONE || i < RH_RELIABLE_MAX_PENDING);
+
+    // A result never collected for an earlier message with this ID is lost now, or sendStatus()
+    // could return it for this one
+    for (i = 0; i < RH_RELIABLE_MAX_PENDING; i++)
+	if (_pending[i].status != RH_RELIABLE_STATUS_PENDING && _pending[i].id == id)
+	    _pending[i].status = RH_RELIABLE_STATUS_UNKNOWN;
+
+    p->status = RH_RELIABLE_STATUS_PENDING;
+    p->address = address;
+    p->id = id;
+    p->tries = 0;
+    p->len = len;
+    memcpy(p->data, buf, len);
+    if (_driver.canSend(len))
+	transmitPending(p);
+    else
+	deferPending(p); // pollPending() sends it when the airtime budget allows
+    _stats.sent++;
+    uint8_t depth = pending();
+    if (depth > _stats.pendingMax)
+	_stats.pendingMax = depth;
+    return id;
+}
+
+////////////////////////////////////////////////////////////////////
+uint8_t RHReliableDatagram::sendStatus(uint8_t handle)
+{
+    uint8_t i;
+    for (i = 0; i < RH_RELIABLE_MAX_PENDING; i++)
+    {
+	if (_pending[i].status != RH_RELIABLE_STATUS_UNKNOWN && _pending[i].id == handle)
+	{
+	    uint8_t status = _pending[i].status;
+	    if (status != RH_RELIABLE_STATUS_PENDING)
+		_pending[i].status = RH_RELIABLE_STATUS_UNKNOWN; // Collected, release it
+	    return status;
+	}
+    }
+    return RH_RELIABLE_STATUS_UNKNOWN;
+}
+
+////////////////////////////////////////////////////////////////////
+void RHReliableDatagram::setSendCallback(SendCallback callback)
+{
+    _sendCallback = callback;
+}
+
+////////////////////////////////////////////////////////////////////
+uint8_t RHReliableDatagram::pending(uint8_t address)
+{
+    uint8_t count = 0;
+    uint8_t i;
+    for (i = 0; i < RH_RELIABLE_MAX_PENDING; i++)
+	if (   _pending[i].status == RH_RELIABLE_STATUS_PENDING
+	    && (address == RH_BROADCAST_ADDRESS || _pending[i].address == address))
+	    count++;
+    return count;
+}
+
+////////////////////////////////////////////////////////////////////
+void RHReliableDatagram::pollPending()
+{
+    uint8_t i;
+    // Send any acknowledgements that have been held long enough
+    for (i = 0; i < RH_RELIABLE_ACK_PEERS; i++)
+	if (_heldAcks[i].valid && (millis() - _heldAcks[i].since) >= _ackDelay)
+	    sendHeldAcks(&_heldAcks[i]);
+
+    for (i = 0; i < RH_RELIABLE_MAX_PENDING; i++)
+    {
+	PendingMessage* p = &_pending[i];
+	if (   p->status != RH_RELIABLE_STATUS_PENDING
+	    || (millis() - p->sentAt) < p->timeout)
+	    continue;
+
+	if (p->tries > _retries)
+	    completePending(p, false); // Retries exhausted
+	else if (!_driver.canSend(p->len))
+	    deferPending(p); // Does not use up a retry
+	else
+	{
+	    if (p->tries)
+		_retransmissions++;
+	    transmitPending(p);
+	}
+    }
+}
+
+////////////////////////////////////////////////////////////////////
+bool RHReliableDatagram::available()
+{
+    pollPending();
+    return _received.valid || RHDatagram::available();
+}
+
+////////////////////////////////////////////////////////////////////
+bool RHReliableDatagram::waitAvailableTimeout(uint16_t timeout)
+{
+    if (_received.valid)
+	return true;
+    return RHDatagram::waitAvailableTimeout(timeout);
+}
+
+////////////////////////////////////////////////////////////////////
+bool RHReliableDatagram::takeReceived(uint8_t* buf, uint8_t* len, uint8_t* from, uint8_t* to, uint8_t* id, uint8_t* flags)
+{
+    if (*len > _received.len)
+	*len = _received.len;
+    memcpy(buf, _received.data, *len);
+    if (from)  *from =  _received.from;
+    if (to)    *to =    _received.to;
+    if (id)    *id =    _received.id;
+    if (flags) *flags = _received.flags;
+    _received.valid = false;
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////
+bool RHReliableDatagram::handleAck(uint8_t from, uint8_t id)
+{
+    uint8_t i;
+    for (i = 0; i < RH_RELIABLE_MAX_PENDING; i++)
+    {
+	PendingMessage* p = &_pending[i];
+	if (p->status == RH_RELIABLE_STATUS_PENDING && p->address == from && p->id == id)
+	{
+	    if (p->tries == 1)
+		updateRtt(from, millis() - p->sentAt);
+	    _stats.acksReceived++;
+	    completePending(p, true);
+	    return true;
+	}
+    }
+    return false;
+}
+
+////////////////////////////////////////////////////////////////////
+void RHReliableDatagram::transmitPending(PendingMessage* p)
+{
+    setHeaderId(p->id);
+    // Always clear the ACK flag, and set the RETRY flag on all but the first transmission
+    if (p->tries == 0)
+	setHeaderFlags(RH_FLAGS_NONE, RH_FLAGS_ACK | RH_FLAGS_RETRY | RH_FLAGS_ACKLIST);
+    else
+	setHeaderFlags(RH_FLAGS_RETRY, RH_FLAGS_ACK | RH_FLAGS_ACKLIST);
+    sendtoWithAcks(p->data, p->len, p->address);
+    p->tries++;
+    p->sentAt = millis();
+    p->timeout = retransmitTimeout(p->address, p->tries, p->len);
+}
+
+////////////////////////////////////////////////////////////////////
+void RHReliableDatagram::deferPending(PendingMessage* p)
+{
+    uint32_t wait = _driver.timeUntilSend(p->len);
+    p->sentAt = millis();
+    p->timeout = wait > 0xffff ? 0xffff : wait;
+}
+
+////////////////////////////////////////////////////////////////////
+bool RHReliableDatagram::waitCanSend(uint8_t len)
+{
+    uint32_t wait = _driver.timeUntilSend(len);
+    if (wait > RH_RELIABLE_MAX_SEND_WAIT)
+	return false;
+    if (wait)
+	delay(wait);
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////
+void RHReliableDatagram::completePending(PendingMessage* p, bool delivered)
+{
+    p->status = delivered ? RH_RELIABLE_STATUS_DELIVERED : RH_RELIABLE_STATUS_FAILED;
+    countCompletion(p->tries, delivered);
+    if (!delivered)
+	forgetRtt(p->address);
+    if (_adaptiveRate && !delivered)
+	_adaptiveRate->linkFailed(p->address);
+    if (_sendCallback)
+    {
+	// Reported, so there is nothing to collect
+	p->status = RH_RELIABLE_STATUS_UNKNOWN;
+	_sendCallback(p->id, p->address, delivered);
+    }
+}
+
+////////////////////////////////////////////////////////////////////
+uint16_t RHReliableDatagram::retransmitTimeout(uint8_t address, uint8_t tries, uint8_t len)
+{
+#if (RH_PLATFORM == RH_PLATFORM_RASPI) // use standard library random(), bugs in random(min, max)
+    uint32_t r = random() & 0xFF;
+#else
+    uint32_t r = random(0, 256);
+#endif
+    if (!_adaptiveTimeout)
+    {
+	// Compute a new timeout, random between _timeout and _timeout*2
+	// This is to prevent collisions on every retransmit
+	// if 2 nodes try to transmit at the same time
+	return _timeout + (_timeout * r / 256);
+    }
+
+    // Never less than the message and its ACK take on air at the current rate, which may be
+    // slower than when the estimate was made
+    uint32_t timeout = timeoutFor(address);
+    uint32_t airtime = (_driver.timeOnAir(len) + _driver.timeOnAir(1)) / 1000 + RH_RELIABLE_MIN_TIMEOUT;
+    if (timeout < airtime)
+	timeout = airtime;
+    // Exponential backoff on each retry, plus up to 25% jitter
+    while (--tries > 0 && timeout < RH_RELIABLE_MAX_TIMEOUT)
+	timeout <<= 1;
+    if (timeout > RH_RELIABLE_MAX_TIMEOUT)
+	timeout = RH_RELIABLE_MAX_TIMEOUT;
+    timeout += timeout * r / 1024;
+    return timeout > 0xffff ? 0xffff : timeout;
+}
+
 ////////////////////////////////////////////////////////////////////
 bool RHReliableDatagram::recvfromAck(uint8_t* buf, uint8_t* len, uint8_t* from, uint8_t* to, uint8_t* id, uint8_t* flags)
 {  
@@ -131,9 +638,31 @@ bool RHReliableDatagram::recvfromAck(uint8_t* buf, uint8_t* len, uint8_t* from,
     uint8_t _to;
     uint8_t _id;
     uint8_t _flags;
+    uint8_t bufLen = *len;
+    // A message kept by sendtoWait() comes first. It has been acknowledged, marked as seen
+    // and had its ACK list dealt with already
+    if (_received.valid)
+    {
+	pollPending();
+	return takeReceived(buf, len, from, to, id, flags);
+    }
     // Get the message before its clobbered by the ACK (shared rx and tx buffer in some drivers
     if (available() && recvfrom(buf, len, &_from, &_to, &_id, &_flags))
     {
+	// Consume any ACKs it carries, and remove any ACK list from the start of the payload
+	uint8_t ackListLen = 0;
+	if (_to == _thisAddress)
+	    ackListLen = handleAcks(_from, _id, _flags, buf, *len);
+	else if ((_flags & RH_FLAGS_ACKLIST) && *len)
+	    ackListLen = 1 + buf[0];
+	if (ackListLen && !(_flags & RH_FLAGS_ACK))
+	{
+	    if (ackListLen > *len)
+		ackListLen = *len;
+	    *len -= ackListLen;
+	    memmove(buf, buf + ackListLen, *len);
+	}
+
 	// Never ACK an ACK
 	if (!(_flags & RH_FLAGS_ACK))
 	{
@@ -142,8 +671,8 @@ bool RHReliableDatagram::recvfromAck(uint8_t* buf, uint8_t* len, uint8_t* from,
 	    {
 	        // Its for this node and
 		// Its not a broadcast, so ACK it
-		// Acknowledge message with ACK set in flags and ID set to received ID
-		acknowledge(_id, _from);
+		// Acknowledge message with ACK set in flags and ID set to received ID.
+		acknowledgeReceived(_id, _from, _flags);
 	    }
             // Filter out retried messages that we have seen before. This explicitly
             // only filters out messages that are marked as retries to protect against
@@ -151,19 +680,21 @@ bool RHReliableDatagram::recvfromAck(uint8_t* buf, uint8_t* len, uint8_t* from,
             // shuts down between transmissions. Devices that do this will report the
             // the same ID each time since their internal sequence number will reset
             // to zero each time the device starts up.
-	    if ((RH_ENABLE_EXPLICIT_RETRY_DEDUP && !(_flags & RH_FLAGS_RETRY)) || _id != _seenIds[_from])
+	    if (!isDuplicate(_from, _id, _flags))
 	    {
 		if (from)  *from =  _from;
 		if (to)    *to =    _to;
 		if (id)    *id =    _id;
 		if (flags) *flags = _flags;
-		_seenIds[_from] = _id;
+		markSeen(_from, _id, _flags);
 		return true;
 	    }
 	    // Else just re-ack it and wait for a new one
+	    _stats.duplicates++;
 	}
     }
-    // No message for us available
+    // No message for us available. Leave the available space unchanged for the next try
+    *len = bufLen;
     return false;
 }
 
@@ -173,16 +704,46 @@ bool RHReliableDatagram::recvfromAckTimeout(uint8_t* buf, uint8_t* len, uint16_t
     int32_t timeLeft;
     while ((timeLeft = timeout - (millis() - starttime)) > 0)
     {
-	if (waitAvailableTimeout(timeLeft))
+	// Dont wait past the next retransmission due for a message sent with sendtoAsync()
+	if (waitAvailableTimeout(pendingTimeLeft(timeLeft)))
 	{
 	    if (recvfromAck(buf, len, from, to, id, flags))
 		return true;
 	}
+	else
+	    pollPending();
 	YIELD;
     }
     return false;
 }
 
+////////////////////////////////////////////////////////////////////
+uint16_t RHReliableDatagram::pendingTimeLeft(uint16_t limit)
+{
+    unsigned long now = millis();
+    uint8_t i;
+    for (i = 0; i < RH_RELIABLE_MAX_PENDING; i++)
+    {
+	if (_pending[i].status != RH_RELIABLE_STATUS_PENDING)
+	    continue;
+	unsigned long elapsed = now - _pending[i].sentAt;
+	uint16_t left = elapsed < _pending[i].timeout ? _pending[i].timeout - elapsed : 1;
+	if (left < limit)
+	    limit = left;
+    }
+    // Or past the time to send held acknowledgements
+    for (i = 0; i < RH_RELIABLE_ACK_PEERS; i++)
+    {
+	if (!_heldAcks[i].valid)
+	    continue;
+	unsigned long elapsed = now - _heldAcks[i].since;
+	uint16_t left = elapsed < _ackDelay ? _ackDelay - elapsed : 1;
+	if (left < limit)
+	    limit = left;
+    }
+    return limit;
+}
+
 uint32_t RHReliableDatagram::retransmissions()
 {
     return _retransmissions;
@@ -192,11 +753,80 @@ void RHReliableDatagram::resetRetransmissions()
 {
     _retransmissions = 0;
 }
+
+////////////////////////////////////////////////////////////////////
+void RHReliableDatagram::countCompletion(uint8_t tries, bool delivered)
+{
+    if (!delivered)
+    {
+	_stats.failed++;
+	return;
+    }
+    _stats.delivered++;
+    uint8_t retries = tries ? tries - 1 : 0;
+    if (retries >= RH_STATS_RETRY_BUCKETS)
+	retries = RH_STATS_RETRY_BUCKETS - 1;
+    if (_stats.retries[retries] != 0xffff)
+	_stats.retries[retries]++;
+}
+
+////////////////////////////////////////////////////////////////////
+void RHReliableDatagram::reliableStats(RHReliableStats* stats)
+{
+    *stats = _stats;
+    stats->retransmissions = _retransmissions;
+    stats->pending = pending();
+    stats->heldAcks = 0;
+    uint8_t i;
+    for (i = 0; i < RH_RELIABLE_ACK_PEERS; i++)
+	if (_heldAcks[i].valid)
+	    stats->heldAcks++;
+}
+
+////////////////////////////////////////////////////////////////////
+void RHReliableDatagram::resetStats()
+{
+    RHDatagram::resetStats();
+    _stats = RHReliableStats();
+    _retransmissions = 0;
+}
+
+////////////////////////////////////////////////////////////////////
+void RHReliableDatagram::writeStats(RHStatsWriter& writer)
+{
+    RHDatagram::writeStats(writer);
+    RHReliableStats stats;
+    reliableStats(&stats);
+    writer.beginSection(RH_STATS_RELIABLE);
+    writer.putVarint(stats.sent);
+    writer.putVarint(stats.delivered);
+    writer.putVarint(stats.failed);
+    writer.putVarint(stats.retransmissions);
+    writer.putVarint(stats.acksSent);
+    writer.putVarint(stats.acksReceived);
+    writer.putVarint(stats.duplicates);
+    writer.putVarint(stats.pending);
+    writer.putVarint(stats.pendingMax);
+    writer.putVarint(stats.heldAcks);
+    writer.putArray(stats.retries, RH_STATS_RETRY_BUCKETS);
+    writer.putHistogram(stats.ackRtt);
+    writer.endSection();
+}
  
 void RHReliableDatagram::acknowledge(uint8_t id, uint8_t from)
 {
+    // If there are others being held for this node, send them all together
+    if (findHeldAcks(from))
+    {
+	holdAck(id, from);
+	HeldAcks* h = findHeldAcks(from);
+	if (h)
+	    sendHeldAcks(h);
+	return;
+    }
+
     setHeaderId(id);
-    setHeaderFlags(RH_FLAGS_ACK);
+    setHeaderFlags(RH_FLAGS_ACK, RH_FLAGS_ACKLIST);
     // We would prefer to send a zero length ACK,
     // but if an RH_RF22 receives a 0 length message with a CRC error, it will never receive
     // a 0 length message again, until its reset, which makes everything hang :-(
@@ -205,5 +835,140 @@ void RHReliableDatagram::acknowledge(uint8_t id, uint8_t from)
     uint8_t ack = '!';
     sendto(&ack, sizeof(ack), from); 
     waitPacketSent();
+    _stats.acksSent++;
+}
+
+
+////////////////////////////////////////////////////////////////////
+void RHReliableDatagram::acknowledgeReceived(uint8_t id, uint8_t from, uint8_t flags)
+{
+    // If ACKs are being delayed, hold it, unless the sender is already retrying
+    if (_ackDelay && !(flags & RH_FLAGS_RETRY))
+	holdAck(id, from);
+    else
+	acknowledge(id, from);
+}
+
+////////////////////////////////////////////////////////////////////
+void RHReliableDatagram::setAckDelay(uint16_t delay)
+{
+    _ackDelay = delay;
+    if (!_ackDelay)
+	flushAcks();
+}
+
+////////////////////////////////////////////////////////////////////
+void RHReliableDatagram::flushAcks()
+{
+    uint8_t i;
+    for (i = 0; i < RH_RELIABLE_ACK_PEERS; i++)
+	if (_heldAcks[i].valid)
+	    sendHeldAcks(&_heldAcks[i]);
+}
+
+////////////////////////////////////////////////////////////////////
+RHReliableDatagram::HeldAcks* RHReliableDatagram::findHeldAcks(uint8_t address)
+{
+    uint8_t i;
+    for (i = 0; i < RH_RELIABLE_ACK_PEERS; i++)
+	if (_heldAcks[i].valid && _heldAcks[i].address == address)
+	    return &_heldAcks[i];
+    return NULL;
+}
+
+////////////////////////////////////////////////////////////////////
+void RHReliableDatagram::holdAck(uint8_t id, uint8_t from)
+{
+    HeldAcks* h = findHeldAcks(from);
+    if (h && h->count >= RH_RELIABLE_MAX_ACKLIST)
+    {
+	// No more room for this node. Send what we have and start again
+	sendHeldAcks(h);
+	h = NULL;
+    }
+    if (!h)
+    {
+	// Use an empty entry, or send the ones held longest to make room
+	uint8_t i;
+	h = &_heldAcks[0];
+	for (i = 0; i < RH_RELIABLE_ACK_PEERS; i++)
+	{
+	    if (!_heldAcks[i].valid)
+	    {
+		h = &_heldAcks[i];
+		break;
+	    }
+	    if ((millis() - _heldAcks[i].since) > (millis() - h->since))
+		h = &_heldAcks[i];
+	}
+	if (h->valid)
+	    sendHeldAcks(h);
+	h->valid = true;
+	h->address = from;
+	h->count = 0;
+	h->since = millis();
+    }
+    uint8_t i;
+    for (i = 0; i < h->count; i++)
+	if (h->ids[i] == id)
+	    return; // Already held
+    h->ids[h->count++] = id;
+}
+
+////////////////////////////////////////////////////////////////////
+void RHReliableDatagram::sendHeldAcks(HeldAcks* h)
+{
+    uint8_t ack[1 + RH_RELIABLE_MAX_ACKLIST];
+    ack[0] = h->count;
+    memcpy(ack + 1, h->ids, h->count);
+    h->valid = false;
+
+    // The ID is the most recent one, so older receivers can still use it
+    setHeaderId(h->ids[h->count - 1]);
+    setHeaderFlags(RH_FLAGS_ACK | RH_FLAGS_ACKLIST);
+    sendto(ack, 1 + h->count, h->address);
+    waitPacketSent();
+    _stats.acksSent++;
+}
+
+////////////////////////////////////////////////////////////////////
+bool RHReliableDatagram::sendtoWithAcks(uint8_t* buf, uint8_t len, uint8_t address)
+{
+    HeldAcks* h = findHeldAcks(address);
+    if (!h || ((uint16_t)len + 1 + h->count) > _driver.maxMessageLength())
+	return sendto(buf, len, address);
+    return sendPiggybacked(h, buf, len, address);
+}
+
+////////////////////////////////////////////////////////////////////
+bool RHReliableDatagram::sendPiggybacked(HeldAcks* h, uint8_t* buf, uint8_t len, uint8_t address)
+{
+    uint8_t message[RH_MAX_MESSAGE_LEN];
+    message[0] = h->count;
+    memcpy(message + 1, h->ids, h->count);
+    memcpy(message + 1 + h->count, buf, len);
+    uint8_t messageLen = 1 + h->count + len;
+    h->valid = false;
+
+    setHeaderFlags(RH_FLAGS_ACKLIST);
+    bool ret = sendto(message, messageLen, address);
+    setHeaderFlags(RH_FLAGS_NONE, RH_FLAGS_ACKLIST);
+    return ret;
 }
 
+////////////////////////////////////////////////////////////////////
+uint8_t RHReliableDatagram::handleAcks(uint8_t from, uint8_t id, uint8_t flags, uint8_t* buf, uint8_t len)
+{
+    if (!(flags & RH_FLAGS_ACKLIST))
+    {
+	if (flags & RH_FLAGS_ACK)
+	    handleAck(from, id);
+	return 0;
+    }
+    if (len < 1)
+	return 0;
+    uint8_t i;
+    for (i = 1; i < len && i <= buf[0]; i++)
+	handleAck(from, buf[i]);
+    return 1 + buf[0];
+}
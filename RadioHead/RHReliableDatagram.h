@@ -15,19 +15,25 @@
 /// The retry bit in the header FLAGS. This indicates that the payload is a retry for a
 /// previously sent message.
 #define RH_FLAGS_RETRY 0x40
+/// The ACK list bit in the header FLAGS. This indicates that the payload starts with a list of the IDs 
+/// of messages being acknowledged to the recipient: 1 octet count followed by that many IDs.
+/// Used by delayed acknowledgements, see setAckDelay().
+#define RH_FLAGS_ACKLIST 0x20
 
-/// This macro enables enhanced message deduplication behavior. This currently defaults
-/// to 0 (off), but this may change to default to 1 (on) in future releases. Consumers who
-/// want to enable this behavior should override this macro in their code and set it to 1.
-/// It is most useful where a transmitter periodically wakes up and starts to transmit
-/// starting again from the first sequence number.
+/// This macro enables enhanced message deduplication behavior. It defaults to 1 (on), because
+/// the duplicate detection window would otherwise drop new messages from a transmitter that
+/// restarts its sequence numbers, for example after a reset or when it periodically wakes up
+/// and starts to transmit again from the first sequence number.
 ///
 /// Enhanced deduplication: Only messages containing the retry bit in the header
 /// FLAGS will be evaluated for deduplication. This ensures that only messages that are
-/// genuine retries will potentially be deduped. Note that this should not be enabled
-/// if you will receive messages from devices using older versions of this library that
-/// do not support the RETRY header. If you do, deduping of messages will be broken.
-#define RH_ENABLE_EXPLICIT_RETRY_DEDUP 0
+/// genuine retries will potentially be deduped. A message without the retry bit is always new, and
+/// restarts the window of IDs seen from its sender at its own ID. Define this as 0 before
+/// including this file if you will receive messages from devices using older versions of this library that
+/// do not support the RETRY header. If you do not, deduping of their messages will be broken.
+#ifndef RH_ENABLE_EXPLICIT_RETRY_DEDUP
+#define RH_ENABLE_EXPLICIT_RETRY_DEDUP 1
+#endif
 
 /// the default retry timeout in milliseconds
 #define RH_DEFAULT_TIMEOUT 200
@@ -35,6 +41,85 @@
 /// The default number of retries
 #define RH_DEFAULT_RETRIES 3
 
+/// The number of destination addresses for which round trip time estimates are kept.
+/// When more destinations are used, the least recently updated estimate is discarded.
+#ifndef RH_RELIABLE_RTT_PEERS
+ #if defined(__AVR__)
+  #define RH_RELIABLE_RTT_PEERS 4
+ #else
+  #define RH_RELIABLE_RTT_PEERS 16
+ #endif
+#endif
+
+/// The number of source addresses for which duplicate detection windows are kept.
+/// When messages arrive from more sources, the least recently heard source is forgotten.
+#ifndef RH_RELIABLE_DEDUP_SOURCES
+ #if defined(__AVR__)
+  #define RH_RELIABLE_DEDUP_SOURCES 8
+ #else
+  #define RH_RELIABLE_DEDUP_SOURCES 32
+ #endif
+#endif
+
+/// The number of sequence numbers, up to and including the highest seen, covered by the
+/// duplicate detection window for each source
+#define RH_RELIABLE_DEDUP_WINDOW 32
+
+/// The maximum number of acknowledgements that can be held for one address when delayed
+/// acknowledgements are enabled, and the maximum number carried in one message
+#ifndef RH_RELIABLE_MAX_ACKLIST
+#define RH_RELIABLE_MAX_ACKLIST 8
+#endif
+
+/// The number of addresses for which delayed acknowledgements can be held at the same time
+#ifndef RH_RELIABLE_ACK_PEERS
+ #if defined(__AVR__)
+  #define RH_RELIABLE_ACK_PEERS 2
+ #else
+  #define RH_RELIABLE_ACK_PEERS 4
+ #endif
+#endif
+
+/// Bounds in milliseconds for retransmit timeouts computed from round trip time estimates
+#ifndef RH_RELIABLE_MIN_TIMEOUT
+#define RH_RELIABLE_MIN_TIMEOUT 10
+#endif
+#ifndef RH_RELIABLE_MAX_TIMEOUT
+#define RH_RELIABLE_MAX_TIMEOUT 30000
+#endif
+
+/// The longest time in milliseconds sendtoWait() waits for the airtime budget of the driver
+/// (see RHGenericDriver::setDutyCycle()) before each transmission. If it would have to wait longer, it gives up
+#ifndef RH_RELIABLE_MAX_SEND_WAIT
+#define RH_RELIABLE_MAX_SEND_WAIT 60000
+#endif
+
+/// The maximum number of messages sent with sendtoAsync() that can be awaiting acknowledgement 
+/// at the same time. Each one holds a copy of the message, so this costs about 
+/// RH_MAX_MESSAGE_LEN octets of RAM each. May be overridden before including RHReliableDatagram.h
+#ifndef RH_RELIABLE_MAX_PENDING
+ #if defined(__AVR__)
+  #define RH_RELIABLE_MAX_PENDING 1
+ #else
+  #define RH_RELIABLE_MAX_PENDING 4
+ #endif
+#endif
+
+/// The maximum number of messages sent with sendtoAsync() that can be awaiting acknowledgement 
+/// from any one destination address
+#ifndef RH_RELIABLE_WINDOW
+#define RH_RELIABLE_WINDOW RH_RELIABLE_MAX_PENDING
+#endif
+
+/// Returned by sendtoAsync() if the message could not be queued
+#define RH_RELIABLE_HANDLE_NONE 0
+
+// Status of a message sent with sendtoAsync(), as returned by sendStatus()
+#define RH_RELIABLE_STATUS_UNKNOWN   0
+#define RH_RELIABLE_STATUS_PENDING   1
+#define RH_RELIABLE_STATUS_DELIVERED 2
+#define RH_RELIABLE_STATUS_FAILED    3
+
 /////////////////////////////////////////////////////////////////////
 /// \class RHReliableDatagram RHReliableDatagram.h <RHReliableDatagram.h>
 /// \brief RHDatagram subclass for sending addressed, acknowledged, retransmitted datagrams.
@@ -54,6 +139,22 @@
 /// The retransmit timeout is randomly varied between timeout and timeout*2 to prevent collisions on all
 /// retries when 2 nodes happen to start sending at the same time .
 ///
+/// \par Adaptive Timeouts
+///
+/// By default, RHReliableDatagram measures the round trip time from each transmission to its ACK 
+/// (ignoring retransmitted messages, whose ACKs are ambiguous), and keeps a smoothed round trip time 
+/// and round trip time variance for each destination address, in the same way as TCP (RFC 6298). 
+/// Once a destination has been measured, its retransmit timeout is the smoothed round trip time plus 
+/// 4 times the variance (between RH_RELIABLE_MIN_TIMEOUT and RH_RELIABLE_MAX_TIMEOUT), 
+/// plus up to 25% random jitter, instead of the fixed timeout set by setTimeout(). For drivers that 
+/// calculate timeOnAir(), it is never less than the time on air of the message and its ACK at the current 
+/// data rate, plus RH_RELIABLE_MIN_TIMEOUT. 
+/// The timeout is doubled on each retry. Destinations that have not been measured yet use the 
+/// fixed timeout, also doubled on each retry. When a message fails after every retry, the estimates 
+/// for its destination are discarded, so a link that has slowed down (for example after a change of 
+/// data rate) is measured again from the fixed timeout. 
+/// You can read the estimates with rttEstimate(), and disable this with setAdaptiveTimeout(false).
+///
 /// Each new message sent by sendtoWait() has its ID incremented.
 ///
 /// An ack consists of a message with:
@@ -84,6 +185,48 @@
 /// retransmit strategy and configuration lest they hang for a long time
 /// trying to reply to clients that are unreachable.
 ///
+/// \par Asynchronous Sending
+///
+/// sendtoAsync() queues a message and transmits it immediately, but returns without
+/// waiting for the acknowledgement. It returns a handle (the message ID) that identifies the message.
+/// Up to RH_RELIABLE_WINDOW messages to each destination (and RH_RELIABLE_MAX_PENDING in total)
+/// can be awaiting acknowledgement at the same time, so bursts of messages can be pipelined.
+/// Acknowledgements are matched, and unacknowledged messages retransmitted, whenever you call
+/// available(), recvfromAck(), recvfromAckTimeout() or pollPending(), so you must call one of them
+/// frequently in your main loop.
+/// When a message is acknowledged, or its retries are exhausted, the function set with 
+/// setSendCallback() is called. If there is no callback, you can poll the result with sendStatus().
+///
+/// \par Duplicate Detection
+///
+/// For each source address it hears from (up to RH_RELIABLE_DEDUP_SOURCES of them, forgetting the 
+/// least recently heard when full), RHReliableDatagram remembers the highest message ID received and which of the 
+/// RH_RELIABLE_DEDUP_WINDOW IDs before it have also been received. Messages can therefore arrive out of order 
+/// (for example when the sender has several messages in flight with sendtoAsync()) and still be delivered 
+/// exactly once. Duplicates are acknowledged again but not delivered. A message whose ID is older than 
+/// the window is assumed to come from a sender that has restarted, and restarts the window.
+/// With RH_ENABLE_EXPLICIT_RETRY_DEDUP (the default), only messages marked as retries can be duplicates, 
+/// and a first transmission restarts the window at its ID, so a sender that restarts is never ignored. 
+/// The cost is that if a first transmission overtakes another one, a retry of the later 
+/// one may be delivered twice.
+///
+/// \par Delayed Acknowledgements
+///
+/// By default every received message is acknowledged immediately with its own ACK message. 
+/// If you call setAckDelay() with a non-zero hold time, acknowledgements are held instead. 
+/// If a message is sent to the same node within the hold time, the held acknowledgements are carried
+/// at the start of its payload (marked with RH_FLAGS_ACKLIST), and no separate ACK is sent. 
+/// Otherwise, when the hold time expires, all the acknowledgements held for that node are sent together 
+/// in a single ACK message. Received messages marked as retries are always acknowledged immediately.
+/// This can save a great deal of airtime for request/response traffic.
+/// The hold time must be well below the retransmit timeout of the sending nodes, and 
+/// all nodes in the network must be running a version of RHReliableDatagram that understands
+/// RH_FLAGS_ACKLIST. Held acknowledgements are sent by available(), recvfromAck(), 
+/// recvfromAckTimeout() and pollPending(), so you must call one of them frequently.
+/// A message that arrives while sendtoWait() is waiting for its ACK (such as the reply that carries
+/// that ACK) is kept, and returned by the next recvfromAck(), which acknowledges it as usual.
+/// One message is kept: while it is uncollected, others are discarded and will be retransmitted by their sender.
+///
 /// Caution: if you have a radio network with a mixture of slow and fast
 /// processors and ReliableDatagrams, you may be affected by race conditions
 /// where the fast processor acknowledges a message before the sender is ready
@@ -93,6 +236,12 @@
 class RHReliableDatagram : public RHDatagram
 {
 public:
+    /// Type of the function called when a message sent with sendtoAsync() completes
+    /// \param[in] handle The handle returned by sendtoAsync() for the message
+    /// \param[in] address The address the message was sent to
+    /// \param[in] delivered true if the message was acknowledged, false if the retries were exhausted
+    typedef void (*SendCallback)(uint8_t handle, uint8_t address, bool delivered);
+
     /// Constructor. 
     /// \param[in] driver The RadioHead driver to use to transport messages.
     /// \param[in] thisAddress The address to assign to this node. Defaults to 0
@@ -107,9 +256,46 @@ public:
     /// Caution: if you are using slow packet rates and long packets 
     /// you may need to change the timeout for reliable operations.
     /// The actual timeout is randomly varied between timeout and timeout*2.
+    /// With adaptive timeouts enabled (the default), this is only used for destinations whose 
+    /// round trip time has not yet been measured.
     /// \param[in] timeout The new timeout period in milliseconds
     void setTimeout(uint16_t timeout);
 
+    /// Enables or disables adaptive, per destination retransmit timeouts computed from
+    /// measured round trip times. Enabled by default. When disabled, every retransmission uses the
+    /// fixed timeout set by setTimeout(), randomly varied between timeout and timeout*2.
+    /// \param[in] adaptive true to enable adaptive timeouts
+    void setAdaptiveTimeout(bool adaptive);
+
+    /// Returns the round trip time estimates for a destination address.
+    /// \param[in] address The destination address
+    /// \param[out] srtt If not NULL, set to the smoothed round trip time in milliseconds
+    /// \param[out] rttvar If not NULL, set to the round trip time variance in milliseconds
+    /// \return true if there is an estimate for address, false if it has not been measured yet
+    bool rttEstimate(uint8_t address, uint16_t* srtt = NULL, uint16_t* rttvar = NULL);
+
+    /// Returns the timeout that will be used for the first transmission of the next message to
+    /// address, before random jitter is added.
+    /// \param[in] address The destination address
+    /// \return The timeout in milliseconds
+    uint16_t timeoutFor(uint8_t address);
+
+    /// Discards all round trip time estimates
+    void clearRttEstimates();
+
+    /// Forgets all message IDs received, so that duplicate detection starts afresh
+    void clearSeenIds();
+
+    /// Sets how long acknowledgements of received messages may be held, waiting to be 
+    /// carried by a message to the same node or combined with other acknowledgements.
+    /// See "Delayed Acknowledgements" above.
+    /// \param[in] delay The maximum hold time in milliseconds. 0 (the default) means 
+    /// acknowledge every message immediately. Setting 0 sends any held acknowledgements.
+    void setAckDelay(uint16_t delay);
+
+    /// Sends all held acknowledgements now, one ACK message per node
+    void flushAcks();
+
     /// Sets the maximum number of retries. Defaults to 3 at construction time. 
     /// If set to 0, each message will only ever be sent once.
     /// sendtoWait will give up and return false if there is no ack received after all transmissions time out
@@ -125,6 +311,8 @@ public:
     /// Send the message (with retries) and waits for an ack. Returns true if an acknowledgement is received.
     /// Synchronous: any message other than the desired ACK received while waiting is discarded.
     /// Blocks until an ACK is received or all retries are exhausted (ie up to retries*timeout milliseconds).
+    /// If the driver has an airtime budget (see RHGenericDriver::setDutyCycle()), also waits before each
+    /// transmission until the budget allows it, and gives up if that would take more than RH_RELIABLE_MAX_SEND_WAIT.
     /// If the destination address is the broadcast address RH_BROADCAST_ADDRESS (255), the message will 
     /// be sent as a broadcast, but receiving nodes do not acknowledge, and sendtoWait() returns true immediately
     /// without waiting for any acknowledgements.
@@ -134,6 +322,58 @@ public:
     /// \return true if the message was transmitted and an acknowledgement was received.
     bool sendtoWait(uint8_t* buf, uint8_t len, uint8_t address);
 
+    /// Sends the message and returns immediately without waiting for an acknowledgement.
+    /// The message is retained and retransmitted (with the same retries and timeout as sendtoWait())
+    /// by later calls to available(), recvfromAck(), recvfromAckTimeout() or pollPending()
+    /// until it is acknowledged or the retries are exhausted.
+    /// If the driver has an airtime budget (see RHGenericDriver::setDutyCycle()), transmissions the budget
+    /// does not allow yet are put off until it does, without using up retries.
+    /// If the destination address is the broadcast address RH_BROADCAST_ADDRESS, the message is
+    /// sent once and is not tracked.
+    /// \param[in] buf Pointer to the binary message to send
+    /// \param[in] len Number of octets to send
+    /// \param[in] address The address to send the message to.
+    /// \return A handle for the message, for use with sendStatus(), or RH_RELIABLE_HANDLE_NONE
+    /// if the message was too long, or too many messages are already awaiting acknowledgement
+    uint8_t sendtoAsync(uint8_t* buf, uint8_t len, uint8_t address);
+
+    /// Returns the status of a message sent with sendtoAsync().
+    /// Once RH_RELIABLE_STATUS_DELIVERED or RH_RELIABLE_STATUS_FAILED has been returned for a message,
+    /// its handle is released and later calls will return RH_RELIABLE_STATUS_UNKNOWN.
+    /// Completed messages that are not collected are discarded when their space is needed by new messages,
+    /// or when their handle is given to a new message after the message IDs wrap around.
+    /// \param[in] handle The handle returned by sendtoAsync()
+    /// \return One of RH_RELIABLE_STATUS_*
+    uint8_t sendStatus(uint8_t handle);
+
+    /// Sets the function to be called when a message sent with sendtoAsync() is acknowledged
+    /// or its retries are exhausted. The function is called from within available(),
+    /// recvfromAck() etc, and must not itself call them.
+    /// \param[in] callback The function to call, or NULL to poll with sendStatus() instead.
+    void setSendCallback(SendCallback callback);
+
+    /// Returns the number of messages sent with sendtoAsync() still awaiting acknowledgement
+    /// \param[in] address Count only messages to this address. RH_BROADCAST_ADDRESS (the default)
+    /// counts messages to all addresses
+    /// \return The number of messages awaiting acknowledgement
+    uint8_t pending(uint8_t address = RH_BROADCAST_ADDRESS);
+
+    /// Retransmits any message sent with sendtoAsync() whose acknowledgement timeout has expired,
+    /// and fails those whose retries are exhausted. 
+    /// Called automatically by available(), recvfromAck() and recvfromAckTimeout().
+    void pollPending();
+
+    /// Retransmits any overdue messages sent with sendtoAsync(),
+    /// then tests whether a new message is available from the driver, or was kept by sendtoWait().
+    /// \return true if a new, complete, error-free uncollected message is available
+    bool available();
+
+    /// Waits until a new message is available from the driver, or returns at once if sendtoWait()
+    /// kept one, or the timeout expires
+    /// \param[in] timeout The maximum time to wait in milliseconds
+    /// \return true if a message is available
+    bool waitAvailableTimeout(uint16_t timeout);
+
     /// If there is a valid message available for this node, send an acknowledgement to the SRC
     /// address (blocking until this is complete), then copy the message to buf and return true
     /// else return false. 
@@ -142,6 +382,7 @@ public:
     /// If to is not NULL, the DEST address is placed in *to.
     /// This is the preferred function for getting messages addressed to this node.
     /// If the message is not a broadcast, acknowledge to the sender before returning.
+    /// Acknowledgements for messages sent with sendtoAsync() are consumed here.
     /// You should be sure to call this function frequently enough to not miss any messages.
     /// It is recommended that you call it in your main loop.
     /// \param[in] buf Location to copy the received message
@@ -181,20 +422,227 @@ public:
     /// to 0. 
     void resetRetransmissions(); 
 
+    /// Takes a snapshot of the statistics of this manager: messages sent, delivered and failed,
+    /// the number of retries each delivered message needed, ACK round trip times, duplicates dropped
+    /// and the number of messages awaiting acknowledgement. Counting is cheap, and always on.
+    /// \param[out] stats The snapshot
+    void reliableStats(RHReliableStats* stats);
+
+    /// Resets the statistics of this manager, including retransmissions(), and of the driver
+    virtual void resetStats();
+
+    /// Writes the statistics of the driver, then the reliableStats() as an RH_STATS_RELIABLE section
+    /// \param[in] writer Where to write them
+    virtual void writeStats(RHStatsWriter& writer);
+
 protected:
-    /// Send an ACK for the message id to the given from address
+    /// Send an ACK for the message id to the given from address, together with any
+    /// acknowledgements being held for that address.
     /// Blocks until the ACK has been sent
     void acknowledge(uint8_t id, uint8_t from);
 
+    /// Acknowledge a message that has been received for this node: hold the ACK if ACKs are
+    /// being delayed and the sender is not yet retrying, else send it now.
+    /// \param[in] id The ID of the received message
+    /// \param[in] from The address of the sender
+    /// \param[in] flags The flags of the received message
+    void acknowledgeReceived(uint8_t id, uint8_t from, uint8_t flags);
+
+    /// Sends a message, carrying any acknowledgements being held for the address at the
+    /// start of the payload if there is room.
+    /// \param[in] buf Pointer to the binary message to send
+    /// \param[in] len Number of octets to send
+    /// \param[in] address The address to send the message to.
+    /// \return true if the message was transmitted.
+    bool sendtoWithAcks(uint8_t* buf, uint8_t len, uint8_t address);
+
+    /// Processes the acknowledgements in a received message: the ACK itself, or the list 
+    /// of IDs at the start of the payload if RH_FLAGS_ACKLIST is set.
+    /// \param[in] from The FROM header of the message
+    /// \param[in] id The ID header of the message
+    /// \param[in] flags The FLAGS header of the message
+    /// \param[in] buf The start of the message payload
+    /// \param[in] len The number of octets of the payload in buf
+    /// \return The length of the ACK list at the start of the payload, or 0 if there is none
+    uint8_t handleAcks(uint8_t from, uint8_t id, uint8_t flags, uint8_t* buf, uint8_t len);
+
     /// Checks whether the message currently in the Rx buffer is a new message, not previously received
     /// based on the from address and the sequence.  If it is new, it is acknowledged and returns true
     /// \return true if there is a message received and it is a new message
     bool haveNewMessage();
 
+    /// Matches a received ACK against the messages sent with sendtoAsync(), 
+    /// and completes the one it acknowledges, if any
+    /// \param[in] from The address the ACK came from
+    /// \param[in] id The ID of the message being acknowledged
+    /// \return true if the ACK was for a message sent with sendtoAsync()
+    bool handleAck(uint8_t from, uint8_t id);
+
+    /// Computes a new retransmit timeout for a message to address, from its round trip time 
+    /// estimates (if adaptive timeouts are enabled), backed off according to the number of times 
+    /// it has been transmitted, and randomly varied.
+    /// This is to prevent collisions on every retransmit if 2 nodes try to transmit at the same time
+    /// An adaptive timeout is never less than the time on air of the message and its ACK, for drivers
+    /// that calculate it (see RHGenericDriver::timeOnAir())
+    /// \param[in] address The destination address
+    /// \param[in] tries The number of times the message has been transmitted so far, including this one
+    /// \param[in] len The length of the message
+    /// \return The timeout in milliseconds
+    uint16_t retransmitTimeout(uint8_t address, uint8_t tries, uint8_t len);
+
+    /// Tests whether a message with the given ID from the given source has already been received
+    /// \param[in] from The source address
+    /// \param[in] id The message ID
+    /// \param[in] flags The header flags of the message
+    /// \return true if the message is a duplicate
+    bool isDuplicate(uint8_t from, uint8_t id, uint8_t flags);
+
+    /// Records that a message with the given ID from the given source has been received
+    /// \param[in] from The source address
+    /// \param[in] id The message ID
+    /// \param[in] flags The header flags of the message
+    void markSeen(uint8_t from, uint8_t id, uint8_t flags);
+
+    /// Adds a round trip time measurement to the estimates for address
+    /// \param[in] address The destination address
+    /// \param[in] rtt The time from transmission to ACK in milliseconds
+    void updateRtt(uint8_t address, unsigned long rtt);
+
+    /// Discards the round trip time estimates for address, after a message to it has failed
+    /// \param[in] address The destination address
+    void forgetRtt(uint8_t address);
+
+    /// Waits until the airtime budget of the driver allows a message to be sent
+    /// \param[in] len The length of the message
+    /// \return true when it can be sent, false if that would take more than RH_RELIABLE_MAX_SEND_WAIT
+    bool waitCanSend(uint8_t len);
+
+    /// Counts a message that has been delivered or has failed in the statistics
+    /// \param[in] tries The number of times it was transmitted
+    /// \param[in] delivered true if it was acknowledged
+    void countCompletion(uint8_t tries, bool delivered);
+
+    /// Returns how long until the next retransmission is due for a message sent with sendtoAsync()
+    /// \param[in] limit The maximum value to return
+    /// \return The time in milliseconds until the next retransmission, or limit if that is sooner
+    uint16_t pendingTimeLeft(uint16_t limit);
+
 private:
+    /// Round trip time estimates for a destination, scaled as in RFC 6298 implementations
+    typedef struct
+    {
+	uint8_t       valid;    ///< true if this entry holds an estimate
+	uint8_t       address;  ///< Destination address
+	uint32_t      srtt8;    ///< Smoothed round trip time in milliseconds * 8
+	uint32_t      rttvar4;  ///< Round trip time variance in milliseconds * 4
+	unsigned long updated;  ///< millis() at the last measurement
+    } RttEstimate;
+
+    /// Window of message IDs recently received from a source
+    typedef struct
+    {
+	uint8_t       valid;    ///< true if this entry is in use
+	uint8_t       source;   ///< Source address
+	uint8_t       highest;  ///< Highest message ID received
+	uint32_t      seen;     ///< Bit n set if message ID highest-n has been received
+	unsigned long heard;    ///< millis() when this source was last heard
+    } SeenWindow;
+
+    /// Finds the window of received message IDs for a source
+    /// \return A pointer to the window, or NULL if there is none
+    SeenWindow* findSeen(uint8_t from);
+
+    /// Finds the round trip time estimates for address
+    /// \return A pointer to the estimates, or NULL if there are none
+    RttEstimate* findRtt(uint8_t address);
+
+    /// Acknowledgements being held for a node
+    typedef struct
+    {
+	uint8_t       valid;    ///< true if this entry is in use
+	uint8_t       address;  ///< The node the acknowledgements are for
+	uint8_t       count;    ///< Number of IDs in ids
+	uint8_t       ids[RH_RELIABLE_MAX_ACKLIST]; ///< IDs of the messages to acknowledge
+	unsigned long since;    ///< millis() when the first one was held
+    } HeldAcks;
+
+    /// Finds the acknowledgements being held for address
+    /// \return A pointer to them, or NULL if there are none
+    HeldAcks* findHeldAcks(uint8_t address);
+
+    /// Holds the acknowledgement of a message, to be sent later
+    void holdAck(uint8_t id, uint8_t from);
+
+    /// Sends the held acknowledgements in a single ACK message and releases them
+    void sendHeldAcks(HeldAcks* h);
+
+    /// Sends a message with the held acknowledgements at the start of the payload and releases them
+    bool sendPiggybacked(HeldAcks* h, uint8_t* buf, uint8_t len, uint8_t address);
+
+    /// A message sent by sendtoAsync() and not yet collected
+    typedef struct
+    {
+	uint8_t       status;   ///< One of RH_RELIABLE_STATUS_*. RH_RELIABLE_STATUS_UNKNOWN if the slot is free
+	uint8_t       address;  ///< Destination address
+	uint8_t       id;       ///< Sequence number, also used as the handle
+	uint8_t       tries;    ///< Number of times it has been transmitted
+	uint8_t       len;      ///< Length of the message
+	uint16_t      timeout;  ///< Time to wait for an ACK after sentAt
+	unsigned long sentAt;   ///< millis() at the last transmission
+	uint8_t       data[RH_MAX_MESSAGE_LEN]; ///< Copy of the message for retransmission
+    } PendingMessage;
+
+    /// Transmits a pending message and restarts its ACK timer
+    void transmitPending(PendingMessage* p);
+
+    /// Puts off the transmission of a pending message until the airtime budget of the driver allows it
+    void deferPending(PendingMessage* p);
+
+    /// Marks a pending message as delivered or failed and reports it to the callback if there is one
+    void completePending(PendingMessage* p, bool delivered);
+
+    /// A message received by sendtoWait() while waiting for an ACK, kept for recvfromAck()
+    typedef struct
+    {
+	uint8_t       valid;    ///< true if a message is kept
+	uint8_t       from;     ///< FROM header
+	uint8_t       to;       ///< TO header
+	uint8_t       id;       ///< ID header
+	uint8_t       flags;    ///< FLAGS header, without RH_FLAGS_ACKLIST
+	uint8_t       len;      ///< Length of the payload
+	uint8_t       data[RH_MAX_MESSAGE_LEN]; ///< The payload, without any ACK list
+    } ReceivedMessage;
+
+    /// Copies the kept message to the caller and releases it, as recvfrom() would for a new one
+    bool takeReceived(uint8_t* buf, uint8_t* len, uint8_t* from, uint8_t* to, uint8_t* id, uint8_t* flags);
+
+    /// The message kept by sendtoWait()
+    ReceivedMessage _received;
+
+    /// Messages sent with sendtoAsync() awaiting acknowledgement or collection
+    PendingMessage _pending[RH_RELIABLE_MAX_PENDING];
+
+    /// Called when a message sent with sendtoAsync() completes
+    SendCallback _sendCallback;
+
+    /// Whether retransmit timeouts are computed from round trip time estimates
+    bool _adaptiveTimeout;
+
+    /// Round trip time estimates for recently used destinations
+    RttEstimate _rtt[RH_RELIABLE_RTT_PEERS];
+
+    /// Maximum time to hold acknowledgements in milliseconds. 0 means dont hold them
+    uint16_t _ackDelay;
+
+    /// Acknowledgements being held
+    HeldAcks _heldAcks[RH_RELIABLE_ACK_PEERS];
+
     /// Count of retransmissions we have had to send
     uint32_t _retransmissions;
 
+    /// Statistics, apart from retransmissions and those measured when a snapshot is taken
+    RHReliableStats _stats;
+
     /// The last sequence number to be used
     /// Defaults to 0
     uint8_t _lastSequenceNumber;
@@ -207,11 +655,11 @@ private:
     /// Defaults to 3
     uint8_t _retries;
 
-    /// Array of the last seen sequence number indexed by node address that sent it
+    /// Windows of recently received message IDs for recently heard sources.
     /// It is used for duplicate detection. Duplicated messages are re-acknowledged when received 
     /// (this is generally due to lost ACKs, causing the sender to retransmit, even though we have already
     /// received that message)
-    uint8_t _seenIds[256];
+    SeenWindow _seenIds[RH_RELIABLE_DEDUP_SOURCES];
 };
 
 /// @example rf22_reliable_datagram_client.pde
@@ -13,7 +13,6 @@
 
 #include <RHRouter.h>
 
-RHRouter::RoutedMessage RHRouter::_tmpMessage;
 
 ////////////////////////////////////////////////////////////////////
 // Constructors
@@ -22,6 +21,17 @@ RHRouter::RHRouter(RHGenericDriver& driver, uint8_t thisAddress)
 {
     _max_hops = RH_DEFAULT_MAX_HOPS;
     _isa_router = true;
+    _routeMaxAge = 0;
+    _interfaces[0] = this;
+    _interfaceCosts[0] = 0;
+    _interfaceCount = 1;
+    _rxInterface = 0;
+    _rxFrom = RH_BROADCAST_ADDRESS;
+    _initialised = false;
+    _forwarded = 0;
+    _forwardFailed = 0;
+    _dropped = 0;
+    resetRouteStats();
     clearRoutingTable();
 }
 
@@ -30,11 +40,91 @@ RHRouter::RHRouter(RHGenericDriver& driver, uint8_t thisAddress)
 bool RHRouter::init()
 {
     bool ret = RHReliableDatagram::init();
+    uint8_t i;
+    for (i = 1; i < _interfaceCount; i++)
+	if (!_interfaces[i]->init())
+	    ret = false;
     if (ret)
 	_max_hops = RH_DEFAULT_MAX_HOPS;
+    _initialised = true;
     return ret;
 }
 
+////////////////////////////////////////////////////////////////////
+void RHRouter::setThisAddress(uint8_t thisAddress)
+{
+    uint8_t i;
+    RHReliableDatagram::setThisAddress(thisAddress);
+    for (i = 1; i < _interfaceCount; i++)
+	_interfaces[i]->setThisAddress(thisAddress);
+}
+
+////////////////////////////////////////////////////////////////////
+uint8_t RHRouter::addInterface(RHReliableDatagram& datagram, uint8_t cost)
+{
+    if (_interfaceCount >= RH_ROUTER_MAX_INTERFACES)
+	return RH_ROUTER_INTERFACE_NONE;
+    // Everything we send and receive uses the same address space
+    datagram.setThisAddress(_thisAddress);
+    if (_initialised && !datagram.init())
+	return RH_ROUTER_INTERFACE_NONE;
+    _interfaces[_interfaceCount] = &datagram;
+    _interfaceCosts[_interfaceCount] = cost;
+    return _interfaceCount++;
+}
+
+////////////////////////////////////////////////////////////////////
+uint8_t RHRouter::interfaceCount()
+{
+    return _interfaceCount;
+}
+
+////////////////////////////////////////////////////////////////////
+RHReliableDatagram* RHRouter::interfaceDatagram(uint8_t iface)
+{
+    return iface < _interfaceCount ? _interfaces[iface] : NULL;
+}
+
+////////////////////////////////////////////////////////////////////
+void RHRouter::setInterfaceCost(uint8_t iface, uint8_t cost)
+{
+    if (iface < _interfaceCount)
+	_interfaceCosts[iface] = cost;
+}
+
+////////////////////////////////////////////////////////////////////
+uint8_t RHRouter::interfaceCost(uint8_t iface)
+{
+    return iface < _interfaceCount ? _interfaceCosts[iface] : 0;
+}
+
+////////////////////////////////////////////////////////////////////
+bool RHRouter::available()
+{
+    uint8_t i;
+    for (i = 0; i < _interfaceCount; i++)
+	if (_interfaces[i]->available())
+	    return true;
+    return false;
+}
+
+////////////////////////////////////////////////////////////////////
+bool RHRouter::waitAvailableTimeout(uint16_t timeout)
+{
+    // With only one driver we can let it wait in its own way
+    if (_interfaceCount == 1)
+	return RHReliableDatagram::waitAvailableTimeout(timeout);
+
+    unsigned long starttime = millis();
+    while ((millis() - starttime) < timeout)
+    {
+	if (available())
+	    return true;
+	YIELD;
+    }
+    return false;
+}
+
 ////////////////////////////////////////////////////////////////////
 void RHRouter::setMaxHops(uint8_t max_hops)
 {
@@ -47,65 +137,136 @@ void RHRouter::setIsaRouter(bool isa_router)
     _isa_router = isa_router;
 }
 ////////////////////////////////////////////////////////////////////
-void RHRouter::addRouteTo(uint8_t dest, uint8_t next_hop, uint8_t state)
+void RHRouter::setRouteMaxAge(unsigned long max_age)
 {
-    uint8_t i;
+    _routeMaxAge = max_age;
+}
 
+////////////////////////////////////////////////////////////////////
+void RHRouter::addRouteTo(uint8_t dest, uint8_t next_hop, uint8_t state, uint8_t metric, uint8_t iface)
+{
     // First look for an existing entry we can update
-    for (i = 0; i < RH_ROUTING_TABLE_SIZE; i++)
+    uint8_t i = findRoute(dest);
+    if (i == RH_ROUTE_INDEX_NONE)
     {
-	if (_routes[i].dest == dest)
-	{
-	    _routes[i].dest = dest;
-	    _routes[i].next_hop = next_hop;
-	    _routes[i].state = state;
-	    return;
-	}
+	// Need a new one. Make room if the table is full
+	if (_routeFree == RH_ROUTE_INDEX_NONE)
+	    retireOldestRoute();
+	// Should be a free slot now. Take it and link it into the hash bucket for dest
+	i = _routeFree;
+	_routeFree = _routeChain[i];
+	uint8_t bucket = dest % RH_ROUTING_HASH_SIZE;
+	_routeChain[i] = _routeBuckets[bucket];
+	_routeBuckets[bucket] = i;
+	_routeOlder[i] = _routeNewer[i] = RH_ROUTE_INDEX_NONE;
     }
+    _routes[i].dest = dest;
+    _routes[i].next_hop = next_hop;
+    _routes[i].iface = iface;
+    _routes[i].state = state;
+    _routes[i].metric = metric;
+    touchRoute(i);
+}
 
-    // Look for an invalid entry we can use
-    for (i = 0; i < RH_ROUTING_TABLE_SIZE; i++)
-    {
-	if (_routes[i].state == Invalid)
-	{
-	    _routes[i].dest = dest;
-	    _routes[i].next_hop = next_hop;
-	    _routes[i].state = state;
-	    return;
-	}
-    }
+////////////////////////////////////////////////////////////////////
+bool RHRouter::addRouteIfBetter(uint8_t dest, uint8_t next_hop, uint8_t metric, uint8_t iface)
+{
+    uint8_t i = findRoute(dest);
+    if (   i != RH_ROUTE_INDEX_NONE
+	&& _routes[i].state == Valid
+	&& (_routes[i].next_hop != next_hop || _routes[i].iface != iface)
+	&& _routes[i].metric != RH_ROUTER_METRIC_UNKNOWN
+	&& (metric == RH_ROUTER_METRIC_UNKNOWN || metric + RH_ROUTER_METRIC_HYSTERESIS > _routes[i].metric))
+	return false; // Existing route is as good
+    addRouteTo(dest, next_hop, Valid, metric, iface);
+    return true;
+}
 
-    // Need to make room for a new one
-    retireOldestRoute();
-    // Should be an invalid slot now
-    for (i = 0; i < RH_ROUTING_TABLE_SIZE; i++)
-    {
-	if (_routes[i].state == Invalid)
-	{
-	    _routes[i].dest = dest;
-	    _routes[i].next_hop = next_hop;
-	    _routes[i].state = state;
-	}
-    }
+////////////////////////////////////////////////////////////////////
+uint8_t RHRouter::findRoute(uint8_t dest)
+{
+    uint8_t i = _routeBuckets[dest % RH_ROUTING_HASH_SIZE];
+    while (i != RH_ROUTE_INDEX_NONE && _routes[i].dest != dest)
+	i = _routeChain[i];
+    return i;
+}
+
+////////////////////////////////////////////////////////////////////
+// Unlinks the entry from the LRU list if it is there, and puts it back at the newest end
+void RHRouter::touchRoute(uint8_t index)
+{
+    uint8_t older = _routeOlder[index];
+    uint8_t newer = _routeNewer[index];
+    if (older != RH_ROUTE_INDEX_NONE)
+	_routeNewer[older] = newer;
+    else if (_routeOldest == index)
+	_routeOldest = newer;
+    if (newer != RH_ROUTE_INDEX_NONE)
+	_routeOlder[newer] = older;
+    else if (_routeNewest == index)
+	_routeNewest = older;
+
+    _routeOlder[index] = _routeNewest;
+    _routeNewer[index] = RH_ROUTE_INDEX_NONE;
+    if (_routeNewest != RH_ROUTE_INDEX_NONE)
+	_routeNewer[_routeNewest] = index;
+    else
+	_routeOldest = index;
+    _routeNewest = index;
+    _routes[index].lastUsed = millis();
 }
 
 ////////////////////////////////////////////////////////////////////
 RHRouter::RoutingTableEntry* RHRouter::getRouteTo(uint8_t dest)
 {
-    uint8_t i;
-    for (i = 0; i < RH_ROUTING_TABLE_SIZE; i++)
-	if (_routes[i].dest == dest && _routes[i].state != Invalid)
+    uint8_t i = findRoute(dest);
+    if (i != RH_ROUTE_INDEX_NONE && _routes[i].state != Invalid)
+    {
+	if (_routeMaxAge && (millis() - _routes[i].lastUsed) > _routeMaxAge)
+	{
+	    // Too old to trust, recycle it
+	    deleteRoute(i);
+	    _routeEvictions++;
+	}
+	else
+	{
+	    touchRoute(i);
+	    _routeHits++;
 	    return &_routes[i];
+	}
+    }
+    _routeMisses++;
     return NULL;
 }
 
 ////////////////////////////////////////////////////////////////////
 void RHRouter::deleteRoute(uint8_t index)
 {
-    // Delete a route by copying following routes on top of it
-    memcpy(&_routes[index], &_routes[index+1], 
-	   sizeof(RoutingTableEntry) * (RH_ROUTING_TABLE_SIZE - index - 1));
-    _routes[RH_ROUTING_TABLE_SIZE - 1].state = Invalid;
+    if (index >= RH_ROUTING_TABLE_SIZE)
+	return;
+
+    // Unlink it from its hash bucket. If it is not there, it is already free
+    uint8_t* p = &_routeBuckets[_routes[index].dest % RH_ROUTING_HASH_SIZE];
+    while (*p != RH_ROUTE_INDEX_NONE && *p != index)
+	p = &_routeChain[*p];
+    if (*p != index)
+	return;
+    *p = _routeChain[index];
+
+    // Take it out of the LRU list
+    if (_routeOlder[index] != RH_ROUTE_INDEX_NONE)
+	_routeNewer[_routeOlder[index]] = _routeNewer[index];
+    else
+	_routeOldest = _routeNewer[index];
+    if (_routeNewer[index] != RH_ROUTE_INDEX_NONE)
+	_routeOlder[_routeNewer[index]] = _routeOlder[index];
+    else
+	_routeNewest = _routeOlder[index];
+
+    // And return it to the free list
+    _routes[index].state = Invalid;
+    _routeChain[index] = _routeFree;
+    _routeFree = index;
 }
 
 ////////////////////////////////////////////////////////////////////
@@ -120,8 +281,12 @@ void RHRouter::printRoutingTable()
 	Serial.print(_routes[i].dest, DEC);
 	Serial.print(" Next Hop: ");
 	Serial.print(_routes[i].next_hop, DEC);
+	Serial.print(" Interface: ");
+	Serial.print(_routes[i].iface, DEC);
 	Serial.print(" State: ");
-	Serial.println(_routes[i].state, DEC);
+	Serial.print(_routes[i].state, DEC);
+	Serial.print(" Metric: ");
+	Serial.println(_routes[i].metric, DEC);
     }
 #endif
 }
@@ -129,33 +294,119 @@ void RHRouter::printRoutingTable()
 ////////////////////////////////////////////////////////////////////
 bool RHRouter::deleteRouteTo(uint8_t dest)
 {
-    uint8_t i;
-    for (i = 0; i < RH_ROUTING_TABLE_SIZE; i++)
-    {
-	if (_routes[i].dest == dest)
-	{
-	    deleteRoute(i);
-	    return true;
-	}
-    }
-    return false;
+    uint8_t i = findRoute(dest);
+    if (i == RH_ROUTE_INDEX_NONE)
+	return false;
+    deleteRoute(i);
+    return true;
 }
 
 ////////////////////////////////////////////////////////////////////
 void RHRouter::retireOldestRoute()
 {
-    // We just obliterate the first in the table and clear the last
-    deleteRoute(0);
+    // The least recently used entry is at the old end of the LRU list
+    if (_routeOldest != RH_ROUTE_INDEX_NONE)
+    {
+	deleteRoute(_routeOldest);
+	_routeEvictions++;
+    }
 }
 
 ////////////////////////////////////////////////////////////////////
 void RHRouter::clearRoutingTable()
 {
-    uint8_t i;
+    uint16_t i;
     for (i = 0; i < RH_ROUTING_TABLE_SIZE; i++)
+    {
 	_routes[i].state = Invalid;
+	_routeChain[i] = (i + 1 < RH_ROUTING_TABLE_SIZE) ? i + 1 : RH_ROUTE_INDEX_NONE;
+    }
+    _routeFree = 0;
+    _routeOldest = _routeNewest = RH_ROUTE_INDEX_NONE;
+    for (i = 0; i < RH_ROUTING_HASH_SIZE; i++)
+	_routeBuckets[i] = RH_ROUTE_INDEX_NONE;
+}
+
+////////////////////////////////////////////////////////////////////
+uint32_t RHRouter::routeHits()
+{
+    return _routeHits;
+}
+
+////////////////////////////////////////////////////////////////////
+uint32_t RHRouter::routeMisses()
+{
+    return _routeMisses;
+}
+
+////////////////////////////////////////////////////////////////////
+uint32_t RHRouter::routeEvictions()
+{
+    return _routeEvictions;
+}
+
+////////////////////////////////////////////////////////////////////
+void RHRouter::resetRouteStats()
+{
+    _routeHits = 0;
+    _routeMisses = 0;
+    _routeEvictions = 0;
+}
+
+////////////////////////////////////////////////////////////////////
+void RHRouter::routerStats(RHRouterStats* stats)
+{
+    stats->routeHits = _routeHits;
+    stats->routeMisses = _routeMisses;
+    stats->routeEvictions = _routeEvictions;
+    stats->forwarded = _forwarded;
+    stats->forwardFailed = _forwardFailed;
+    stats->dropped = _dropped;
+    stats->routes = 0;
+    uint8_t i;
+    for (i = _routeOldest; i != RH_ROUTE_INDEX_NONE; i = _routeNewer[i])
+	stats->routes++;
+    stats->routesMax = RH_ROUTING_TABLE_SIZE;
+}
+
+////////////////////////////////////////////////////////////////////
+void RHRouter::resetStats()
+{
+    RHReliableDatagram::resetStats();
+    resetRouteStats();
+    _forwarded = 0;
+    _forwardFailed = 0;
+    _dropped = 0;
+    uint8_t i;
+    for (i = 1; i < _interfaceCount; i++)
+	_interfaces[i]->resetStats();
 }
 
+////////////////////////////////////////////////////////////////////
+void RHRouter::writeStats(RHStatsWriter& writer)
+{
+    RHReliableDatagram::writeStats(writer);
+    uint8_t i;
+    for (i = 1; i < _interfaceCount; i++)
+    {
+	writer.setInterface(i);
+	_interfaces[i]->writeStats(writer);
+    }
+    writer.setInterface(0);
+
+    RHRouterStats stats;
+    routerStats(&stats);
+    writer.beginSection(RH_STATS_ROUTER);
+    writer.putVarint(stats.routeHits);
+    writer.putVarint(stats.routeMisses);
+    writer.putVarint(stats.routeEvictions);
+    writer.putVarint(stats.forwarded);
+    writer.putVarint(stats.forwardFailed);
+    writer.putVarint(stats.dropped);
+    writer.putVarint(stats.routes);
+    writer.putVarint(stats.routesMax);
+    writer.endSection();
+}
 
 uint8_t RHRouter::sendtoWait(uint8_t* buf, uint8_t len, uint8_t dest, uint8_t flags)
 {
@@ -166,34 +417,65 @@ uint8_t RHRouter::sendtoWait(uint8_t* buf, uint8_t len, uint8_t dest, uint8_t fl
 // Waits for delivery to the next hop (but not for delivery to the final destination)
 uint8_t RHRouter::sendtoFromSourceWait(uint8_t* buf, uint8_t len, uint8_t dest, uint8_t source, uint8_t flags)
 {
-    if (((uint16_t)len + sizeof(RoutedMessageHeader)) > _driver.maxMessageLength())
+    if (len > RH_ROUTER_MAX_MESSAGE_LEN)
 	return RH_ROUTER_ERROR_INVALID_LENGTH;
 
-    // Construct a RH RouterMessage message
-    _tmpMessage.header.source = source;
-    _tmpMessage.header.dest = dest;
-    _tmpMessage.header.hops = 0;
-    _tmpMessage.header.id = _lastE2ESequenceNumber++;
-    _tmpMessage.header.flags = flags;
-    memcpy(_tmpMessage.data, buf, len);
+    // Construct a RH RouterMessage message, unless the caller built it in place
+    if (buf != _txMessage.data)
+	memcpy(_txMessage.data, buf, len);
+    return sendInPlaceWait(&_txMessage, len, dest, source, flags);
+}
+
+////////////////////////////////////////////////////////////////////
+uint8_t RHRouter::sendInPlaceWait(RoutedMessage* message, uint8_t len, uint8_t dest, uint8_t source, uint8_t flags)
+{
+    // route() checks it against the driver of the interface it goes out on
+    if (len > RH_ROUTER_MAX_MESSAGE_LEN)
+	return RH_ROUTER_ERROR_INVALID_LENGTH;
 
-    return route(&_tmpMessage, sizeof(RoutedMessageHeader)+len);
+    message->header.source = source;
+    message->header.dest = dest;
+    message->header.hops = 0;
+    message->header.id = _lastE2ESequenceNumber++;
+    message->header.flags = flags;
+    return route(message, sizeof(RoutedMessageHeader)+len);
+}
+
+////////////////////////////////////////////////////////////////////
+uint8_t* RHRouter::txBuffer()
+{
+    return _txMessage.data;
 }
 
 ////////////////////////////////////////////////////////////////////
 uint8_t RHRouter::route(RoutedMessage* message, uint8_t messageLen)
 {
-    // Reliably deliver it if possible. See if we have a route:
-    uint8_t next_hop = RH_BROADCAST_ADDRESS;
-    if (message->header.dest != RH_BROADCAST_ADDRESS)
+    if (message->header.dest == RH_BROADCAST_ADDRESS)
     {
-	RoutingTableEntry* route = getRouteTo(message->header.dest);
-	if (!route)
-	    return RH_ROUTER_ERROR_NO_ROUTE;
-	next_hop = route->next_hop;
+	// Broadcast on every interface that can carry it
+	uint8_t ret = RH_ROUTER_ERROR_INVALID_LENGTH;
+	uint8_t i;
+	for (i = 0; i < _interfaceCount; i++)
+	{
+	    if (messageLen > _interfaces[i]->driver().maxMessageLength())
+		continue;
+	    if (_interfaces[i]->sendtoWait((uint8_t*)message, messageLen, RH_BROADCAST_ADDRESS))
+		ret = RH_ROUTER_ERROR_NONE;
+	    else if (ret != RH_ROUTER_ERROR_NONE)
+		ret = RH_ROUTER_ERROR_UNABLE_TO_DELIVER;
+	}
+	return ret;
     }
 
-    if (!RHReliableDatagram::sendtoWait((uint8_t*)message, messageLen, next_hop))
+    // Reliably deliver it if possible. See if we have a route:
+    RoutingTableEntry* route = getRouteTo(message->header.dest);
+    if (!route || route->iface >= _interfaceCount)
+	return RH_ROUTER_ERROR_NO_ROUTE;
+    RHReliableDatagram* iface = _interfaces[route->iface];
+    if (messageLen > iface->driver().maxMessageLength())
+	return RH_ROUTER_ERROR_INVALID_LENGTH;
+
+    if (!iface->sendtoWait((uint8_t*)message, messageLen, route->next_hop))
 	return RH_ROUTER_ERROR_UNABLE_TO_DELIVER;
 
     return RH_ROUTER_ERROR_NONE;
@@ -211,12 +493,39 @@ void RHRouter::peekAtMessage(RoutedMessage* message, uint8_t messageLen)
 ////////////////////////////////////////////////////////////////////
 bool RHRouter::recvfromAck(uint8_t* buf, uint8_t* len, uint8_t* source, uint8_t* dest, uint8_t* id, uint8_t* flags)
 {  
-    uint8_t tmpMessageLen = sizeof(_tmpMessage);
+    uint8_t* msg;
+    uint8_t msgLen;
+    if (!recvfromAckInPlace(&msg, &msgLen, source, dest, id, flags))
+	return false;
+    if (*len > msgLen)
+	*len = msgLen;
+    memcpy(buf, msg, *len);
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////
+bool RHRouter::recvfromAckInPlace(uint8_t** buf, uint8_t* len, uint8_t* source, uint8_t* dest, uint8_t* id, uint8_t* flags)
+{  
+    uint8_t tmpMessageLen = sizeof(_rxMessage);
     uint8_t _from;
     uint8_t _to;
     uint8_t _id;
     uint8_t _flags;
-    if (RHReliableDatagram::recvfromAck((uint8_t*)&_tmpMessage, &tmpMessageLen, &_from, &_to, &_id, &_flags))
+    // Take turns between the interfaces, starting after the one we last received on, 
+    // so a busy interface cannot starve the others
+    uint8_t i;
+    for (i = 1; i <= _interfaceCount; i++)
+    {
+	uint8_t iface = (_rxInterface + i) % _interfaceCount;
+	if (_interfaces[iface]->recvfromAck((uint8_t*)&_rxMessage, &tmpMessageLen, &_from, &_to, &_id, &_flags))
+	{
+	    _rxInterface = iface;
+	    _rxFrom = _from;
+	    break;
+	}
+	tmpMessageLen = sizeof(_rxMessage);
+    }
+    if (i <= _interfaceCount)
     {
 	// Here we simulate networks with limited visibility between nodes
 	// so we can test routing
@@ -267,32 +576,38 @@ bool RHRouter::recvfromAck(uint8_t* buf, uint8_t* len, uint8_t* source, uint8_t*
 	}
 #endif
 
-	peekAtMessage(&_tmpMessage, tmpMessageLen);
+	if (tmpMessageLen < sizeof(RoutedMessageHeader))
+	    return false; // Too short to be one of ours
+	peekAtMessage(&_rxMessage, tmpMessageLen);
 	// See if its for us or has to be routed
-	if (_tmpMessage.header.dest == _thisAddress || _tmpMessage.header.dest == RH_BROADCAST_ADDRESS)
+	if (_rxMessage.header.dest == _thisAddress || _rxMessage.header.dest == RH_BROADCAST_ADDRESS)
 	{
 	    // Deliver it here
-	    if (source) *source  = _tmpMessage.header.source;
-	    if (dest)   *dest    = _tmpMessage.header.dest;
-	    if (id)     *id      = _tmpMessage.header.id;
-	    if (flags)  *flags   = _tmpMessage.header.flags;
-	    uint8_t msgLen = tmpMessageLen - sizeof(RoutedMessageHeader);
-	    if (*len > msgLen)
-		*len = msgLen;
-	    memcpy(buf, _tmpMessage.data, *len);
+	    if (source) *source  = _rxMessage.header.source;
+	    if (dest)   *dest    = _rxMessage.header.dest;
+	    if (id)     *id      = _rxMessage.header.id;
+	    if (flags)  *flags   = _rxMessage.header.flags;
+	    *buf = _rxMessage.data;
+	    *len = tmpMessageLen - sizeof(RoutedMessageHeader);
 	    return true; // Its for you!
 	}
-	else if (   _tmpMessage.header.dest != RH_BROADCAST_ADDRESS
-		 && _tmpMessage.header.hops++ < _max_hops)
+	else if (   _rxMessage.header.dest != RH_BROADCAST_ADDRESS
+		 && _rxMessage.header.hops++ < _max_hops)
 	{
 	    // Maybe it has to be routed to the next hop
 	    // REVISIT: if it fails due to no route or unable to deliver to the next hop, 
 	    // tell the originator. BUT HOW?
 	    
 	    // If we are forwarding packets, do so. Otherwise, drop.
-	    if (_isa_router)
-	        route(&_tmpMessage, tmpMessageLen);
+	    if (!_isa_router)
+		_dropped++;
+	    else if (route(&_rxMessage, tmpMessageLen) == RH_ROUTER_ERROR_NONE)
+		_forwarded++;
+	    else
+		_forwardFailed++;
 	}
+	else
+	    _dropped++; // Too many hops
 	// Discard it and maybe wait for another
     }
     return false;
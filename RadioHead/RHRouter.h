@@ -13,7 +13,46 @@
 #define RH_DEFAULT_MAX_HOPS 30
 
 // The default size of the routing table we keep
+// May be overridden before including RHRouter.h. Maximum 254 entries.
+#ifndef RH_ROUTING_TABLE_SIZE
 #define RH_ROUTING_TABLE_SIZE 10
+#endif
+
+// Number of hash buckets used to index the routing table by destination address.
+// Defaults to a little more than the table size so chains stay short. Maximum 256
+#ifndef RH_ROUTING_HASH_SIZE
+ #if RH_ROUTING_TABLE_SIZE > 170
+  #define RH_ROUTING_HASH_SIZE 256
+ #else
+  #define RH_ROUTING_HASH_SIZE (RH_ROUTING_TABLE_SIZE + (RH_ROUTING_TABLE_SIZE / 2) + 1)
+ #endif
+#endif
+
+// Marks the end of a hash chain or free list in the routing table
+#define RH_ROUTE_INDEX_NONE 0xff
+
+// Metric of a route whose cost is not known, such as one added by addRouteTo()
+#define RH_ROUTER_METRIC_UNKNOWN 0xff
+
+// A route via a different next hop must have a metric this much lower than the 
+// existing route before addRouteIfBetter() will replace it. Prevents routes flapping between 
+// two paths of similar quality
+#ifndef RH_ROUTER_METRIC_HYSTERESIS
+#define RH_ROUTER_METRIC_HYSTERESIS 2
+#endif
+
+// The maximum number of interfaces (drivers) an RHRouter can send and receive with, 
+// including the one it was constructed with. May be overridden before including RHRouter.h
+#ifndef RH_ROUTER_MAX_INTERFACES
+ #if defined(__AVR__)
+  #define RH_ROUTER_MAX_INTERFACES 2
+ #else
+  #define RH_ROUTER_MAX_INTERFACES 4
+ #endif
+#endif
+
+// Returned by addInterface() when there is no room for another interface
+#define RH_ROUTER_INTERFACE_NONE 0xff
 
 // Error codes
 #define RH_ROUTER_ERROR_NONE              0
@@ -22,6 +61,7 @@
 #define RH_ROUTER_ERROR_TIMEOUT           3
 #define RH_ROUTER_ERROR_NO_REPLY          4
 #define RH_ROUTER_ERROR_UNABLE_TO_DELIVER 5
+#define RH_ROUTER_ERROR_QUEUED            6
 
 // This size of RH_ROUTER_MAX_MESSAGE_LEN is OK for Arduino Mega, but too big for
 // Duemilanove. Size of 50 works with the sample router programs on Duemilanove.
@@ -70,6 +110,15 @@
 /// call recvfromAck() or recvfromAckTimeout() frequently in your main loop. recvfromAck() will return 
 /// false if it receives a message but it is not for this node.
 ///
+/// \par Buffers
+///
+/// Each RHRouter has its own transmit and receive buffers, with room reserved in front of the
+/// payload for the RHRouter header, so several instances can be used in one process. To send without
+/// copying, write the payload at txBuffer() and pass txBuffer() to sendtoWait(): the header is filled in
+/// in place and the buffer is handed straight to the driver. recvfromAckInPlace() returns a pointer to
+/// the payload in the receive buffer instead of copying it. Subclasses use the same buffers, so 
+/// messages travel through all the layers with one copy into and one copy out of the driver.
+///
 /// RHRouter does not provide reliable end-to-end delivery, but uses reliable hop-to-hop delivery. 
 /// If a message is unable to be delivered to an end node during to a delivery failure between 2 hops, 
 /// the source node will not be told about it.
@@ -78,6 +127,27 @@
 /// (i.e. the nodes dont move around), and for which the 
 /// routing never changes. If that is not the case for your proposed network, see RHMesh instead.
 ///
+/// \par Interfaces
+///
+/// An RHRouter can send and receive with several drivers at once, for example a long range LoRa 
+/// radio and a short range 2.4GHz radio, giving one address space across all of them. 
+/// The driver given to the constructor is interface 0. Others are added with addInterface(), 
+/// each through its own RHReliableDatagram, which does the hop-to-hop acknowledgement on that interface:
+/// \code
+/// RH_RF95 lora;
+/// RH_NRF51 nrf;
+/// RHReliableDatagram nrfDatagram(nrf);
+/// RHMesh mesh(lora, MY_ADDRESS);
+/// ...
+/// mesh.addInterface(nrfDatagram);
+/// mesh.init();
+/// \endcode
+/// Each routing table entry records the interface to send on as well as the next hop.
+/// Messages received on one interface are forwarded on another from the receive buffer, without 
+/// being copied again. Broadcasts are sent on every interface. Each interface has a cost, 
+/// set with setInterfaceCost(), that RHMesh adds to the cost of each hop over it, so that 
+/// route discovery picks the cheapest interface for each destination.
+///
 /// \par The Routing Table
 ///
 /// The routing table is a local table in RHRouter that holds the information about the next hop node 
@@ -90,9 +160,16 @@
 /// You can also use addRouteTo() to change a route and 
 /// deleteRouteTo() to delete a route at run time. Youcan also clear the entire routing table
 ///
-/// The Routing Table has limited capacity for entries (defined by RH_ROUTING_TABLE_SIZE, which is 10)
-/// if more than RH_ROUTING_TABLE_SIZE are added, the oldest (first) one will be removed by calling 
-/// retireOldestRoute()
+/// The Routing Table has limited capacity for entries (defined by RH_ROUTING_TABLE_SIZE, which defaults to 10
+/// and may be defined up to 254 before including RHRouter.h).
+/// Entries are indexed by a hash of the destination address (RH_ROUTING_HASH_SIZE buckets), so
+/// lookups, additions and deletions take constant time on average regardless of the table size.
+/// Each entry records the time it was last used (looked up or refreshed). If more than
+/// RH_ROUTING_TABLE_SIZE are added, the least recently used one will be removed by calling 
+/// retireOldestRoute(). You can also set a maximum age with setRouteMaxAge(): routes that have not 
+/// been used within that time are treated as absent and recycled.
+/// Counts of lookup hits, misses and evictions are available from routeHits(), routeMisses() 
+/// and routeEvictions().
 ///
 /// \par Message Format
 ///
@@ -164,7 +241,10 @@ public:
     {
 	uint8_t      dest;      ///< Destination node address
 	uint8_t      next_hop;  ///< Send via this next hop address
+	uint8_t      iface;     ///< Send on this interface. 0 is the driver given to the constructor
 	uint8_t      state;     ///< State of this route, one of RouteState
+	uint8_t      metric;    ///< Cost of this route (lower is better), or RH_ROUTER_METRIC_UNKNOWN
+	unsigned long lastUsed; ///< millis() when this route was last looked up or updated
     } RoutingTableEntry;
 
     /// Constructor. 
@@ -178,6 +258,48 @@ public:
     bool init();
 
 
+    /// Sets the address of this node, on every interface
+    /// \param[in] thisAddress The address of this node
+    void setThisAddress(uint8_t thisAddress);
+
+    /// Adds another interface to send and receive messages with. Its datagram is given the address
+    /// of this node, and is initialised by init() if this is called before init().
+    /// Per-hop settings such as timeouts and retries are set on the datagram itself.
+    /// \param [in] datagram An RHReliableDatagram for the driver of the new interface
+    /// \param [in] cost The cost of each hop over the new interface. See setInterfaceCost()
+    /// \return The index of the new interface, or RH_ROUTER_INTERFACE_NONE if there are already 
+    /// RH_ROUTER_MAX_INTERFACES
+    uint8_t addInterface(RHReliableDatagram& datagram, uint8_t cost = 0);
+
+    /// Returns the number of interfaces, including the driver given to the constructor
+    /// \return The number of interfaces
+    uint8_t interfaceCount();
+
+    /// Returns the datagram used to send and receive on an interface
+    /// \param [in] iface The interface index. 0 is this RHRouter itself
+    /// \return Pointer to the datagram, or NULL if there is no such interface
+    RHReliableDatagram* interfaceDatagram(uint8_t iface);
+
+    /// Sets the cost of each hop over an interface. RHMesh adds it to the cost of the link, so 
+    /// that a slow or expensive interface is only chosen when it gives a much better route. Defaults to 0
+    /// \param [in] iface The interface index
+    /// \param [in] cost The additional cost of each hop over the interface
+    void setInterfaceCost(uint8_t iface, uint8_t cost);
+
+    /// Returns the cost of each hop over an interface
+    /// \param [in] iface The interface index
+    /// \return The cost set with setInterfaceCost()
+    uint8_t interfaceCost(uint8_t iface);
+
+    /// Tests whether a new message is available on any interface
+    /// \return true if a new message is available
+    bool available();
+
+    /// Blocks until a message is available on any interface or the timeout expires
+    /// \param[in] timeout Maximum time to wait in milliseconds
+    /// \return true if a message is available
+    bool waitAvailableTimeout(uint16_t timeout);
+
     /// Sets the flag determining if the node will participate in routing.
     /// if isa_router is true, the node will be a full participant. If false the node
     /// will only respond to
@@ -192,16 +314,36 @@ public:
     /// \param [in] max_hops The new value for max_hops
     void setMaxHops(uint8_t max_hops);
 
+    /// Sets the maximum age of routes in the local routing table.
+    /// Routes that have not been looked up or updated within max_age milliseconds are treated
+    /// as if they were not present, and their slots are reused.
+    /// \param [in] max_age The maximum age in milliseconds. 0 (the default) means routes never expire.
+    void setRouteMaxAge(unsigned long max_age);
+
     /// Adds a route to the local routing table, or updates it if already present.
-    /// If there is not enough room the oldest (first) route will be deleted by calling retireOldestRoute().
+    /// If there is not enough room the least recently used route will be deleted by calling retireOldestRoute().
     /// \param [in] dest The destination node address. RH_BROADCAST_ADDRESS is permitted.
     /// \param [in] next_hop The address of the next hop to send messages destined for dest
     /// \param [in] state The satte of the route. Defaults to Valid
-    void addRouteTo(uint8_t dest, uint8_t next_hop, uint8_t state = Valid);
+    /// \param [in] metric The cost of the route. Defaults to RH_ROUTER_METRIC_UNKNOWN
+    /// \param [in] iface The interface to send on to reach next_hop. Defaults to 0
+    void addRouteTo(uint8_t dest, uint8_t next_hop, uint8_t state = Valid, uint8_t metric = RH_ROUTER_METRIC_UNKNOWN, uint8_t iface = 0);
+
+    /// Adds a route to the local routing table if there is no valid route to dest, or replaces the
+    /// existing route if the new one is better. A route via the same next hop and interface always replaces
+    /// the existing one, so its metric stays current. A route via a different next hop or interface replaces it if the 
+    /// existing metric is unknown or at least RH_ROUTER_METRIC_HYSTERESIS higher than the new one.
+    /// \param [in] dest The destination node address
+    /// \param [in] next_hop The address of the next hop to send messages destined for dest
+    /// \param [in] metric The cost of the route through next_hop. Lower is better
+    /// \param [in] iface The interface to send on to reach next_hop. Defaults to 0
+    /// \return true if the route was added or replaced
+    bool addRouteIfBetter(uint8_t dest, uint8_t next_hop, uint8_t metric, uint8_t iface = 0);
 
     /// Finds and returns a RoutingTableEntry for the given destination node
+    /// and marks it as recently used.
     /// \param [in] dest The desired destination node address.
-    /// \return pointer to a RoutingTableEntry for dest
+    /// \return pointer to a RoutingTableEntry for dest, or NULL if there is no valid route
     RoutingTableEntry* getRouteTo(uint8_t dest);
 
     /// Deletes from the local routing table any route for the destination node.
@@ -209,7 +351,7 @@ public:
     /// \return true if the route was present
     bool deleteRouteTo(uint8_t dest);
 
-    /// Deletes the oldest (first) route from the 
+    /// Deletes the least recently used route from the 
     /// local routing table
     void retireOldestRoute();
 
@@ -217,6 +359,37 @@ public:
     /// local routing table
     void clearRoutingTable();
 
+    /// Returns the number of routing table lookups that found a valid route
+    /// since starting or since the last call to resetRouteStats().
+    /// \return The number of routing table hits
+    uint32_t routeHits();
+
+    /// Returns the number of routing table lookups that did not find a valid route
+    /// since starting or since the last call to resetRouteStats().
+    /// \return The number of routing table misses
+    uint32_t routeMisses();
+
+    /// Returns the number of routes removed to make room for new ones or because they 
+    /// exceeded the maximum age, since starting or since the last call to resetRouteStats().
+    /// \return The number of routing table evictions
+    uint32_t routeEvictions();
+
+    /// Resets the routing table hit, miss and eviction counts to 0.
+    void resetRouteStats();
+
+    /// Takes a snapshot of the statistics of this router: routing table hits, misses and evictions,
+    /// messages forwarded for other nodes, or dropped, and the number of routes in the routing table
+    /// \param[out] stats The snapshot
+    void routerStats(RHRouterStats* stats);
+
+    /// Resets the statistics of this router, including the route stats, and of every interface
+    virtual void resetStats();
+
+    /// Writes the statistics of the reliable datagram and driver of each interface, each with its
+    /// interface index, then the routerStats() as an RH_STATS_ROUTER section
+    /// \param[in] writer Where to write them
+    virtual void writeStats(RHStatsWriter& writer);
+
     /// If RH_HAVE_SERIAL is defined, this will print out the contents of the local 
     /// routing table using Serial
     void printRoutingTable();
@@ -255,6 +428,11 @@ public:
     ///           (usually because it dod not acknowledge due to being off the air or out of range
     uint8_t sendtoFromSourceWait(uint8_t* buf, uint8_t len, uint8_t dest, uint8_t source, uint8_t flags = 0);
 
+    /// Returns the location of the payload in the transmit buffer. If the message passed to sendtoWait()
+    /// is already there, it is sent without being copied. Its contents are undefined after sendtoWait().
+    /// \return Pointer to room for up to RH_ROUTER_MAX_MESSAGE_LEN octets
+    uint8_t* txBuffer();
+
     /// Starts the receiver if it is not running already.
     /// If there is a valid message available for this node (or RH_BROADCAST_ADDRESS), 
     /// send an acknowledgement to the last hop
@@ -277,6 +455,17 @@ public:
     /// \return true if a valid message was recvived for this node copied to buf
     bool recvfromAck(uint8_t* buf, uint8_t* len, uint8_t* source = NULL, uint8_t* dest = NULL, uint8_t* id = NULL, uint8_t* flags = NULL);
 
+    /// Like recvfromAck(), but instead of copying the message, sets *buf to point at it in the receive buffer.
+    /// It remains valid until the next call to a receive function.
+    /// \param[out] buf Set to the location of the received message
+    /// \param[out] len Set to the length of the received message
+    /// \param[in] source If present and not NULL, the referenced uint8_t will be set to the SOURCE address
+    /// \param[in] dest If present and not NULL, the referenced uint8_t will be set to the DEST address
+    /// \param[in] id If present and not NULL, the referenced uint8_t will be set to the ID
+    /// \param[in] flags If present and not NULL, the referenced uint8_t will be set to the FLAGS
+    /// \return true if a valid message was received for this node
+    bool recvfromAckInPlace(uint8_t** buf, uint8_t* len, uint8_t* source = NULL, uint8_t* dest = NULL, uint8_t* id = NULL, uint8_t* flags = NULL);
+
     /// Starts the receiver if it is not running already.
     /// Similar to recvfromAck(), this will block until either a valid message available for this node
     /// or the timeout expires. 
@@ -300,17 +489,38 @@ protected:
     /// \param [in] messageLen Length of message in octets
     virtual void peekAtMessage(RoutedMessage* message, uint8_t messageLen);
 
-    /// Finds the next-hop route and sends the message via RHReliableDatagram::sendtoWait().
+    /// Finds the next-hop route and sends the message via RHReliableDatagram::sendtoWait() on the 
+    /// route's interface. Broadcasts are sent on every interface.
     /// This is virtual, which lets subclasses override or intercept the route() function.
     /// Called by sendtoWait after the message header has been filled in.
     /// \param [in] message Pointer to the RHRouter message to be sent.
     /// \param [in] messageLen Length of message in octets
     virtual uint8_t route(RoutedMessage* message, uint8_t messageLen);
 
+    /// Fills in the header of a message in place and routes it. The message can be in any buffer 
+    /// with room for the header, such as _txMessage or _rxMessage.
+    /// \param [in] message The message, with the payload already in message->data
+    /// \param [in] len Number of octets in the payload
+    /// \param [in] dest The destination node address
+    /// \param [in] source The originating node address
+    /// \param [in] flags Flags to deliver end-to-end
+    /// \return The result code, as for sendtoWait()
+    uint8_t sendInPlaceWait(RoutedMessage* message, uint8_t len, uint8_t dest, uint8_t source, uint8_t flags = 0);
+
     /// Deletes a specific rout entry from therouting table
     /// \param [in] index The 0 based index of the routing table entry to delete
     void deleteRoute(uint8_t index);
 
+    /// Finds the index of the routing table entry for dest, regardless of its state
+    /// \param [in] dest The destination node address
+    /// \return The 0 based index of the entry, or RH_ROUTE_INDEX_NONE if there is none
+    uint8_t findRoute(uint8_t dest);
+
+    /// Moves a routing table entry to the most recently used end of the LRU list
+    /// and updates its lastUsed time
+    /// \param [in] index The 0 based index of the routing table entry
+    void touchRoute(uint8_t index);
+
     /// The last end-to-end sequence number to be used
     /// Defaults to 0
     uint8_t _lastE2ESequenceNumber;
@@ -322,13 +532,70 @@ protected:
     /// Flag to set if packets are forwarded or not
     bool _isa_router;
 
-private:
+    /// Transmit buffer
+    RoutedMessage        _txMessage;
+
+    /// Receive buffer. Messages being forwarded are sent from here
+    RoutedMessage        _rxMessage;
+
+    /// The interface the message in _rxMessage arrived on
+    uint8_t              _rxInterface;
+
+    /// The address of the node that sent the message in _rxMessage to us (the previous hop)
+    uint8_t              _rxFrom;
+
+    /// The datagram for each interface. Interface 0 is this RHRouter
+    RHReliableDatagram*  _interfaces[RH_ROUTER_MAX_INTERFACES];
+
+    /// The cost of each hop over each interface
+    uint8_t              _interfaceCosts[RH_ROUTER_MAX_INTERFACES];
 
-    /// Temporary mesage buffer
-    static RoutedMessage _tmpMessage;
+    /// The number of interfaces
+    uint8_t              _interfaceCount;
+
+    /// Set once init() has been called, after which added interfaces are not initialised
+    bool                 _initialised;
+
+private:
 
     /// Local routing table
     RoutingTableEntry    _routes[RH_ROUTING_TABLE_SIZE];
+
+    /// Index of the first entry in each hash bucket, indexed by dest % RH_ROUTING_HASH_SIZE
+    uint8_t              _routeBuckets[RH_ROUTING_HASH_SIZE];
+
+    /// Index of the next entry in the same hash bucket (or free list) for each entry
+    uint8_t              _routeChain[RH_ROUTING_TABLE_SIZE];
+
+    /// Index of the first unused entry
+    uint8_t              _routeFree;
+
+    /// Index of the next older and next newer entry in the LRU list, for each entry in use
+    uint8_t              _routeOlder[RH_ROUTING_TABLE_SIZE];
+    uint8_t              _routeNewer[RH_ROUTING_TABLE_SIZE];
+
+    /// Index of the least recently used entry
+    uint8_t              _routeOldest;
+
+    /// Index of the most recently used entry
+    uint8_t              _routeNewest;
+
+    /// Maximum age of a route in milliseconds. 0 means routes never expire
+    unsigned long        _routeMaxAge;
+
+    /// Count of routing table lookups that found a route
+    uint32_t             _routeHits;
+
+    /// Count of routing table lookups that did not find a route
+    uint32_t             _routeMisses;
+
+    /// Count of routes removed to make room or because they were too old
+    uint32_t             _routeEvictions;
+
+    /// Count of messages for other nodes forwarded, not forwarded, and dropped
+    uint32_t             _forwarded;
+    uint32_t             _forwardFailed;
+    uint32_t             _dropped;
 };
 
 /// @example rf22_router_client.pde
@@ -8,7 +8,12 @@
 RHSPIDriver::RHSPIDriver(uint8_t slaveSelectPin, RHGenericSPI& spi)
     : 
     _spi(spi),
-    _slaveSelectPin(slaveSelectPin)
+    _slaveSelectPin(slaveSelectPin),
+    _shadowFirst(0),
+    _shadowLen(0),
+    _fifoRegister(RH_SPI_NO_FIFO),
+    _shadowBatch(0),
+    _shadowDirty(0)
 {
 }
 
@@ -49,6 +54,7 @@ uint8_t RHSPIDriver::spiWrite(uint8_t reg, uint8_t val)
     _spi.transfer(val); // New value follows
     digitalWrite(_slaveSelectPin, HIGH);
     _spi.endTransaction();
+    spiShadowWritten(reg, &val, 1);
     ATOMIC_BLOCK_END;
     return status;
 }
@@ -75,6 +81,7 @@ uint8_t RHSPIDriver::spiBurstWrite(uint8_t reg, const uint8_t* src, uint8_t len)
     _spi.beginTransaction();
     digitalWrite(_slaveSelectPin, LOW);
     status = _spi.transfer(reg | RH_SPI_WRITE_MASK); // Send the start address with the write mask on
+    spiShadowWritten(reg, src, len);
     while (len--)
 	_spi.transfer(*src++);
     digitalWrite(_slaveSelectPin, HIGH);
@@ -93,3 +100,97 @@ void RHSPIDriver::spiUsingInterrupt(uint8_t interruptNumber)
     _spi.usingInterrupt(interruptNumber);
 }
 
+bool RHSPIDriver::spiShadowRegisters(uint8_t reg, uint8_t len)
+{
+    if (len > RH_SPI_SHADOW_SIZE || len > 32)
+	return false;
+    spiShadowFlush();
+    _shadowLen = 0; // Not valid while it is read
+    if (len)
+	spiBurstRead(reg, _shadow, len);
+    _shadowFirst = reg & ~RH_SPI_WRITE_MASK;
+    _shadowDirty = 0;
+    _shadowLen = len;
+    return true;
+}
+
+void RHSPIDriver::spiFifoRegister(uint8_t reg)
+{
+    _fifoRegister = reg;
+}
+
+uint8_t RHSPIDriver::spiReadShadow(uint8_t reg)
+{
+    uint8_t offset = (reg & ~RH_SPI_WRITE_MASK) - _shadowFirst;
+    if (offset < _shadowLen)
+	return _shadow[offset];
+    return spiRead(reg);
+}
+
+void RHSPIDriver::spiWriteShadow(uint8_t reg, uint8_t val)
+{
+    uint8_t offset = (reg & ~RH_SPI_WRITE_MASK) - _shadowFirst;
+    if (offset >= _shadowLen)
+    {
+	spiWrite(reg, val);
+	return;
+    }
+    ATOMIC_BLOCK_START;
+    if (_shadow[offset] != val)
+    {
+	_shadow[offset] = val;
+	_shadowDirty |= 1UL << offset;
+    }
+    ATOMIC_BLOCK_END;
+    if (!_shadowBatch)
+	spiShadowFlush();
+}
+
+void RHSPIDriver::spiBatchBegin()
+{
+    _shadowBatch++;
+}
+
+void RHSPIDriver::spiBatchEnd()
+{
+    if (_shadowBatch && !--_shadowBatch)
+	spiShadowFlush();
+}
+
+void RHSPIDriver::spiShadowFlush()
+{
+    uint32_t dirty = _shadowDirty;
+    if (!dirty)
+	return;
+    uint8_t first = 0;
+    while (!(dirty & (1UL << first)))
+	first++;
+    uint8_t last = _shadowLen - 1;
+    while (!(dirty & (1UL << last)))
+	last--;
+    // Registers between the changed ones are written back with the values they already have.
+    // The write clears their dirty bits
+    if (first == last)
+	spiWrite(_shadowFirst + first, _shadow[first]);
+    else
+	spiBurstWrite(_shadowFirst + first, _shadow + first, last - first + 1);
+}
+
+// Called with interrupts disabled by the write routines
+void RHSPIDriver::spiShadowWritten(uint8_t reg, const uint8_t* src, uint8_t len)
+{
+    uint8_t i;
+    reg &= ~RH_SPI_WRITE_MASK;
+    if (reg == _fifoRegister)
+	return; // Everything went into the FIFO
+    for (i = 0; i < len; i++)
+    {
+	uint8_t offset = reg + i - _shadowFirst;
+	if (offset < _shadowLen)
+	{
+	    _shadow[offset] = src[i];
+	    _shadowDirty &= ~(1UL << offset);
+	}
+    }
+}
+
@@ -12,6 +12,14 @@
 // This is the bit in the SPI address that marks it as a write
 #define RH_SPI_WRITE_MASK 0x80
 
+// Value for spiFifoRegister() when the device has no FIFO register
+#define RH_SPI_NO_FIFO 0xff
+
+// Largest number of consecutive registers that can be shadowed. See spiShadowRegisters(). At most 32
+#ifndef RH_SPI_SHADOW_SIZE
+#define RH_SPI_SHADOW_SIZE 16
+#endif
+
 class RHGenericSPI;
 
 /////////////////////////////////////////////////////////////////////
@@ -33,6 +41,14 @@ class RHGenericSPI;
 /// in subclasses if necessaryor an alternative class, RHNRFSPIDriver can be used to access devices like 
 /// Nordic NRF series radios, which have different requirements.
 ///
+/// A driver can keep a shadow of a range of configuration registers with spiShadowRegisters(). The shadow is
+/// read once from the device, and kept up to date by every write, so spiReadShadow() needs no SPI transfer.
+/// spiWriteShadow() only writes registers whose value changes. Between spiBatchBegin() and spiBatchEnd()
+/// changes are only marked dirty, and spiBatchEnd() writes them all with one burst write, so a driver
+/// can change many fields of several registers for the cost of a single transfer. A driver for a device
+/// with a FIFO register must name it with spiFifoRegister(), because burst writes to a FIFO do not move on
+/// to the following registers.
+///
 /// Application developers are not expected to instantiate this class directly: 
 /// it is for the use of Driver developers.
 class RHSPIDriver : public RHGenericDriver
@@ -89,12 +105,70 @@ public:
     /// \param[in] interruptNumber the interrupt number
     void spiUsingInterrupt(uint8_t interruptNumber);
 
+    /// Starts keeping a shadow of a range of registers, reading their current values with one burst read.
+    /// The registers must be ones the device does not change by itself, and not a FIFO: a batch may
+    /// write them all back from the shadow
+    /// \param[in] reg Register number of the first register
+    /// \param[in] len Number of registers, at most RH_SPI_SHADOW_SIZE. 0 stops shadowing
+    /// \return true if the range was shadowed
+    bool           spiShadowRegisters(uint8_t reg, uint8_t len);
+
+    /// Names the FIFO register of the device. Every octet of a burst write to it goes into the FIFO, so
+    /// such writes leave the shadow alone
+    /// \param[in] reg Register number of the FIFO. The default RH_SPI_NO_FIFO means there is none
+    void           spiFifoRegister(uint8_t reg);
+
+    /// Reads a register, from the shadow if it is shadowed
+    /// \param[in] reg Register number
+    /// \return The value of the register, including any change not yet written in a batch
+    uint8_t        spiReadShadow(uint8_t reg);
+
+    /// Writes a register through the shadow. A shadowed register is only written if its value changes, and
+    /// not until spiBatchEnd() if a batch has begun. Other registers are written with spiWrite()
+    /// \param[in] reg Register number
+    /// \param[in] val The value to write
+    void           spiWriteShadow(uint8_t reg, uint8_t val);
+
+    /// Begins a batch of spiWriteShadow() calls. Batches may be nested
+    void           spiBatchBegin();
+
+    /// Ends a batch. At the end of the outermost one, writes all the changed shadowed registers, and any
+    /// between them, with one burst write
+    void           spiBatchEnd();
+
     protected:
+    /// Writes the changed shadowed registers now
+    void           spiShadowFlush();
+
+    /// Updates the shadow after registers have been written
+    /// \param[in] reg Register number of the first register written
+    /// \param[in] src The values written
+    /// \param[in] len Number of registers written
+    void           spiShadowWritten(uint8_t reg, const uint8_t* src, uint8_t len);
+
     /// Reference to the RHGenericSPI instance to use to transfer data with the SPI device
     RHGenericSPI&       _spi;
 
     /// The pin number of the Slave Select pin that is used to select the desired device.
     uint8_t             _slaveSelectPin;
+
+    /// Register number of the first shadowed register
+    uint8_t             _shadowFirst;
+
+    /// Number of shadowed registers
+    uint8_t             _shadowLen;
+
+    /// Register number of the FIFO, or RH_SPI_NO_FIFO
+    uint8_t             _fifoRegister;
+
+    /// Depth of nested batches
+    uint8_t             _shadowBatch;
+
+    /// Bit n is set if shadowed register n has changed since it was written
+    volatile uint32_t   _shadowDirty;
+
+    /// The shadowed register values
+    uint8_t             _shadow[RH_SPI_SHADOW_SIZE];
 };
 
 #endif
@@ -0,0 +1,353 @@
+// RHStats.cpp
+//
+// Copyright (C) 2014 Mike McCauley
+// $Id: RHStats.cpp,v 1.1 2019/09/06 04:40:40 mikem Exp $
+
+#include <RHStats.h>
+
+RHHistogram::RHHistogram()
+{
+    reset();
+}
+
+void RHHistogram::reset()
+{
+    memset(_buckets, 0, sizeof(_buckets));
+    _count = 0;
+    _sum = 0;
+    _min = 0;
+    _max = 0;
+}
+
+void RHHistogram::add(uint32_t value)
+{
+    // Bucket is the number of significant bits in value
+    uint8_t b = 0;
+    uint32_t v = value;
+    while (v && b < RH_STATS_HISTOGRAM_BUCKETS - 1)
+    {
+	v >>= 1;
+	b++;
+    }
+    if (_buckets[b] != 0xffff)
+	_buckets[b]++;
+    if (!_count || value < _min)
+	_min = value;
+    if (!_count || value > _max)
+	_max = value;
+    _count++;
+    _sum += value;
+}
+
+uint32_t RHHistogram::count() const
+{
+    return _count;
+}
+
+uint32_t RHHistogram::minimum() const
+{
+    return _min;
+}
+
+uint32_t RHHistogram::maximum() const
+{
+    return _max;
+}
+
+uint32_t RHHistogram::mean() const
+{
+    return _count ? _sum / _count : 0;
+}
+
+uint16_t RHHistogram::bucket(uint8_t bucket) const
+{
+    return bucket < RH_STATS_HISTOGRAM_BUCKETS ? _buckets[bucket] : 0;
+}
+
+uint32_t RHHistogram::bucketStart(uint8_t bucket)
+{
+    return bucket ? 1UL << (bucket - 1) : 0;
+}
+
+RHStatsWriter::RHStatsWriter(uint8_t* buf, uint16_t len)
+    : _buf(buf),
+      _size(len),
+      _len(0),
+      _sectionStart(0),
+      _iface(0),
+      _overflow(false),
+      _truncated(false)
+{
+    if (_size)
+	_buf[_len++] = RH_STATS_VERSION;
+}
+
+void RHStatsWriter::setInterface(uint8_t iface)
+{
+    _iface = iface;
+}
+
+void RHStatsWriter::beginSection(uint8_t tag)
+{
+    _sectionStart = _len;
+    _overflow = !_len || _len + 3 > _size;
+    if (_overflow)
+	return;
+    _buf[_len++] = tag;
+    _buf[_len++] = _iface;
+    _buf[_len++] = 0; // Length, filled in by endSection()
+}
+
+bool RHStatsWriter::endSection()
+{
+    uint16_t sectionLen = _len - _sectionStart - 3;
+    if (_overflow || sectionLen > 0xff)
+    {
+	// Leave it out altogether
+	_len = _sectionStart;
+	_truncated = true;
+	return false;
+    }
+    _buf[_sectionStart + 2] = sectionLen;
+    return true;
+}
+
+void RHStatsWriter::putVarint(uint32_t value)
+{
+    // LEB128: 7 bits per octet, least significant first, top bit set on all but the last
+    do
+    {
+	if (_overflow || _len >= _size)
+	{
+	    _overflow = true;
+	    return;
+	}
+	uint8_t octet = value & 0x7f;
+	value >>= 7;
+	_buf[_len++] = value ? (octet | 0x80) : octet;
+    } while (value);
+}
+
+void RHStatsWriter::putArray(const uint16_t* values, uint8_t count)
+{
+    putVarint(count);
+    uint8_t i;
+    for (i = 0; i < count; i++)
+	putVarint(values[i]);
+}
+
+void RHStatsWriter::putHistogram(const RHHistogram& histogram)
+{
+    putVarint(histogram._count);
+    putVarint(histogram._sum);
+    putVarint(histogram._min);
+    putVarint(histogram._max);
+    uint32_t mask = 0;
+    uint8_t i;
+    for (i = 0; i < RH_STATS_HISTOGRAM_BUCKETS; i++)
+	if (histogram._buckets[i])
+	    mask |= 1UL << i;
+    putVarint(mask);
+    for (i = 0; i < RH_STATS_HISTOGRAM_BUCKETS; i++)
+	if (histogram._buckets[i])
+	    putVarint(histogram._buckets[i]);
+}
+
+uint16_t RHStatsWriter::length()
+{
+    return _len;
+}
+
+bool RHStatsWriter::truncated()
+{
+    return _truncated;
+}
+
+RHStatsReader::RHStatsReader(const uint8_t* buf, uint16_t len)
+    : _buf(buf),
+      _len(len),
+      _pos(len ? 1 : 0),
+      _sectionEnd(_pos)
+{
+}
+
+uint8_t RHStatsReader::version()
+{
+    return _len ? _buf[0] : 0;
+}
+
+bool RHStatsReader::nextSection(uint8_t* tag, uint8_t* iface)
+{
+    _pos = _sectionEnd;
+    if (_pos + 3 > _len)
+    {
+	_sectionEnd = _pos = _len;
+	return false;
+    }
+    *tag = _buf[_pos++];
+    *iface = _buf[_pos++];
+    uint8_t sectionLen = _buf[_pos++];
+    _sectionEnd = _pos + sectionLen;
+    if (_sectionEnd > _len)
+	_sectionEnd = _len; // Truncated in transit
+    return true;
+}
+
+bool RHStatsReader::getVarint(uint32_t* value)
+{
+    *value = 0;
+    uint8_t shift = 0;
+    while (_pos < _sectionEnd)
+    {
+	uint8_t octet = _buf[_pos++];
+	if (shift < 32)
+	    *value |= (uint32_t)(octet & 0x7f) << shift;
+	shift += 7;
+	if (!(octet & 0x80))
+	    return true;
+    }
+    *value = 0;
+    return false;
+}
+
+bool RHStatsReader::getArray(uint16_t* values, uint8_t count)
+{
+    uint32_t n, value;
+    memset(values, 0, count * sizeof(*values));
+    if (!getVarint(&n))
+	return false;
+    uint32_t i;
+    for (i = 0; i < n; i++)
+    {
+	if (!getVarint(&value))
+	    return false;
+	if (i < count)
+	    values[i] = value;
+    }
+    return true;
+}
+
+bool RHStatsReader::getHistogram(RHHistogram* histogram)
+{
+    uint32_t mask, value;
+    histogram->reset();
+    if (   !getVarint(&histogram->_count)
+	|| !getVarint(&histogram->_sum)
+	|| !getVarint(&histogram->_min)
+	|| !getVarint(&histogram->_max)
+	|| !getVarint(&mask))
+	return false;
+    // Buckets beyond ours are added to our last one
+    uint8_t i;
+    for (i = 0; i < 32; i++)
+    {
+	if (!(mask & (1UL << i)))
+	    continue;
+	if (!getVarint(&value))
+	    return false;
+	uint8_t b = i < RH_STATS_HISTOGRAM_BUCKETS ? i : RH_STATS_HISTOGRAM_BUCKETS - 1;
+	value += histogram->_buckets[b];
+	histogram->_buckets[b] = value > 0xffff ? 0xffff : value;
+    }
+    return true;
+}
+
+#ifdef RH_HAVE_SERIAL
+// Names of the fields in each section, in order. Names starting with '#' are histograms,
+// with '[' arrays
+static const char* const driverFields[] =
+    { "rxBad", "rxGood", "txGood", "txAirtime", "elapsed", "dutyCycle", NULL };
+static const char* const reliableFields[] =
+    { "sent", "delivered", "failed", "retransmissions", "acksSent", "acksReceived", "duplicates",
+      "pending", "pendingMax", "heldAcks", "[retries", "#ackRtt", NULL };
+static const char* const routerFields[] =
+    { "routeHits", "routeMisses", "routeEvictions", "forwarded", "forwardFailed", "dropped",
+      "routes", "routesMax", NULL };
+static const char* const meshFields[] =
+    { "discoveries", "resolved", "failed", "requestsForwarded", "routeFailuresSent",
+      "discovering", "queued", "queueMax", "queueFull", "#discoveryTime", NULL };
+#endif
+
+void RHStatsReader::print(const uint8_t* buf, uint16_t len)
+{
+#ifdef RH_HAVE_SERIAL
+    RHStatsReader reader(buf, len);
+    uint8_t tag, iface;
+    while (reader.nextSection(&tag, &iface))
+    {
+	const char* const* names = NULL;
+	const char* section = "unknown";
+	switch (tag)
+	{
+	case RH_STATS_DRIVER:   names = driverFields;   section = "driver";   break;
+	case RH_STATS_RELIABLE: names = reliableFields; section = "reliable"; break;
+	case RH_STATS_ROUTER:   names = routerFields;   section = "router";   break;
+	case RH_STATS_MESH:     names = meshFields;     section = "mesh";     break;
+	}
+	Serial.print(section);
+	Serial.print(" ");
+	Serial.print(iface, DEC);
+	Serial.println(":");
+	uint8_t i;
+	for (i = 0; names && names[i]; i++)
+	{
+	    const char* name = names[i];
+	    if (name[0] == '#')
+	    {
+		RHHistogram h;
+		if (!reader.getHistogram(&h))
+		    break;
+		Serial.print("  ");
+		Serial.print(name + 1);
+		Serial.print(": count ");
+		Serial.print(h.count(), DEC);
+		Serial.print(" min ");
+		Serial.print(h.minimum(), DEC);
+		Serial.print(" mean ");
+		Serial.print(h.mean(), DEC);
+		Serial.print(" max ");
+		Serial.print(h.maximum(), DEC);
+		uint8_t b;
+		for (b = 0; b < RH_STATS_HISTOGRAM_BUCKETS; b++)
+		{
+		    if (!h.bucket(b))
+			continue;
+		    Serial.print(" >=");
+		    Serial.print(RHHistogram::bucketStart(b), DEC);
+		    Serial.print(":");
+		    Serial.print((unsigned int)h.bucket(b), DEC);
+		}
+	    }
+	    else if (name[0] == '[')
+	    {
+		uint16_t values[RH_STATS_RETRY_BUCKETS];
+		if (!reader.getArray(values, RH_STATS_RETRY_BUCKETS))
+		    break;
+		Serial.print("  ");
+		Serial.print(name + 1);
+		Serial.print(":");
+		uint8_t j;
+		for (j = 0; j < RH_STATS_RETRY_BUCKETS; j++)
+		{
+		    Serial.print(" ");
+		    Serial.print((unsigned int)values[j], DEC);
+		}
+	    }
+	    else
+	    {
+		uint32_t value;
+		if (!reader.getVarint(&value))
+		    break;
+		Serial.print("  ");
+		Serial.print(name);
+		Serial.print(": ");
+		Serial.print(value, DEC);
+	    }
+	    Serial.println("");
+	}
+    }
+#else
+    (void)buf;
+    (void)len;
+#endif
+}
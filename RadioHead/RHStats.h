@@ -0,0 +1,298 @@
+// RHStats.h
+// Author: Mike McCauley (mikem@airspayce.com)
+// Copyright (C) 2014 Mike McCauley
+// $Id: RHStats.h,v 1.1 2019/09/06 04:40:40 mikem Exp $
+
+#ifndef RHStats_h
+#define RHStats_h
+
+#include <RadioHead.h>
+
+// Version of the binary statistics format written by RHStatsWriter
+#define RH_STATS_VERSION 1
+
+// Section tags in the binary statistics format
+#define RH_STATS_DRIVER   1
+#define RH_STATS_RELIABLE 2
+#define RH_STATS_ROUTER   3
+#define RH_STATS_MESH     4
+
+// Number of buckets in an RHHistogram. Bucket 0 counts values of 0, bucket n counts values
+// from 2^(n-1) to 2^n - 1, and the last bucket also counts everything larger
+#ifndef RH_STATS_HISTOGRAM_BUCKETS
+ #if defined(__AVR__)
+  #define RH_STATS_HISTOGRAM_BUCKETS 12
+ #else
+  #define RH_STATS_HISTOGRAM_BUCKETS 16
+ #endif
+#endif
+
+// Number of buckets in the distribution of retries needed to deliver a message.
+// The last bucket also counts messages that needed more retries
+#ifndef RH_STATS_RETRY_BUCKETS
+#define RH_STATS_RETRY_BUCKETS 8
+#endif
+
+/////////////////////////////////////////////////////////////////////
+/// \class RHHistogram RHStats.h <RHStats.h>
+/// \brief Histogram of values, such as times in milliseconds, in power of 2 buckets
+///
+/// Adding a value only increments a counter, so it is cheap enough to do for every message.
+/// Also keeps the number, sum, minimum and maximum of the values added.
+class RHHistogram
+{
+public:
+    /// Constructor. The histogram is empty
+    RHHistogram();
+
+    /// Empties the histogram
+    void     reset();
+
+    /// Adds a value to the histogram
+    /// \param[in] value The value
+    void     add(uint32_t value);
+
+    /// Returns the number of values added
+    /// \return The count
+    uint32_t count() const;
+
+    /// Returns the smallest value added
+    /// \return The minimum, or 0 if the histogram is empty
+    uint32_t minimum() const;
+
+    /// Returns the largest value added
+    /// \return The maximum, or 0 if the histogram is empty
+    uint32_t maximum() const;
+
+    /// Returns the mean of the values added
+    /// \return The mean, or 0 if the histogram is empty
+    uint32_t mean() const;
+
+    /// Returns the number of values in a bucket
+    /// \param[in] bucket 0 to RH_STATS_HISTOGRAM_BUCKETS - 1
+    /// \return The count. Counts stop at 65535
+    uint16_t bucket(uint8_t bucket) const;
+
+    /// Returns the smallest value that is counted in a bucket
+    /// \param[in] bucket 0 to RH_STATS_HISTOGRAM_BUCKETS - 1
+    /// \return The value
+    static uint32_t bucketStart(uint8_t bucket);
+
+protected:
+    friend class RHStatsWriter;
+    friend class RHStatsReader;
+
+    /// Number of values in each bucket
+    uint16_t _buckets[RH_STATS_HISTOGRAM_BUCKETS];
+
+    /// Number, sum, minimum and maximum of the values added
+    uint32_t _count;
+    uint32_t _sum;
+    uint32_t _min;
+    uint32_t _max;
+};
+
+/// Snapshot of the statistics of a driver. See RHGenericDriver::driverStats()
+typedef struct
+{
+    uint16_t    rxBad;      ///< Bad messages received
+    uint16_t    rxGood;     ///< Good messages received
+    uint16_t    txGood;     ///< Messages transmitted
+    uint32_t    txAirtime;  ///< Time spent transmitting in milliseconds, for drivers that measure it
+    uint32_t    elapsed;    ///< Milliseconds since the statistics were reset
+    uint16_t    dutyCycle;  ///< txAirtime as a proportion of elapsed, in units of 0.01%
+} RHDriverStats;
+
+/// Snapshot of the statistics of an RHReliableDatagram. See RHReliableDatagram::reliableStats()
+typedef struct
+{
+    uint32_t    sent;            ///< Messages sent to a single address (not counting retransmissions)
+    uint32_t    delivered;       ///< Messages acknowledged
+    uint32_t    failed;          ///< Messages not acknowledged after all retries
+    uint32_t    retransmissions; ///< Retransmissions
+    uint32_t    acksSent;        ///< ACK messages sent, including those carrying held acknowledgements
+    uint32_t    acksReceived;    ///< Acknowledgements received for messages we sent
+    uint32_t    duplicates;      ///< Duplicate messages received and dropped
+    uint8_t     pending;         ///< Messages sent with sendtoAsync() awaiting acknowledgement now
+    uint8_t     pendingMax;      ///< Most messages ever awaiting acknowledgement at once
+    uint8_t     heldAcks;        ///< Addresses with delayed acknowledgements being held now
+    uint16_t    retries[RH_STATS_RETRY_BUCKETS]; ///< Delivered messages by the number of retries they needed
+    RHHistogram ackRtt;          ///< Round trip times of messages acknowledged first time, in milliseconds
+} RHReliableStats;
+
+/// Snapshot of the statistics of an RHRouter. See RHRouter::routerStats()
+typedef struct
+{
+    uint32_t    routeHits;       ///< Routing table lookups that found a route
+    uint32_t    routeMisses;     ///< Routing table lookups that did not find a route
+    uint32_t    routeEvictions;  ///< Routes removed to make room or because they were too old
+    uint32_t    forwarded;       ///< Messages for other nodes forwarded to the next hop
+    uint32_t    forwardFailed;   ///< Messages for other nodes that could not be forwarded
+    uint32_t    dropped;         ///< Messages for other nodes dropped because of max_hops, or because we are not a router
+    uint8_t     routes;          ///< Routes in the routing table now
+    uint8_t     routesMax;       ///< Size of the routing table
+} RHRouterStats;
+
+/// Snapshot of the statistics of an RHMesh. See RHMesh::meshStats()
+typedef struct
+{
+    uint32_t    discoveries;       ///< Route discoveries started
+    uint32_t    resolved;          ///< Route discoveries that found a route
+    uint32_t    failed;            ///< Route discoveries that gave up
+    uint32_t    requestsForwarded; ///< Route discovery requests from other nodes rebroadcast
+    uint32_t    routeFailuresSent; ///< Route failures reported to the originators of messages
+    uint8_t     discovering;       ///< Route discoveries in progress now
+    uint8_t     queued;            ///< Messages waiting for route discovery now
+    uint8_t     queueMax;          ///< Most messages ever waiting for route discovery at once
+    uint32_t    queueFull;         ///< Messages refused because the queue was full
+    RHHistogram discoveryTime;     ///< Time to find routes, in milliseconds
+} RHMeshStats;
+
+/////////////////////////////////////////////////////////////////////
+/// \class RHStatsWriter RHStats.h <RHStats.h>
+/// \brief Writes statistics in a compact binary format
+///
+/// The format is small enough to send in a RadioHead message, or to dump over a serial port, and can
+/// be extended without breaking older readers. It starts with 1 octet, RH_STATS_VERSION, followed by
+/// sections. Each section is
+/// - 1 octet tag, one of RH_STATS_DRIVER, RH_STATS_RELIABLE, RH_STATS_ROUTER or RH_STATS_MESH
+/// - 1 octet interface index: 0, or the RHRouter interface index for the layers of other interfaces
+/// - 1 octet length of the rest of the section
+/// - the fields of the statistics structure, in order, as unsigned LEB128 variable length integers.
+///   Arrays are written as the number of entries followed by the entries.
+///   Histograms are written as count, sum, minimum, maximum, a bitmask of the buckets that are not
+///   empty, and the count of each of those buckets
+///
+/// New fields are only ever added at the end of a section, so readers ignore fields and sections
+/// they do not know about. If a section does not fit in the buffer, it is left out.
+///
+/// Normally you would not use this directly, but call RHDatagram::serializeStats()
+class RHStatsWriter
+{
+public:
+    /// Constructor. Writes the version octet
+    /// \param[in] buf Where to write
+    /// \param[in] len Size of buf in octets
+    RHStatsWriter(uint8_t* buf, uint16_t len);
+
+    /// Sets the interface index written in the following sections
+    /// \param[in] iface The interface index
+    void     setInterface(uint8_t iface);
+
+    /// Starts a section
+    /// \param[in] tag One of RH_STATS_*
+    void     beginSection(uint8_t tag);
+
+    /// Finishes a section. If it did not fit, it is removed
+    /// \return true if the section fitted
+    bool     endSection();
+
+    /// Writes a number
+    /// \param[in] value The number
+    void     putVarint(uint32_t value);
+
+    /// Writes an array of numbers, preceded by the number of entries
+    /// \param[in] values The numbers
+    /// \param[in] count Number of entries
+    void     putArray(const uint16_t* values, uint8_t count);
+
+    /// Writes a histogram
+    /// \param[in] histogram The histogram
+    void     putHistogram(const RHHistogram& histogram);
+
+    /// Returns the number of octets written
+    /// \return The length of the statistics, or 0 if even the version did not fit
+    uint16_t length();
+
+    /// Tells whether any section was left out because it did not fit
+    /// \return true if some statistics are missing
+    bool     truncated();
+
+private:
+    uint8_t* _buf;
+    uint16_t _size;
+    uint16_t _len;
+
+    /// Where the current section started
+    uint16_t _sectionStart;
+
+    /// Interface index for new sections
+    uint8_t  _iface;
+
+    /// true if the current section has run out of room
+    bool     _overflow;
+
+    /// true if any section has been left out
+    bool     _truncated;
+};
+
+/////////////////////////////////////////////////////////////////////
+/// \class RHStatsReader RHStats.h <RHStats.h>
+/// \brief Reads statistics written by RHStatsWriter
+///
+/// \code
+/// RHStatsReader reader(buf, len);
+/// uint8_t tag, iface;
+/// while (reader.nextSection(&tag, &iface))
+/// {
+///     if (tag == RH_STATS_RELIABLE)
+///     {
+///         uint32_t sent, delivered;
+///         reader.getVarint(&sent);
+///         reader.getVarint(&delivered);
+///         ...
+///     }
+/// }
+/// \endcode
+class RHStatsReader
+{
+public:
+    /// Constructor
+    /// \param[in] buf The statistics
+    /// \param[in] len Length of the statistics in octets
+    RHStatsReader(const uint8_t* buf, uint16_t len);
+
+    /// Returns the version of the format
+    /// \return The version, or 0 if there are no statistics
+    uint8_t  version();
+
+    /// Moves to the next section, skipping any fields of the current section that have not been read
+    /// \param[out] tag Set to the tag of the section
+    /// \param[out] iface Set to the interface index of the section
+    /// \return true if there is another section
+    bool     nextSection(uint8_t* tag, uint8_t* iface);
+
+    /// Reads the next number in the current section
+    /// \param[out] value Set to the number, or 0 at the end of the section
+    /// \return true if there was a number
+    bool     getVarint(uint32_t* value);
+
+    /// Reads an array of numbers written by RHStatsWriter::putArray()
+    /// \param[out] values Set to the entries. Extra entries are skipped, missing ones are set to 0
+    /// \param[in] count Number of entries in values
+    /// \return true if there was an array
+    bool     getArray(uint16_t* values, uint8_t count);
+
+    /// Reads a histogram written by RHStatsWriter::putHistogram()
+    /// \param[out] histogram Set to the histogram
+    /// \return true if there was a histogram
+    bool     getHistogram(RHHistogram* histogram);
+
+    /// If RH_HAVE_SERIAL is defined, prints all the statistics in a buffer, with the names of the fields,
+    /// using Serial
+    /// \param[in] buf The statistics
+    /// \param[in] len Length of the statistics in octets
+    static void print(const uint8_t* buf, uint16_t len);
+
+private:
+    const uint8_t* _buf;
+    uint16_t       _len;
+
+    /// Position of the next octet to read
+    uint16_t       _pos;
+
+    /// End of the current section
+    uint16_t       _sectionEnd;
+};
+
+#endif
@@ -0,0 +1,314 @@
+// RH_Loopback.cpp
+//
+// Copyright (C) 2014 Mike McCauley
+// $Id: RH_Loopback.cpp,v 1.1 2019/09/06 04:40:40 mikem Exp $
+
+#include <RadioHead.h>
+
+// This can only build on Linux and compatible systems
+#if (RH_PLATFORM == RH_PLATFORM_UNIX)
+
+#include <RH_Loopback.h>
+#include <thread>
+
+#if (RH_LOOPBACK_RING_LEN & (RH_LOOPBACK_RING_LEN - 1))
+#error RH_LOOPBACK_RING_LEN must be a power of 2
+#endif
+
+RHLoopbackRing::RHLoopbackRing()
+    : _head(0),
+      _tail(0)
+{
+}
+
+RHLoopbackFrame* RHLoopbackRing::back()
+{
+    uint32_t head = _head.load(std::memory_order_relaxed);
+    if (head - _tail.load(std::memory_order_acquire) == RH_LOOPBACK_RING_LEN)
+	return NULL;
+    return &_frames[head & (RH_LOOPBACK_RING_LEN - 1)];
+}
+
+void RHLoopbackRing::push()
+{
+    _head.store(_head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+RHLoopbackFrame* RHLoopbackRing::front()
+{
+    uint32_t tail = _tail.load(std::memory_order_relaxed);
+    if (_head.load(std::memory_order_acquire) == tail)
+	return NULL;
+    return &_frames[tail & (RH_LOOPBACK_RING_LEN - 1)];
+}
+
+void RHLoopbackRing::pop()
+{
+    _tail.store(_tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+RHLoopbackMedium::RHLoopbackMedium()
+    : _nodes(0),
+      _loss(0),
+      _reorder(0),
+      _minDelay(0),
+      _maxDelay(0),
+      _holdback(0),
+      _seed(1)
+{
+    memset(_rings, 0, sizeof(_rings));
+}
+
+RHLoopbackMedium::~RHLoopbackMedium()
+{
+    for (uint8_t from = 0; from < _nodes; from++)
+	for (uint8_t to = 0; to < _nodes; to++)
+	    delete _rings[from][to];
+}
+
+void RHLoopbackMedium::setLoss(float probability)
+{
+    _loss = (uint64_t)(probability * 4294967296.0);
+}
+
+void RHLoopbackMedium::setDelay(uint16_t minimum, uint16_t maximum)
+{
+    _minDelay = minimum;
+    _maxDelay = maximum < minimum ? minimum : maximum;
+}
+
+void RHLoopbackMedium::setReorder(float probability, uint16_t holdback)
+{
+    _reorder = (uint64_t)(probability * 4294967296.0);
+    _holdback = holdback;
+}
+
+void RHLoopbackMedium::setSeed(uint32_t seed)
+{
+    _seed = seed;
+}
+
+uint8_t RHLoopbackMedium::nodes()
+{
+    return _nodes;
+}
+
+int8_t RHLoopbackMedium::attach(uint32_t* random)
+{
+    if (_nodes >= RH_LOOPBACK_MAX_NODES)
+	return -1;
+    uint8_t index = _nodes++;
+    for (uint8_t other = 0; other < index; other++)
+    {
+	_rings[index][other] = new RHLoopbackRing;
+	_rings[other][index] = new RHLoopbackRing;
+    }
+    // Spread the seeds out, xorshift gives similar sequences for similar seeds
+    *random = (_seed + index) * 2654435761U;
+    if (!*random)
+	*random = 1; // xorshift never leaves 0
+    return index;
+}
+
+RHLoopbackRing* RHLoopbackMedium::ring(uint8_t from, uint8_t to)
+{
+    return _rings[from][to];
+}
+
+RH_Loopback::RH_Loopback(RHLoopbackMedium& medium)
+    : _medium(medium),
+      _index(-1),
+      _random(1),
+      _pendingLen(0),
+      _rxIndex(-1),
+      _nextRing(0),
+      _sequence(0),
+      _overflows(0)
+{
+}
+
+bool RH_Loopback::init()
+{
+    if (!RHGenericDriver::init())
+	return false;
+    if (_index < 0 && (_index = _medium.attach(&_random)) < 0)
+	return false;
+    _mode = RHModeIdle;
+    return true;
+}
+
+uint32_t RH_Loopback::random32()
+{
+    _random ^= _random << 13;
+    _random ^= _random >> 17;
+    _random ^= _random << 5;
+    return _random;
+}
+
+void RH_Loopback::drainRings()
+{
+    uint8_t nodes = _medium._nodes;
+    for (uint8_t i = 0; i < nodes && _pendingLen < RH_LOOPBACK_PENDING_LEN; i++)
+    {
+	uint8_t from = (_nextRing + i) % nodes;
+	if (from == _index)
+	    continue;
+	RHLoopbackRing* ring = _medium.ring(from, _index);
+	RHLoopbackFrame* frame;
+	while (_pendingLen < RH_LOOPBACK_PENDING_LEN && (frame = ring->front()))
+	{
+	    // Like a radio, only keep messages addressed to us
+	    if (_promiscuous || frame->to == _thisAddress || frame->to == RH_BROADCAST_ADDRESS)
+	    {
+		RHLoopbackFrame* pending = &_pending[_pendingLen++];
+		pending->deliverAt = frame->deliverAt;
+		pending->sequence  = _sequence++;
+		pending->to        = frame->to;
+		pending->from      = frame->from;
+		pending->id        = frame->id;
+		pending->flags     = frame->flags;
+		pending->len       = frame->len;
+		memcpy(pending->payload, frame->payload, frame->len);
+	    }
+	    ring->pop();
+	}
+    }
+    if (nodes)
+	_nextRing = (_nextRing + 1) % nodes;
+}
+
+bool RH_Loopback::available()
+{
+    if (_rxIndex >= 0)
+	return true;
+    if (_index < 0)
+	return false;
+    _mode = RHModeRx;
+    drainRings();
+
+    // Find the message that is due first. Without delays they are all due now, in the order they came
+    bool delayed = _medium._maxDelay || _medium._reorder;
+    unsigned long now = delayed ? millis() : 0;
+    for (uint8_t i = 0; i < _pendingLen; i++)
+    {
+	RHLoopbackFrame* frame = &_pending[i];
+	if (delayed && (long)(frame->deliverAt - now) > 0)
+	    continue;
+	if (_rxIndex < 0 
+	    || (long)(frame->deliverAt - _pending[_rxIndex].deliverAt) < 0
+	    || (frame->deliverAt == _pending[_rxIndex].deliverAt && frame->sequence < _pending[_rxIndex].sequence))
+	    _rxIndex = i;
+    }
+    if (_rxIndex < 0)
+	return false;
+    RHLoopbackFrame* frame = &_pending[_rxIndex];
+    _rxHeaderTo    = frame->to;
+    _rxHeaderFrom  = frame->from;
+    _rxHeaderId    = frame->id;
+    _rxHeaderFlags = frame->flags;
+    _rxGood++;
+    return true;
+}
+
+void RH_Loopback::waitAvailable()
+{
+    while (!available())
+	std::this_thread::yield();
+}
+
+bool RH_Loopback::waitAvailableTimeout(uint16_t timeout)
+{
+    unsigned long starttime = millis();
+    while (!available())
+    {
+	if (millis() - starttime >= timeout)
+	    return false;
+	std::this_thread::yield();
+    }
+    return true;
+}
+
+bool RH_Loopback::recv(uint8_t* buf, uint8_t* len)
+{
+    if (!available())
+	return false;
+
+    RHLoopbackFrame* frame = &_pending[_rxIndex];
+    if (buf && len)
+    {
+	if (*len > frame->len)
+	    *len = frame->len;
+	memcpy(buf, frame->payload, *len);
+    }
+    // Fill the gap with the last one, the sequence numbers keep the order
+    RHLoopbackFrame* last = &_pending[--_pendingLen];
+    if (frame != last)
+    {
+	frame->deliverAt = last->deliverAt;
+	frame->sequence  = last->sequence;
+	frame->to        = last->to;
+	frame->from      = last->from;
+	frame->id        = last->id;
+	frame->flags     = last->flags;
+	frame->len       = last->len;
+	memcpy(frame->payload, last->payload, last->len);
+    }
+    _rxIndex = -1;
+    return true;
+}
+
+bool RH_Loopback::send(const uint8_t* data, uint8_t len)
+{
+    if (len > RH_LOOPBACK_MAX_MESSAGE_LEN || _index < 0)
+	return false;
+    if (!waitCAD())
+	return false;
+
+    bool delayed = _medium._maxDelay || _medium._reorder;
+    unsigned long now = delayed ? millis() : 0;
+    for (uint8_t to = 0; to < _medium._nodes; to++)
+    {
+	if (to == _index)
+	    continue;
+	if (_medium._loss && random32() < _medium._loss)
+	    continue;
+	RHLoopbackRing* ring = _medium.ring(_index, to);
+	RHLoopbackFrame* frame = ring->back();
+	if (!frame)
+	{
+	    _overflows++;
+	    continue;
+	}
+	frame->deliverAt = 0;
+	if (delayed)
+	{
+	    unsigned long delay = _medium._minDelay;
+	    if (_medium._maxDelay > _medium._minDelay)
+		delay += random32() % (_medium._maxDelay - _medium._minDelay + 1);
+	    if (_medium._reorder && random32() < _medium._reorder)
+		delay += _medium._holdback;
+	    frame->deliverAt = now + delay;
+	}
+	frame->to    = _txHeaderTo;
+	frame->from  = _txHeaderFrom;
+	frame->id    = _txHeaderId;
+	frame->flags = _txHeaderFlags;
+	frame->len   = len;
+	memcpy(frame->payload, data, len);
+	ring->push();
+    }
+    _txGood++;
+    return true;
+}
+
+uint8_t RH_Loopback::maxMessageLength()
+{
+    return RH_LOOPBACK_MAX_MESSAGE_LEN;
+}
+
+uint16_t RH_Loopback::overflows()
+{
+    return _overflows;
+}
+
+#endif
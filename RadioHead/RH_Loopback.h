@@ -0,0 +1,279 @@
+// RH_Loopback.h
+// Author: Mike McCauley (mikem@airspayce.com)
+// Copyright (C) 2014 Mike McCauley
+// $Id: RH_Loopback.h,v 1.1 2019/09/06 04:40:40 mikem Exp $
+
+#ifndef RH_Loopback_h
+#define RH_Loopback_h
+
+#include <RHGenericDriver.h>
+#include <atomic>
+
+// The largest payload the loopback medium carries, the same as RH_TCP
+#define RH_LOOPBACK_MAX_MESSAGE_LEN 251
+
+// Most drivers that can attach to one RHLoopbackMedium
+#ifndef RH_LOOPBACK_MAX_NODES
+#define RH_LOOPBACK_MAX_NODES 16
+#endif
+
+// Number of messages each ring from one driver to another can hold. Must be a power of 2.
+// Messages sent to a full ring are lost, as they would be by a receiver that is not keeping up
+#ifndef RH_LOOPBACK_RING_LEN
+#define RH_LOOPBACK_RING_LEN 16
+#endif
+
+// Number of messages each driver can hold while they are delayed or reordered
+#ifndef RH_LOOPBACK_PENDING_LEN
+#define RH_LOOPBACK_PENDING_LEN 16
+#endif
+
+class RH_Loopback;
+
+// One message in transit through an RHLoopbackMedium
+typedef struct
+{
+    unsigned long deliverAt; ///< millis() when it may be received, 0 for immediately
+    uint32_t      sequence;  ///< Order the receiver took it from its ring, so messages due together stay in order
+    uint8_t       to;        ///< TO header
+    uint8_t       from;      ///< FROM header
+    uint8_t       id;        ///< ID header
+    uint8_t       flags;     ///< FLAGS header
+    uint8_t       len;       ///< Length of the payload
+    uint8_t       payload[RH_LOOPBACK_MAX_MESSAGE_LEN]; ///< Payload
+} RHLoopbackFrame;
+
+/////////////////////////////////////////////////////////////////////
+/// \class RHLoopbackRing RH_Loopback.h <RH_Loopback.h>
+/// \brief Lock-free single producer, single consumer ring of messages from one RH_Loopback to another
+///
+/// Only the sending driver writes to a ring and only the receiving driver reads from it, so
+/// each can be used in its own thread without locks.
+class RHLoopbackRing
+{
+public:
+    /// Constructor
+    RHLoopbackRing();
+
+    /// Returns the free slot the next message can be written into, for the producer
+    /// \return The slot, or NULL if the ring is full
+    RHLoopbackFrame* back();
+
+    /// Makes the message written into back() visible to the consumer
+    void push();
+
+    /// Returns the oldest message, for the consumer
+    /// \return The message, or NULL if the ring is empty
+    RHLoopbackFrame* front();
+
+    /// Removes the oldest message, after the consumer has finished with it
+    void pop();
+
+private:
+    /// Number of messages pushed and popped, modulo 2^32
+    std::atomic<uint32_t> _head;
+    std::atomic<uint32_t> _tail;
+
+    /// The messages
+    RHLoopbackFrame       _frames[RH_LOOPBACK_RING_LEN];
+};
+
+/////////////////////////////////////////////////////////////////////
+/// \class RHLoopbackMedium RH_Loopback.h <RH_Loopback.h>
+/// \brief In-memory broadcast medium shared by RH_Loopback drivers in one process
+///
+/// Every message sent by a driver attached to the medium is heard by all the others, as if they
+/// were radios in range of each other. There is a ring (RHLoopbackRing) from each driver to each
+/// other driver. The medium can lose, delay and reorder messages, to exercise the managers'
+/// retransmission and duplicate detection. The random choices are made from a seeded generator
+/// in each sending driver, so the same sequence of sends gives the same impairments each time.
+///
+/// Configure the medium and init() all the drivers before any of them start sending. After that,
+/// each driver may be used from its own thread.
+class RHLoopbackMedium
+{
+public:
+    /// Constructor
+    RHLoopbackMedium();
+
+    /// Destructor. Frees the rings
+    ~RHLoopbackMedium();
+
+    /// Sets the probability of losing each message, independently for each receiver. Defaults to 0
+    /// \param[in] probability 0.0 to 1.0
+    void setLoss(float probability);
+
+    /// Sets how long messages take to arrive. Each message is delayed by a random time in the range.
+    /// Defaults to 0, so messages can be received as soon as they are sent
+    /// \param[in] minimum Shortest delay in milliseconds
+    /// \param[in] maximum Longest delay in milliseconds
+    void setDelay(uint16_t minimum, uint16_t maximum);
+
+    /// Sets the probability of holding back a message so that later ones overtake it. Defaults to 0
+    /// \param[in] probability 0.0 to 1.0
+    /// \param[in] holdback How long such messages are held back, in milliseconds, on top of setDelay()
+    void setReorder(float probability, uint16_t holdback);
+
+    /// Sets the seed of the random generators the drivers use to impair messages.
+    /// Drivers attached afterwards use this seed, plus their index
+    /// \param[in] seed Any number
+    void setSeed(uint32_t seed);
+
+    /// Returns the number of drivers attached
+    /// \return The number of drivers
+    uint8_t nodes();
+
+protected:
+    friend class RH_Loopback;
+
+    /// Adds a driver to the medium and creates the rings to and from it
+    /// \param[out] random Set to the seed of the driver's random generator
+    /// \return The index of the driver, or -1 if RH_LOOPBACK_MAX_NODES are already attached
+    int8_t attach(uint32_t* random);
+
+    /// Returns the ring carrying messages from one driver to another
+    /// \param[in] from Index of the sending driver
+    /// \param[in] to Index of the receiving driver
+    /// \return The ring
+    RHLoopbackRing* ring(uint8_t from, uint8_t to);
+
+private:
+    /// Number of drivers attached
+    uint8_t         _nodes;
+
+    /// _rings[from][to] carries messages from driver index from to driver index to
+    RHLoopbackRing* _rings[RH_LOOPBACK_MAX_NODES][RH_LOOPBACK_MAX_NODES];
+
+    /// Probabilities scaled to 0 to 2^32
+    uint64_t        _loss;
+    uint64_t        _reorder;
+
+    /// Delays in milliseconds
+    uint16_t        _minDelay;
+    uint16_t        _maxDelay;
+    uint16_t        _holdback;
+
+    uint32_t        _seed;
+};
+
+/////////////////////////////////////////////////////////////////////
+/// \class RH_Loopback RH_Loopback.h <RH_Loopback.h>
+/// \brief Driver to send and receive unaddressed, unreliable datagrams through memory shared with other
+/// drivers in the same process
+///
+/// \par Overview
+///
+/// This class is intended to support testing and benchmarking RadioHead manager classes on a Linux host
+/// without any system calls or external processes. Unlike RH_TCP, no ether simulator server is needed, and
+/// sending or receiving a message only copies it in memory. Unlike RH_Sim, time is real: the nodes can run
+/// in their own threads, and managers that wait, such as RHReliableDatagram::sendtoWait(), spin until the
+/// other node replies.
+///
+/// All the drivers attached to the same RHLoopbackMedium hear each other. The medium can be configured
+/// to lose, delay and reorder messages.
+///
+/// \code
+/// RHLoopbackMedium medium;
+/// RH_Loopback driver1(medium), driver2(medium);
+/// RHMesh manager1(driver1, 1), manager2(driver2, 2);
+/// medium.setLoss(0.1);
+/// manager1.init();
+/// manager2.init();
+/// // Now run each manager in its own thread
+/// \endcode
+///
+/// \par Prerequisites
+///
+/// g++ compiler with C++11 installed and in your $PATH, on Linux or another system with threads.
+/// Build sketches with tools/simBuild, which links with the thread library.
+///
+class RH_Loopback : public RHGenericDriver
+{
+public:
+    /// Constructor
+    /// \param[in] medium The medium shared with the drivers this one sends to and receives from
+    RH_Loopback(RHLoopbackMedium& medium);
+
+    /// Initialise the Driver and attaches it to the medium.
+    /// \return true if initialisation succeeded, false if the medium already has RH_LOOPBACK_MAX_NODES drivers
+    virtual bool init();
+
+    /// Tests whether a new message is available
+    /// from the Driver.
+    /// This can be called multiple times in a timeout loop
+    /// \return true if a new, complete, error-free uncollected message is available to be retreived by recv()
+    virtual bool available();
+
+    /// Wait until a new message is available from the driver.
+    /// Yields the thread while waiting, so nodes sharing a CPU do not hold each other up
+    virtual void waitAvailable();
+
+    /// Wait until a new message is available from the driver
+    /// or the timeout expires.
+    /// Yields the thread while waiting, so nodes sharing a CPU do not hold each other up
+    /// \param[in] timeout The maximum time to wait in milliseconds
+    /// \return true if a message is available as reported by available()
+    virtual bool waitAvailableTimeout(uint16_t timeout);
+
+    /// If there is a valid message available, copy it to buf and return true
+    /// else return false.
+    /// If a message is copied, *len is set to the length (Caution, 0 length messages are permitted).
+    /// \param[in] buf Location to copy the received message
+    /// \param[in,out] len Pointer to available space in buf. Set to the actual number of octets copied.
+    /// \return true if a valid message was copied to buf
+    virtual bool recv(uint8_t* buf, uint8_t* len);
+
+    /// Copies the message into the ring to each other driver on the medium, unless the medium
+    /// loses it. Does not wait: the message has been sent when this returns.
+    /// \param[in] data Array of data to be sent
+    /// \param[in] len Number of bytes of data to send (> 0)
+    /// \return true if the message length was valid
+    virtual bool send(const uint8_t* data, uint8_t len);
+
+    /// Returns the maximum message length
+    /// available in this Driver.
+    /// \return The maximum legal message length
+    virtual uint8_t maxMessageLength();
+
+    /// Returns the number of messages lost because the ring to a receiver was full
+    /// \return The count
+    uint16_t overflows();
+
+protected:
+    /// Moves messages addressed to us from the rings into _pending
+    void drainRings();
+
+    /// Returns a random number from this driver's generator
+    /// \return 0 to 2^32 - 1
+    uint32_t random32();
+
+private:
+    /// The medium we are attached to
+    RHLoopbackMedium& _medium;
+
+    /// Our index in the medium, or -1 before init()
+    int8_t          _index;
+
+    /// State of our xorshift random generator
+    uint32_t        _random;
+
+    /// Messages taken from the rings that are not yet due, or waiting to be received
+    RHLoopbackFrame _pending[RH_LOOPBACK_PENDING_LEN];
+    uint8_t         _pendingLen;
+
+    /// Index in _pending of the message available() found, or -1
+    int8_t          _rxIndex;
+
+    /// Index of the ring drainRings() starts with, so each sender gets a fair turn
+    uint8_t         _nextRing;
+
+    /// Sequence number for the next message taken from the rings
+    uint32_t        _sequence;
+
+    /// Messages lost to full rings
+    uint16_t        _overflows;
+};
+
+/// @example simulator_loopback.pde
+
+#endif
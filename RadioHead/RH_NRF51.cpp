@@ -216,6 +216,7 @@ bool RH_NRF51::send(const uint8_t* data, uint8_t len)
     _buf[5] = _txHeaderId;
     _buf[6] = _txHeaderFlags;
     memcpy(_buf+RH_NRF51_HEADER_LEN, data, len);
+    captureTx(data, len);
     _rxBufValid = false;
     setModeTx();
 
@@ -374,6 +375,7 @@ bool RH_NRF51::recv(uint8_t* buf, uint8_t* len)
 	    *len = _buf[1]-RH_NRF51_HEADER_LEN;
 	memcpy(buf, _buf+RH_NRF51_HEADER_LEN, *len);
     }
+    captureRx(_buf+RH_NRF51_HEADER_LEN, _buf[1]-RH_NRF51_HEADER_LEN);
     clearRxBuf(); // This message accepted and cleared
     return true;
 }
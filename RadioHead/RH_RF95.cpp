@@ -11,6 +11,14 @@
 RH_RF95* RH_RF95::_deviceForInterrupt[RH_RF95_NUM_INTERRUPTS] = {0, 0, 0};
 uint8_t RH_RF95::_interruptCount = 0; // Index into _deviceForInterrupt for next device
 
+// States of channelAccess()
+#define CSMA_STATE_IDLE    0
+#define CSMA_STATE_CAD     1
+#define CSMA_STATE_BACKOFF 2
+
+// Bandwidths in Hz, indexed by the top 4 bits of RH_RF95_REG_1D_MODEM_CONFIG1
+static const uint32_t BANDWIDTHS[] = { 7800, 10400, 15600, 20800, 31250, 41700, 62500, 125000, 250000, 500000 };
+
 // These are indexed by the values of ModemConfigChoice
 // Stored in flash (program) memory to save SRAM
 PROGMEM static const RH_RF95::ModemConfig MODEM_CONFIG_TABLE[] =
@@ -26,10 +34,39 @@ PROGMEM static const RH_RF95::ModemConfig MODEM_CONFIG_TABLE[] =
 RH_RF95::RH_RF95(uint8_t slaveSelectPin, uint8_t interruptPin, RHGenericSPI& spi)
     :
     RHSPIDriver(slaveSelectPin, spi),
-    _rxBufValid(0)
+    _rxTail(0),
+    _rxCount(0),
+    _rxOverflow(0),
+    _lastRxTime(0),
+    _txHead(0),
+    _txCount(0),
+    _txLastHandle(0),
+    _txGap(0),
+    _txDoneAt(0),
+    _rxAfterTx(false),
+    _frequency(0),
+    _useRFO(false),
+    _csmaState(CSMA_STATE_IDLE),
+    _csmaExponent(RH_RF95_CSMA_MIN_EXPONENT),
+    _csmaStart(0),
+    _csmaBackoffEnd(0),
+    _csmaSlot(0),
+    _csmaStats(NULL),
+    _preambleLength(8),
+    _txPreamble(8),
+    _worInterval(0),
+    _worAwake(RH_RF95_WOR_AWAKE),
+    _worMinListen(0),
+    _worMaxListen(0),
+    _worNextWake(0),
+    _worAwakeUntil(0),
+    _worWokeAt(0),
+    _worListening(false)
 {
     _interruptPin = interruptPin;
     _myInterruptIndex = 0xff; // Not allocated yet
+    memset(_channelStats, 0, sizeof(_channelStats));
+    memset(_worPeers, 0, sizeof(_worPeers));
 }
 
 bool RH_RF95::init()
@@ -60,6 +97,12 @@ bool RH_RF95::init()
 	return false; // No device present?
     }
 
+    // Keep a shadow of the modem configuration, so the setters below can be batched and
+    // timeOnAir() needs no SPI reads. 0x25 in the middle is read only, so writing it back is harmless.
+    // Payloads written to the FIFO must not be taken for writes to the registers after it
+    spiFifoRegister(RH_RF95_REG_00_FIFO);
+    spiShadowRegisters(RH_RF95_REG_1D_MODEM_CONFIG1, RH_RF95_REG_26_MODEM_CONFIG3 - RH_RF95_REG_1D_MODEM_CONFIG1 + 1);
+
     // Add by Adrien van den Bossche <vandenbo@univ-tlse2.fr> for Teensy
     // ARM M4 requires the below. else pin interrupt doesn't work properly.
     // On all other platforms, its innocuous, belt and braces
@@ -138,47 +181,79 @@ void RH_RF95::handleInterrupt()
     }
     else if (_mode == RHModeRx && irq_flags & RH_RF95_RX_DONE)
     {
-	// Have received a packet
-	uint8_t len = spiRead(RH_RF95_REG_13_RX_NB_BYTES);
-
-	// Reset the fifo read ptr to the beginning of the packet
-	spiWrite(RH_RF95_REG_0D_FIFO_ADDR_PTR, spiRead(RH_RF95_REG_10_FIFO_RX_CURRENT_ADDR));
-	spiBurstRead(RH_RF95_REG_00_FIFO, _buf, len);
-	_bufLen = len;
-	spiWrite(RH_RF95_REG_12_IRQ_FLAGS, 0xff); // Clear all IRQ flags
-
-	// Remember the last signal to noise ratio, LORA mode
-	// Per page 111, SX1276/77/78/79 datasheet
-	_lastSNR = (int8_t)spiRead(RH_RF95_REG_19_PKT_SNR_VALUE) / 4;
-
-	// Remember the RSSI of this packet, LORA mode
-	// this is according to the doc, but is it really correct?
-	// weakest receiveable signals are reported RSSI at about -66
-	_lastRssi = spiRead(RH_RF95_REG_1A_PKT_RSSI_VALUE);
-	// Adjust the RSSI, datasheet page 87
-	if (_lastSNR < 0)
-	    _lastRssi = _lastRssi + _lastSNR;
-	else
-	    _lastRssi = (int)_lastRssi * 16 / 15;
-	if (_usingHFport)
-	    _lastRssi -= 157;
+	// Have received a packet. The receiver stays on for the next one
+	uint32_t now = micros();
+	if (_rxCount >= RH_RF95_RX_SLOTS)
+	{
+	    // Nowhere to put it
+	    _rxOverflow++;
+	    spiWrite(RH_RF95_REG_12_IRQ_FLAGS, 0xff); // Clear all IRQ flags
+	}
 	else
-	    _lastRssi -= 164;
-	    
-	// We have received a message.
-	validateRxBuf(); 
-	if (_rxBufValid)
-	    setModeIdle(); // Got one 
+	{
+	    RxSlot* slot = &_rxSlots[(_rxTail + _rxCount) % RH_RF95_RX_SLOTS];
+	    uint8_t len = spiRead(RH_RF95_REG_13_RX_NB_BYTES);
+
+	    // Reset the fifo read ptr to the beginning of the packet
+	    spiWrite(RH_RF95_REG_0D_FIFO_ADDR_PTR, spiRead(RH_RF95_REG_10_FIFO_RX_CURRENT_ADDR));
+	    spiBurstRead(RH_RF95_REG_00_FIFO, slot->buf, len);
+	    slot->len = len;
+	    slot->time = now;
+	    spiWrite(RH_RF95_REG_12_IRQ_FLAGS, 0xff); // Clear all IRQ flags
+
+	    // Remember the signal to noise ratio, LORA mode
+	    // Per page 111, SX1276/77/78/79 datasheet
+	    slot->snr = (int8_t)spiRead(RH_RF95_REG_19_PKT_SNR_VALUE) / 4;
+
+	    // Remember the RSSI of this packet, LORA mode
+	    // this is according to the doc, but is it really correct?
+	    // weakest receiveable signals are reported RSSI at about -66
+	    slot->rssi = spiRead(RH_RF95_REG_1A_PKT_RSSI_VALUE);
+	    // Adjust the RSSI, datasheet page 87
+	    if (slot->snr < 0)
+		slot->rssi = slot->rssi + slot->snr;
+	    else
+		slot->rssi = (int)slot->rssi * 16 / 15;
+	    if (_usingHFport)
+		slot->rssi -= 157;
+	    else
+		slot->rssi -= 164;
+
+	    // Every message heard from a wake on radio peer shows when it will next wake
+	    if (len >= RH_RF95_HEADER_LEN)
+		heardFrom(slot->buf[1]);
+	    // We have received a message. Keep it if it is for us
+	    if (validateRxBuf())
+	    {
+		if (_worInterval)
+		    _worAwakeUntil = millis() + _worAwake; // Stay awake for a reply
+		_rxCount++;
+	    }
+	}
     }
     else if (_mode == RHModeTx && irq_flags & RH_RF95_TX_DONE)
     {
 	_txGood++;
-	setModeIdle();
+	_txAirtime += millis() - _txStarted;
+	txDone();
     }
     else if (_mode == RHModeCad && irq_flags & RH_RF95_CAD_DONE)
     {
         _cad = irq_flags & RH_RF95_CAD_DETECTED;
-        setModeIdle();
+	if (_worListening)
+	{
+	    // Woken to listen. Receive the message whose preamble was heard, else sleep again
+	    _worListening = false;
+	    if (_cad)
+	    {
+		setModeRx();
+		_worWokeAt = millis();
+	    }
+	    else
+		sleep();
+	}
+	else
+	    setModeIdle();
     }
     // Sigh: on some processors, for some unknown reason, doing this only once does not actually
     // clear the radio's interrupt flag. So we do it twice. Why?
@@ -206,37 +281,55 @@ void RH_INTERRUPT_ATTR RH_RF95::isr2()
 }
 
 // Check whether the latest received message is complete and uncorrupted
-void RH_RF95::validateRxBuf()
-{
-    if (_bufLen < 4)
-	return; // Too short to be a real message
-    // Extract the 4 headers
-    _rxHeaderTo    = _buf[0];
-    _rxHeaderFrom  = _buf[1];
-    _rxHeaderId    = _buf[2];
-    _rxHeaderFlags = _buf[3];
+bool RH_RF95::validateRxBuf()
+{
+    RxSlot* slot = &_rxSlots[(_rxTail + _rxCount) % RH_RF95_RX_SLOTS];
+    if (slot->len < RH_RF95_HEADER_LEN)
+	return false; // Too short to be a real message
+    // The TO header
     if (_promiscuous ||
-	_rxHeaderTo == _thisAddress ||
-	_rxHeaderTo == RH_BROADCAST_ADDRESS)
+	slot->buf[0] == _thisAddress ||
+	slot->buf[0] == RH_BROADCAST_ADDRESS)
     {
 	_rxGood++;
-	_rxBufValid = true;
+	return true;
     }
+    return false;
+}
+
+void RH_RF95::loadRxHeaders()
+{
+    // The interrupt handler leaves the oldest slot alone until recv() releases it
+    RxSlot* slot = &_rxSlots[_rxTail];
+    _rxHeaderTo    = slot->buf[0];
+    _rxHeaderFrom  = slot->buf[1];
+    _rxHeaderId    = slot->buf[2];
+    _rxHeaderFlags = slot->buf[3];
+    _lastRssi      = slot->rssi;
+    _lastSNR       = slot->snr;
+    _lastRxTime    = slot->time;
 }
 
 bool RH_RF95::available()
 {
-    if (_mode == RHModeTx)
-	return false;
-    setModeRx();
-    return _rxBufValid; // Will be set by the interrupt handler when a good message is received
+    pollTx();
+    // Messages already queued can be collected even while transmitting. Leave any CAD for
+    // channelAccess() to finish
+    if (_worInterval)
+	pollWakeOnRadio();
+    else if (_mode != RHModeTx && _mode != RHModeCad)
+	setModeRx();
+    if (!_rxCount)
+	return false; // Will be set by the interrupt handler when a good message is received
+    loadRxHeaders();
+    return true;
 }
 
 void RH_RF95::clearRxBuf()
 {
     ATOMIC_BLOCK_START;
-    _rxBufValid = false;
-    _bufLen = 0;
+    _rxTail = 0;
+    _rxCount = 0;
     ATOMIC_BLOCK_END;
 }
 
@@ -244,16 +337,20 @@ bool RH_RF95::recv(uint8_t* buf, uint8_t* len)
 {
     if (!available())
 	return false;
+    RxSlot* slot = &_rxSlots[_rxTail];
     if (buf && len)
     {
-	ATOMIC_BLOCK_START;
-	// Skip the 4 headers that are at the beginning of the rxBuf
-	if (*len > _bufLen-RH_RF95_HEADER_LEN)
-	    *len = _bufLen-RH_RF95_HEADER_LEN;
-	memcpy(buf, _buf+RH_RF95_HEADER_LEN, *len);
-	ATOMIC_BLOCK_END;
+	// Skip the 4 headers that are at the beginning of the slot
+	if (*len > slot->len-RH_RF95_HEADER_LEN)
+	    *len = slot->len-RH_RF95_HEADER_LEN;
+	memcpy(buf, slot->buf+RH_RF95_HEADER_LEN, *len);
     }
-    clearRxBuf(); // This message accepted and cleared
+    captureRx(slot->buf+RH_RF95_HEADER_LEN, slot->len-RH_RF95_HEADER_LEN, _lastSNR);
+    // This message accepted. Release its slot to the interrupt handler
+    ATOMIC_BLOCK_START;
+    _rxTail = (_rxTail + 1) % RH_RF95_RX_SLOTS;
+    _rxCount--;
+    ATOMIC_BLOCK_END;
     return true;
 }
 
@@ -262,11 +359,23 @@ bool RH_RF95::send(const uint8_t* data, uint8_t len)
     if (len > RH_RF95_MAX_MESSAGE_LEN)
 	return false;
 
+#if RH_RF95_TX_SLOTS
+    // Wait for a free slot
+    while (_txCount >= RH_RF95_TX_SLOTS)
+    {
+	pollTx();
+	YIELD;
+    }
+    return sendQueued(data, len) != RH_RF95_TX_HANDLE_NONE;
+#else
     waitPacketSent(); // Make sure we dont interrupt an outgoing message
     setModeIdle();
 
     if (!waitCAD()) 
 	return false;  // Check channel activity
+    if (!spendAirtime(len))
+	return false;  // Would exceed the duty cycle limit
+    setTxPreamble(_txHeaderTo);
 
     // Position at the beginning of the FIFO
     spiWrite(RH_RF95_REG_0D_FIFO_ADDR_PTR, 0);
@@ -278,10 +387,200 @@ bool RH_RF95::send(const uint8_t* data, uint8_t len)
     // The message data
     spiBurstWrite(RH_RF95_REG_00_FIFO, data, len);
     spiWrite(RH_RF95_REG_22_PAYLOAD_LENGTH, len + RH_RF95_HEADER_LEN);
+    captureTx(data, len);
 
     setModeTx(); // Start the transmitter
     // when Tx is done, interruptHandler will fire and radio mode will return to STANDBY
     return true;
+#endif
+}
+
+uint8_t RH_RF95::sendQueued(const uint8_t* data, uint8_t len)
+{
+#if RH_RF95_TX_SLOTS
+    if (len > RH_RF95_MAX_MESSAGE_LEN || _txCount >= RH_RF95_TX_SLOTS)
+	return RH_RF95_TX_HANDLE_NONE;
+    if (!spendAirtime(len))
+	return RH_RF95_TX_HANDLE_NONE; // Would exceed the duty cycle limit
+
+    // The interrupt handler does not touch slots beyond _txCount
+    TxSlot* slot = &_txSlots[(_txHead + _txCount) % RH_RF95_TX_SLOTS];
+    if (++_txLastHandle == RH_RF95_TX_HANDLE_NONE)
+	++_txLastHandle;
+    slot->handle = _txLastHandle;
+    slot->status = RH_RF95_TX_STATUS_QUEUED;
+    slot->buf[0] = _txHeaderTo;
+    slot->buf[1] = _txHeaderFrom;
+    slot->buf[2] = _txHeaderId;
+    slot->buf[3] = _txHeaderFlags;
+    memcpy(slot->buf + RH_RF95_HEADER_LEN, data, len);
+    slot->len = len + RH_RF95_HEADER_LEN;
+    captureTx(data, len);
+    ATOMIC_BLOCK_START;
+    _txCount++;
+    ATOMIC_BLOCK_END;
+
+    pollTx();
+    return slot->handle;
+#else
+    (void)data; // Not used
+    (void)len; // Not used
+    return RH_RF95_TX_HANDLE_NONE;
+#endif
+}
+
+uint8_t RH_RF95::txStatus(uint8_t handle)
+{
+#if RH_RF95_TX_SLOTS
+    uint8_t i;
+    for (i = 0; i < RH_RF95_TX_SLOTS; i++)
+    {
+	TxSlot* slot = &_txSlots[i];
+	if (slot->status != RH_RF95_TX_STATUS_UNKNOWN && slot->handle == handle)
+	{
+	    uint8_t status = slot->status;
+	    if (status != RH_RF95_TX_STATUS_QUEUED)
+		slot->status = RH_RF95_TX_STATUS_UNKNOWN; // Collected, release it
+	    return status;
+	}
+    }
+#else
+    (void)handle; // Not used
+#endif
+    return RH_RF95_TX_STATUS_UNKNOWN;
+}
+
+uint8_t RH_RF95::txQueued()
+{
+    return _txCount;
+}
+
+void RH_RF95::pollTx()
+{
+#if RH_RF95_TX_SLOTS
+    // The interrupt handler only starts messages while the transmitter is running, so
+    // when it is not, there is no race with it here
+    if (!_cad_timeout)
+	_csmaState = CSMA_STATE_IDLE; // Listen before talk turned off
+    while (   _txCount
+	   && _mode != RHModeTx
+	   && (!_txGap || (millis() - _txDoneAt) >= _txGap))
+    {
+	uint8_t access = _cad_timeout ? channelAccess() : RH_RF95_CSMA_CLEAR;
+	if (access == RH_RF95_CSMA_PENDING)
+	    return; // Still doing CAD or backing off
+	if (access == RH_RF95_CSMA_CLEAR)
+	{
+	    startTx();
+	    return;
+	}
+	// Channel still busy after the CAD timeout. This one fails, try the next
+	_txSlots[_txHead].status = RH_RF95_TX_STATUS_FAILED;
+	ATOMIC_BLOCK_START;
+	_txHead = (_txHead + 1) % RH_RF95_TX_SLOTS;
+	_txCount--;
+	ATOMIC_BLOCK_END;
+    }
+#endif
+}
+
+void RH_RF95::clearTxQueue()
+{
+#if RH_RF95_TX_SLOTS
+    ATOMIC_BLOCK_START;
+    // Leave the one being transmitted, if any
+    uint8_t keep = (_mode == RHModeTx && _txCount) ? 1 : 0;
+    if (!keep)
+	_csmaState = CSMA_STATE_IDLE; // Abandon listen before talk for the first one
+    while (_txCount > keep)
+    {
+	_txSlots[(_txHead + _txCount - 1) % RH_RF95_TX_SLOTS].status = RH_RF95_TX_STATUS_FAILED;
+	_txCount--;
+    }
+    ATOMIC_BLOCK_END;
+#endif
+}
+
+void RH_RF95::setTxGap(uint16_t gap)
+{
+    _txGap = gap;
+}
+
+void RH_RF95::setRxAfterTx(bool rx)
+{
+    _rxAfterTx = rx;
+}
+
+bool RH_RF95::waitPacketSent()
+{
+    while (_txCount || _mode == RHModeTx)
+    {
+	pollTx();
+	YIELD; // Wait for the queue to drain
+    }
+    return true;
+}
+
+bool RH_RF95::waitPacketSent(uint16_t timeout)
+{
+    unsigned long starttime = millis();
+    while ((millis() - starttime) < timeout)
+    {
+	pollTx();
+	if (!_txCount && _mode != RHModeTx)
+	    return true;
+	YIELD;
+    }
+    return false;
+}
+
+void RH_RF95::startTx()
+{
+#if RH_RF95_TX_SLOTS
+    TxSlot* slot = &_txSlots[_txHead];
+    setModeIdle();
+    setTxPreamble(slot->buf[0]);
+    // Position at the beginning of the FIFO
+    spiWrite(RH_RF95_REG_0D_FIFO_ADDR_PTR, 0);
+    spiBurstWrite(RH_RF95_REG_00_FIFO, slot->buf, slot->len);
+    spiWrite(RH_RF95_REG_22_PAYLOAD_LENGTH, slot->len);
+    setModeTx(); // Start the transmitter
+#endif
+}
+
+// Called by the interrupt handler when a transmission has finished
+void RH_RF95::txDone()
+{
+    _txDoneAt = millis();
+    if (_worInterval)
+    {
+	// Peers that heard this expect the next wake one interval after it, and a reply straight away
+	_worNextWake = _txDoneAt + _worInterval;
+	_worAwakeUntil = _txDoneAt + _worAwake;
+    }
+#if RH_RF95_TX_SLOTS
+    if (_txCount)
+    {
+	_txSlots[_txHead].status = RH_RF95_TX_STATUS_SENT;
+	_txHead = (_txHead + 1) % RH_RF95_TX_SLOTS;
+	_txCount--;
+    }
+    if (_txCount && !_txGap && !_cad_timeout)
+    {
+	// Chain the next one straight away
+	startTx();
+	return;
+    }
+#endif
+    setModeIdle();
+    if (_txPreamble != _preambleLength)
+    {
+	// A long preamble from the receiver would not be heard
+	writePreamble(_preambleLength);
+    }
+    // Anything left is started by pollTx()
+    if ((_rxAfterTx || (_worInterval && _worAwake)) && !_txCount)
+	setModeRx();
 }
 
 bool RH_RF95::printRegisters()
@@ -309,10 +608,10 @@ bool RH_RF95::setFrequency(float centre)
 {
     // Frf = FRF / FSTEP
     uint32_t frf = (centre * 1000000.0) / RH_RF95_FSTEP;
-    spiWrite(RH_RF95_REG_06_FRF_MSB, (frf >> 16) & 0xff);
-    spiWrite(RH_RF95_REG_07_FRF_MID, (frf >> 8) & 0xff);
-    spiWrite(RH_RF95_REG_08_FRF_LSB, frf & 0xff);
+    uint8_t regs[3] = { (uint8_t)(frf >> 16), (uint8_t)(frf >> 8), (uint8_t)frf };
+    spiBurstWrite(RH_RF95_REG_06_FRF_MSB, regs, sizeof(regs));
     _usingHFport = (centre >= 779.0);
+    _frequency = centre * 1000.0 + 0.5;
 
     return true;
 }
@@ -321,7 +620,7 @@ void RH_RF95::setModeIdle()
 {
     if (_mode != RHModeIdle)
     {
-	spiWrite(RH_RF95_REG_01_OP_MODE, RH_RF95_MODE_STDBY);
+	spiWrite(RH_RF95_REG_01_OP_MODE, RH_RF95_MODE_STDBY | RH_RF95_LONG_RANGE_MODE);
 	_mode = RHModeIdle;
     }
 }
@@ -330,7 +629,7 @@ bool RH_RF95::sleep()
 {
     if (_mode != RHModeSleep)
     {
-	spiWrite(RH_RF95_REG_01_OP_MODE, RH_RF95_MODE_SLEEP);
+	spiWrite(RH_RF95_REG_01_OP_MODE, RH_RF95_MODE_SLEEP | RH_RF95_LONG_RANGE_MODE);
 	_mode = RHModeSleep;
     }
     return true;
@@ -340,7 +639,7 @@ void RH_RF95::setModeRx()
 {
     if (_mode != RHModeRx)
     {
-	spiWrite(RH_RF95_REG_01_OP_MODE, RH_RF95_MODE_RXCONTINUOUS);
+	spiWrite(RH_RF95_REG_01_OP_MODE, RH_RF95_MODE_RXCONTINUOUS | RH_RF95_LONG_RANGE_MODE);
 	spiWrite(RH_RF95_REG_40_DIO_MAPPING1, 0x00); // Interrupt on RxDone
 	_mode = RHModeRx;
     }
@@ -350,14 +649,16 @@ void RH_RF95::setModeTx()
 {
     if (_mode != RHModeTx)
     {
-	spiWrite(RH_RF95_REG_01_OP_MODE, RH_RF95_MODE_TX);
+	spiWrite(RH_RF95_REG_01_OP_MODE, RH_RF95_MODE_TX | RH_RF95_LONG_RANGE_MODE);
 	spiWrite(RH_RF95_REG_40_DIO_MAPPING1, 0x40); // Interrupt on TxDone
+	_txStarted = millis();
 	_mode = RHModeTx;
     }
 }
 
 void RH_RF95::setTxPower(int8_t power, bool useRFO)
 {
+    _useRFO = useRFO;
     // Sigh, different behaviours depending on whther the module use PA_BOOST or the RFO pin
     // for the transmitter output
     if (useRFO)
@@ -401,9 +702,11 @@ void RH_RF95::setTxPower(int8_t power, bool useRFO)
 // Sets registers from a canned modem configuration structure
 void RH_RF95::setModemRegisters(const ModemConfig* config)
 {
-    spiWrite(RH_RF95_REG_1D_MODEM_CONFIG1,       config->reg_1d);
-    spiWrite(RH_RF95_REG_1E_MODEM_CONFIG2,       config->reg_1e);
-    spiWrite(RH_RF95_REG_26_MODEM_CONFIG3,       config->reg_26);
+    spiBatchBegin();
+    spiWriteShadow(RH_RF95_REG_1D_MODEM_CONFIG1, config->reg_1d);
+    spiWriteShadow(RH_RF95_REG_1E_MODEM_CONFIG2, config->reg_1e);
+    spiWriteShadow(RH_RF95_REG_26_MODEM_CONFIG3, config->reg_26);
+    spiBatchEnd();
 }
 
 // Set one of the canned FSK Modem configs
@@ -422,19 +725,22 @@ bool RH_RF95::setModemConfig(ModemConfigChoice index)
 
 void RH_RF95::setPreambleLength(uint16_t bytes)
 {
-    spiWrite(RH_RF95_REG_20_PREAMBLE_MSB, bytes >> 8);
-    spiWrite(RH_RF95_REG_21_PREAMBLE_LSB, bytes & 0xff);
+    _preambleLength = bytes;
+    writePreamble(bytes);
+}
+
+void RH_RF95::writePreamble(uint16_t symbols)
+{
+    uint8_t regs[2] = { (uint8_t)(symbols >> 8), (uint8_t)symbols };
+    spiBurstWrite(RH_RF95_REG_20_PREAMBLE_MSB, regs, sizeof(regs));
+    _txPreamble = symbols;
 }
 
 bool RH_RF95::isChannelActive()
 {
     // Set mode RHModeCad
     if (_mode != RHModeCad)
-    {
-        spiWrite(RH_RF95_REG_01_OP_MODE, RH_RF95_MODE_CAD);
-        spiWrite(RH_RF95_REG_40_DIO_MAPPING1, 0x80); // Interrupt on CadDone
-        _mode = RHModeCad;
-    }
+	startCad();
 
     while (_mode == RHModeCad)
         YIELD;
@@ -442,6 +748,295 @@ bool RH_RF95::isChannelActive()
     return _cad;
 }
 
+void RH_RF95::startCad(bool wake)
+{
+    if (_mode == RHModeRx)
+	setModeIdle();
+    _cad = true; // Busy, unless CadDone says otherwise
+    _worListening = wake;
+    spiWrite(RH_RF95_REG_01_OP_MODE, RH_RF95_MODE_CAD | RH_RF95_LONG_RANGE_MODE);
+    spiWrite(RH_RF95_REG_40_DIO_MAPPING1, 0x80); // Interrupt on CadDone
+    _mode = RHModeCad;
+}
+
+uint8_t RH_RF95::channelAccess()
+{
+    switch (_csmaState)
+    {
+	case CSMA_STATE_IDLE:
+	{
+	    // A new message. Try straight away
+	    _csmaStart = millis();
+	    _csmaExponent = RH_RF95_CSMA_MIN_EXPONENT;
+	    _csmaSlot = symbolTime() * RH_RF95_CSMA_SLOT_SYMBOLS;
+	    // Find the statistics of this frequency, or replace those of the least used one
+	    uint8_t i;
+	    _csmaStats = &_channelStats[0];
+	    for (i = 0; i < RH_RF95_CSMA_CHANNELS; i++)
+	    {
+		if (_channelStats[i].frequency == _frequency)
+		{
+		    _csmaStats = &_channelStats[i];
+		    break;
+		}
+		if (_channelStats[i].cads < _csmaStats->cads)
+		    _csmaStats = &_channelStats[i];
+	    }
+	    if (_csmaStats->frequency != _frequency)
+	    {
+		memset(_csmaStats, 0, sizeof(*_csmaStats));
+		_csmaStats->frequency = _frequency;
+	    }
+	    startCad();
+	    _csmaState = CSMA_STATE_CAD;
+	    return RH_RF95_CSMA_PENDING;
+	}
+
+	case CSMA_STATE_CAD:
+	    if (_mode == RHModeCad)
+		return RH_RF95_CSMA_PENDING; // The interrupt handler goes to idle when it is done
+	    _csmaStats->cads++;
+	    if (_cad)
+		return channelBusy();
+	    _csmaState = CSMA_STATE_IDLE;
+	    return RH_RF95_CSMA_CLEAR;
+
+	case CSMA_STATE_BACKOFF:
+	    if ((long)(millis() - _csmaBackoffEnd) < 0)
+		return RH_RF95_CSMA_PENDING;
+	    // A message arriving shows the channel is busy as well as CAD would, and CAD would lose it
+	    if (_mode == RHModeRx && (spiRead(RH_RF95_REG_18_MODEM_STAT) & RH_RF95_MODEM_STATUS_SIGNAL_DETECTED))
+		return channelBusy();
+	    startCad();
+	    _csmaState = CSMA_STATE_CAD;
+	    return RH_RF95_CSMA_PENDING;
+    }
+    return RH_RF95_CSMA_FAILED; // Not reached
+}
+
+uint8_t RH_RF95::channelBusy()
+{
+    _csmaStats->busy++;
+    if (millis() - _csmaStart > _cad_timeout)
+    {
+	_csmaStats->failed++;
+	_csmaState = CSMA_STATE_IDLE;
+	return RH_RF95_CSMA_FAILED;
+    }
+    // Binary exponential backoff: 1 to 2^exponent slots, and double the range for next time
+#if (RH_PLATFORM == RH_PLATFORM_STM32) // stdlib on STMF103 gets confused if random is redefined
+    uint32_t slots = _random(1, (1L << _csmaExponent) + 1);
+#else
+    uint32_t slots = random(1, (1L << _csmaExponent) + 1);
+#endif
+    if (_csmaExponent < RH_RF95_CSMA_MAX_EXPONENT)
+	_csmaExponent++;
+    uint32_t backoff = (slots * _csmaSlot + 999) / 1000;
+    _csmaStats->backoff += backoff;
+    _csmaBackoffEnd = millis() + backoff;
+    _csmaState = CSMA_STATE_BACKOFF;
+    return RH_RF95_CSMA_PENDING;
+}
+
+bool RH_RF95::waitCAD()
+{
+    if (!_cad_timeout)
+	return true;
+    uint8_t access;
+    while ((access = channelAccess()) == RH_RF95_CSMA_PENDING)
+	YIELD;
+    return access == RH_RF95_CSMA_CLEAR;
+}
+
+void RH_RF95::setWakeOnRadio(uint16_t interval, uint16_t awake)
+{
+    _worInterval = interval;
+    _worAwake = awake;
+    if (!interval)
+	return; // available() listens all the time again
+    // Once woken, listen long enough for the modem to find the preamble, and at most for
+    // the rest of a preamble stretched to a whole interval and the longest message after it
+    _worMinListen = (8 * symbolTime() + 999) / 1000 + 1;
+    _worMaxListen = (uint32_t)interval + RH_RF95_WOR_GUARD + timeOnAir(RH_RF95_MAX_MESSAGE_LEN);
+    unsigned long now = millis();
+    _worNextWake = now + interval;
+    _worAwakeUntil = now;
+    _worWokeAt = now;
+}
+
+unsigned long RH_RF95::nextWake()
+{
+    return _worNextWake;
+}
+
+bool RH_RF95::setPeerWakeOnRadio(uint8_t address, uint16_t interval, uint16_t awake)
+{
+    WakePeer* peer = NULL;
+    uint8_t i;
+    for (i = 0; i < RH_RF95_WOR_PEERS; i++)
+    {
+	if (_worPeers[i].interval && _worPeers[i].address == address)
+	{
+	    peer = &_worPeers[i];
+	    break;
+	}
+	if (!peer && !_worPeers[i].interval)
+	    peer = &_worPeers[i];
+    }
+    if (!interval)
+    {
+	// No longer in wake on radio mode, forget it
+	if (peer && peer->address == address)
+	    peer->interval = 0;
+	return true;
+    }
+    if (!peer)
+	return false; // Table full
+    peer->address = address;
+    peer->interval = interval;
+    peer->awake = awake;
+    peer->known = false;
+    peer->unconfirmed = false;
+    return true;
+}
+
+uint32_t RH_RF95::timeUntilWake(uint8_t address)
+{
+    uint8_t i;
+    for (i = 0; i < RH_RF95_WOR_PEERS; i++)
+    {
+	WakePeer* peer = &_worPeers[i];
+	if (!peer->interval || peer->address != address)
+	    continue;
+	if (!peer->known || peer->unconfirmed)
+	    return 0; // Schedule not known
+	unsigned long elapsed = millis() - peer->heard;
+	if (elapsed + RH_RF95_WOR_GUARD < peer->awake)
+	    return 0; // Still awake
+	return peer->interval - elapsed % peer->interval;
+    }
+    return 0;
+}
+
+void RH_RF95::pollWakeOnRadio()
+{
+    if (_mode == RHModeTx || _mode == RHModeCad || _txCount || _csmaState != CSMA_STATE_IDLE)
+	return; // Transmitting or listening before talk. Come back to it afterwards
+    unsigned long now = millis();
+    if ((long)(now - _worAwakeUntil) < 0)
+    {
+	// Awake after a message. Anything arriving at the end of it is still heard
+	setModeRx();
+	_worWokeAt = now;
+	return;
+    }
+    if (_mode == RHModeRx)
+    {
+	unsigned long listened = now - _worWokeAt;
+	if (listened < _worMinListen)
+	    return;
+	if (   listened < _worMaxListen
+	    && (spiRead(RH_RF95_REG_18_MODEM_STAT) & (RH_RF95_MODEM_STATUS_SIGNAL_DETECTED
+						      | RH_RF95_MODEM_STATUS_SIGNAL_SYNCHRONIZED
+						      | RH_RF95_MODEM_STATUS_RX_ONGOING
+						      | RH_RF95_MODEM_STATUS_HEADER_INFO_VALID)))
+	    return; // A preamble or message is still arriving
+    }
+    if ((long)(now - _worNextWake) >= 0)
+    {
+	// Keep to the schedule peers have learned, even if wakes were missed
+	_worNextWake += ((now - _worNextWake) / _worInterval + 1) * _worInterval;
+	startCad(true);
+	return;
+    }
+    sleep();
+}
+
+uint32_t RH_RF95::wakeCover(WakePeer* peer, bool commit)
+{
+    // A whole interval of preamble always spans a wake
+    uint32_t full = (uint32_t)peer->interval + RH_RF95_WOR_GUARD;
+    if (!peer->known || peer->unconfirmed)
+	return full;
+    unsigned long elapsed = millis() - peer->heard;
+    if (elapsed + RH_RF95_WOR_GUARD < peer->awake)
+	return 0; // Still awake after its last message
+    // Both clocks drift apart from when it was heard
+    uint32_t guard = RH_RF95_WOR_GUARD + elapsed / (1000000UL / RH_RF95_WOR_DRIFT);
+    uint32_t wait = peer->interval - elapsed % peer->interval;
+    if (wait < guard)
+	wait += peer->interval; // It may have woken already
+    uint32_t cover = wait + guard;
+    if (cover >= full)
+	return full;
+    // Unless we hear from it again, this is not to be relied on next time
+    if (commit)
+	peer->unconfirmed = true;
+    return cover;
+}
+
+uint16_t RH_RF95::wakePreamble(uint8_t to, bool commit)
+{
+    uint32_t cover = 0;
+    uint8_t i;
+    for (i = 0; i < RH_RF95_WOR_PEERS; i++)
+    {
+	WakePeer* peer = &_worPeers[i];
+	if (!peer->interval)
+	    continue;
+	if (to == RH_BROADCAST_ADDRESS)
+	{
+	    // Must wake every peer, whatever their schedules
+	    if ((uint32_t)peer->interval + RH_RF95_WOR_GUARD > cover)
+		cover = (uint32_t)peer->interval + RH_RF95_WOR_GUARD;
+	}
+	else if (peer->address == to)
+	{
+	    cover = wakeCover(peer, commit);
+	    break;
+	}
+    }
+    if (!cover)
+	return 0;
+    uint32_t symbol = symbolTime();
+    uint32_t symbols = (cover * 1000UL + symbol - 1) / symbol;
+    if (symbols > 0xffffUL - _preambleLength)
+	symbols = 0xffffUL - _preambleLength;
+    return symbols;
+}
+
+void RH_RF95::setTxPreamble(uint8_t to)
+{
+    uint16_t preamble = _preambleLength + wakePreamble(to, true);
+    if (preamble != _txPreamble)
+	writePreamble(preamble);
+}
+
+void RH_RF95::heardFrom(uint8_t from)
+{
+    uint8_t i;
+    for (i = 0; i < RH_RF95_WOR_PEERS; i++)
+    {
+	WakePeer* peer = &_worPeers[i];
+	if (peer->interval && peer->address == from)
+	{
+	    // It wakes one interval after the end of each message it sends
+	    peer->heard = millis();
+	    peer->known = true;
+	    peer->unconfirmed = false;
+	    return;
+	}
+    }
+}
+
+bool RH_RF95::channelStats(uint8_t index, ChannelStats* stats)
+{
+    if (index >= RH_RF95_CSMA_CHANNELS || !_channelStats[index].cads)
+	return false;
+    *stats = _channelStats[index];
+    return true;
+}
+
 void RH_RF95::enableTCXO()
 {
     while ((spiRead(RH_RF95_REG_4B_TCXO) & RH_RF95_TCXO_TCXO_INPUT_ON) != RH_RF95_TCXO_TCXO_INPUT_ON)
@@ -472,7 +1067,7 @@ int RH_RF95::frequencyError()
 
     int error = 0; // In hertz
     float bw_tab[] = {7.8, 10.4, 15.6, 20.8, 31.25, 41.7, 62.5, 125, 250, 500};
-    uint8_t bwindex = spiRead(RH_RF95_REG_1D_MODEM_CONFIG1) >> 4;
+    uint8_t bwindex = spiReadShadow(RH_RF95_REG_1D_MODEM_CONFIG1) >> 4;
     if (bwindex < (sizeof(bw_tab) / sizeof(float)))
 	error = (float)freqerror * bw_tab[bwindex] * ((float)(1L << 24) / (float)RH_RF95_FXOSC / 500.0);
     // else not defined
@@ -480,11 +1075,96 @@ int RH_RF95::frequencyError()
     return error;
 }
 
+bool RH_RF95::setLoRaRate(uint8_t spreadingFactor, uint32_t bandwidth)
+{
+    waitPacketSent();
+    // Modem settings must only be changed in sleep or standby
+    setModeIdle();
+    // Both changes, and the low data rate bit, go in one write
+    spiBatchBegin();
+    setSpreadingFactor(spreadingFactor);
+    setSignalBandwidth(bandwidth);
+    spiBatchEnd();
+    return true;
+}
+
+bool RH_RF95::setTransmitPower(int8_t power)
+{
+    waitPacketSent();
+    setTxPower(power, _useRFO);
+    return true;
+}
+
 int RH_RF95::lastSNR()
 {
     return _lastSNR;
 }
 
+uint32_t RH_RF95::lastRxTime()
+{
+    return _lastRxTime;
+}
+
+uint16_t RH_RF95::rxOverflow()
+{
+    return _rxOverflow;
+}
+
+// See Semtech AN1200.13 "LoRa Modem Designer's Guide", in integer arithmetic
+uint32_t RH_RF95::timeOnAir(uint8_t len)
+{
+    uint8_t config1 = spiReadShadow(RH_RF95_REG_1D_MODEM_CONFIG1);
+    uint8_t config2 = spiReadShadow(RH_RF95_REG_1E_MODEM_CONFIG2);
+    uint8_t config3 = spiReadShadow(RH_RF95_REG_26_MODEM_CONFIG3);
+    // The preamble as it would be sent now, stretched for a wake on radio peer
+    uint32_t preamble = _preambleLength + wakePreamble(_txHeaderTo, false);
+
+    uint8_t bwindex = config1 >> 4;
+    if (bwindex >= sizeof(BANDWIDTHS) / sizeof(BANDWIDTHS[0]))
+	bwindex = sizeof(BANDWIDTHS) / sizeof(BANDWIDTHS[0]) - 1;
+    uint8_t codingRate = ((config1 & RH_RF95_CODING_RATE) >> 1) + 4; // Denominator, 5 to 8
+    uint8_t sf = config2 >> 4;
+    if (sf < 6)
+	sf = 6;
+    if (sf > 12)
+	sf = 12;
+    bool implicitHeader = config1 & RH_RF95_IMPLICIT_HEADER_MODE_ON;
+    bool crc = config2 & RH_RF95_PAYLOAD_CRC_ON;
+    bool lowDataRate = config3 & RH_RF95_LOW_DATA_RATE_OPTIMIZE;
+
+    // 2^12 * 1000000 still fits in 32 bits
+    uint32_t symbolTime = ((1UL << sf) * 1000000UL) / BANDWIDTHS[bwindex]; // Microseconds
+    int16_t numerator = 8 * (len + RH_RF95_HEADER_LEN) - 4 * sf + 28 + (crc ? 16 : 0) - (implicitHeader ? 20 : 0);
+    int16_t denominator = 4 * (sf - (lowDataRate ? 2 : 0));
+    uint32_t payloadSymbols = 8;
+    if (numerator > 0)
+	payloadSymbols += ((numerator + denominator - 1) / denominator) * codingRate;
+
+    // The preamble is another 4.25 symbols longer than programmed, so count in quarter symbols
+    uint32_t quarters = 4 * (preamble + payloadSymbols) + 17;
+    if (quarters > 0xffffffffUL / symbolTime)
+	return 0xffffffff;
+    return (quarters * symbolTime + 3) / 4;
+}
+
+uint32_t RH_RF95::dutyCycleChannel()
+{
+    return _frequency;
+}
+
+uint32_t RH_RF95::symbolTime()
+{
+    uint8_t bwindex = spiReadShadow(RH_RF95_REG_1D_MODEM_CONFIG1) >> 4;
+    if (bwindex >= sizeof(BANDWIDTHS) / sizeof(BANDWIDTHS[0]))
+	bwindex = sizeof(BANDWIDTHS) / sizeof(BANDWIDTHS[0]) - 1;
+    uint8_t sf = spiReadShadow(RH_RF95_REG_1E_MODEM_CONFIG2) >> 4;
+    if (sf < 6)
+	sf = 6;
+    if (sf > 12)
+	sf = 12;
+    return ((1UL << sf) * 1000000UL) / BANDWIDTHS[bwindex];
+}
+
  ///////////////////////////////////////////////////
  //
  // additions below by Brian Norman 9th Nov 2018
@@ -512,10 +1192,12 @@ int RH_RF95::lastSNR()
    else if (sf >= 12)
      sf =  RH_RF95_SPREADING_FACTOR_4096CPS;
  
-   // set the new spreading factor
-   spiWrite(RH_RF95_REG_1E_MODEM_CONFIG2, (spiRead(RH_RF95_REG_1E_MODEM_CONFIG2) & ~RH_RF95_SPREADING_FACTOR) | sf);
+   // set the new spreading factor, and the Low data Rate bit with it
+   spiBatchBegin();
+   spiWriteShadow(RH_RF95_REG_1E_MODEM_CONFIG2, (spiReadShadow(RH_RF95_REG_1E_MODEM_CONFIG2) & ~RH_RF95_SPREADING_FACTOR) | sf);
    // check if Low data Rate bit should be set or cleared
    setLowDatarate();
+   spiBatchEnd();
  }
  
 void RH_RF95::setSignalBandwidth(long sbw)
@@ -544,9 +1226,11 @@ void RH_RF95::setSignalBandwidth(long sbw)
 	bw =  RH_RF95_BW_500KHZ;
      
     // top 4 bits of reg 1D control bandwidth
-    spiWrite(RH_RF95_REG_1D_MODEM_CONFIG1, (spiRead(RH_RF95_REG_1D_MODEM_CONFIG1) & ~RH_RF95_BW) | bw);
+    spiBatchBegin();
+    spiWriteShadow(RH_RF95_REG_1D_MODEM_CONFIG1, (spiReadShadow(RH_RF95_REG_1D_MODEM_CONFIG1) & ~RH_RF95_BW) | bw);
     // check if low data rate bit should be set or cleared
     setLowDatarate();
+    spiBatchEnd();
 }
  
 void RH_RF95::setCodingRate4(uint8_t denominator)
@@ -563,7 +1247,7 @@ void RH_RF95::setCodingRate4(uint8_t denominator)
 	cr = RH_RF95_CODING_RATE_4_8;
  
     // CR is bits 3..1 of RH_RF95_REG_1D_MODEM_CONFIG1
-    spiWrite(RH_RF95_REG_1D_MODEM_CONFIG1, (spiRead(RH_RF95_REG_1D_MODEM_CONFIG1) & ~RH_RF95_CODING_RATE) | cr);
+    spiWriteShadow(RH_RF95_REG_1D_MODEM_CONFIG1, (spiReadShadow(RH_RF95_REG_1D_MODEM_CONFIG1) & ~RH_RF95_CODING_RATE) | cr);
 }
  
 void RH_RF95::setLowDatarate()
@@ -575,8 +1259,8 @@ void RH_RF95::setLowDatarate()
     // this  adds  a  small  overhead  to increase robustness to reference frequency variations over the timescale of the LoRa packet."
  
     // read current value for BW and SF
-    uint8_t BW = spiRead(RH_RF95_REG_1D_MODEM_CONFIG1) >> 4;	// bw is in bits 7..4
-    uint8_t SF = spiRead(RH_RF95_REG_1E_MODEM_CONFIG2) >> 4;	// sf is in bits 7..4
+    uint8_t BW = spiReadShadow(RH_RF95_REG_1D_MODEM_CONFIG1) >> 4;	// bw is in bits 7..4
+    uint8_t SF = spiReadShadow(RH_RF95_REG_1E_MODEM_CONFIG2) >> 4;	// sf is in bits 7..4
    
     // calculate symbol time (see Semtech AN1200.22 section 4)
     float bw_tab[] = {7800, 10400, 15600, 20800, 31250, 41700, 62500, 125000, 250000, 500000};
@@ -592,22 +1276,22 @@ void RH_RF95::setLowDatarate()
     // So the threshold used here is 16.0ms
  
     // the LDR is bit 3 of RH_RF95_REG_26_MODEM_CONFIG3
-    uint8_t current = spiRead(RH_RF95_REG_26_MODEM_CONFIG3) & ~RH_RF95_LOW_DATA_RATE_OPTIMIZE; // mask off the LDR bit
+    uint8_t current = spiReadShadow(RH_RF95_REG_26_MODEM_CONFIG3) & ~RH_RF95_LOW_DATA_RATE_OPTIMIZE; // mask off the LDR bit
     if (symbolTime > 16.0)
-	spiWrite(RH_RF95_REG_26_MODEM_CONFIG3, current | RH_RF95_LOW_DATA_RATE_OPTIMIZE);
+	spiWriteShadow(RH_RF95_REG_26_MODEM_CONFIG3, current | RH_RF95_LOW_DATA_RATE_OPTIMIZE);
     else
-	spiWrite(RH_RF95_REG_26_MODEM_CONFIG3, current);
+	spiWriteShadow(RH_RF95_REG_26_MODEM_CONFIG3, current);
    
 }
  
 void RH_RF95::setPayloadCRC(bool on)
 {
     // Payload CRC is bit 2 of register 1E
-    uint8_t current = spiRead(RH_RF95_REG_1E_MODEM_CONFIG2) & ~RH_RF95_PAYLOAD_CRC_ON; // mask off the CRC
+    uint8_t current = spiReadShadow(RH_RF95_REG_1E_MODEM_CONFIG2) & ~RH_RF95_PAYLOAD_CRC_ON; // mask off the CRC
    
     if (on)
-	spiWrite(RH_RF95_REG_1E_MODEM_CONFIG2, current | RH_RF95_PAYLOAD_CRC_ON);
+	spiWriteShadow(RH_RF95_REG_1E_MODEM_CONFIG2, current | RH_RF95_PAYLOAD_CRC_ON);
     else
-	spiWrite(RH_RF95_REG_1E_MODEM_CONFIG2, current);
+	spiWriteShadow(RH_RF95_REG_1E_MODEM_CONFIG2, current);
 }
  
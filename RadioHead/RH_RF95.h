@@ -36,6 +36,92 @@
  #define RH_RF95_MAX_MESSAGE_LEN (RH_RF95_MAX_PAYLOAD_LEN - RH_RF95_HEADER_LEN)
 #endif
 
+// Number of received messages the interrupt handler can queue for recv(). Each slot costs
+// RH_RF95_MAX_PAYLOAD_LEN plus 8 octets of RAM. May be overridden before including RH_RF95.h
+#ifndef RH_RF95_RX_SLOTS
+ #if defined(__AVR__)
+  #define RH_RF95_RX_SLOTS 1
+ #else
+  #define RH_RF95_RX_SLOTS 4
+ #endif
+#endif
+
+// Number of messages send() can queue for transmission. Each slot costs RH_RF95_MAX_PAYLOAD_LEN plus
+// 4 octets of RAM. 0 (the default on AVR, to save RAM) disables the queue, and send() waits for each
+// message to finish before loading the next. May be overridden before including RH_RF95.h
+#ifndef RH_RF95_TX_SLOTS
+ #if defined(__AVR__)
+  #define RH_RF95_TX_SLOTS 0
+ #else
+  #define RH_RF95_TX_SLOTS 4
+ #endif
+#endif
+
+// Returned by sendQueued() if the message could not be queued
+#define RH_RF95_TX_HANDLE_NONE 0
+
+// Status of a message sent with sendQueued(), as returned by txStatus()
+#define RH_RF95_TX_STATUS_UNKNOWN 0
+#define RH_RF95_TX_STATUS_QUEUED  1
+#define RH_RF95_TX_STATUS_SENT    2
+#define RH_RF95_TX_STATUS_FAILED  3
+
+// Listen before talk, enabled with setCADTimeout(). When CAD finds the channel busy, the next CAD is after
+// a random backoff of 1 to 2^exponent slots. The exponent starts at RH_RF95_CSMA_MIN_EXPONENT for each
+// message, and goes up by 1 each time the channel is busy, up to RH_RF95_CSMA_MAX_EXPONENT
+#ifndef RH_RF95_CSMA_MIN_EXPONENT
+#define RH_RF95_CSMA_MIN_EXPONENT 3
+#endif
+#ifndef RH_RF95_CSMA_MAX_EXPONENT
+#define RH_RF95_CSMA_MAX_EXPONENT 8
+#endif
+
+// Length of a backoff slot in LoRa symbols at the current spreading factor and bandwidth.
+// A CAD takes about 2 symbols
+#ifndef RH_RF95_CSMA_SLOT_SYMBOLS
+#define RH_RF95_CSMA_SLOT_SYMBOLS 4
+#endif
+
+// Number of frequencies whose channel access statistics are kept. See channelStats()
+#ifndef RH_RF95_CSMA_CHANNELS
+ #if defined(__AVR__)
+  #define RH_RF95_CSMA_CHANNELS 1
+ #else
+  #define RH_RF95_CSMA_CHANNELS 4
+ #endif
+#endif
+
+// Progress of channelAccess()
+#define RH_RF95_CSMA_PENDING 0
+#define RH_RF95_CSMA_CLEAR   1
+#define RH_RF95_CSMA_FAILED  2
+
+// Wake on radio (see setWakeOnRadio()). Default time in milliseconds that a node stays awake after
+// sending or receiving a message, so replies reach it with a normal preamble
+#ifndef RH_RF95_WOR_AWAKE
+#define RH_RF95_WOR_AWAKE 200
+#endif
+
+// Clock drift allowed for when predicting when a peer wakes, in parts per million of the time
+// since its schedule was learned, for both clocks together
+#ifndef RH_RF95_WOR_DRIFT
+#define RH_RF95_WOR_DRIFT 100
+#endif
+
+// Uncertainty in milliseconds of a learned wake time, before any drift
+#ifndef RH_RF95_WOR_GUARD
+#define RH_RF95_WOR_GUARD 10
+#endif
+
+// Number of peers whose wake on radio schedules are kept. See setPeerWakeOnRadio()
+#ifndef RH_RF95_WOR_PEERS
+ #if defined(__AVR__)
+  #define RH_RF95_WOR_PEERS 2
+ #else
+  #define RH_RF95_WOR_PEERS 8
+ #endif
+#endif
+
 // The crystal oscillator frequency of the module
 #define RH_RF95_FXOSC 32000000.0
 
@@ -461,6 +547,83 @@
 /// and from that other device.  Use cli() to disable interrupts and sei() to
 /// reenable them.
 ///
+/// \par Receive Queue
+///
+/// The interrupt service routine copies each good message addressed to this node into the next of
+/// RH_RF95_RX_SLOTS receive slots, along with its RSSI, SNR and the time it was received, and leaves
+/// the receiver running. available() and recv() return the queued messages oldest first, so messages
+/// that arrive in quick succession (such as a route discovery followed by data) are not lost while
+/// the application is busy. If all the slots are full, new messages are dropped and counted by rxOverflow().
+/// On AVR there is only 1 slot by default, to save RAM.
+///
+/// \par Transmit Queue
+///
+/// Unless RH_RF95_TX_SLOTS is 0, send() copies the message into the next free transmit slot and
+/// returns at once, only waiting if all the slots are full. When each message has been transmitted,
+/// the interrupt service routine loads the next one and starts the transmitter again, so a burst of
+/// messages goes out while the CPU sleeps. When the queue is empty, the radio goes to idle, or back
+/// to receiving if you call setRxAfterTx(true). sendQueued() never waits, and returns a handle
+/// for the message so you can find out with txStatus() whether it was sent.
+/// If you set a gap between messages with setTxGap(), or a CAD timeout with setCADTimeout(),
+/// the next message is started by pollTx() instead, which is called by available(), recv(), send() and
+/// waitPacketSent(), so you must call one of them frequently. If CAD does not find the channel clear
+/// within the timeout, that message fails and the next one is tried.
+///
+/// \par Listen Before Talk
+///
+/// If you set a CAD timeout with setCADTimeout(), each message is only transmitted once Channel Activity
+/// Detection finds the channel clear. When it is busy, the driver backs off for a random number of slots of
+/// RH_RF95_CSMA_SLOT_SYMBOLS symbols at the current spreading factor and bandwidth, and the range doubles each
+/// time the channel is found busy again (binary exponential backoff), so the more nodes are contending, the
+/// more they spread out. The backoff is in slots of symbol time because that is how long other nodes take to
+/// detect and react to the channel: a fixed delay would be far too long at spreading factor 7 and too short
+/// at 12. If the channel is still busy after the CAD timeout, the message fails.
+///
+/// With the transmit queue, this is done by channelAccess(), a state machine driven by pollTx() that starts
+/// each CAD and lets the interrupt service routine report it, and never waits: the receiver stays on during
+/// the backoff, and a message arriving then counts as the channel being busy. Without the queue, waitCAD()
+/// runs the same state machine until it finishes. channelStats() reports, for each frequency, how often the
+/// channel was busy, how many messages failed, and the time spent backing off, so you can see how congested
+/// each channel is.
+///
+/// \par Wake On Radio
+///
+/// A receiver that is always on uses about 12mA, far more than anything else in a sleeping node.
+/// After setWakeOnRadio(interval), available() instead keeps the radio asleep, and wakes it every interval
+/// milliseconds for a CAD, which takes a couple of symbols. If the CAD hears a preamble, the receiver stays on
+/// while the modem hears the message arriving, and otherwise goes straight back to sleep. After a node
+/// sends or receives a message, it stays awake for a while (RH_RF95_WOR_AWAKE by default) so replies
+/// reach it at once. The schedule carries on from the end of each message the node sends: it next wakes
+/// interval milliseconds later. You must call available() (or recv() etc) often, and can sleep the
+/// processor until nextWake().
+///
+/// Nodes that send to a node in this mode must be told about it with setPeerWakeOnRadio(), with the same interval.
+/// They then stretch the preamble of messages to it so that it lasts until the peer wakes. Until they have heard
+/// from the peer, that is a whole interval plus RH_RF95_WOR_GUARD. Once they have heard a message from the peer,
+/// they know when it will wake (interval after the end of the message, then every interval), and the preamble only
+/// needs to last until the next wake, plus RH_RF95_WOR_GUARD and RH_RF95_WOR_DRIFT. While the peer is still awake
+/// after its message, no stretch is needed at all. If a message sent with a learned schedule is not followed by
+/// hearing from the peer again, the next one uses the whole interval, in case the schedule was wrong.
+/// To save the most airtime, wait timeUntilWake() before sending. Broadcasts use the whole interval of
+/// the slowest peer. The stretched preamble counts towards timeOnAir() and any airtime budget.
+///
+/// \par Modem Configuration Writes
+///
+/// The driver keeps a shadow of the modem configuration registers (0x1d to 0x26, see
+/// RHSPIDriver::spiShadowRegisters()), so setSpreadingFactor(), setSignalBandwidth(), setCodingRate4(),
+/// setPayloadCRC() and timeOnAir() read no registers, and registers are only written when they change.
+/// Settings changed between spiBatchBegin() and spiBatchEnd() are written together with one burst write,
+/// as setModemConfig() and setLoRaRate() do:
+/// \code
+/// rf95.spiBatchBegin();
+/// rf95.setSpreadingFactor(10);
+/// rf95.setCodingRate4(8);
+/// rf95.setPayloadCRC(true);
+/// rf95.spiBatchEnd();
+/// \endcode
+/// Do not begin a batch that an interrupt could end, and change these registers with spiWriteShadow()
+/// rather than spiWrite() if doing it directly.
+///
 /// \par Memory
 ///
 /// The RH_RF95 driver requires non-trivial amounts of memory. The sample
@@ -647,8 +810,10 @@ public:
 
     /// Tests whether a new message is available
     /// from the Driver. 
-    /// On most drivers, this will also put the Driver into RHModeRx mode until
-    /// a message is actually received by the transport, when it wil be returned to RHModeIdle.
+    /// Puts the Driver into RHModeRx mode if it is not transmitting. The receiver stays on
+    /// while messages are received, unless all the receive slots are full.
+    /// If a message is available, the headers, lastRssi(), lastSNR() and lastRxTime() are those of
+    /// the oldest queued message, the one recv() will return next.
     /// This can be called multiple times in a timeout loop
     /// \return true if a new, complete, error-free uncollected message is available to be retreived by recv()
     virtual bool    available();
@@ -669,6 +834,8 @@ public:
     /// to show the channnel is clear (if the radio supports CAD) by calling waitCAD().
     /// Then loads a message into the transmitter and starts the transmitter. Note that a message length
     /// of 0 is permitted. 
+    /// If RH_RF95_TX_SLOTS is not 0, instead waits only until there is a free transmit slot, and queues
+    /// the message with sendQueued()
     /// \param[in] data Array of data to be sent
     /// \param[in] len Number of bytes of data to send
     /// specify the maximum time in ms to wait. If 0 (the default) do not wait for CAD before transmitting.
@@ -676,6 +843,110 @@ public:
     /// if CAD was requested and the CAD timeout timed out before clear channel was detected.
     virtual bool    send(const uint8_t* data, uint8_t len);
 
+    /// Queues a message for transmission with the current TX headers, and returns at once.
+    /// It is transmitted after the messages queued before it. See the Transmit Queue section above.
+    /// \param[in] data Array of data to be sent
+    /// \param[in] len Number of bytes of data to send
+    /// \return A handle for the message, for use with txStatus(), or RH_RF95_TX_HANDLE_NONE if it is too long,
+    /// all the transmit slots are full, it would exceed the airtime budget (see setDutyCycle()),
+    /// or RH_RF95_TX_SLOTS is 0
+    uint8_t         sendQueued(const uint8_t* data, uint8_t len);
+
+    /// Returns the status of a message queued with sendQueued().
+    /// Once RH_RF95_TX_STATUS_SENT or RH_RF95_TX_STATUS_FAILED has been returned for a message,
+    /// its handle is released and later calls return RH_RF95_TX_STATUS_UNKNOWN. The results of
+    /// messages that are not collected are discarded when their slots are needed for new messages.
+    /// \param[in] handle The handle returned by sendQueued()
+    /// \return One of RH_RF95_TX_STATUS_*
+    uint8_t         txStatus(uint8_t handle);
+
+    /// Returns the number of messages queued for transmission, including the one being transmitted
+    /// \return The number of messages
+    uint8_t         txQueued();
+
+    /// Starts transmitting the next queued message if the radio is not already transmitting,
+    /// the gap set by setTxGap() has passed, and CAD (if enabled) shows the channel is clear.
+    /// Called automatically by available(), recv(), send() and waitPacketSent()
+    void            pollTx();
+
+    /// Discards all the queued messages that have not started transmitting yet. They fail
+    void            clearTxQueue();
+
+    /// Sets a gap between the end of one queued message and the start of the next.
+    /// Messages after a gap are started by pollTx()
+    /// \param[in] gap The gap in milliseconds. 0 (the default) starts the next message as soon as
+    /// the last one finishes, from the interrupt service routine
+    void            setTxGap(uint16_t gap);
+
+    /// Sets what the radio does when the last queued message has been transmitted
+    /// \param[in] rx true to start receiving again, false (the default) to go to idle
+    void            setRxAfterTx(bool rx);
+
+    /// Listen before talk, without waiting. Each call moves on a state machine that does CAD and,
+    /// when the channel is busy, a random binary exponential backoff before the next CAD. See the
+    /// Listen Before Talk section above. Called by pollTx() and waitCAD() when a CAD timeout is set
+    /// with setCADTimeout(). Keep calling it until it does not return RH_RF95_CSMA_PENDING, then
+    /// transmit at once if it returns RH_RF95_CSMA_CLEAR
+    /// \return RH_RF95_CSMA_PENDING if it is still in progress, RH_RF95_CSMA_CLEAR if the channel is clear,
+    /// or RH_RF95_CSMA_FAILED if it was still busy after the CAD timeout
+    uint8_t         channelAccess();
+
+    /// Channel access statistics for one frequency. See channelStats()
+    typedef struct
+    {
+	uint32_t        frequency; ///< The frequency in kHz
+	uint32_t        cads;      ///< Number of CADs done
+	uint32_t        busy;      ///< Number of times the channel was found busy, by CAD or by a message arriving
+	uint32_t        failed;    ///< Number of messages given up on because the channel stayed busy
+	uint32_t        backoff;   ///< Total time spent backing off in milliseconds
+    } ChannelStats;
+
+    /// Returns the channel access statistics of one of the frequencies listen before talk has been used on.
+    /// The statistics of up to RH_RF95_CSMA_CHANNELS frequencies are kept. After that, a new frequency
+    /// replaces the one with the fewest CADs
+    /// \param[in] index Which frequency, from 0
+    /// \param[out] stats The statistics
+    /// \return true if there are statistics for index
+    bool            channelStats(uint8_t index, ChannelStats* stats);
+
+    /// Turns wake on radio listening on or off. See the Wake On Radio section above.
+    /// Call it after setting the modem configuration
+    /// \param[in] interval The time between wakes in milliseconds, or 0 (the default) to listen all the time
+    /// \param[in] awake How long to stay awake after sending or receiving a message in milliseconds
+    void            setWakeOnRadio(uint16_t interval, uint16_t awake = RH_RF95_WOR_AWAKE);
+
+    /// Returns when this node next wakes to listen, if wake on radio is on
+    /// \return The millis() time of the next wake
+    unsigned long   nextWake();
+
+    /// Tells the driver that a peer listens with wake on radio, so messages to it are sent with a preamble
+    /// long enough for it to wake and hear them. See the Wake On Radio section above
+    /// \param[in] address The address of the peer
+    /// \param[in] interval The interval the peer passed to setWakeOnRadio(), or 0 if it listens all the time
+    /// \param[in] awake The awake time the peer passed to setWakeOnRadio()
+    /// \return true if the peer was added or changed, false if there are already RH_RF95_WOR_PEERS
+    bool            setPeerWakeOnRadio(uint8_t address, uint16_t interval, uint16_t awake = RH_RF95_WOR_AWAKE);
+
+    /// Returns how long until a peer in wake on radio mode next wakes, as learned from the last message
+    /// heard from it. A message sent then needs only a short preamble
+    /// \param[in] address The address of the peer
+    /// \return The time in milliseconds, 0 if it is awake now or its schedule is not known
+    uint32_t        timeUntilWake(uint8_t address);
+
+    /// Waits for the channel to be clear with channelAccess(), if a CAD timeout is set with setCADTimeout().
+    /// Used by send() when RH_RF95_TX_SLOTS is 0
+    /// \return true if the channel is clear, false if it was still busy after the CAD timeout
+    virtual bool    waitCAD();
+
+    /// Waits until all queued messages have been transmitted
+    /// \return true
+    virtual bool    waitPacketSent();
+
+    /// Waits until all queued messages have been transmitted, or a timeout
+    /// \param[in] timeout Maximum time to wait in milliseconds
+    /// \return true if they have all been transmitted
+    virtual bool    waitPacketSent(uint16_t timeout);
+
     /// Sets the length of the preamble
     /// in bytes. 
     /// Caution: this should be set to the same 
@@ -729,6 +1000,19 @@ public:
     /// the PA_BOOST pin (false). Choose the correct setting for your module.
     void           setTxPower(int8_t power, bool useRFO = false);
 
+    /// Changes the spreading factor and bandwidth, keeping the coding rate, as setSpreadingFactor() and
+    /// setSignalBandwidth(). Waits for any message being sent to finish first. Used by RHAdaptiveRate
+    /// \param[in] spreadingFactor The spreading factor, 6 to 12
+    /// \param[in] bandwidth The bandwidth in Hz
+    /// \return true
+    virtual bool   setLoRaRate(uint8_t spreadingFactor, uint32_t bandwidth);
+
+    /// Changes the transmitter power, keeping the useRFO setting of the last call to setTxPower().
+    /// Waits for any message being sent to finish first. Used by RHAdaptiveRate
+    /// \param[in] power Transmitter power in dBm
+    /// \return true
+    virtual bool   setTransmitPower(int8_t power);
+
     /// Sets the radio into low-power sleep mode.
     /// If successful, the transport will stay in sleep mode until woken by 
     /// changing mode it idle, transmit or receive (eg by calling send(), recv(), available() etc)
@@ -770,7 +1054,25 @@ public:
     /// Returns the Signal-to-noise ratio (SNR) of the last received message, as measured
     /// by the receiver.
     /// \return SNR of the last received message in dB
-    int lastSNR();
+    virtual int lastSNR();
+
+    /// Returns when the last received message finished arriving
+    /// \return micros() at the time the receiver signalled the message was complete
+    uint32_t lastRxTime();
+
+    /// Returns the number of messages dropped because all RH_RF95_RX_SLOTS receive slots were full.
+    /// They are counted without reading them, so this includes messages addressed to other nodes
+    /// \return The number of messages dropped
+    uint16_t rxOverflow();
+
+    /// Returns the time it takes to transmit a message, including the RadioHead headers, calculated
+    /// from the current spreading factor, bandwidth, coding rate, low data rate optimisation, preamble length,
+    /// payload CRC and header mode in the modem registers. See Semtech AN1200.13 "LoRa Modem Designer's Guide".
+    /// Includes any preamble stretched for a wake on radio peer at the current TO header.
+    /// Used by setDutyCycle() to keep to an airtime budget
+    /// \param[in] len The length of the payload in octets
+    /// \return The time on air in microseconds
+    virtual uint32_t timeOnAir(uint8_t len);
 
     /// brian.n.norman@gmail.com 9th Nov 2018
     /// Sets the radio spreading factor.
@@ -828,12 +1130,78 @@ protected:
     /// Should not need to be called by user code.
     void           handleInterrupt();
 
-    /// Examine the revceive buffer to determine whether the message is for this node
-    void validateRxBuf();
+    /// Examine the newest receive slot to determine whether the message is for this node
+    /// \return true if it is
+    bool validateRxBuf();
 
-    /// Clear our local receive buffer
+    /// Discards all the messages in the receive slots
     void clearRxBuf();
 
+    /// Sets the RX headers, lastRssi() and lastSNR() from those of the oldest message in the receive slots
+    void loadRxHeaders();
+
+    /// Loads the oldest queued message into the FIFO and starts the transmitter
+    void startTx();
+
+    /// Called when the transmitter has finished. Marks the message sent, and starts the next one
+    /// if there is no gap, else goes to idle or starts receiving
+    void txDone();
+
+    /// Airtime budgets are per frequency
+    /// \return The frequency set by setFrequency() in kHz
+    virtual uint32_t dutyCycleChannel();
+
+    /// Starts Channel Activity Detection. The interrupt handler sets _cad and goes to idle when it is done
+    /// \param[in] wake true if this is a wake on radio wake. The interrupt handler then starts receiving
+    /// if the channel is busy, else goes to sleep
+    void startCad(bool wake = false);
+
+    /// Keeps the radio asleep, waking it to listen, when wake on radio is on. Called by available()
+    void pollWakeOnRadio();
+
+    /// A peer that listens with wake on radio
+    typedef struct
+    {
+	uint8_t         address;     ///< Address of the peer
+	uint16_t        interval;    ///< Its wake interval in milliseconds, 0 if this entry is free
+	uint16_t        awake;       ///< How long it stays awake after a message in milliseconds
+	bool            known;       ///< Whether heard is valid
+	bool            unconfirmed; ///< Whether a message was sent with the learned schedule since heard
+	unsigned long   heard;       ///< millis() when a message from it was last received
+    } WakePeer;
+
+    /// Returns how long the preamble of a message to a wake on radio peer must last
+    /// \param[in] peer The peer
+    /// \param[in] commit true if the message is being sent now, so the schedule will need confirming
+    /// \return The time in milliseconds, 0 if it is awake
+    uint32_t wakeCover(WakePeer* peer, bool commit);
+
+    /// Returns how many symbols to add to the preamble of a message so wake on radio peers hear it
+    /// \param[in] to The TO header of the message
+    /// \param[in] commit true if the message is being sent now
+    /// \return The number of extra symbols
+    uint16_t wakePreamble(uint8_t to, bool commit);
+
+    /// Sets the preamble for a message about to be transmitted
+    /// \param[in] to The TO header of the message
+    void setTxPreamble(uint8_t to);
+
+    /// Writes the preamble length registers with one burst write
+    /// \param[in] symbols The preamble length in symbols
+    void writePreamble(uint16_t symbols);
+
+    /// Called by the interrupt handler when a message is received. Learns the schedule of wake on radio peers
+    /// \param[in] from The FROM header of the message
+    void heardFrom(uint8_t from);
+
+    /// Called by channelAccess() when the channel is busy. Starts a backoff, or gives up
+    /// \return RH_RF95_CSMA_PENDING, or RH_RF95_CSMA_FAILED if the CAD timeout has passed
+    uint8_t channelBusy();
+
+    /// Returns the length of a LoRa symbol at the current spreading factor and bandwidth
+    /// \return The symbol time in microseconds
+    uint32_t symbolTime();
+
 private:
     /// Low level interrupt service routine for device connected to interrupt 0
     static void         isr0();
@@ -857,20 +1225,131 @@ private:
     /// else 0xff
     uint8_t             _myInterruptIndex;
 
-    /// Number of octets in the buffer
-    volatile uint8_t    _bufLen;
-    
-    /// The receiver/transmitter buffer
-    uint8_t             _buf[RH_RF95_MAX_PAYLOAD_LEN];
+    /// A message received by the interrupt handler
+    typedef struct
+    {
+	uint8_t         len;    ///< Number of octets in buf, including the headers
+	int16_t         rssi;   ///< RSSI in dBm
+	int8_t          snr;    ///< SNR in dB
+	uint32_t        time;   ///< micros() when it was received
+	uint8_t         buf[RH_RF95_MAX_PAYLOAD_LEN]; ///< The headers then the payload
+    } RxSlot;
+
+    /// The receive queue
+    RxSlot              _rxSlots[RH_RF95_RX_SLOTS];
+
+    /// Index of the oldest message in _rxSlots
+    volatile uint8_t    _rxTail;
+
+    /// Number of messages in _rxSlots
+    volatile uint8_t    _rxCount;
+
+    /// Count of messages dropped because _rxSlots was full
+    volatile uint16_t   _rxOverflow;
+
+    /// micros() when the oldest queued message, or the last one collected, was received
+    uint32_t            _lastRxTime;
+
+#if RH_RF95_TX_SLOTS
+    /// A message queued for transmission, or the result of one that has finished
+    typedef struct
+    {
+	uint8_t         handle; ///< The handle returned by sendQueued()
+	uint8_t         status; ///< One of RH_RF95_TX_STATUS_*
+	uint8_t         len;    ///< Number of octets in buf, including the headers
+	uint8_t         buf[RH_RF95_MAX_PAYLOAD_LEN]; ///< The headers then the payload
+    } TxSlot;
+
+    /// The transmit queue
+    TxSlot              _txSlots[RH_RF95_TX_SLOTS];
+#endif
+
+    /// Index of the oldest message in _txSlots that has not finished
+    volatile uint8_t    _txHead;
+
+    /// Number of messages in _txSlots that have not finished
+    volatile uint8_t    _txCount;
+
+    /// The last handle returned by sendQueued()
+    uint8_t             _txLastHandle;
+
+    /// Gap between queued messages in milliseconds
+    uint16_t            _txGap;
 
-    /// True when there is a valid message in the buffer
-    volatile bool       _rxBufValid;
+    /// millis() when the last message finished transmitting
+    volatile unsigned long _txDoneAt;
+
+    /// Whether to start receiving when the transmit queue is empty
+    bool                _rxAfterTx;
 
     // True if we are using the HF port (779.0 MHz and above)
     bool                _usingHFport;
 
     // Last measured SNR, dB
     int8_t              _lastSNR;
+
+    /// millis() when the current transmission started, to measure the time spent transmitting
+    unsigned long       _txStarted;
+
+    /// Frequency set by setFrequency() in kHz
+    uint32_t            _frequency;
+
+    /// Whether setTxPower() was last told to use the RFO pins
+    bool                _useRFO;
+
+    /// State of channelAccess()
+    uint8_t             _csmaState;
+
+    /// Backoff exponent for the next backoff
+    uint8_t             _csmaExponent;
+
+    /// millis() when channelAccess() started on the current message
+    unsigned long       _csmaStart;
+
+    /// millis() when the current backoff ends
+    unsigned long       _csmaBackoffEnd;
+
+    /// Backoff slot in microseconds
+    uint32_t            _csmaSlot;
+
+    /// Channel access statistics, per frequency
+    ChannelStats        _channelStats[RH_RF95_CSMA_CHANNELS];
+
+    /// The entry of _channelStats for the current message
+    ChannelStats*       _csmaStats;
+
+    /// Preamble length set by setPreambleLength()
+    uint16_t            _preambleLength;
+
+    /// Preamble length in the modem registers
+    volatile uint16_t   _txPreamble;
+
+    /// Wake on radio interval in milliseconds, 0 if off
+    uint16_t            _worInterval;
+
+    /// How long to stay awake after a message in milliseconds
+    uint16_t            _worAwake;
+
+    /// Shortest time to listen after a wake in milliseconds
+    uint16_t            _worMinListen;
+
+    /// Longest time to listen after a wake in milliseconds
+    uint32_t            _worMaxListen;
+
+    /// millis() of the next wake
+    volatile unsigned long _worNextWake;
+
+    /// millis() until which to stay awake after a message
+    volatile unsigned long _worAwakeUntil;
+
+    /// millis() when the receiver was last woken by a preamble
+    volatile unsigned long _worWokeAt;
+
+    /// Whether the CAD in progress is a wake on radio wake
+    volatile bool       _worListening;
+
+    /// Peers that listen with wake on radio
+    WakePeer            _worPeers[RH_RF95_WOR_PEERS];
 };
 
 /// @example rf95_client.pde
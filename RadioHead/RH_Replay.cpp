@@ -0,0 +1,232 @@
+// RH_Replay.cpp
+//
+// Copyright (C) 2014 Mike McCauley
+// $Id: RH_Replay.cpp,v 1.1 2019/09/06 04:40:40 mikem Exp $
+
+#include <RadioHead.h>
+
+// This can only build on Linux and compatible systems
+#if (RH_PLATFORM == RH_PLATFORM_UNIX)
+
+#include <RH_Replay.h>
+
+// Reads a little-endian number
+static uint32_t getLE(const uint8_t* p, uint8_t len)
+{
+    uint32_t value = 0;
+    while (len--)
+	value = (value << 8) | p[len];
+    return value;
+}
+
+RH_Replay::RH_Replay(const char* filename)
+    : _filename(filename),
+      _rxFile(NULL),
+      _txFile(NULL),
+      _rxAfterTx(0),
+      _rxAfterTxTime(0),
+      _txCount(0),
+      _lastTxAt(0),
+      _firstTime(0),
+      _haveFirstTime(false),
+      _start(0),
+      _timed(false),
+      _rxBufValid(false),
+      _txMatched(0),
+      _txMismatches(0),
+      _lastSNR(0)
+{
+    _rxRecord.valid = false;
+    _txRecord.valid = false;
+}
+
+RH_Replay::~RH_Replay()
+{
+    if (_rxFile)
+	fclose(_rxFile);
+    if (_txFile)
+	fclose(_txFile);
+}
+
+bool RH_Replay::init()
+{
+    if (!RHGenericDriver::init())
+	return false;
+    if (_rxFile)
+	fclose(_rxFile);
+    if (_txFile)
+	fclose(_txFile);
+    _rxFile = fopen(_filename, "rb");
+    _txFile = fopen(_filename, "rb");
+    if (!_rxFile || !_txFile)
+    {
+	fprintf(stderr, "RH_Replay::init could not open %s\n", _filename);
+	return false;
+    }
+    uint8_t header[RH_PCAP_FILE_HEADER_LEN];
+    if (   fread(header, sizeof(header), 1, _rxFile) != 1
+	|| getLE(header, 4) != 0xa1b2c3d4
+	|| getLE(header + 20, 4) != RH_CAPTURE_LINKTYPE)
+    {
+	fprintf(stderr, "RH_Replay::init %s is not a RadioHead capture\n", _filename);
+	return false;
+    }
+    fseek(_txFile, RH_PCAP_FILE_HEADER_LEN, SEEK_SET);
+
+    _haveFirstTime = false;
+    _rxAfterTx = 0;
+    _rxAfterTxTime = 0;
+    _txCount = 0;
+    _txMatched = 0;
+    _txMismatches = 0;
+    _rxBufValid = false;
+    readRecord(_rxFile, RH_CAPTURE_RX, &_rxRecord);
+    readRecord(_txFile, RH_CAPTURE_TX, &_txRecord);
+    _start = _lastTxAt = millis();
+    _mode = RHModeIdle;
+    return true;
+}
+
+void RH_Replay::readRecord(FILE* file, uint8_t direction, Record* record)
+{
+    uint8_t header[RH_PCAP_RECORD_HEADER_LEN + RH_CAPTURE_HEADER_LEN];
+    record->valid = false;
+    while (fread(header, RH_PCAP_RECORD_HEADER_LEN, 1, file) == 1)
+    {
+	uint32_t length = getLE(header + 8, 4);
+	if (length < RH_CAPTURE_HEADER_LEN || length > RH_CAPTURE_HEADER_LEN + RH_CAPTURE_MAX_PAYLOAD_LEN)
+	{
+	    fprintf(stderr, "RH_Replay: bad record length %u in %s\n", length, _filename);
+	    return;
+	}
+	uint8_t* p = header + RH_PCAP_RECORD_HEADER_LEN;
+	if (fread(p, RH_CAPTURE_HEADER_LEN, 1, file) != 1)
+	    return;
+	uint8_t len = length - RH_CAPTURE_HEADER_LEN;
+	// The first record in the file is time 0. Both files see it first
+	unsigned long time = getLE(header, 4) * 1000 + getLE(header + 4, 4) / 1000;
+	if (!_haveFirstTime)
+	{
+	    _firstTime = time;
+	    _haveFirstTime = true;
+	}
+	if (p[0] != RH_CAPTURE_VERSION || p[1] != direction)
+	{
+	    // Keep track of what was sent before the next message received
+	    if (p[0] == RH_CAPTURE_VERSION && direction == RH_CAPTURE_RX)
+	    {
+		_rxAfterTx++;
+		_rxAfterTxTime = time - _firstTime;
+	    }
+	    fseek(file, len, SEEK_CUR);
+	    continue;
+	}
+	if (len && fread(record->payload, len, 1, file) != 1)
+	    return;
+	record->time       = time - _firstTime;
+	record->direction  = direction;
+	record->rssi       = (int16_t)getLE(p + 2, 2);
+	record->snr        = (int8_t)p[4];
+	memcpy(record->headers, p + 6, sizeof(record->headers));
+	record->len        = len;
+	record->valid      = true;
+	return;
+    }
+}
+
+bool RH_Replay::available()
+{
+    if (_rxBufValid)
+	return true;
+    if (!_rxRecord.valid)
+	return false;
+    // Lockstep: due once the stack has sent what was sent before it, and as long after the
+    // last of them as in the capture. Timed: due at its time
+    unsigned long now = millis();
+    if (_timed 
+	? (now - _start < _rxRecord.time)
+	: (_txCount < _rxAfterTx || now - _lastTxAt < _rxRecord.time - _rxAfterTxTime))
+	return false;
+    _rxHeaderTo    = _rxRecord.headers[0];
+    _rxHeaderFrom  = _rxRecord.headers[1];
+    _rxHeaderId    = _rxRecord.headers[2];
+    _rxHeaderFlags = _rxRecord.headers[3];
+    _lastRssi      = _rxRecord.rssi;
+    _lastSNR       = _rxRecord.snr;
+    _rxGood++;
+    _rxBufValid = true;
+    return true;
+}
+
+bool RH_Replay::recv(uint8_t* buf, uint8_t* len)
+{
+    if (!available())
+	return false;
+
+    if (buf && len)
+    {
+	if (*len > _rxRecord.len)
+	    *len = _rxRecord.len;
+	memcpy(buf, _rxRecord.payload, *len);
+    }
+    _rxBufValid = false;
+    readRecord(_rxFile, RH_CAPTURE_RX, &_rxRecord);
+    return true;
+}
+
+bool RH_Replay::send(const uint8_t* data, uint8_t len)
+{
+    if (len > RH_REPLAY_MAX_MESSAGE_LEN || !_txFile)
+	return false;
+    if (!waitCAD())
+	return false;
+
+    _txCount++;
+    _txGood++;
+    _lastTxAt = millis();
+    if (   _txRecord.valid
+	&& _txRecord.headers[0] == _txHeaderTo
+	&& _txRecord.headers[1] == _txHeaderFrom
+	&& _txRecord.headers[2] == _txHeaderId
+	&& _txRecord.headers[3] == _txHeaderFlags
+	&& _txRecord.len == len
+	&& !memcmp(_txRecord.payload, data, len))
+	_txMatched++;
+    else
+	_txMismatches++;
+    if (_txRecord.valid)
+	readRecord(_txFile, RH_CAPTURE_TX, &_txRecord);
+    return true;
+}
+
+uint8_t RH_Replay::maxMessageLength()
+{
+    return RH_REPLAY_MAX_MESSAGE_LEN;
+}
+
+void RH_Replay::setTimed(bool timed)
+{
+    _timed = timed;
+}
+
+uint16_t RH_Replay::txMatched()
+{
+    return _txMatched;
+}
+
+uint16_t RH_Replay::txMismatches()
+{
+    return _txMismatches;
+}
+
+bool RH_Replay::finished()
+{
+    return !_rxBufValid && !_rxRecord.valid && !_txRecord.valid;
+}
+
+int RH_Replay::lastSNR()
+{
+    return _lastSNR;
+}
+
+#endif
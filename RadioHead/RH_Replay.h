@@ -0,0 +1,164 @@
+// RH_Replay.h
+// Author: Mike McCauley (mikem@airspayce.com)
+// Copyright (C) 2014 Mike McCauley
+// $Id: RH_Replay.h,v 1.1 2019/09/06 04:40:40 mikem Exp $
+
+#ifndef RH_Replay_h
+#define RH_Replay_h
+
+#include <RHGenericDriver.h>
+#include <RHCapture.h>
+#include <stdio.h>
+
+// The largest payload the replay driver sends, the same as RH_TCP and RH_RF95
+#define RH_REPLAY_MAX_MESSAGE_LEN 251
+
+/////////////////////////////////////////////////////////////////////
+/// \class RH_Replay RH_Replay.h <RH_Replay.h>
+/// \brief Driver that feeds the messages in a capture back into a RadioHead stack, and checks what it sends
+///
+/// \par Overview
+///
+/// This class is intended to turn captures of real traffic, recorded with RHPcapCapture (see RHCapture),
+/// into repeatable tests of RadioHead manager classes on a Linux host.
+/// Put an RH_Replay in place of the driver the capture was made with, and the manager receives the
+/// messages that were received when the capture was made, in the same order. Each message the manager sends
+/// is compared with the next message that was sent when the capture was made: txMatched() and
+/// txMismatches() count the results. So if the stack still behaves the same, all the messages it sends match.
+///
+/// By default the replay is in lockstep: each received message becomes available once the stack has sent
+/// as many messages as had been sent before it in the capture, and as long after the last of them as it was
+/// received in the capture. So replies arrive when the stack is waiting for them, as they did when the capture
+/// was made, however fast the host is. If the stack has changed so much that it stops sending, or stops
+/// listening when the capture says it was, the replay stops too: finished() tells whether it got to the end.
+/// Alternatively, setTimed() makes received messages available at the same times after init() as
+/// after the start of the capture, by millis(). This is also repeatable when run in virtual time
+/// under RHSimulator.
+///
+/// Received messages are given to the application with the headers, RSSI and SNR they were captured with,
+/// whatever this node's address and promiscuous setting.
+///
+/// \par Prerequisites
+///
+/// Linux or another system with stdio files.
+///
+class RH_Replay : public RHGenericDriver
+{
+public:
+    /// Constructor
+    /// \param[in] filename Name of the pcap file written by RHPcapCapture
+    RH_Replay(const char* filename);
+
+    /// Destructor. Closes the file
+    ~RH_Replay();
+
+    /// Opens the capture file and checks it is a RadioHead capture
+    /// \return true if initialisation succeeded.
+    virtual bool init();
+
+    /// Tests whether the next received message in the capture is due
+    /// \return true if a new, complete, error-free uncollected message is available to be retreived by recv()
+    virtual bool available();
+
+    /// If there is a valid message available, copy it to buf and return true
+    /// else return false.
+    /// If a message is copied, *len is set to the length (Caution, 0 length messages are permitted).
+    /// \param[in] buf Location to copy the received message
+    /// \param[in,out] len Pointer to available space in buf. Set to the actual number of octets copied.
+    /// \return true if a valid message was copied to buf
+    virtual bool recv(uint8_t* buf, uint8_t* len);
+
+    /// Compares the message and its headers with the next message sent in the capture.
+    /// \param[in] data Array of data to be sent
+    /// \param[in] len Number of bytes of data to send (> 0)
+    /// \return true if the message length was valid
+    virtual bool send(const uint8_t* data, uint8_t len);
+
+    /// Returns the maximum message length
+    /// available in this Driver.
+    /// \return The maximum legal message length
+    virtual uint8_t maxMessageLength();
+
+    /// Makes received messages available at their captured times instead of in lockstep with sending.
+    /// \param[in] timed true for timed replay
+    void setTimed(bool timed);
+
+    /// Returns the number of messages sent that were the same as in the capture
+    /// \return The count
+    uint16_t txMatched();
+
+    /// Returns the number of messages sent that were different from the capture, or that were sent after
+    /// all the messages in the capture
+    /// \return The count
+    uint16_t txMismatches();
+
+    /// Tells whether all the messages in the capture have been received and sent
+    /// \return true if the replay is complete
+    bool finished();
+
+    /// Returns the SNR of the last received message, as captured
+    /// \return SNR in dB
+    virtual int lastSNR();
+
+protected:
+    /// One message read from the capture
+    typedef struct
+    {
+	unsigned long time;    ///< Milliseconds since the first message in the capture
+	uint8_t       direction;
+	int16_t       rssi;
+	int8_t        snr;
+	uint8_t       headers[4];
+	uint8_t       len;
+	uint8_t       payload[RH_CAPTURE_MAX_PAYLOAD_LEN];
+	bool          valid;   ///< false at the end of the capture
+    } Record;
+
+    /// Reads the next record in a direction from one of the files
+    /// \param[in] file The file to read from
+    /// \param[in] direction RH_CAPTURE_RX or RH_CAPTURE_TX
+    /// \param[out] record The record. valid is false at the end of the file
+    void readRecord(FILE* file, uint8_t direction, Record* record);
+
+private:
+    /// Name of the capture file
+    const char*   _filename;
+
+    /// The capture is read twice, independently, for messages received and for messages sent
+    FILE*         _rxFile;
+    FILE*         _txFile;
+
+    /// Next message to be received, the number of messages sent before it in the capture,
+    /// and the time the last of them was sent
+    Record        _rxRecord;
+    unsigned long _rxAfterTx;
+    unsigned long _rxAfterTxTime;
+
+    /// Next message expected to be sent
+    Record        _txRecord;
+
+    /// Number of messages the stack has sent, and millis() when it sent the last one
+    unsigned long _txCount;
+    unsigned long _lastTxAt;
+
+    /// Timestamp of the first record in the capture, in milliseconds
+    unsigned long _firstTime;
+    bool          _haveFirstTime;
+
+    /// millis() at init()
+    unsigned long _start;
+
+    /// true for timed replay
+    bool          _timed;
+
+    /// true if _rxRecord is available to be collected by recv()
+    bool          _rxBufValid;
+
+    uint16_t      _txMatched;
+    uint16_t      _txMismatches;
+    int8_t        _lastSNR;
+};
+
+/// @example simulator_replay.pde
+
+#endif
@@ -195,6 +195,7 @@ bool RH_Serial::recv(uint8_t* buf, uint8_t* len)
 	    *len = _rxBufLen-RH_SERIAL_HEADER_LEN;
 	memcpy(buf, _rxBuf+RH_SERIAL_HEADER_LEN, *len);
     }
+    captureRx(_rxBuf+RH_SERIAL_HEADER_LEN, _rxBufLen-RH_SERIAL_HEADER_LEN);
     clearRxBuf(); // This message accepted and cleared
     return true;
 }
@@ -208,6 +209,7 @@ bool RH_Serial::send(const uint8_t* data, uint8_t len)
     if (!waitCAD()) 
 	return false;  // Check channel activity
 
+    captureTx(data, len);
     _txFcs = 0xffff;    // Initial value
     _serial.write(DLE); // Not in FCS
     _serial.write(STX); // Not in FCS
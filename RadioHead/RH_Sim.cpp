@@ -0,0 +1,270 @@
+// RH_Sim.cpp
+//
+// Copyright (C) 2014 Mike McCauley
+// $Id: RH_Sim.cpp,v 1.1 2019/09/06 04:40:40 mikem Exp $
+
+#include <RadioHead.h>
+
+// This can only build on Linux and compatible systems
+#if (RH_PLATFORM == RH_PLATFORM_UNIX)
+
+#include <RH_Sim.h>
+#include <RHutil/RHSimulator.h>
+#include <math.h>
+
+// Spreading factor, bandwidth, coding rate and low data rate optimisation of each RH_RF95 canned 
+// configuration. See MODEM_CONFIG_TABLE in RH_RF95.cpp
+static const struct
+{
+    uint8_t  spreadingFactor;
+    uint32_t bandwidth;
+    uint8_t  codingRate;
+    bool     lowDataRate;
+} MODEM_CONFIG_TABLE[] =
+{
+    {  7, 125000, 5, false }, // Bw125Cr45Sf128
+    {  7, 500000, 5, false }, // Bw500Cr45Sf128
+    {  9,  31250, 8, false }, // Bw31_25Cr48Sf512
+    { 12, 125000, 8, true  }, // Bw125Cr48Sf4096
+};
+
+RH_Sim::RH_Sim(uint8_t channel)
+    : _node(NULL),
+      _channel(channel),
+      _spreadingFactor(0),
+      _bandwidth(0),
+      _codingRate(5),
+      _lowDataRate(false),
+      _preambleLength(RH_SIM_DEFAULT_PREAMBLE_LEN),
+      _power(RH_SIM_DEFAULT_TX_POWER),
+      _lastSNR(0),
+      _txEnd(0),
+      _txAirtimeRemainder(0),
+      _rxStart(0),
+      _rxBufLen(0),
+      _rxBufValid(false)
+{
+}
+
+bool RH_Sim::init()
+{
+    if (!RHGenericDriver::init())
+	return false;
+    Simulator.attach(this);
+    _mode = RHModeIdle;
+    return true;
+}
+
+void RH_Sim::setChannel(uint8_t channel)
+{
+    _channel = channel;
+}
+
+bool RH_Sim::setModemConfig(ModemConfigChoice index)
+{
+    if ((unsigned)index >= sizeof(MODEM_CONFIG_TABLE) / sizeof(MODEM_CONFIG_TABLE[0]))
+	return false;
+    _spreadingFactor = MODEM_CONFIG_TABLE[index].spreadingFactor;
+    _bandwidth       = MODEM_CONFIG_TABLE[index].bandwidth;
+    _codingRate      = MODEM_CONFIG_TABLE[index].codingRate;
+    _lowDataRate     = MODEM_CONFIG_TABLE[index].lowDataRate;
+    return true;
+}
+
+void RH_Sim::setModemParameters(uint8_t spreadingFactor, uint32_t bandwidth, uint8_t codingRate)
+{
+    _spreadingFactor = spreadingFactor;
+    _bandwidth = bandwidth;
+    _codingRate = codingRate;
+    // Required when symbols are longer than 16ms
+    _lowDataRate = bandwidth && ((1000000UL << spreadingFactor) / bandwidth) > 16000;
+}
+
+void RH_Sim::setPreambleLength(uint16_t symbols)
+{
+    _preambleLength = symbols;
+}
+
+void RH_Sim::setTxPower(int8_t power)
+{
+    _power = power;
+}
+
+bool RH_Sim::setLoRaRate(uint8_t spreadingFactor, uint32_t bandwidth)
+{
+    waitPacketSent();
+    setModemParameters(spreadingFactor, bandwidth, _codingRate);
+    return true;
+}
+
+bool RH_Sim::setTransmitPower(int8_t power)
+{
+    waitPacketSent();
+    setTxPower(power);
+    return true;
+}
+
+int RH_Sim::lastSNR()
+{
+    return _lastSNR;
+}
+
+// See Semtech AN1200.13 "LoRa Modem Designer's Guide". 
+// Explicit header and CRC on, as RH_RF95 uses
+uint32_t RH_Sim::timeOnAir(uint8_t len)
+{
+    uint16_t octets = len + RH_SIM_HEADER_LEN;
+    if (!_spreadingFactor || !_bandwidth)
+	return ((uint64_t)octets * 8 * 1000000) / Simulator.bitRate();
+
+    double symbolTime = (double)(1UL << _spreadingFactor) / _bandwidth; // Seconds
+    int32_t numerator = 8 * octets - 4 * _spreadingFactor + 28 + 16;
+    int32_t denominator = 4 * (_spreadingFactor - (_lowDataRate ? 2 : 0));
+    int32_t payloadSymbols = 8;
+    if (numerator > 0)
+	payloadSymbols += ((numerator + denominator - 1) / denominator) * _codingRate;
+    return (uint32_t)(((_preambleLength + 4.25) + payloadSymbols) * symbolTime * 1000000);
+}
+
+uint32_t RH_Sim::dutyCycleChannel()
+{
+    return _channel;
+}
+
+uint32_t RH_Sim::preambleTime()
+{
+    if (!_spreadingFactor || !_bandwidth)
+	return ((uint64_t)_preambleLength * 1000000) / Simulator.bitRate();
+    return (uint32_t)((_preambleLength + 4.25) * (1UL << _spreadingFactor) * 1000000.0 / _bandwidth);
+}
+
+float RH_Sim::noiseFloor()
+{
+    uint32_t bandwidth = _spreadingFactor ? _bandwidth : Simulator.bitRate();
+    return -174.0 + 10.0 * log10((double)bandwidth) + RH_SIM_NOISE_FIGURE;
+}
+
+float RH_Sim::requiredSNR()
+{
+    if (!_spreadingFactor)
+	return 10.0;
+    return -5.0 - 2.5 * (_spreadingFactor - 6);
+}
+
+void RH_Sim::checkTxDone()
+{
+    if (_mode == RHModeTx && Simulator.now() >= _txEnd)
+    {
+	_mode = RHModeIdle;
+	_txGood++;
+    }
+}
+
+bool RH_Sim::available()
+{
+    Simulator.spin();
+    checkTxDone();
+    if (_mode == RHModeTx)
+	return false;
+    if (_mode != RHModeRx)
+    {
+	_mode = RHModeRx;
+	_rxStart = Simulator.now();
+    }
+    return _rxBufValid;
+}
+
+// Sleep in virtual time until something is available
+void RH_Sim::waitAvailable()
+{
+    while (!available())
+	// If we are still transmitting, wake when it finishes so we can start receiving
+	Simulator.sleepUntil(_mode == RHModeTx ? _txEnd : UINT64_MAX, true);
+}
+
+// Sleep in virtual time until something is available or timeout expires
+bool RH_Sim::waitAvailableTimeout(uint16_t timeout)
+{
+    uint64_t end = Simulator.now() + (uint64_t)timeout * 1000;
+    while (!available())
+    {
+	if (Simulator.now() >= end)
+	    return false;
+	// If we are still transmitting, wake when it finishes so we can start receiving
+	Simulator.sleepUntil(_mode == RHModeTx && _txEnd < end ? _txEnd : end, true);
+    }
+    return true;
+}
+
+bool RH_Sim::recv(uint8_t* buf, uint8_t* len)
+{
+    if (!available())
+	return false;
+
+    if (buf && len)
+    {
+	if (*len > _rxBufLen)
+	    *len = _rxBufLen;
+	memcpy(buf, _rxBuf, *len);
+    }
+    captureRx(_rxBuf, _rxBufLen, _lastSNR);
+    _rxBufValid = false;
+    return true;
+}
+
+bool RH_Sim::send(const uint8_t* data, uint8_t len)
+{
+    if (len > RH_SIM_MAX_MESSAGE_LEN)
+	return false;
+    waitPacketSent();
+    if (!waitCAD())
+	return false;
+    if (!spendAirtime(len))
+	return false;
+
+    captureTx(data, len);
+    _mode = RHModeTx;
+    uint64_t start = Simulator.now();
+    _txEnd = Simulator.transmit(this, _txHeaderTo, _txHeaderFrom, _txHeaderId, _txHeaderFlags, data, len);
+    // Carry the fractions of a millisecond, so the total is not rounded once per message
+    uint64_t airtime = _txEnd - start + _txAirtimeRemainder;
+    _txAirtime += airtime / 1000;
+    _txAirtimeRemainder = airtime % 1000;
+    return true;
+}
+
+bool RH_Sim::waitPacketSent()
+{
+    while (_mode == RHModeTx && Simulator.now() < _txEnd)
+	Simulator.sleepUntil(_txEnd, false);
+    checkTxDone();
+    return true;
+}
+
+uint8_t RH_Sim::maxMessageLength()
+{
+    return RH_SIM_MAX_MESSAGE_LEN;
+}
+
+bool RH_Sim::receive(const uint8_t* header, const uint8_t* data, uint8_t len, float rssi, float snr)
+{
+    // Like a radio, we cant take another message until the last one has been collected
+    if (_rxBufValid)
+	return false;
+    if (!_promiscuous && header[0] != _thisAddress && header[0] != RH_BROADCAST_ADDRESS)
+	return false;
+
+    _rxHeaderTo    = header[0];
+    _rxHeaderFrom  = header[1];
+    _rxHeaderId    = header[2];
+    _rxHeaderFlags = header[3];
+    _lastRssi      = (int16_t)floor(rssi + 0.5);
+    _lastSNR       = (int8_t)floor(snr + 0.5);
+    memcpy(_rxBuf, data, len);
+    _rxBufLen = len;
+    _rxBufValid = true;
+    _rxGood++;
+    return true;
+}
+
+#endif
@@ -0,0 +1,251 @@
+// RH_Sim.h
+// Author: Mike McCauley (mikem@airspayce.com)
+// Copyright (C) 2014 Mike McCauley
+// $Id: RH_Sim.h,v 1.1 2019/09/06 04:40:40 mikem Exp $
+
+#ifndef RH_Sim_h
+#define RH_Sim_h
+
+#include <RHGenericDriver.h>
+
+// The largest payload the simulated ether carries, the same as RH_TCP
+#define RH_SIM_MAX_MESSAGE_LEN 251
+
+// Number of octets of RadioHead headers sent before the payload
+#define RH_SIM_HEADER_LEN 4
+
+// Default transmitter power in dBm, the same as RH_RF95
+#define RH_SIM_DEFAULT_TX_POWER 13
+
+// Default LoRa preamble length in symbols, the same as RH_RF95
+#define RH_SIM_DEFAULT_PREAMBLE_LEN 8
+
+class RHSimulator;
+
+/////////////////////////////////////////////////////////////////////
+/// \class RH_Sim RH_Sim.h <RH_Sim.h>
+/// \brief Driver to send and receive unaddressed, unreliable datagrams through the RHSimulator
+/// discrete event simulator
+///
+/// \par Overview
+///
+/// This class is intended to support the testing of RadioHead manager classes with many simulated
+/// nodes in virtual time on a Linux host. Unlike RH_TCP, which needs a separate process for each node
+/// and the etherSimulator.pl server, all the nodes run in one process under RHSimulator, and time passes
+/// only in the simulation, so long scenarios run quickly and give the same results each time.
+///
+/// Each RH_Sim belongs to the simulated node (see RHSimNode) that calls its init(). A node can have
+/// several RH_Sim drivers on different channels, for example to test RHRouter::addInterface().
+///
+/// By default messages take the time to transmit given by the bit rate of the simulated ether.
+/// setModemConfig() or setModemParameters() make the driver behave like a LoRa radio instead:
+/// messages take the LoRa time on air for the spreading factor, bandwidth, coding rate and preamble length,
+/// the same as RH_RF95 with the same settings, and need the SNR the spreading factor can demodulate.
+/// See RHSimulator for how messages propagate, collide and are received.
+///
+/// \par Running simulations
+///
+/// \code
+/// cd whatever/RadioHead
+/// tools/simEventBuild examples/simulator/simulator_mesh_events/simulator_mesh_events.pde
+/// ./simulator_mesh_events
+/// \endcode
+///
+/// \par Prerequisites
+///
+/// g++ compiler installed and in your $PATH, on Linux (or another system with ucontext)
+///
+class RH_Sim : public RHGenericDriver
+{
+public:
+    /// Choices for setModemConfig(), the same as RH_RF95::ModemConfigChoice
+    typedef enum
+    {
+	Bw125Cr45Sf128 = 0,	   ///< Bw = 125 kHz, Cr = 4/5, Sf = 128chips/symbol, CRC on. Default medium range
+	Bw500Cr45Sf128,	           ///< Bw = 500 kHz, Cr = 4/5, Sf = 128chips/symbol, CRC on. Fast+short range
+	Bw31_25Cr48Sf512,	   ///< Bw = 31.25 kHz, Cr = 4/8, Sf = 512chips/symbol, CRC on. Slow+long range
+	Bw125Cr48Sf4096,           ///< Bw = 125 kHz, Cr = 4/8, Sf = 4096chips/symbol, CRC on. Slow+long range
+    } ModemConfigChoice;
+
+    /// Constructor
+    /// \param[in] channel The channel to transmit and receive on. Only drivers on the same channel
+    /// hear each other
+    RH_Sim(uint8_t channel = 0);
+
+    /// Initialise the Driver and connects it to the simulated ether, as part of the running node.
+    /// \return true if initialisation succeeded.
+    virtual bool init();
+
+    /// Tests whether a new message is available
+    /// from the Driver.
+    /// This can be called multiple times in a timeout loop
+    /// \return true if a new, complete, error-free uncollected message is available to be retreived by recv()
+    virtual bool available();
+
+    /// Wait until a new message is available from the driver.
+    /// The node sleeps in virtual time until a message arrives
+    virtual void waitAvailable();
+
+    /// Wait until a new message is available from the driver
+    /// or the timeout expires.
+    /// The node sleeps in virtual time until a message arrives or the timeout expires
+    /// \param[in] timeout The maximum time to wait in milliseconds
+    /// \return true if a message is available as reported by available()
+    virtual bool waitAvailableTimeout(uint16_t timeout);
+
+    /// If there is a valid message available, copy it to buf and return true
+    /// else return false.
+    /// If a message is copied, *len is set to the length (Caution, 0 length messages are permitted).
+    /// \param[in] buf Location to copy the received message
+    /// \param[in,out] len Pointer to available space in buf. Set to the actual number of octets copied.
+    /// \return true if a valid message was copied to buf
+    virtual bool recv(uint8_t* buf, uint8_t* len);
+
+    /// Waits until any previous transmit packet is finished being transmitted with waitPacketSent().
+    /// Then transmits the message into the simulated ether. The transmission takes the time
+    /// given by timeOnAir()
+    /// \param[in] data Array of data to be sent
+    /// \param[in] len Number of bytes of data to send (> 0)
+    /// \return true if the message length was valid and it was transmitted
+    virtual bool send(const uint8_t* data, uint8_t len);
+
+    /// Blocks in virtual time until the transmitter is no longer transmitting.
+    /// \return true
+    virtual bool waitPacketSent();
+
+    /// Returns the maximum message length
+    /// available in this Driver.
+    /// \return The maximum legal message length
+    virtual uint8_t maxMessageLength();
+
+    /// Sets the channel to transmit and receive on
+    /// \param[in] channel The channel number. Only drivers on the same channel hear each other
+    void setChannel(uint8_t channel);
+
+    /// Makes the driver simulate a LoRa radio with one of the RH_RF95 canned modem configurations,
+    /// including its low data rate optimisation setting.
+    /// \param[in] index The configuration to use
+    /// \return true if index is a valid choice
+    bool setModemConfig(ModemConfigChoice index);
+
+    /// Makes the driver simulate a LoRa radio with any modem parameters. Low data rate optimisation
+    /// is used if symbols last longer than 16ms, as the LoRa modem datasheets require.
+    /// \param[in] spreadingFactor 6 to 12. 0 goes back to using the bit rate of the ether
+    /// \param[in] bandwidth Bandwidth in Hz
+    /// \param[in] codingRate Denominator of the coding rate, 5 to 8
+    void setModemParameters(uint8_t spreadingFactor, uint32_t bandwidth, uint8_t codingRate);
+
+    /// Sets the length of the preamble. A receiver must be listening by the end of the preamble
+    /// to receive the message. Defaults to RH_SIM_DEFAULT_PREAMBLE_LEN
+    /// \param[in] symbols The number of preamble symbols for LoRa, otherwise bits. Without LoRa modem
+    /// parameters the preamble overlaps the start of the message and does not add to its time on air
+    void setPreambleLength(uint16_t symbols);
+
+    /// Sets the transmitter power, used with the path loss model. Defaults to RH_SIM_DEFAULT_TX_POWER
+    /// \param[in] power Transmitter power in dBm
+    void setTxPower(int8_t power);
+
+    /// Changes the spreading factor and bandwidth, keeping the coding rate. Used by RHAdaptiveRate
+    /// \param[in] spreadingFactor The spreading factor, 6 to 12
+    /// \param[in] bandwidth The bandwidth in Hz
+    /// \return true
+    virtual bool setLoRaRate(uint8_t spreadingFactor, uint32_t bandwidth);
+
+    /// Changes the transmitter power, as setTxPower(). Used by RHAdaptiveRate
+    /// \param[in] power Transmitter power in dBm
+    /// \return true
+    virtual bool setTransmitPower(int8_t power);
+
+    /// Returns the time it takes to transmit a message, including the RadioHead headers
+    /// \param[in] len The length of the payload in octets
+    /// \return The time on air in microseconds
+    virtual uint32_t timeOnAir(uint8_t len);
+
+    /// Returns the time it takes to transmit the preamble
+    /// \return The preamble time in microseconds
+    uint32_t preambleTime();
+
+    /// Returns the signal to noise ratio of the last received message
+    /// \return SNR in dB
+    virtual int lastSNR();
+
+protected:
+    friend class RHSimulator;
+
+    /// Called by RHSimulator when a message arrives intact. Keeps it if the receive buffer is free
+    /// and it is addressed to this node.
+    /// \param[in] header TO, FROM, ID and FLAGS headers
+    /// \param[in] data The payload
+    /// \param[in] len Length of the payload
+    /// \param[in] rssi Power it was received with, in dBm
+    /// \param[in] snr Its signal to noise ratio in dB
+    /// \return true if the message was kept
+    bool receive(const uint8_t* header, const uint8_t* data, uint8_t len, float rssi, float snr);
+
+    /// Returns the noise power in the receiver bandwidth
+    /// \return The noise floor in dBm
+    float noiseFloor();
+
+    /// Returns the lowest SNR that can be received: from -7.5dB at SF7 to -20dB at SF12 for LoRa, 
+    /// 10dB otherwise
+    /// \return The SNR in dB
+    float requiredSNR();
+
+    /// Updates the mode when a transmission has finished
+    void checkTxDone();
+
+    /// Airtime budgets are per simulator channel
+    /// \return The channel set by setChannel()
+    virtual uint32_t dutyCycleChannel();
+
+    /// The simulated node this driver belongs to
+    class RHSimNode* _node;
+
+    /// The channel we transmit and receive on
+    uint8_t     _channel;
+
+    /// LoRa spreading factor, or 0 to use the bit rate of the ether
+    uint8_t     _spreadingFactor;
+
+    /// LoRa bandwidth in Hz
+    uint32_t    _bandwidth;
+
+    /// Denominator of the LoRa coding rate
+    uint8_t     _codingRate;
+
+    /// true if LoRa low data rate optimisation is on
+    bool        _lowDataRate;
+
+    /// LoRa preamble length in symbols
+    uint16_t    _preambleLength;
+
+    /// Transmitter power in dBm
+    int8_t      _power;
+
+    /// SNR of the last received message
+    int8_t      _lastSNR;
+
+    /// Virtual time the current transmission ends
+    uint64_t    _txEnd;
+
+    /// Microseconds of airtime not yet counted in the whole milliseconds of _txAirtime
+    uint16_t    _txAirtimeRemainder;
+
+    /// Virtual time we last started listening
+    uint64_t    _rxStart;
+
+    /// Receive buffer
+    uint8_t     _rxBuf[RH_SIM_MAX_MESSAGE_LEN];
+
+    /// Length of the message in _rxBuf
+    uint8_t     _rxBufLen;
+
+    /// true if _rxBuf holds a message that has not been collected
+    bool        _rxBufValid;
+};
+
+/// @example simulator_mesh_events.pde
+/// @example simulator_lora_events.pde
+/// @example simulator_benchmark.pde
+
+#endif
@@ -17,18 +17,66 @@
 #include <unistd.h>
 #include <sys/ioctl.h>
 #include <netdb.h>
+#include <netinet/tcp.h>
 #include <string>
+#include <vector>
+#include <algorithm>
+#ifdef __linux__
+#include <sys/epoll.h>
+#else
+#include <poll.h>
+#endif
+
+#if (RH_TCP_RX_RING_LEN & (RH_TCP_RX_RING_LEN - 1))
+#error RH_TCP_RX_RING_LEN must be a power of 2
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+// Most events handled by each call to pollEvents()
+#define RH_TCP_MAX_EVENTS 64
+
+// All the initialised RH_TCP instances in this process, served by one event loop
+static std::vector<RH_TCP*> instances;
+
+#ifdef __linux__
+// The epoll instance watching the sockets of all of them
+static int epollFd = -1;
+#endif
 
 RH_TCP::RH_TCP(const char* server)
     : _server(server),
+      _socket(-1),
+      _rxHead(0),
+      _rxTail(0),
+      _txBufLen(0),
+      _txBlocked(false),
+      _rxBlocked(false),
+      _registered(false),
+      _txEnd(0),
+      _lastConnect(0),
       _rxBufLen(0),
       _rxBufValid(false),
-      _socket(-1)
+      _rxBufFull(false)
+{
+}
+
+RH_TCP::~RH_TCP()
 {
+    disconnect(NULL);
+    if (_registered)
+	instances.erase(std::find(instances.begin(), instances.end(), this));
 }
     
 bool RH_TCP::init()
 {   
+    if (!_registered)
+    {
+	instances.push_back(this);
+	_registered = true;
+    }
     if (!connectToServer())
 	return false;
     return sendThisAddress(_thisAddress);
@@ -38,10 +86,9 @@ bool RH_TCP::connectToServer()
 {
     struct addrinfo hints;
     struct addrinfo *result, *rp;
-    int sfd, s;
-    struct sockaddr_storage peer_addr;
-    socklen_t peer_addr_len;
+    int s;
 
+    _lastConnect = millis();
     memset(&hints, 0, sizeof(struct addrinfo));
     hints.ai_family = AF_UNSPEC;    // Allow IPv4 or IPv6
     hints.ai_socktype = SOCK_STREAM; // Stream socket
@@ -82,11 +129,13 @@ bool RH_TCP::connectToServer()
 	    break;                  /* Success */
 
 	close(_socket);
+	_socket = -1;
     }
 
     if (rp == NULL) 
     {               /* No address succeeded */
 	fprintf(stderr, "RH_TCP::connect could not connect to %s\n", _server);
+	freeaddrinfo(result);
 	return false;
     }
 
@@ -102,79 +151,283 @@ bool RH_TCP::connectToServer()
 	_socket = -1;
 	return false;
     }
+
+    // Messages are already batched by queue(), so send them as soon as they are flushed
+    setsockopt(_socket, IPPROTO_TCP, TCP_NODELAY, (char *)&on, sizeof(on));
+
+#ifdef __linux__
+    if (epollFd < 0 && (epollFd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+    {
+	fprintf(stderr,"RH_TCP::init failed to create epoll instance: %s\n", strerror(errno));
+	close(_socket);
+	_socket = -1;
+	return false;
+    }
+#endif
+    _rxHead = _rxTail = 0;
+    _txBufLen = 0;
+    _txBlocked = _rxBlocked = false;
+    watchSocket(true);
     return true;
 }
 
-void RH_TCP::clearRxBuf()
+void RH_TCP::watchSocket(bool add)
 {
-    _rxBufValid = false;
-    _rxBufLen = 0;
+#ifdef __linux__
+    struct epoll_event event;
+    event.events = (_rxBlocked ? 0 : (uint32_t)EPOLLIN) | (_txBlocked ? (uint32_t)EPOLLOUT : 0);
+    event.data.ptr = this;
+    if (epoll_ctl(epollFd, add ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, _socket, &event) < 0)
+	fprintf(stderr,"RH_TCP::watchSocket epoll_ctl failed: %s\n", strerror(errno));
+#else
+    (void)add; // pollEvents() builds its poll() set from the flags each time
+#endif
 }
 
-void RH_TCP::checkForEvents()
+void RH_TCP::disconnect(const char* reason)
 {
-    #define RH_TCP_SOCKETBUF_LEN 500
-    static uint8_t socketBuf[RH_TCP_SOCKETBUF_LEN]; // Room for several messages
-    static uint16_t socketBufLen = 0;
+    if (_socket < 0)
+	return;
+    if (reason)
+	fprintf(stderr, "RH_TCP lost connection to %s: %s. Will reconnect\n", _server, reason);
+#ifdef __linux__
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, _socket, NULL);
+#endif
+    close(_socket);
+    _socket = -1;
+    // Anything in transit is lost, and the stream starts again with the next connection
+    _rxHead = _rxTail = 0;
+    _txBufLen = 0;
+    _txBlocked = _rxBlocked = false;
+    _lastConnect = millis();
+}
 
-    // Read at most the amount of space we have left in the buffer
-    ssize_t count = read(_socket, socketBuf + socketBufLen, sizeof(socketBuf) - socketBufLen);
-    if (count < 0)
+bool RH_TCP::reconnect()
+{
+    if (_socket >= 0)
+	return true;
+    if (!_registered || millis() - _lastConnect < RH_TCP_RECONNECT_INTERVAL)
+	return false;
+    if (!connectToServer())
+	return false;
+    fprintf(stderr, "RH_TCP reconnected to %s\n", _server);
+    return sendThisAddress(_thisAddress);
+}
+
+bool RH_TCP::connected()
+{
+    return _socket >= 0;
+}
+
+void RH_TCP::readSocket()
+{
+    // Read until the socket is drained, in contiguous pieces of the ring
+    while (_socket >= 0)
     {
-	if (errno != EAGAIN)
+	uint32_t used = _rxHead - _rxTail;
+	if (used == RH_TCP_RX_RING_LEN)
+	{
+	    // Stop watching for input until some has been parsed
+	    if (!_rxBlocked)
+	    {
+		_rxBlocked = true;
+		watchSocket(false);
+	    }
+	    return;
+	}
+	uint32_t start = _rxHead & (RH_TCP_RX_RING_LEN - 1);
+	uint32_t space = RH_TCP_RX_RING_LEN - start;
+	if (space > RH_TCP_RX_RING_LEN - used)
+	    space = RH_TCP_RX_RING_LEN - used;
+	ssize_t count = read(_socket, _rxRing + start, space);
+	if (count < 0)
 	{
-	    fprintf(stderr,"RH_TCP::checkForEvents read error: %s\n", strerror(errno));
-	    exit(1);
+	    if (errno == EINTR)
+		continue;
+	    if (errno != EAGAIN && errno != EWOULDBLOCK)
+		disconnect(strerror(errno));
+	    return;
 	}
+	if (count == 0)
+	{
+	    disconnect("unexpected end of file on read");
+	    return;
+	}
+	_rxHead += count;
+	if ((uint32_t)count < space)
+	    return; // Drained
     }
-    else if (count == 0)
+}
+
+bool RH_TCP::flush()
+{
+    uint16_t sent = 0;
+    while (_socket >= 0 && sent < _txBufLen)
     {
-	// End of file
-	fprintf(stderr,"RH_TCP::checkForEvents unexpected end of file on read\n");
-	exit(1);
+	ssize_t count = ::send(_socket, _txBuf + sent, _txBufLen - sent, MSG_NOSIGNAL);
+	if (count < 0)
+	{
+	    if (errno == EINTR)
+		continue;
+	    if (errno == EAGAIN || errno == EWOULDBLOCK)
+		break;
+	    disconnect(strerror(errno));
+	}
+	else
+	    sent += count;
     }
-    else
+    if (_socket < 0)
+	return false;
+    memmove(_txBuf, _txBuf + sent, _txBufLen - sent);
+    _txBufLen -= sent;
+    // If the socket is full, have the event loop write the rest when there is room
+    bool blocked = _txBufLen > 0;
+    if (blocked != _txBlocked)
     {
-	socketBufLen += count;
-	while (socketBufLen >= 5)
+	_txBlocked = blocked;
+	watchSocket(false);
+    }
+    return true;
+}
+
+bool RH_TCP::queue(const void* message, uint16_t len)
+{
+    if (!reconnect())
+	return false;
+    if (_txBufLen + len > sizeof(_txBuf))
+	flush();
+    // Wait for the server to take enough, serving the other instances meanwhile
+    while (_socket >= 0 && _txBufLen + len > sizeof(_txBuf))
+	pollEvents(RH_TCP_TX_TIME);
+    if (_socket < 0)
+	return false;
+    memcpy(_txBuf + _txBufLen, message, len);
+    _txBufLen += len;
+    return true;
+}
+
+bool RH_TCP::pollEvents(uint16_t timeout)
+{
+    bool disconnected = false;
+    size_t i;
+    for (i = 0; i < instances.size(); i++)
+    {
+	RH_TCP* tcp = instances[i];
+	if (!tcp->reconnect())
+	    disconnected = true;
+	else if (tcp->_txBufLen && !tcp->_txBlocked)
+	    tcp->flush();
+    }
+    // Wake in time to retry connections
+    if (disconnected && timeout > RH_TCP_RECONNECT_INTERVAL)
+	timeout = RH_TCP_RECONNECT_INTERVAL;
+
+    int count;
+#ifdef __linux__
+    if (epollFd < 0)
+    {
+	delay(timeout);
+	return false;
+    }
+    struct epoll_event events[RH_TCP_MAX_EVENTS];
+    count = epoll_wait(epollFd, events, RH_TCP_MAX_EVENTS, timeout);
+    for (i = 0; i < (size_t)(count > 0 ? count : 0); i++)
+    {
+	RH_TCP* tcp = (RH_TCP*)events[i].data.ptr;
+	if (events[i].events & EPOLLOUT)
+	    tcp->flush();
+	if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+	    tcp->readSocket();
+    }
+#else
+    std::vector<struct pollfd> fds;
+    std::vector<RH_TCP*> polled;
+    for (i = 0; i < instances.size(); i++)
+    {
+	RH_TCP* tcp = instances[i];
+	if (tcp->_socket < 0)
+	    continue;
+	struct pollfd fd;
+	fd.fd = tcp->_socket;
+	fd.events = (tcp->_rxBlocked ? 0 : POLLIN) | (tcp->_txBlocked ? POLLOUT : 0);
+	fd.revents = 0;
+	fds.push_back(fd);
+	polled.push_back(tcp);
+    }
+    count = poll(fds.empty() ? NULL : &fds[0], fds.size(), timeout);
+    for (i = 0; count > 0 && i < fds.size(); i++)
+    {
+	if (fds[i].revents & POLLOUT)
+	    polled[i]->flush();
+	if (fds[i].revents & (POLLIN | POLLERR | POLLHUP))
+	    polled[i]->readSocket();
+    }
+#endif
+    if (count < 0 && errno != EINTR)
+	fprintf(stderr, "RH_TCP::pollEvents: wait failed %s\n", strerror(errno));
+    return count > 0;
+}
+
+void RH_TCP::copyFromRing(uint8_t* dest, uint32_t offset, uint32_t len)
+{
+    uint32_t start = (_rxTail + offset) & (RH_TCP_RX_RING_LEN - 1);
+    uint32_t first = RH_TCP_RX_RING_LEN - start;
+    if (first > len)
+	first = len;
+    memcpy(dest, _rxRing + start, first);
+    memcpy(dest + first, _rxRing, len - first);
+}
+
+void RH_TCP::clearRxBuf()
+{
+    _rxBufValid = false;
+    _rxBufLen = 0;
+}
+
+void RH_TCP::checkForEvents()
+{
+    if (!reconnect())
+	return;
+    readSocket();
+
+    // Parse one message at a time, leaving the rest in the ring until this one has been dealt with
+    while (!_rxBufFull && !_rxBufValid && _rxHead - _rxTail >= sizeof(uint32_t))
+    {
+	RHTcpTypeMessage message;
+	copyFromRing((uint8_t*)&message.length, 0, sizeof(message.length));
+	uint32_t len = ntohl(message.length);
+	uint32_t messageLen = len + sizeof(message.length);
+	if (len > RH_TCP_MAX_PAYLOAD_LEN + 1)
 	{
-	    RHTcpTypeMessage* message = ((RHTcpTypeMessage*)socketBuf);
-	    uint32_t len = ntohl(message->length);
-	    uint32_t messageLen = len + sizeof(message->length);
-	    if (len > sizeof(socketBuf) - sizeof(message->length))
-	    {
-		// Bogus length
-		fprintf(stderr, "RH_TCP::checkForEvents read ridiculous length: %d. Corrupt message stream? Aborting\n", len);
-		exit(1);
-	    }
-	    if (socketBufLen >= len + sizeof(message->length))
-	    {
-		// Got at least all of this message
-		if (message->type == RH_TCP_MESSAGE_TYPE_PACKET && len >= 5)
-		{
-		    // REVISIT: need to check if we are actually receiving?
-		    // Its a new packet, extract the headers and payload
-		    RHTcpPacket* packet = ((RHTcpPacket*)socketBuf);
-		    _rxHeaderTo    = packet->to;
-		    _rxHeaderFrom  = packet->from;
-		    _rxHeaderId    = packet->id;
-		    _rxHeaderFlags = packet->flags;
-		    uint32_t payloadLen = len - 5;
-		    if (payloadLen <= sizeof(_rxBuf))
-		    {
-			// Enough room in our receiver buffer
-			memcpy(_rxBuf, packet->payload, payloadLen);
-			_rxBufLen = payloadLen;
-			_rxBufFull = true;
-		    }
-		}
-		// check for other message types here
-		// Now remove the used message by copying the trailing bytes (maybe start of a new message?)
-		// to the top of the buffer
-		memcpy(socketBuf, socketBuf + messageLen, sizeof(socketBuf) - messageLen);
-		socketBufLen -= messageLen;
-	    }
+	    // Bogus length
+	    fprintf(stderr, "RH_TCP::checkForEvents read ridiculous length: %u\n", len);
+	    disconnect("corrupt message stream");
+	    return;
+	}
+	if (_rxHead - _rxTail < messageLen)
+	    break; // Rest of the message not here yet
+	copyFromRing((uint8_t*)&message, 0, messageLen);
+	_rxTail += messageLen;
+	if (message.type == RH_TCP_MESSAGE_TYPE_PACKET && len >= 5)
+	{
+	    // REVISIT: need to check if we are actually receiving?
+	    // Its a new packet, extract the headers and payload
+	    RHTcpPacket* packet = ((RHTcpPacket*)&message);
+	    _rxHeaderTo    = packet->to;
+	    _rxHeaderFrom  = packet->from;
+	    _rxHeaderId    = packet->id;
+	    _rxHeaderFlags = packet->flags;
+	    _rxBufLen = len - 5;
+	    memcpy(_rxBuf, packet->payload, _rxBufLen);
+	    _rxBufFull = true;
 	}
+	// check for other message types here
+    }
+    if (_rxBlocked && _rxHead - _rxTail < RH_TCP_RX_RING_LEN)
+    {
+	// Room again: resume watching for input
+	_rxBlocked = false;
+	watchSocket(false);
     }
 }
 
@@ -192,13 +445,16 @@ void RH_TCP::validateRxBuf()
 
 bool RH_TCP::available()
 {
-    if (_socket < 0)
-	return false;
-    checkForEvents();
-    if (_rxBufFull)
+    if (_txBufLen && !_txBlocked)
+	flush();
+    // Skip over packets not addressed to us
+    while (!_rxBufValid)
     {
+	checkForEvents();
+	if (!_rxBufFull)
+	    break;
 	validateRxBuf();
-	_rxBufFull= false;
+	_rxBufFull = false;
     }
     return _rxBufValid;
 }
@@ -209,32 +465,18 @@ void RH_TCP::waitAvailable()
     waitAvailableTimeout(0); // 0 = Wait forever
 }
 
-// Block until something is available or timeout expires
+// Block until something is available or timeout expires, serving all the instances meanwhile
 bool RH_TCP::waitAvailableTimeout(uint16_t timeout)
 {
-    int            max_fd;
-    fd_set         input;
-    int            result;
-
-    FD_ZERO(&input);
-    FD_SET(_socket, &input);
-    max_fd = _socket + 1;
-
-    if (timeout)
-    {
-	struct timeval timer;
-	// Timeout is in milliseconds
-	timer.tv_sec  = timeout / 1000;
-	timer.tv_usec = (timeout % 1000) * 1000;
-	result = select(max_fd, &input, NULL, NULL, &timer);
-    }
-    else
+    unsigned long start = millis();
+    while (!available())
     {
-	result = select(max_fd, &input, NULL, NULL, NULL);
+	unsigned long elapsed = millis() - start;
+	if (timeout && elapsed >= timeout)
+	    return false;
+	pollEvents(timeout ? timeout - elapsed : RH_TCP_RECONNECT_INTERVAL);
     }
-    if (result < 0)
-	fprintf(stderr, "RH_TCP::waitAvailableTimeout: select failed %s\n", strerror(errno));
-    return result > 0;
+    return true;
 }
 
 bool RH_TCP::recv(uint8_t* buf, uint8_t* len)
@@ -248,18 +490,36 @@ bool RH_TCP::recv(uint8_t* buf, uint8_t* len)
 	    *len = _rxBufLen;
 	memcpy(buf, _rxBuf, *len);
     }
+    captureRx(_rxBuf, _rxBufLen);
     clearRxBuf();
     return true;
 }
 
 bool RH_TCP::send(const uint8_t* data, uint8_t len)
 {
+    if (len > RH_TCP_MAX_MESSAGE_LEN)
+	return false;
     if (!waitCAD()) 
 	return false;  // Check channel activity (prob not possible for this driver?)
 
-    bool ret = sendPacket(data, len);
-    delay(10); // Wait for transmit to succeed. REVISIT: depends on length and speed
-    return ret;
+    if (!sendPacket(data, len))
+	return false;
+    captureTx(data, len);
+    // waitPacketSent() waits for transmit to succeed. REVISIT: depends on length and speed
+    _txEnd = millis() + RH_TCP_TX_TIME;
+    return true;
+}
+
+bool RH_TCP::waitPacketSent()
+{
+    // Write the batch, waiting for the server to take all of it
+    flush();
+    while (_socket >= 0 && _txBufLen)
+	pollEvents(RH_TCP_TX_TIME);
+    long remaining;
+    while ((remaining = (long)(_txEnd - millis())) > 0)
+	pollEvents(remaining);
+    return _socket >= 0;
 }
 
 uint8_t RH_TCP::maxMessageLength()
@@ -275,20 +535,15 @@ void RH_TCP::setThisAddress(uint8_t address)
 
 bool RH_TCP::sendThisAddress(uint8_t thisAddress)
 {
-    if (_socket < 0)
-	return false;
     RHTcpThisAddress m;
     m.length = htonl(2);
     m.type = RH_TCP_MESSAGE_TYPE_THISADDRESS;
     m.thisAddress = thisAddress;
-    ssize_t sent = write(_socket, &m, sizeof(m));
-    return sent > 0;
+    return queue(&m, sizeof(m)) && flush();
 }
 
 bool RH_TCP::sendPacket(const uint8_t* data, uint8_t len)
 {
-    if (_socket < 0)
-	return false;
     RHTcpPacket m;
     m.length = htonl(len + 4);
     m.type  = RH_TCP_MESSAGE_TYPE_PACKET;
@@ -297,8 +552,7 @@ bool RH_TCP::sendPacket(const uint8_t* data, uint8_t len)
     m.id    = _txHeaderId;
     m.flags = _txHeaderFlags;
     memcpy(m.payload, data, len);
-    ssize_t sent = write(_socket, &m, len + 8);
-    return sent > 0;
+    return queue(&m, len + 8);
 }
 
 #endif
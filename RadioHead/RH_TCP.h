@@ -8,6 +8,28 @@
 #include <RHGenericDriver.h>
 #include <RHTcpProtocol.h>
 
+// Size of the ring buffer each instance receives from the server into. Must be a power of 2,
+// and big enough for at least one whole RHTcpPacket
+#ifndef RH_TCP_RX_RING_LEN
+#define RH_TCP_RX_RING_LEN 2048
+#endif
+
+// Size of the buffer each instance collects messages to the server in, so that several
+// can be written with one system call
+#ifndef RH_TCP_TX_BUF_LEN
+#define RH_TCP_TX_BUF_LEN 1024
+#endif
+
+// Milliseconds waitPacketSent() allows for each message to be transmitted
+#ifndef RH_TCP_TX_TIME
+#define RH_TCP_TX_TIME 10
+#endif
+
+// Milliseconds between attempts to reconnect to the server after losing the connection
+#ifndef RH_TCP_RECONNECT_INTERVAL
+#define RH_TCP_RECONNECT_INTERVAL 1000
+#endif
+
 /////////////////////////////////////////////////////////////////////
 /// \class RH_TCP RH_TCP.h <RH_TCP.h>
 /// \brief Driver to send and receive unaddressed, unreliable datagrams via sockets on a Linux simulator
@@ -22,6 +44,8 @@
 /// passing messages to each other via the etherSimulator.pl server.
 ///
 /// Simple RadioHead sketches can be compiled and run on Linux using a build script and some support files.
+/// To simulate larger networks quickly and repeatably, see RH_Sim, which runs all the nodes in one process
+/// in virtual time.
 ///
 /// \par Running simulated sketches
 ///
@@ -50,6 +74,22 @@
 /// You can change the listen port and the simulated baud rate with 
 /// command line arguments passed to etherSimulator.pl
 ///
+/// \par Many simulated radios in one process
+///
+/// Each RH_TCP has its own connection to the server and its own buffers, so a process can have many
+/// of them, for example to simulate a whole network in one program. All the instances in a process
+/// share one event loop (epoll on Linux, poll() elsewhere): whenever one of them waits, with
+/// waitAvailable(), waitAvailableTimeout() or waitPacketSent(), input for all of them is read, and
+/// output for all of them is written. pollEvents() does the same for programs with their own main loop.
+///
+/// send() does not write the message to the server immediately. Messages are collected and written together
+/// by the next call to waitPacketSent(), available(), recv(), the wait functions or pollEvents(), so a burst
+/// of small messages costs one system call. The managers all call waitPacketSent() after sending.
+///
+/// If the connection to the server fails, the error is printed to stderr, messages in transit are 
+/// discarded, and the driver tries to reconnect every RH_TCP_RECONNECT_INTERVAL milliseconds. 
+/// Meanwhile send() returns false and nothing is received. connected() tells whether it is connected.
+///
 /// \par Implementation
 ///
 /// etherServer.pl is a conventional server written in Perl.
@@ -74,6 +114,9 @@ public:
     /// port name or port number.
     RH_TCP(const char* server = "localhost:4000");
 
+    /// Destructor. Closes the connection to the server
+    ~RH_TCP();
+
     /// Initialise the Driver transport hardware and software.
     /// Make sure the Driver is properly configured before calling init().
     /// \return true if initialisation succeeded.
@@ -93,11 +136,17 @@ public:
 
     /// Wait until a new message is available from the driver
     /// or the timeout expires
-    /// Blocks until a complete message is received as reported by available()
-    /// \param[in] timeout The maximum time to wait in milliseconds
+    /// Blocks until a complete message is received as reported by available(), while
+    /// servicing all the other RH_TCP instances in the process
+    /// \param[in] timeout The maximum time to wait in milliseconds. 0 means wait forever
     /// \return true if a message is available as reported by available()
     virtual bool waitAvailableTimeout(uint16_t timeout);
 
+    /// Writes any messages waiting to be sent to the server, then blocks until the last one
+    /// has had RH_TCP_TX_TIME milliseconds to be transmitted
+    /// \return true if the messages were written to the server
+    virtual bool waitPacketSent();
+
     /// Turns the receiver on if it not already on.
     /// If there is a valid message available, copy it to buf and return true
     /// else return false.
@@ -109,8 +158,8 @@ public:
     /// \return true if a valid message was copied to buf
     virtual bool recv(uint8_t* buf, uint8_t* len);
 
-    /// Waits until any previous transmit packet is finished being transmitted with waitPacketSent().
-    /// Then loads a message into the transmitter and starts the transmitter. Note that a message length
+    /// Queues a message to be written to the server with any others sent since the last
+    /// waitPacketSent(), available() or pollEvents(). Note that a message length
     /// of 0 is NOT permitted. If the message is too long for the underlying radio technology, send() will
     /// return false and will not send the message.
     /// \param[in] data Array of data to be sent
@@ -134,6 +183,17 @@ public:
     /// \param[in] address The address of this node.
     void setThisAddress(uint8_t address);
 
+    /// Tells whether the driver is connected to the ether simulator server
+    /// \return true if connected
+    bool connected();
+
+    /// Writes messages waiting to be sent, and reads from the server, for all the RH_TCP instances 
+    /// in the process, waiting up to timeout milliseconds for something to arrive. Also tries to
+    /// reconnect instances that have lost their connection.
+    /// \param[in] timeout The maximum time to wait in milliseconds. 0 does not wait
+    /// \return true if anything was read
+    static bool pollEvents(uint16_t timeout);
+
 protected:
 
 private:
@@ -141,9 +201,40 @@ private:
     /// Prepares the socket for use.
     bool connectToServer();
 
+    /// Closes the connection to the server after an error, so that it can be reconnected later
+    /// \param[in] reason Description of the error, printed to stderr
+    void disconnect(const char* reason);
+
+    /// Tries to reconnect to the server, if it is time to
+    /// \return true if connected
+    bool reconnect();
+
+    /// Reads whatever the server has sent into the receive ring
+    void readSocket();
+
+    /// Writes whatever is in the transmit buffer to the server, as far as the socket will take it
+    /// \return false if the connection failed
+    bool flush();
+
+    /// Appends a message for the server to the transmit buffer, flushing it first if it is full
+    /// \param[in] message The message, starting with its length
+    /// \param[in] len Length of the message
+    /// \return true if the message was queued
+    bool queue(const void* message, uint16_t len);
+
+    /// Tells the event loop which events to watch the socket for
+    /// \param[in] add true if the socket is new to the event loop
+    void watchSocket(bool add);
+
     /// Check for new messages from the ether simulator server
     void checkForEvents();
 
+    /// Copies octets out of the receive ring
+    /// \param[out] dest Where to copy them to
+    /// \param[in] offset Offset from the oldest octet in the ring
+    /// \param[in] len Number of octets to copy
+    void copyFromRing(uint8_t* dest, uint32_t offset, uint32_t len);
+
     /// Clear the receive buffer
     void clearRxBuf();
 
@@ -167,7 +258,32 @@ private:
     /// The TCP socket used to communicate with the message server
     int         _socket;
 
-    /// Buffer to receive RHTcpProtocol messages
+    /// Ring of octets read from the server but not yet parsed. _rxHead and _rxTail count
+    /// octets added and removed, modulo 2^32
+    uint8_t     _rxRing[RH_TCP_RX_RING_LEN];
+    uint32_t    _rxHead;
+    uint32_t    _rxTail;
+
+    /// Messages waiting to be written to the server
+    uint8_t     _txBuf[RH_TCP_TX_BUF_LEN];
+    uint16_t    _txBufLen;
+
+    /// true if the socket is being watched for room to write the rest of _txBuf
+    bool        _txBlocked;
+
+    /// true if the socket is not being read because _rxRing is full
+    bool        _rxBlocked;
+
+    /// true once init() has added this instance to the event loop
+    bool        _registered;
+
+    /// millis() when the last queued message has been transmitted
+    unsigned long _txEnd;
+
+    /// millis() of the last attempt to connect to the server
+    unsigned long _lastConnect;
+
+    /// Payload of the latest received packet
     uint8_t     _rxBuf[RH_TCP_MAX_PAYLOAD_LEN + 5];
     uint16_t    _rxBufLen;
     bool        _rxBufValid;
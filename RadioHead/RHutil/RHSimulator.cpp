@@ -0,0 +1,485 @@
+// RHSimulator.cpp
+//
+// Copyright (C) 2014 Mike McCauley
+// $Id: RHSimulator.cpp,v 1.1 2019/09/06 04:40:40 mikem Exp $
+
+#include <RadioHead.h>
+#if (RH_PLATFORM == RH_PLATFORM_UNIX)
+
+#include <RHutil/RHSimulator.h>
+#include <RH_Sim.h>
+#include <math.h>
+
+RHSimNode::RHSimNode()
+    : _stack(NULL),
+      _wakeTime(0),
+      _wakeOnRx(false),
+      _spins(0),
+      _index(0)
+{
+}
+
+RHSimNode::~RHSimNode()
+{
+    delete[] _stack;
+}
+
+void RHSimNode::setup()
+{
+}
+
+void RHSimNode::loop()
+{
+}
+
+uint16_t RHSimNode::index()
+{
+    return _index;
+}
+
+RHSimulator::RHSimulator()
+    : _current(NULL),
+      _now(0),
+      _sequence(0),
+      _random(1),
+      _bitrate(RH_SIM_DEFAULT_BITRATE),
+      _running(false),
+      _transmitted(0),
+      _delivered(0),
+      _collisions(0),
+      _halfDuplexLosses(0)
+{
+    _defaultLink.probability = 1.0;
+    _defaultLink.rssi = RH_SIM_DEFAULT_RSSI;
+    setPathLoss(RH_SIM_DEFAULT_REFERENCE_LOSS, RH_SIM_DEFAULT_REFERENCE_DISTANCE, RH_SIM_DEFAULT_PATH_LOSS_EXPONENT);
+    _captureThreshold = RH_SIM_DEFAULT_CAPTURE_THRESHOLD;
+}
+
+RHSimulator::~RHSimulator()
+{
+    for (size_t i = 0; i < _nodes.size(); i++)
+	delete _nodes[i];
+}
+
+void RHSimulator::reset()
+{
+    for (size_t i = 0; i < _nodes.size(); i++)
+	delete _nodes[i];
+    _nodes.clear();
+    _drivers.clear();
+    _frames.clear();
+    _freeFrames.clear();
+    _arrivals = std::priority_queue<Arrival, std::vector<Arrival>, Later>();
+    _receptions.clear();
+    _freeReceptions.clear();
+    _links.clear();
+    _positions.clear();
+    _defaultLink.probability = 1.0;
+    _defaultLink.rssi = RH_SIM_DEFAULT_RSSI;
+    setPathLoss(RH_SIM_DEFAULT_REFERENCE_LOSS, RH_SIM_DEFAULT_REFERENCE_DISTANCE, RH_SIM_DEFAULT_PATH_LOSS_EXPONENT);
+    _captureThreshold = RH_SIM_DEFAULT_CAPTURE_THRESHOLD;
+    _now = 0;
+    _sequence = 0;
+    _random = 1;
+    _bitrate = RH_SIM_DEFAULT_BITRATE;
+    _transmitted = 0;
+    _delivered = 0;
+    _collisions = 0;
+    _halfDuplexLosses = 0;
+}
+
+void RHSimulator::addNode(RHSimNode* node)
+{
+    node->_index = _nodes.size();
+    node->_wakeTime = _now;
+    _nodes.push_back(node);
+}
+
+uint16_t RHSimulator::nodeCount()
+{
+    return _nodes.size();
+}
+
+RHSimNode* RHSimulator::node(uint16_t index)
+{
+    return index < _nodes.size() ? _nodes[index] : NULL;
+}
+
+RHSimNode* RHSimulator::currentNode()
+{
+    return _current;
+}
+
+uint64_t RHSimulator::now()
+{
+    return _now;
+}
+
+void RHSimulator::setSeed(uint32_t seed)
+{
+    _random = seed ? seed : 1; // xorshift never leaves 0
+}
+
+// xorshift32: fast, and the same on every host
+uint32_t RHSimulator::random32()
+{
+    _random ^= _random << 13;
+    _random ^= _random >> 17;
+    _random ^= _random << 5;
+    return _random;
+}
+
+void RHSimulator::setBitRate(uint32_t bitrate)
+{
+    if (bitrate)
+	_bitrate = bitrate;
+}
+
+void RHSimulator::setLink(uint8_t from, uint8_t to, float probability, int16_t rssi)
+{
+    Link link;
+    link.probability = probability;
+    link.rssi = rssi;
+    _links[(from << 8) | to] = link;
+}
+
+void RHSimulator::setDefaultLink(float probability, int16_t rssi)
+{
+    _defaultLink.probability = probability;
+    _defaultLink.rssi = rssi;
+}
+
+// Box-Muller transform
+float RHSimulator::randomNormal()
+{
+    double u1 = (random32() + 1.0) / 4294967297.0;
+    double u2 = random32() / 4294967296.0;
+    return sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+}
+
+uint32_t RHSimulator::bitRate()
+{
+    return _bitrate;
+}
+
+void RHSimulator::setPosition(uint8_t address, float x, float y)
+{
+    Position position;
+    position.x = x;
+    position.y = y;
+    _positions[address] = position;
+}
+
+void RHSimulator::setPathLoss(float referenceLoss, float referenceDistance, float exponent, float shadowing)
+{
+    _referenceLoss = referenceLoss;
+    _referenceDistance = referenceDistance;
+    _pathLossExponent = exponent;
+    _shadowing = shadowing;
+}
+
+void RHSimulator::setCaptureThreshold(float threshold)
+{
+    _captureThreshold = threshold;
+}
+
+uint32_t RHSimulator::transmitted()
+{
+    return _transmitted;
+}
+
+uint32_t RHSimulator::delivered()
+{
+    return _delivered;
+}
+
+uint32_t RHSimulator::collisions()
+{
+    return _collisions;
+}
+
+uint32_t RHSimulator::halfDuplexLosses()
+{
+    return _halfDuplexLosses;
+}
+
+void RHSimulator::run(unsigned long duration)
+{
+    uint64_t end = _now + (uint64_t)duration * 1000;
+    uint16_t last = _nodes.size() - 1;
+    _running = true;
+    while (_running)
+    {
+	// Find the node due to run first. Ties go round robin, so a node that keeps
+	// waiting for 0 time cannot starve the others
+	RHSimNode* next = NULL;
+	uint16_t i;
+	for (i = 1; i <= _nodes.size(); i++)
+	{
+	    RHSimNode* n = _nodes[(last + i) % _nodes.size()];
+	    if (!next || n->_wakeTime < next->_wakeTime)
+		next = n;
+	}
+
+	// Messages arriving at the same time as a node wakes are delivered first
+	if (!_arrivals.empty() && (!next || _arrivals.top().time <= next->_wakeTime))
+	{
+	    if (_arrivals.top().time > end)
+		break;
+	    if (_arrivals.top().time > _now)
+		_now = _arrivals.top().time;
+	    arrive();
+	    continue;
+	}
+	if (!next || next->_wakeTime > end)
+	    break;
+	if (next->_wakeTime > _now)
+	    _now = next->_wakeTime;
+	last = next->_index;
+	resume(next);
+    }
+    if (_running && _now < end)
+	_now = end;
+    _running = false;
+}
+
+void RHSimulator::stop()
+{
+    _running = false;
+}
+
+void RHSimulator::nodeMain()
+{
+    RHSimNode* node = Simulator._current;
+    node->setup();
+    while (1)
+    {
+	node->loop();
+	// A loop() that only polls must still let time pass
+	Simulator.spin();
+    }
+}
+
+void RHSimulator::resume(RHSimNode* node)
+{
+    if (!node->_stack)
+    {
+	// First time: give it a stack to run on
+	node->_stack = new uint8_t[RH_SIM_STACK_SIZE];
+	getcontext(&node->_context);
+	node->_context.uc_stack.ss_sp = node->_stack;
+	node->_context.uc_stack.ss_size = RH_SIM_STACK_SIZE;
+	node->_context.uc_link = NULL;
+	makecontext(&node->_context, nodeMain, 0);
+    }
+    _current = node;
+    swapcontext(&_context, &node->_context);
+    _current = NULL;
+}
+
+void RHSimulator::suspend()
+{
+    swapcontext(&_current->_context, &_context);
+}
+
+void RHSimulator::sleepUntil(uint64_t when, bool wakeOnRx)
+{
+    if (!_current)
+    {
+	// Not in a node, so nothing else can happen meanwhile
+	if (when > _now)
+	    _now = when;
+	return;
+    }
+    RHSimNode* node = _current;
+    node->_wakeTime = when > _now ? when : _now;
+    node->_wakeOnRx = wakeOnRx;
+    node->_spins = 0;
+    suspend();
+    node->_wakeOnRx = false;
+}
+
+void RHSimulator::yield()
+{
+    sleepUntil(_now + RH_SIM_YIELD_TIME, true);
+}
+
+void RHSimulator::spin()
+{
+    if (_current && ++_current->_spins >= RH_SIM_SPIN_LIMIT)
+	yield();
+}
+
+void RHSimulator::attach(RH_Sim* driver)
+{
+    for (size_t i = 0; i < _drivers.size(); i++)
+	if (_drivers[i] == driver)
+	    return;
+    driver->_node = _current;
+    _drivers.push_back(driver);
+}
+
+bool RHSimulator::propagate(RH_Sim* from, RH_Sim* to, float* power, bool* detectable)
+{
+    // A link configured by address takes priority
+    std::map<uint16_t, Link>::iterator l = _links.find((from->_thisAddress << 8) | to->_thisAddress);
+    std::map<uint8_t, Position>::iterator pf = _positions.find(from->_thisAddress);
+    std::map<uint8_t, Position>::iterator pt = _positions.find(to->_thisAddress);
+    if (l == _links.end() && pf != _positions.end() && pt != _positions.end())
+    {
+	// Log-distance path loss
+	float dx = pf->second.x - pt->second.x;
+	float dy = pf->second.y - pt->second.y;
+	float distance = sqrt(dx * dx + dy * dy);
+	if (distance < _referenceDistance)
+	    distance = _referenceDistance;
+	float loss = _referenceLoss + 10.0 * _pathLossExponent * log10(distance / _referenceDistance);
+	if (_shadowing > 0.0)
+	    loss += _shadowing * randomNormal();
+	*power = from->_power - loss;
+	float snr = *power - to->noiseFloor();
+	if (snr < -RH_SIM_INTERFERENCE_FLOOR)
+	    return false; // Too weak to matter
+	*detectable = snr >= to->requiredSNR();
+	return true;
+    }
+
+    const Link& link = l == _links.end() ? _defaultLink : l->second;
+    if (link.probability <= 0.0)
+	return false;
+    if (link.probability < 1.0 && random32() >= link.probability * 4294967296.0)
+	return false; // Lost on the way
+    *power = link.rssi;
+    *detectable = true;
+    return true;
+}
+
+uint64_t RHSimulator::transmit(RH_Sim* driver, uint8_t to, uint8_t from, uint8_t id, uint8_t flags, const uint8_t* data, uint8_t len)
+{
+    uint64_t end = _now + driver->timeOnAir(len);
+    _transmitted++;
+
+    uint16_t f;
+    if (_freeFrames.empty())
+    {
+	f = _frames.size();
+	_frames.resize(f + 1);
+    }
+    else
+    {
+	f = _freeFrames.back();
+	_freeFrames.pop_back();
+    }
+    Frame* frame = &_frames[f];
+    frame->header[0] = to;
+    frame->header[1] = from;
+    frame->header[2] = id;
+    frame->header[3] = flags;
+    memcpy(frame->data, data, len);
+    frame->len = len;
+    frame->arrivals = 0;
+
+    size_t i, j;
+    // Half duplex: transmitting wrecks anything the sender was receiving
+    for (j = 0; j < _receptions.size(); j++)
+	if (_receptions[j].receiver == driver && _receptions[j].state == ReceptionReceiving)
+	    _receptions[j].state = ReceptionDeafened;
+
+    for (i = 0; i < _drivers.size(); i++)
+    {
+	RH_Sim* receiver = _drivers[i];
+	if (receiver == driver || receiver->_channel != driver->_channel)
+	    continue;
+	// Different LoRa modem settings cant hear each other
+	if (   receiver->_spreadingFactor != driver->_spreadingFactor
+	    || (driver->_spreadingFactor && receiver->_bandwidth != driver->_bandwidth))
+	    continue;
+	float power;
+	bool detectable;
+	if (!propagate(driver, receiver, &power, &detectable))
+	    continue;
+
+	uint16_t r;
+	if (_freeReceptions.empty())
+	{
+	    r = _receptions.size();
+	    _receptions.resize(r + 1);
+	}
+	else
+	{
+	    r = _freeReceptions.back();
+	    _freeReceptions.pop_back();
+	}
+	Reception* reception = &_receptions[r];
+	reception->receiver = receiver;
+	reception->frame = f;
+	reception->end = end;
+	reception->sync = _now + driver->preambleTime();
+	reception->power = power;
+	reception->snr = power - receiver->noiseFloor();
+	receiver->checkTxDone();
+	reception->state = receiver->_mode == RHGenericDriver::RHModeTx ? ReceptionDeafened : ReceptionReceiving;
+	reception->detectable = detectable;
+
+	// Collide with whatever else is arriving at this receiver, unless one captures the receiver
+	for (j = 0; j < _receptions.size(); j++)
+	{
+	    Reception* other = &_receptions[j];
+	    if (   j == r
+		|| other->state == ReceptionFree
+		|| other->receiver != receiver)
+		continue;
+	    if (reception->power < other->power + _captureThreshold && reception->state == ReceptionReceiving)
+		reception->state = ReceptionCollided;
+	    if (other->power < reception->power + _captureThreshold && other->state == ReceptionReceiving)
+		other->state = ReceptionCollided;
+	}
+
+	Arrival a;
+	a.time = end;
+	a.sequence = _sequence++;
+	a.reception = r;
+	_arrivals.push(a);
+	frame->arrivals++;
+    }
+    if (!frame->arrivals)
+	_freeFrames.push_back(f);
+    return end;
+}
+
+void RHSimulator::arrive()
+{
+    Arrival a = _arrivals.top();
+    _arrivals.pop();
+    Reception* reception = &_receptions[a.reception];
+    Frame* frame = &_frames[reception->frame];
+    RH_Sim* receiver = reception->receiver;
+
+    receiver->checkTxDone();
+    if (!reception->detectable)
+    {
+	// Too weak to receive, but interfered while it lasted
+    }
+    else if (reception->state == ReceptionDeafened)
+	_halfDuplexLosses++;
+    else if (receiver->_mode != RHGenericDriver::RHModeRx || receiver->_rxStart > reception->sync)
+    {
+	// Not listening in time
+    }
+    else if (reception->state == ReceptionCollided)
+	_collisions++;
+    else if (receiver->receive(frame->header, frame->data, frame->len, reception->power, reception->snr))
+    {
+	_delivered++;
+	RHSimNode* node = receiver->_node;
+	if (node && node->_wakeOnRx && node->_wakeTime > _now)
+	    node->_wakeTime = _now;
+    }
+
+    reception->state = ReceptionFree;
+    _freeReceptions.push_back(a.reception);
+    if (--frame->arrivals == 0)
+	_freeFrames.push_back(reception->frame);
+}
+
+#endif
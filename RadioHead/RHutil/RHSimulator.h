@@ -0,0 +1,417 @@
+// RHSimulator.h
+// Discrete event simulator that runs many simulated RadioHead nodes in one process, in virtual time
+// Copyright (C) 2014 Mike McCauley
+// $Id: RHSimulator.h,v 1.1 2019/09/06 04:40:40 mikem Exp $
+
+#ifndef RHSimulator_h
+#define RHSimulator_h
+
+#include <stdint.h>
+#include <ucontext.h>
+#include <map>
+#include <queue>
+#include <vector>
+
+// Size of the stack each simulated node runs on
+#ifndef RH_SIM_STACK_SIZE
+#define RH_SIM_STACK_SIZE (64 * 1024)
+#endif
+
+// How far virtual time moves on when a node calls YIELD, in microseconds
+#ifndef RH_SIM_YIELD_TIME
+#define RH_SIM_YIELD_TIME 1000
+#endif
+
+// A node that calls millis() or polls its driver this many times without waiting
+// is treated as if it had called YIELD, so spin loops cannot stop virtual time
+#ifndef RH_SIM_SPIN_LIMIT
+#define RH_SIM_SPIN_LIMIT 100
+#endif
+
+// Default simulated bit rate of the ether, in bits per second
+#define RH_SIM_DEFAULT_BITRATE 10000
+
+// Default RSSI reported for messages received over a link with no configured RSSI
+#define RH_SIM_DEFAULT_RSSI -50
+
+// Default log-distance path loss model, used between nodes with positions (see setPosition()).
+// Loss in dB at the reference distance in metres, and the path loss exponent. These are measured
+// values for LoRa at 868MHz in a built up area, from Bor et al, "Do LoRa Low-Power Wide-Area Networks Scale?"
+#define RH_SIM_DEFAULT_REFERENCE_LOSS 127.41
+#define RH_SIM_DEFAULT_REFERENCE_DISTANCE 40.0
+#define RH_SIM_DEFAULT_PATH_LOSS_EXPONENT 2.08
+
+// Default capture threshold in dB. A message survives an overlapping transmission if it is 
+// received at least this much stronger
+#define RH_SIM_DEFAULT_CAPTURE_THRESHOLD 6.0
+
+// Noise figure of the simulated receivers in dB, added to the thermal noise in the receiver bandwidth
+#define RH_SIM_NOISE_FIGURE 6
+
+// Interference this far below the noise floor in dB is ignored
+#define RH_SIM_INTERFERENCE_FLOOR 30
+
+class RH_Sim;
+
+/////////////////////////////////////////////////////////////////////
+/// \class RHSimNode RHSimulator.h <RHutil/RHSimulator.h>
+/// \brief Base class for one simulated node run by RHSimulator
+///
+/// A node holds what would be the globals of an Arduino sketch (the driver and manager instances)
+/// as members, and implements the sketch's setup() and loop(). Each node runs on its own stack.
+/// Whenever it waits, with delay(), YIELD or by waiting for its RH_Sim driver, it gives way to the
+/// other nodes until virtual time reaches the end of the wait.
+class RHSimNode
+{
+public:
+    /// Constructor
+    RHSimNode();
+
+    /// Destructor
+    virtual ~RHSimNode();
+
+    /// Called once, in virtual time, when the simulation starts running this node
+    virtual void setup();
+
+    /// Called repeatedly after setup()
+    virtual void loop();
+
+    /// Returns the index of this node in the simulator, in the order nodes were added
+    /// \return The index of this node
+    uint16_t index();
+
+protected:
+    friend class RHSimulator;
+
+    /// The context to switch to, to resume the node
+    ucontext_t _context;
+
+    /// The stack the node runs on
+    uint8_t*   _stack;
+
+    /// The virtual time at which the node is next to run, in microseconds
+    uint64_t   _wakeTime;
+
+    /// true if the node is also to run as soon as its driver receives a message
+    bool       _wakeOnRx;
+
+    /// Calls to millis() or available() since the node last waited
+    uint16_t   _spins;
+
+    /// Index of this node in the simulator
+    uint16_t   _index;
+};
+
+/////////////////////////////////////////////////////////////////////
+/// \class RHSimulator RHSimulator.h <RHutil/RHSimulator.h>
+/// \brief Discrete event simulator for networks of RadioHead nodes
+///
+/// RHSimulator runs many simulated nodes (see RHSimNode) in one Linux process, with a virtual clock
+/// behind millis(), delay() and YIELD. Nodes communicate through RH_Sim drivers over a simulated ether.
+/// Only one node runs at a time, and virtual time moves on only when every node is waiting,
+/// so a network runs as fast as the host can execute it, regardless of the durations simulated.
+/// With the same seed, a simulation always gives the same result.
+///
+/// \par The Ether
+///
+/// Each message takes a time to transmit that depends on its length and on the driver: LoRa time on air
+/// if the RH_Sim driver has LoRa modem parameters (RH_Sim::setModemConfig()), otherwise the bit rate 
+/// of the ether (setBitRate()). It is received by the other RH_Sim drivers on the same channel when the 
+/// transmission ends. The power it is received with is worked out in one of three ways:
+/// - If the link from the sender's address to the receiver's has been configured with setLink(), the message
+///   arrives with the configured probability, at the configured RSSI.
+/// - Otherwise, if both nodes have positions (setPosition()), it arrives with the power given by the 
+///   log-distance path loss model (setPathLoss()) and the transmitter power (RH_Sim::setTxPower()). 
+///   It can only be received if its SNR is enough for the spreading factor 
+///   (from -7.5dB at SF7 to -20dB at SF12), but weaker messages still interfere.
+/// - Otherwise it uses the default link (setDefaultLink()).
+///
+/// Messages that overlap at a receiver collide, unless one is received at least the capture threshold 
+/// (setCaptureThreshold()) stronger than the other, in which case the stronger one survives. LoRa 
+/// spreading factors are orthogonal: drivers only hear, and only collide with, messages sent with the same
+/// spreading factor and bandwidth as their own.
+/// Receivers are half duplex: to receive a message, a driver must be in RHModeRx (RH_Sim::available() puts 
+/// it there) by the end of the preamble (RH_Sim::setPreambleLength()) and stay there until the message ends. 
+/// A driver that starts transmitting loses anything it was receiving. Messages a receiver is not listening 
+/// for still interfere with the ones it is.
+/// A receiver that has not yet collected the previous message with recv() does not receive another.
+///
+/// Build a simulation with tools/simEventBuild, which uses tools/simEventMain.cpp in place of tools/simMain.cpp.
+/// The sketch creates the nodes and configures the ether in setup(), then calls run() from loop():
+/// \code
+/// class Node : public RHSimNode
+/// {
+/// public:
+///     Node(uint8_t address) : manager(driver, address) {}
+///     void setup() { manager.init(); }
+///     void loop()  { ... }
+///     RH_Sim             driver;
+///     RHReliableDatagram manager;
+/// };
+/// void setup()
+/// {
+///     Simulator.setSeed(1);
+///     Simulator.addNode(new Node(1));
+///     Simulator.addNode(new Node(2));
+///     Simulator.setLink(1, 2, 0.9);
+/// }
+/// void loop()
+/// {
+///     Simulator.run(3600000); // One hour of virtual time
+///     exit(0);
+/// }
+/// \endcode
+class RHSimulator
+{
+public:
+    /// Constructor
+    RHSimulator();
+
+    /// Destructor
+    ~RHSimulator();
+
+    /// Adds a node to the simulation. It starts running (setup() is called) at the current virtual time
+    /// the next time run() is called. The simulator owns the node and deletes it on destruction.
+    /// \param[in] node The node to add
+    void addNode(RHSimNode* node);
+
+    /// Returns the number of nodes added to the simulation
+    /// \return The number of nodes
+    uint16_t nodeCount();
+
+    /// Returns the node at an index
+    /// \param[in] index The index of the node, in the order they were added
+    /// \return Pointer to the node, or NULL if there is none
+    RHSimNode* node(uint16_t index);
+
+    /// Returns the node that is running now
+    /// \return Pointer to the running node, or NULL if the simulator itself is running
+    RHSimNode* currentNode();
+
+    /// Runs the simulation until virtual time has moved on by duration, or stop() is called
+    /// \param[in] duration The virtual time to run for, in milliseconds
+    void run(unsigned long duration);
+
+    /// Stops run() once the running node next waits
+    void stop();
+
+    /// Deletes all the nodes and puts the simulator back as it was constructed, with virtual time at 0,
+    /// so that one program can run a series of simulations, for example to compare parameters. 
+    /// Must not be called by a node
+    void reset();
+
+    /// Returns the current virtual time
+    /// \return The time since the simulation started, in microseconds
+    uint64_t now();
+
+    /// Sets the seed of the random number generator used for random() and by the ether.
+    /// Simulations with the same seed and configuration give the same results. Defaults to 1
+    /// \param[in] seed The seed
+    void setSeed(uint32_t seed);
+
+    /// Returns the next number from the random number generator
+    /// \return A pseudo random number
+    uint32_t random32();
+
+    /// Sets the bit rate of the ether, which determines how long each message takes to transmit
+    /// \param[in] bitrate Bits per second. Defaults to RH_SIM_DEFAULT_BITRATE
+    void setBitRate(uint32_t bitrate);
+
+    /// Configures the link from one node address to another. Links are one way, so to configure
+    /// both directions call it twice. Links that are not configured use the defaults set by setDefaultLink()
+    /// \param[in] from The address of the sending node
+    /// \param[in] to The address of the receiving node
+    /// \param[in] probability The probability that a message is received, from 0.0 (never) to 1.0 (always)
+    /// \param[in] rssi The RSSI reported by the receiving driver for messages over this link
+    void setLink(uint8_t from, uint8_t to, float probability, int16_t rssi = RH_SIM_DEFAULT_RSSI);
+
+    /// Sets the probability and RSSI of links that have not been configured with setLink(),
+    /// between nodes that do not both have positions.
+    /// The defaults are 1.0 and RH_SIM_DEFAULT_RSSI: every node hears every other.
+    /// \param[in] probability The probability that a message is received, from 0.0 to 1.0
+    /// \param[in] rssi The RSSI reported for messages received
+    void setDefaultLink(float probability, int16_t rssi = RH_SIM_DEFAULT_RSSI);
+
+    /// Sets the position of a node, so that the power of messages between it and other nodes with 
+    /// positions is given by the path loss model
+    /// \param[in] address The address of the node
+    /// \param[in] x The x coordinate in metres
+    /// \param[in] y The y coordinate in metres
+    void setPosition(uint8_t address, float x, float y);
+
+    /// Sets the log-distance path loss model: loss = referenceLoss + 10 * exponent * log10(distance / referenceDistance),
+    /// plus a normally distributed random shadowing term. Defaults to RH_SIM_DEFAULT_REFERENCE_LOSS,
+    /// RH_SIM_DEFAULT_REFERENCE_DISTANCE, RH_SIM_DEFAULT_PATH_LOSS_EXPONENT and no shadowing.
+    /// \param[in] referenceLoss Loss in dB at the reference distance
+    /// \param[in] referenceDistance The reference distance in metres. Nodes closer than this have the reference loss
+    /// \param[in] exponent The path loss exponent. 2 is free space
+    /// \param[in] shadowing Standard deviation in dB of the random variation of each message
+    void setPathLoss(float referenceLoss, float referenceDistance, float exponent, float shadowing = 0.0);
+
+    /// Sets the capture threshold. Defaults to RH_SIM_DEFAULT_CAPTURE_THRESHOLD
+    /// \param[in] threshold How much stronger in dB a message must be than any message it overlaps with to be received
+    void setCaptureThreshold(float threshold);
+
+    /// Returns the bit rate of the ether, used by drivers without LoRa modem parameters
+    /// \return Bits per second
+    uint32_t bitRate();
+
+    /// Returns the number of messages transmitted since the simulation started
+    uint32_t transmitted();
+
+    /// Returns the number of messages delivered to receivers since the simulation started.
+    /// A broadcast is counted once for each receiver
+    uint32_t delivered();
+
+    /// Returns the number of messages lost in collisions since the simulation started
+    uint32_t collisions();
+
+    /// Returns the number of messages lost because the receiver was transmitting, since the simulation started
+    uint32_t halfDuplexLosses();
+
+    /// Suspends the running node until virtual time reaches when. Used by delay(), YIELD and RH_Sim.
+    /// If called by the simulator itself (for example in setup()), virtual time just moves on
+    /// \param[in] when The virtual time to wake at, in microseconds
+    /// \param[in] wakeOnRx If true, also wake as soon as one of the node's drivers receives a message
+    void sleepUntil(uint64_t when, bool wakeOnRx);
+
+    /// Suspends the running node for the yield time (RH_SIM_YIELD_TIME), or until it receives a message
+    void yield();
+
+    /// Counts a poll of the clock or a driver by the running node, and yields after RH_SIM_SPIN_LIMIT of them
+    void spin();
+
+    /// Connects a driver to the ether. Called by RH_Sim::init()
+    /// \param[in] driver The driver
+    void attach(RH_Sim* driver);
+
+    /// Transmits a message from a driver to the ether. It takes RH_Sim::timeOnAir() to transmit
+    /// \param[in] driver The transmitting driver
+    /// \param[in] to The TO header
+    /// \param[in] from The FROM header
+    /// \param[in] id The ID header
+    /// \param[in] flags The FLAGS header
+    /// \param[in] data The payload
+    /// \param[in] len Length of the payload
+    /// \return The virtual time at which the transmission ends, in microseconds
+    uint64_t transmit(RH_Sim* driver, uint8_t to, uint8_t from, uint8_t id, uint8_t flags, const uint8_t* data, uint8_t len);
+
+private:
+    /// States of a Reception
+    typedef enum
+    {
+	ReceptionFree = 0,   ///< Not in use
+	ReceptionReceiving,  ///< Arriving intact so far
+	ReceptionCollided,   ///< Wrecked by an overlapping message
+	ReceptionDeafened    ///< Wrecked by the receiver transmitting
+    } ReceptionState;
+
+    /// A message on its way through the ether to one receiver
+    typedef struct
+    {
+	RH_Sim*   receiver;   ///< The receiving driver
+	uint16_t  frame;      ///< Index of the message in _frames
+	uint64_t  end;        ///< Virtual time the transmission ends
+	uint64_t  sync;       ///< Virtual time the preamble ends: the receiver must be listening by then
+	float     power;      ///< Received power in dBm
+	float     snr;        ///< Signal to noise ratio in dB
+	uint8_t   state;      ///< One of ReceptionState
+	bool      detectable; ///< Strong enough to be received, if nothing else interferes
+    } Reception;
+
+    /// The end of a Reception
+    typedef struct
+    {
+	uint64_t  time;      ///< Virtual time the transmission ends
+	uint32_t  sequence;  ///< Order of scheduling, to keep simultaneous events in a repeatable order
+	uint16_t  reception; ///< Index of the Reception in _receptions
+    } Arrival;
+
+    /// Orders the event queue earliest first
+    struct Later
+    {
+	bool operator()(const Arrival& a, const Arrival& b) const
+	{
+	    return a.time != b.time ? a.time > b.time : a.sequence > b.sequence;
+	}
+    };
+
+    /// A transmitted message, shared by all its arrivals
+    typedef struct
+    {
+	uint8_t   header[4];  ///< TO, FROM, ID and FLAGS
+	uint8_t   data[255];  ///< Payload
+	uint8_t   len;        ///< Length of the payload
+	uint16_t  arrivals;   ///< Number of arrivals still to be processed
+    } Frame;
+
+    /// Probability and RSSI of a link
+    typedef struct
+    {
+	float     probability;
+	int16_t   rssi;
+    } Link;
+
+    /// Coordinates of a node in metres
+    typedef struct
+    {
+	float     x;
+	float     y;
+    } Position;
+
+    /// Works out whether and how strongly a message from one driver reaches another
+    /// \param[in] from The transmitting driver
+    /// \param[in] to The receiving driver
+    /// \param[out] power Set to the received power in dBm
+    /// \param[out] detectable Set to true if it is strong enough to be received
+    /// \return false if it does not reach the receiver at all
+    bool propagate(RH_Sim* from, RH_Sim* to, float* power, bool* detectable);
+
+    /// Returns a normally distributed random number
+    /// \return A random number with mean 0 and standard deviation 1
+    float randomNormal();
+
+    /// Switches from the running node back to the simulator
+    void suspend();
+
+    /// Runs a node until it next waits
+    void resume(RHSimNode* node);
+
+    /// Processes the earliest message arrival
+    void arrive();
+
+    /// Entry point of each node's stack
+    static void nodeMain();
+
+    std::vector<RHSimNode*> _nodes;
+    std::vector<RH_Sim*>    _drivers;
+    std::vector<Frame>      _frames;
+    std::vector<uint16_t>   _freeFrames;
+    std::priority_queue<Arrival, std::vector<Arrival>, Later> _arrivals;
+    std::vector<Reception>  _receptions;
+    std::vector<uint16_t>   _freeReceptions;
+    std::map<uint16_t, Link> _links;
+    Link                    _defaultLink;
+    std::map<uint8_t, Position> _positions;
+    float                   _referenceLoss;
+    float                   _referenceDistance;
+    float                   _pathLossExponent;
+    float                   _shadowing;
+    float                   _captureThreshold;
+    ucontext_t              _context;
+    RHSimNode*              _current;
+    uint64_t                _now;
+    uint32_t                _sequence;
+    uint32_t                _random;
+    uint32_t                _bitrate;
+    bool                    _running;
+    uint32_t                _transmitted;
+    uint32_t                _delivered;
+    uint32_t                _collisions;
+    uint32_t                _halfDuplexLosses;
+};
+
+/// The simulator, defined in tools/simEventMain.cpp
+extern RHSimulator Simulator;
+
+#endif
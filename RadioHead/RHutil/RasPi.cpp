@@ -105,6 +105,15 @@ unsigned long millis()
   return difference;
 }
 
+unsigned long micros()
+{
+  struct timeval RHCurrentTime;
+  gettimeofday(&RHCurrentTime,NULL);
+  unsigned long difference = ((RHCurrentTime.tv_sec - RHStartTime.tv_sec) * 1000000);
+  difference += (RHCurrentTime.tv_usec - RHStartTime.tv_usec);
+  return difference;
+}
+
 void delay (unsigned long ms)
 {
   //Implement Delay function
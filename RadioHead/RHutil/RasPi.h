@@ -68,6 +68,8 @@ void digitalWrite(unsigned char pin, unsigned char value);
 
 unsigned long millis();
 
+unsigned long micros();
+
 void delay (unsigned long delay);
 
 long random(long min, long max);
@@ -10,6 +10,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <math.h>
 
 // Equivalent types for common Arduino types like uint8_t are in stdint.h
 
@@ -23,6 +24,25 @@ extern void delay(unsigned long ms);
 extern unsigned long millis();
 extern long random(long to);
 extern long random(long from, long to);
+extern void yield();
+extern unsigned long micros();
+
+// Digital pins, for drivers of devices on the SPI bus. Only the virtual time simulator
+// (tools/simEventMain.cpp) has them. Interrupts are numbered as their pins, and run when 
+// digitalWrite() makes the edge they wait for. A simulated device can watch its chip select
+// pin that way
+#define LOW     0
+#define HIGH    1
+#define INPUT   0
+#define OUTPUT  1
+#define CHANGE  1
+#define FALLING 2
+#define RISING  3
+extern void pinMode(uint8_t pin, uint8_t mode);
+extern void digitalWrite(uint8_t pin, uint8_t val);
+extern int  digitalRead(uint8_t pin);
+extern void attachInterrupt(uint8_t interrupt, void (*isr)(), int mode);
+extern void detachInterrupt(uint8_t interrupt);
 
 // Equavalent to HardwareSerial in Arduino
 // but outputs to stdout
@@ -136,6 +136,21 @@ For use with simulated sketches compiled and running on Linux.
 Works with tools/etherSimulator.pl to pass messages between simulated sketches, allowing
 testing of Manager classes on Linux and without need for real radios or other transport hardware.
 
+- RH_Sim
+For use with the RHSimulator discrete event simulator (RHutil/RHSimulator.h) on Linux, which runs 
+many simulated nodes in one process in virtual time, so large networks can be tested 
+quickly and repeatably. Build with tools/simEventBuild.
+
+- RH_Loopback
+For use with simulated sketches on Linux. Passes messages between drivers in the same process through
+memory, with optional loss, delay and reordering, so Manager classes can be tested and benchmarked in 
+one program, in real time, with no ether simulator server and no system calls.
+
+- RH_Replay
+For use with simulated sketches on Linux. Feeds the messages in a pcap capture, made with RHPcapCapture 
+and RHGenericDriver::setCapture(), back into a RadioHead stack and checks that it sends the same 
+messages as when the capture was made, so field traffic can be turned into repeatable tests.
+
 - RHEncryptedDriver
 Adds encryption and decryption to any RadioHead transport driver, using any encrpytion cipher
 supported by ArduinoLibs Cryptographic Library http://rweather.github.io/arduinolibs/crypto.html
@@ -172,6 +187,21 @@ Multi-hop delivery of RHReliableDatagrams with automatic route discovery and red
 
 Any Manager may be used with any Driver.
 
+Each Manager and Driver keeps statistics, such as ACK round trip times, retries per message, duplicates
+dropped, routing table hits and misses, route discovery times and time spent transmitting.
+RHDatagram::serializeStats() writes the statistics of a whole stack in a compact binary format (see RHStats.h)
+that can be sent in a message or dumped over a serial port, and decoded with RHStatsReader.
+
+Where regulations limit the duty cycle, such as 1% in parts of the EU 868 MHz band, an RHDutyCycle
+airtime budget can be given to drivers that know the time on air of their messages (RH_RF95 and RH_Sim)
+with RHGenericDriver::setDutyCycle(). The driver then refuses to exceed it, and RHReliableDatagram
+and RHMesh wait for the budget to allow each transmission, so you get the most traffic the rules allow.
+
+On LoRa links, an RHAdaptiveRate controller given to a manager with RHDatagram::setAdaptiveRate() picks the
+fastest spreading factor and bandwidth, and the lowest transmitter power, that each link can carry, from the SNR
+of recent messages. The two ends of a link agree each change in a short control exchange. It suits point to point
+links and polled stars, with RH_RF95 and RH_Sim.
+
 \par Platforms
 
 A range of processors and platforms are supported:
@@ -1409,6 +1439,8 @@ these examples and explanations and extend them to suit your needs.
  // Simulate the sketch on Linux and OSX
  #include <RHutil/simulator.h>
  #define RH_HAVE_SERIAL
+ #define PROGMEM
+ #define memcpy_P memcpy
 #include <netinet/in.h> // For htons and friends
 
 #else
@@ -1464,6 +1496,9 @@ these examples and explanations and extend them to suit your needs.
    void mgosYield(void);
  }
  #define YIELD mgosYield()
+#elif (RH_PLATFORM == RH_PLATFORM_UNIX)
+ // The virtual time simulator (tools/simEventMain.cpp) runs other nodes meanwhile
+ #define YIELD yield();
 #else
  #define YIELD
 #endif
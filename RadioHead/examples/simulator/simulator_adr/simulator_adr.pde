@@ -0,0 +1,185 @@
+// simulator_adr.pde
+// -*- mode: C++ -*-
+// Example sketch showing how RHAdaptiveRate adapts the spreading factor, bandwidth and transmitter
+// power of each link to its quality. A gateway polls 3 collars in turn with RHReliableDatagram, and
+// each collar replies with a reading. The collars are 5m, 1km and 4km from the gateway, and all
+// start at spreading factor 7, 125kHz and 14dBm. After 30 minutes of virtual time the gateway prints
+// the rate and power of each link, and the airtime each node used.
+// Then the same network runs again without adaptation, for comparison. Prints PASS if adaptation
+// answered at least as many polls in less airtime, else FAIL. Exits with status 1 on FAIL.
+// Tested on Linux
+// Build with
+// cd whatever/RadioHead
+// tools/simEventBuild examples/simulator/simulator_adr/simulator_adr.pde
+// Run with ./simulator_adr [seed]
+
+#include <RHReliableDatagram.h>
+#include <RHAdaptiveRate.h>
+#include <RH_Sim.h>
+#include <RHutil/RHSimulator.h>
+
+#define NODES 4
+#define GATEWAY_ADDRESS 1
+
+// Thirty minutes
+#define DURATION 1800000
+
+// Each collar is polled this often, in milliseconds
+#define POLL_INTERVAL 10000
+
+#define MAX_POWER 14
+
+uint8_t poll[] = "Report";
+uint8_t reading[] = "Temperature 21.5C, battery 3.9V";
+
+bool useAdr;
+uint32_t seed = 1;
+
+class AdrNode : public RHSimNode
+{
+public:
+  AdrNode(uint8_t address)
+    : manager(driver, address),
+      adr(driver, MAX_POWER, 2),
+      nextPoll(0),
+      collar(0),
+      polls(0),
+      replies(0)
+  {
+  }
+
+  void setup()
+  {
+    if (!manager.init())
+      Serial.println("init failed");
+    driver.setModemConfig(RH_Sim::Bw125Cr45Sf128);
+    driver.setTxPower(MAX_POWER);
+    // Each link carries a poll every POLL_INTERVAL, so this is several missed polls
+    adr.setSilence(POLL_INTERVAL * 6);
+    if (useAdr)
+      manager.setAdaptiveRate(&adr);
+  }
+
+  void loop()
+  {
+    uint8_t len = sizeof(buf);
+    uint8_t from;
+    if (manager.thisAddress() != GATEWAY_ADDRESS)
+    {
+      // Collar: reply to each poll
+      if (manager.recvfromAckTimeout(buf, &len, 1000, &from))
+	manager.sendtoWait(reading, sizeof(reading), from);
+      return;
+    }
+
+    // Gateway: poll the collars in turn, and wait for the reply at the rate of the link
+    if (millis() < nextPoll)
+    {
+      manager.recvfromAckTimeout(buf, &len, nextPoll - millis());
+      return;
+    }
+    nextPoll = millis() + POLL_INTERVAL / (NODES - 1);
+    uint8_t address = GATEWAY_ADDRESS + 1 + collar;
+    collar = (collar + 1) % (NODES - 1);
+    polls++;
+    if (manager.sendtoWait(poll, sizeof(poll), address)
+	&& manager.recvfromAckTimeout(buf, &len, 3000, &from)
+	&& from == address)
+      replies++;
+  }
+
+  RH_Sim             driver;
+  RHReliableDatagram manager;
+  RHAdaptiveRate     adr;
+  unsigned long      nextPoll;
+  uint8_t            collar;
+  uint32_t           polls;
+  uint32_t           replies;
+  uint8_t            buf[RH_SIM_MAX_MESSAGE_LEN];
+};
+
+AdrNode* nodes[NODES];
+
+// Distance of each node from the gateway in metres
+float distances[NODES] = { 0.0, 5.0, 1000.0, 4000.0 };
+
+// Runs the network for DURATION, and prints the results
+// \param[out] replies Set to the number of polls answered
+// \return The total airtime of all the nodes in milliseconds
+uint32_t simulate(bool adr, uint32_t* replies)
+{
+  useAdr = adr;
+  Simulator.reset();
+  Simulator.setSeed(seed);
+  uint8_t i;
+  for (i = 0; i < NODES; i++)
+  {
+    Simulator.addNode(nodes[i] = new AdrNode(i + 1));
+    Simulator.setPosition(i + 1, distances[i], 0.0);
+  }
+  // Open country: free space loss at 868MHz to 1m, then falling off a little faster, with 3dB of fading
+  Simulator.setPathLoss(31.2, 1.0, 2.7, 3.0);
+  Simulator.run(DURATION);
+
+  Serial.println(adr ? "With adaptive data rate" : "Without adaptive data rate");
+  AdrNode* gateway = nodes[0];
+  Serial.print("Gateway: ");
+  Serial.print(gateway->replies, DEC);
+  Serial.print(" replies to ");
+  Serial.print(gateway->polls, DEC);
+  Serial.print(" polls, ");
+  Serial.print((unsigned int)gateway->adr.rateChanges(), DEC);
+  Serial.println(" rate changes");
+
+  uint32_t airtime = 0;
+  for (i = 0; i < NODES; i++)
+  {
+    RHDriverStats stats;
+    nodes[i]->driver.driverStats(&stats);
+    Serial.print("Node ");
+    Serial.print((unsigned int)(i + 1), DEC);
+    if (i != 0)
+    {
+      RHAdaptiveRate::Rate rate = gateway->adr.rate(i + 1);
+      Serial.print(" at ");
+      Serial.print((uint32_t)distances[i], DEC);
+      Serial.print("m: SF");
+      Serial.print((unsigned int)rate.spreadingFactor, DEC);
+      Serial.print(" ");
+      Serial.print(rate.bandwidth / 1000, DEC);
+      Serial.print("kHz, gateway power ");
+      Serial.print((unsigned int)gateway->adr.power(i + 1), DEC);
+      Serial.print("dBm, collar power ");
+      Serial.print((unsigned int)nodes[i]->adr.power(GATEWAY_ADDRESS), DEC);
+      Serial.print("dBm");
+    }
+    Serial.print(": transmitted ");
+    Serial.print((unsigned int)stats.txGood, DEC);
+    Serial.print(" messages, airtime ");
+    Serial.print(stats.txAirtime, DEC);
+    Serial.println(" ms");
+    airtime += stats.txAirtime;
+  }
+  Serial.print("Total airtime ");
+  Serial.print(airtime, DEC);
+  Serial.println(" ms");
+  *replies = gateway->replies;
+  return airtime;
+}
+
+void setup()
+{
+  if (_simulator_argc >= 2)
+    seed = atoi(_simulator_argv[1]);
+}
+
+void loop()
+{
+  uint32_t adrReplies, fixedReplies;
+  uint32_t adrAirtime = simulate(true, &adrReplies);
+  uint32_t fixedAirtime = simulate(false, &fixedReplies);
+
+  bool pass = adrReplies >= fixedReplies && adrAirtime < fixedAirtime;
+  Serial.println(pass ? "PASS" : "FAIL");
+  exit(pass ? 0 : 1);
+}
@@ -0,0 +1,786 @@
+// simulator_benchmark.pde
+// -*- mode: C++ -*-
+// Benchmarks for the RadioHead protocol stack, run on a Linux host.
+// Runs the managers over in-memory RH_Sim drivers under the RHSimulator discrete event simulator, and
+// reports:
+// - throughput: messages per CPU second, CPU nanoseconds per message, and the extra CPU each layer adds
+//   to the one below it, for RH_Sim alone, RHDatagram, RHReliableDatagram (including the ACK), 
+//   RHRouter (static route), RHMesh (route already discovered) and RHEncryptedDriver (Speck, if built with it).
+//   The extra CPU is the difference between the best runs of two layers, so it is only meaningful when it is 
+//   bigger than the run to run noise: layer_cpu_noise is the gap between the best and second best runs of 
+//   both layers, and layer_cpu_resolved is 0 when the difference is smaller than that. Differences below 0 
+//   are reported as 0
+// - bytes copied per message by memcpy and memmove, when built with tools/benchBuild
+// - loopback: the same layers over RH_Loopback in real time, with the receiving node in its own thread:
+//   messages per wall clock second and wall clock nanoseconds per message, with no simulator or system calls
+//   in the way (except when a thread has nothing to do and yields)
+// - RH_Serial over a pseudo terminal that echoes everything back, and the RHCRC functions
+// - RHMesh route discovery: virtual time until the first message reaches the far end of a chain of 
+//   nodes that only hear their neighbours, for each chain length up to --nodes. The first node keeps calling 
+//   sendtoWait() until it gets there, as an application would. Every node needs a route to every other, so 
+//   chains can be no longer than RH_ROUTING_TABLE_SIZE + 1 nodes
+// - RHReliableDatagram delivery latency percentiles in virtual time, over a link that loses messages
+// Results are written to stdout as CSV (the default) or JSON, one row per measurement, 
+// so they can be kept and compared between releases. CPU times vary from run to run, virtual
+// times and message counts do not.
+// Tested on Linux
+// Build with
+// cd whatever/RadioHead 
+// tools/benchBuild examples/simulator/simulator_benchmark/simulator_benchmark.pde
+// Run with ./simulator_benchmark [--json] [--messages n] [--size octets] [--loss probability] [--nodes n] [--repeats n] [--seed n]
+
+#include <RHMesh.h>
+#include <RH_Sim.h>
+#include <RH_Serial.h>
+#include <RH_Loopback.h>
+#include <RHCRC.h>
+#include <RHutil/RHSimulator.h>
+#include <RHutil/HardwareSerial.h>
+#ifdef RH_ENABLE_ENCRYPTION_MODULE
+#include <RHEncryptedDriver.h>
+#include <Speck.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+
+// Command line options
+unsigned long messages = 10000;  // Messages for each throughput benchmark
+uint8_t       size = 20;         // Payload octets
+float         loss = 0.1;        // Probability of losing each message in the latency benchmark
+uint8_t       maxNodes = 8;      // Longest chain in the route discovery benchmark
+uint32_t      seed = 1;
+uint8_t       repeats = 5;       // Runs of each throughput benchmark
+bool          json = false;
+
+// Bytes copied by memcpy and memmove. tools/benchBuild links the sketch so that all calls 
+// to them go through here
+unsigned long long copied = 0;
+#ifdef RH_BENCHMARK_COUNT_COPIES
+extern "C" void* __real_memcpy(void* dest, const void* src, size_t n);
+extern "C" void* __real_memmove(void* dest, const void* src, size_t n);
+extern "C" void* __wrap_memcpy(void* dest, const void* src, size_t n)
+{
+  copied += n;
+  return __real_memcpy(dest, src, n);
+}
+extern "C" void* __wrap_memmove(void* dest, const void* src, size_t n)
+{
+  copied += n;
+  return __real_memmove(dest, src, n);
+}
+#endif
+
+// One measurement
+typedef struct
+{
+  const char*   benchmark;
+  const char*   name;
+  unsigned long param;
+  const char*   metric;
+  double        value;
+  const char*   unit;
+} Result;
+
+std::vector<Result> results;
+
+void report(const char* benchmark, const char* name, unsigned long param, const char* metric, double value, const char* unit)
+{
+  Result r = { benchmark, name, param, metric, value, unit };
+  results.push_back(r);
+}
+
+void printResults()
+{
+  size_t i;
+  if (json)
+  {
+    printf("[\n");
+    for (i = 0; i < results.size(); i++)
+      printf("  {\"benchmark\": \"%s\", \"name\": \"%s\", \"param\": %lu, \"metric\": \"%s\", \"value\": %.6g, \"unit\": \"%s\"}%s\n",
+	     results[i].benchmark, results[i].name, results[i].param, results[i].metric, 
+	     results[i].value, results[i].unit, i + 1 < results.size() ? "," : "");
+    printf("]\n");
+  }
+  else
+  {
+    printf("benchmark,name,param,metric,value,unit\n");
+    for (i = 0; i < results.size(); i++)
+      printf("%s,%s,%lu,%s,%.6g,%s\n",
+	     results[i].benchmark, results[i].name, results[i].param, results[i].metric, 
+	     results[i].value, results[i].unit);
+  }
+}
+
+// CPU time used by the process
+uint64_t cpuNanoseconds()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/////////////////////////////////////////////////////////////////////
+// Throughput: node 1 sends messages to node 2 as fast as the layer allows
+
+typedef enum
+{
+  LayerDriver = 0,
+  LayerDatagram,
+  LayerReliable,
+  LayerRouter,
+  LayerMesh,
+  LayerEncrypted,
+} Layer;
+
+const char* layerNames[] = { "driver", "datagram", "reliable", "router", "mesh", "encrypted" };
+
+// The layer each one adds to
+const Layer layerBelow[] = { LayerDriver, LayerDriver, LayerDatagram, LayerReliable, LayerRouter, LayerDatagram };
+
+unsigned long throughputSent;
+unsigned long throughputReceived;
+
+#ifdef RH_ENABLE_ENCRYPTION_MODULE
+uint8_t encryptionKey[16] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16 };
+#endif
+
+class ThroughputNode : public RHSimNode
+{
+public:
+  ThroughputNode(Layer layer, uint8_t address)
+    : layer(layer),
+      address(address),
+      datagram(driver, address),
+      reliable(driver, address),
+      router(driver, address),
+      mesh(driver, address)
+#ifdef RH_ENABLE_ENCRYPTION_MODULE
+      , encrypted(driver, cipher),
+      encryptedDatagram(encrypted, address)
+#endif
+  {
+  }
+
+  void setup()
+  {
+    switch (layer)
+    {
+      case LayerDriver:
+	driver.init();
+	driver.setThisAddress(address);
+	driver.setHeaderFrom(address);
+	driver.setHeaderTo(address == 1 ? 2 : 1);
+	break;
+      case LayerDatagram:  datagram.init(); break;
+      case LayerReliable:  reliable.init(); break;
+      case LayerRouter:
+	router.init();
+	router.addRouteTo(address == 1 ? 2 : 1, address == 1 ? 2 : 1);
+	break;
+      case LayerMesh:      mesh.init(); break;
+      case LayerEncrypted:
+#ifdef RH_ENABLE_ENCRYPTION_MODULE
+	cipher.setKey(encryptionKey, sizeof(encryptionKey));
+	encryptedDatagram.init();
+#endif
+	break;
+    }
+  }
+
+  void loop()
+  {
+    if (address == 1)
+    {
+      memset(buf, 'a', size);
+      if (throughputSent >= messages + 1) // The first is not timed
+      {
+	Simulator.stop();
+	delay(1000000);
+	return;
+      }
+      throughputSent++;
+      switch (layer)
+      {
+	case LayerDriver:    driver.send(buf, size); driver.waitPacketSent(); break;
+	case LayerDatagram:  datagram.sendto(buf, size, 2); datagram.waitPacketSent(); break;
+	case LayerReliable:  reliable.sendtoWait(buf, size, 2); break;
+	case LayerRouter:    router.sendtoWait(buf, size, 2); break;
+	case LayerMesh:      mesh.sendtoWait(buf, size, 2); break;
+	case LayerEncrypted:
+#ifdef RH_ENABLE_ENCRYPTION_MODULE
+	  encryptedDatagram.sendto(buf, size, 2); encryptedDatagram.waitPacketSent();
+#endif
+	  break;
+      }
+    }
+    else
+    {
+      uint8_t len = sizeof(buf);
+      bool got = false;
+      switch (layer)
+      {
+	case LayerDriver:    driver.waitAvailable(); got = driver.recv(buf, &len); break;
+	case LayerDatagram:  datagram.waitAvailable(); got = datagram.recvfrom(buf, &len); break;
+	case LayerReliable:  got = reliable.recvfromAckTimeout(buf, &len, 1000); break;
+	case LayerRouter:    got = router.recvfromAckTimeout(buf, &len, 1000); break;
+	case LayerMesh:      got = mesh.recvfromAckTimeout(buf, &len, 1000); break;
+	case LayerEncrypted:
+#ifdef RH_ENABLE_ENCRYPTION_MODULE
+	  encryptedDatagram.waitAvailable(); got = encryptedDatagram.recvfrom(buf, &len);
+#endif
+	  break;
+      }
+      if (got)
+	throughputReceived++;
+    }
+  }
+
+  Layer              layer;
+  uint8_t            address;
+  RH_Sim             driver;
+  RHDatagram         datagram;
+  RHReliableDatagram reliable;
+  RHRouter           router;
+  RHMesh             mesh;
+#ifdef RH_ENABLE_ENCRYPTION_MODULE
+  Speck              cipher;
+  RHEncryptedDriver  encrypted;
+  RHDatagram         encryptedDatagram;
+#endif
+  uint8_t            buf[RH_SIM_MAX_MESSAGE_LEN];
+};
+
+// CPU nanoseconds per message of each layer in its best run, and how much worse its second best run
+// was, to work out what each adds
+double layerNanoseconds[LayerEncrypted + 1];
+double layerNoise[LayerEncrypted + 1];
+
+void benchmarkThroughput(Layer layer)
+{
+  // CPU times are the best of several runs, to keep out noise from the rest of the system
+  double        nanoseconds = 0;
+  double        secondBest = 0;
+#ifdef RH_BENCHMARK_COUNT_COPIES
+  double        bytesCopied = 0;
+#endif
+  unsigned long received = 0;
+  for (uint8_t run = 0; run < repeats; run++)
+  {
+    Simulator.reset();
+    Simulator.setSeed(seed);
+    Simulator.addNode(new ThroughputNode(layer, 1));
+    Simulator.addNode(new ThroughputNode(layer, 2));
+    throughputSent = 0;
+    throughputReceived = 0;
+
+    // Let the first message through untimed, so the mesh has discovered its route
+    while (throughputSent < 1 || (throughputReceived < 1 && Simulator.now() < 10000000))
+      Simulator.run(1);
+    unsigned long firstReceived = throughputReceived;
+#ifdef RH_BENCHMARK_COUNT_COPIES
+    unsigned long long startCopied = copied;
+#endif
+    uint64_t start = cpuNanoseconds();
+    Simulator.run(0xffffffff);
+    uint64_t cpu = cpuNanoseconds() - start;
+    received = throughputReceived - firstReceived;
+    if (!received)
+      return;
+    double perMessage = (double)cpu / received;
+    if (!run || perMessage < nanoseconds)
+    {
+      secondBest = nanoseconds;
+      nanoseconds = perMessage;
+    }
+    else if (run == 1 || perMessage < secondBest)
+      secondBest = perMessage;
+#ifdef RH_BENCHMARK_COUNT_COPIES
+    bytesCopied = (double)(copied - startCopied) / received;
+#endif
+  }
+
+  const char* name = layerNames[layer];
+  layerNanoseconds[layer] = nanoseconds;
+  layerNoise[layer] = repeats > 1 ? secondBest - nanoseconds : 0;
+  report("throughput", name, size, "messages_per_second", 1e9 / nanoseconds, "1/s");
+  report("throughput", name, size, "cpu_per_message", nanoseconds, "ns");
+  if (layer != LayerDriver)
+  {
+    Layer below = layerBelow[layer];
+    double extra = nanoseconds - layerNanoseconds[below];
+    double noise = layerNoise[layer] + layerNoise[below];
+    report("throughput", name, size, "layer_cpu_per_message", extra > 0 ? extra : 0, "ns");
+    report("throughput", name, size, "layer_cpu_noise", noise, "ns");
+    report("throughput", name, size, "layer_cpu_resolved", extra > noise, "bool");
+  }
+#ifdef RH_BENCHMARK_COUNT_COPIES
+  report("throughput", name, size, "bytes_copied_per_message", bytesCopied, "bytes");
+#endif
+  report("throughput", name, size, "delivered", (double)received / messages, "ratio");
+}
+
+/////////////////////////////////////////////////////////////////////
+// Loopback: the same layers over RH_Loopback, with node 2 receiving in its own thread. Routes are
+// added statically, so the nodes never wait in virtual time, which does not pass outside the simulator
+
+class LoopbackNode
+{
+public:
+  LoopbackNode(RHLoopbackMedium& medium, Layer layer, uint8_t address)
+    : layer(layer),
+      address(address),
+      driver(medium),
+      datagram(driver, address),
+      reliable(driver, address),
+      router(driver, address),
+      mesh(driver, address)
+  {
+  }
+
+  bool init()
+  {
+    uint8_t other = address == 1 ? 2 : 1;
+    switch (layer)
+    {
+      case LayerDriver:
+	if (!driver.init())
+	  return false;
+	driver.setThisAddress(address);
+	driver.setHeaderFrom(address);
+	driver.setHeaderTo(other);
+	return true;
+      case LayerDatagram:  return datagram.init();
+      case LayerReliable:  return reliable.init();
+      case LayerRouter:
+	if (!router.init())
+	  return false;
+	router.addRouteTo(other, other);
+	return true;
+      case LayerMesh:
+	if (!mesh.init())
+	  return false;
+	mesh.addRouteTo(other, other);
+	return true;
+      default:
+	return false;
+    }
+  }
+
+  bool send()
+  {
+    memset(buf, 'a', size);
+    switch (layer)
+    {
+      case LayerDriver:    return driver.send(buf, size);
+      case LayerDatagram:  return datagram.sendto(buf, size, 2);
+      case LayerReliable:  return reliable.sendtoWait(buf, size, 2);
+      case LayerRouter:    return router.sendtoWait(buf, size, 2) == RH_ROUTER_ERROR_NONE;
+      case LayerMesh:      return mesh.sendtoWait(buf, size, 2) == RH_ROUTER_ERROR_NONE;
+      default:             return false;
+    }
+  }
+
+  // Does not wait, so the receiving thread never calls millis() or random()
+  bool receive()
+  {
+    uint8_t len = sizeof(buf);
+    switch (layer)
+    {
+      case LayerDriver:    return driver.recv(buf, &len);
+      case LayerDatagram:  return datagram.recvfrom(buf, &len);
+      case LayerReliable:  return reliable.recvfromAck(buf, &len);
+      case LayerRouter:    return router.recvfromAck(buf, &len);
+      case LayerMesh:      return mesh.recvfromAck(buf, &len);
+      default:             return false;
+    }
+  }
+
+  Layer              layer;
+  uint8_t            address;
+  RH_Loopback        driver;
+  RHDatagram         datagram;
+  RHReliableDatagram reliable;
+  RHRouter           router;
+  RHMesh             mesh;
+  uint8_t            buf[RH_LOOPBACK_MAX_MESSAGE_LEN];
+};
+
+std::atomic<bool>          loopbackDone;
+std::atomic<unsigned long> loopbackReceived;
+
+void loopbackReceiver(LoopbackNode* node)
+{
+  while (!loopbackDone)
+  {
+    if (node->receive())
+      loopbackReceived++;
+    else
+      std::this_thread::yield();
+  }
+}
+
+uint64_t wallNanoseconds()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void benchmarkLoopback(Layer layer)
+{
+  double        nanoseconds = 0;
+  unsigned long received = 0;
+  for (uint8_t run = 0; run < repeats; run++)
+  {
+    RHLoopbackMedium medium;
+    LoopbackNode* sender = new LoopbackNode(medium, layer, 1);
+    LoopbackNode* receiver = new LoopbackNode(medium, layer, 2);
+    if (!sender->init() || !receiver->init())
+      return;
+    loopbackDone = false;
+    loopbackReceived = 0;
+    std::thread thread(loopbackReceiver, receiver);
+
+    uint64_t start = wallNanoseconds();
+    for (unsigned long sent = 0; sent < messages; sent++)
+    {
+      // Without acknowledgements, keep from overflowing the ring to the receiver
+      while (sent - loopbackReceived >= RH_LOOPBACK_RING_LEN)
+	std::this_thread::yield();
+      sender->send();
+    }
+    // Wait for the last few to arrive
+    for (unsigned long tries = 0; loopbackReceived < messages && tries < 1000000; tries++)
+      std::this_thread::yield();
+    uint64_t wall = wallNanoseconds() - start;
+    loopbackDone = true;
+    thread.join();
+    received = loopbackReceived;
+    delete sender;
+    delete receiver;
+    if (!received)
+      return;
+    if (!run || (double)wall / received < nanoseconds)
+      nanoseconds = (double)wall / received;
+  }
+
+  const char* name = layerNames[layer];
+  report("loopback", name, size, "messages_per_second", 1e9 / nanoseconds, "1/s");
+  report("loopback", name, size, "wall_per_message", nanoseconds, "ns");
+  report("loopback", name, size, "delivered", (double)received / messages, "ratio");
+}
+
+/////////////////////////////////////////////////////////////////////
+// RH_Serial through a pseudo terminal. The master side echoes everything back, so 
+// each message is encoded, sent, received and decoded by the same driver
+void benchmarkSerial()
+{
+  int master = posix_openpt(O_RDWR | O_NOCTTY);
+  if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0)
+  {
+    fprintf(stderr, "simulator_benchmark: could not open a pseudo terminal\n");
+    return;
+  }
+  fcntl(master, F_SETFL, O_NONBLOCK);
+  HardwareSerial port(ptsname(master));
+  RH_Serial driver(port);
+  port.begin(115200);
+  if (!driver.init())
+    return;
+
+  uint8_t buf[RH_SERIAL_MAX_MESSAGE_LEN];
+  uint8_t echo[1024];
+  unsigned long received = 0;
+  unsigned long n = messages / 10; // Each byte is a system call
+#ifdef RH_BENCHMARK_COUNT_COPIES
+  unsigned long long startCopied = copied;
+#endif
+  uint64_t start = cpuNanoseconds();
+  for (unsigned long i = 0; i < n; i++)
+  {
+    memset(buf, 'a', size);
+    driver.send(buf, size);
+    // Echo it back, until the driver has it. The pseudo terminal may take a moment
+    for (unsigned long tries = 0; tries < 100000; tries++)
+    {
+      ssize_t len = read(master, echo, sizeof(echo));
+      if (len > 0)
+	write(master, echo, len);
+      if (driver.available())
+	break;
+    }
+    uint8_t len = sizeof(buf);
+    if (driver.recv(buf, &len))
+      received++;
+  }
+  uint64_t cpu = cpuNanoseconds() - start;
+  port.end();
+  close(master);
+  if (!received)
+    return;
+  report("throughput", "serial", size, "messages_per_second", received * 1e9 / cpu, "1/s");
+  report("throughput", "serial", size, "cpu_per_message", (double)cpu / received, "ns");
+#ifdef RH_BENCHMARK_COUNT_COPIES
+  report("throughput", "serial", size, "bytes_copied_per_message", (double)(copied - startCopied) / received, "bytes");
+#endif
+  report("throughput", "serial", size, "delivered", (double)received / n, "ratio");
+}
+
+/////////////////////////////////////////////////////////////////////
+void benchmarkCRC()
+{
+  static uint8_t data[65536];
+  unsigned long octets = 0;
+  uint16_t crc = 0xffff;
+  for (size_t i = 0; i < sizeof(data); i++)
+    data[i] = i * 7;
+
+  uint64_t start = cpuNanoseconds();
+  for (unsigned long repeat = 0; repeat < 64; repeat++)
+    for (size_t i = 0; i < sizeof(data); i++, octets++)
+      crc = RHcrc_ccitt_update(crc, data[i]);
+  uint64_t cpu = cpuNanoseconds() - start;
+  report("crc", "ccitt", 0, "cpu_per_octet", (double)cpu / octets, "ns");
+
+  start = cpuNanoseconds();
+  for (unsigned long repeat = 0; repeat < 64; repeat++)
+    for (size_t i = 0; i < sizeof(data); i++)
+      crc = RHcrc16_update(crc, data[i]);
+  cpu = cpuNanoseconds() - start;
+  report("crc", "crc16", 0, "cpu_per_octet", (double)cpu / octets, "ns");
+
+  // Keep the compiler from optimising it all away
+  if (crc == 0x1234)
+    fprintf(stderr, " ");
+}
+
+/////////////////////////////////////////////////////////////////////
+// Route discovery: node 1 sends one message to the far end of a chain
+
+uint64_t      discoveryStart;
+uint64_t      discoveryEnd;
+unsigned long discoveryAttempts;
+
+class ChainNode : public RHSimNode
+{
+public:
+  ChainNode(uint8_t address, uint8_t last)
+    : manager(driver, address),
+      last(last)
+  {
+  }
+
+  void setup()
+  {
+    manager.init();
+  }
+
+  void loop()
+  {
+    uint8_t len = sizeof(buf);
+    if (manager.thisAddress() == 1)
+    {
+      if (!discoveryStart)
+      {
+	delay(100); // Let the others start listening
+	discoveryStart = Simulator.now();
+      }
+      discoveryAttempts++;
+      memset(buf, 'a', size);
+      manager.sendtoWait(buf, size, last);
+      // Give it time to get there before trying again
+      unsigned long start = millis();
+      while (!discoveryEnd && millis() - start < RH_MESH_ARP_TIMEOUT)
+	manager.recvfromAckTimeout(buf, &len, 100);
+    }
+    else if (manager.recvfromAckTimeout(buf, &len, 1000) && manager.thisAddress() == last)
+    {
+      discoveryEnd = Simulator.now();
+      Simulator.stop();
+    }
+  }
+
+  RH_Sim  driver;
+  RHMesh  manager;
+  uint8_t last;
+  uint8_t buf[RH_MESH_MAX_MESSAGE_LEN];
+};
+
+void benchmarkDiscovery(uint8_t nodes)
+{
+  Simulator.reset();
+  Simulator.setSeed(seed);
+  Simulator.setDefaultLink(0.0);
+  for (uint8_t i = 1; i <= nodes; i++)
+  {
+    Simulator.addNode(new ChainNode(i, nodes));
+    if (i < nodes)
+    {
+      Simulator.setLink(i, i + 1, 1.0);
+      Simulator.setLink(i + 1, i, 1.0);
+    }
+  }
+  discoveryStart = 0;
+  discoveryEnd = 0;
+  discoveryAttempts = 0;
+  Simulator.run(600000);
+  if (!discoveryEnd)
+  {
+    report("discovery", "chain", nodes, "converged", 0, "bool");
+    return;
+  }
+  report("discovery", "chain", nodes, "converged", 1, "bool");
+  report("discovery", "chain", nodes, "time_to_deliver", (discoveryEnd - discoveryStart) / 1000.0, "ms");
+  report("discovery", "chain", nodes, "attempts", discoveryAttempts, "messages");
+  report("discovery", "chain", nodes, "transmissions", Simulator.transmitted(), "messages");
+}
+
+/////////////////////////////////////////////////////////////////////
+// Reliable delivery latency over a lossy link
+
+std::vector<uint64_t> latencies;
+unsigned long latencyFailed;
+
+class LatencyNode : public RHSimNode
+{
+public:
+  LatencyNode(uint8_t address)
+    : manager(driver, address)
+  {
+  }
+
+  void setup()
+  {
+    manager.init();
+  }
+
+  void loop()
+  {
+    if (manager.thisAddress() == 1)
+    {
+      if (latencies.size() + latencyFailed >= messages / 10)
+      {
+	Simulator.stop();
+	delay(1000000);
+	return;
+      }
+      memset(buf, 'a', size);
+      uint64_t start = Simulator.now();
+      if (manager.sendtoWait(buf, size, 2))
+	latencies.push_back(Simulator.now() - start);
+      else
+	latencyFailed++;
+      delay(random(100, 200));
+    }
+    else
+    {
+      uint8_t len = sizeof(buf);
+      manager.recvfromAckTimeout(buf, &len, 1000);
+    }
+  }
+
+  RH_Sim             driver;
+  RHReliableDatagram manager;
+  uint8_t            buf[RH_SIM_MAX_MESSAGE_LEN];
+};
+
+double percentile(double p)
+{
+  size_t i = (size_t)(p * (latencies.size() - 1) + 0.5);
+  return latencies[i] / 1000.0;
+}
+
+void benchmarkLatency()
+{
+  Simulator.reset();
+  Simulator.setSeed(seed);
+  Simulator.addNode(new LatencyNode(1));
+  Simulator.addNode(new LatencyNode(2));
+  Simulator.setLink(1, 2, 1.0 - loss);
+  Simulator.setLink(2, 1, 1.0 - loss);
+  latencies.clear();
+  latencyFailed = 0;
+  Simulator.run(0xffffffff);
+
+  unsigned long param = (unsigned long)(loss * 100 + 0.5); // Percent
+  report("latency", "reliable", param, "delivered", (double)latencies.size() / (latencies.size() + latencyFailed), "ratio");
+  if (latencies.empty())
+    return;
+  std::sort(latencies.begin(), latencies.end());
+  report("latency", "reliable", param, "p50", percentile(0.5), "ms");
+  report("latency", "reliable", param, "p90", percentile(0.9), "ms");
+  report("latency", "reliable", param, "p99", percentile(0.99), "ms");
+  report("latency", "reliable", param, "max", percentile(1.0), "ms");
+}
+
+/////////////////////////////////////////////////////////////////////
+void usage()
+{
+  fprintf(stderr, "usage: simulator_benchmark [--json] [--messages n] [--size octets] [--loss probability] [--nodes n] [--repeats n] [--seed n]\n");
+  exit(1);
+}
+
+void setup() 
+{
+  for (int i = 1; i < _simulator_argc; i++)
+  {
+    const char* arg = _simulator_argv[i];
+    const char* value = i + 1 < _simulator_argc ? _simulator_argv[i + 1] : NULL;
+    if (!strcmp(arg, "--json"))
+      json = true;
+    else if (!strcmp(arg, "--csv"))
+      json = false;
+    else if (!value)
+      usage();
+    else if (!strcmp(arg, "--messages"))
+      messages = strtoul(_simulator_argv[++i], NULL, 0);
+    else if (!strcmp(arg, "--size"))
+      size = atoi(_simulator_argv[++i]);
+    else if (!strcmp(arg, "--loss"))
+      loss = atof(_simulator_argv[++i]);
+    else if (!strcmp(arg, "--nodes"))
+      maxNodes = atoi(_simulator_argv[++i]);
+    else if (!strcmp(arg, "--repeats"))
+      repeats = atoi(_simulator_argv[++i]);
+    else if (!strcmp(arg, "--seed"))
+      seed = strtoul(_simulator_argv[++i], NULL, 0);
+    else
+      usage();
+  }
+  if (size < 1 || size > RH_MESH_MAX_MESSAGE_LEN || messages < 10 || loss < 0.0 || loss >= 1.0 || maxNodes < 2 || maxNodes > RH_ROUTING_TABLE_SIZE + 1 || repeats < 1)
+    usage();
+}
+
+void loop()
+{
+  benchmarkThroughput(LayerDriver);
+  benchmarkThroughput(LayerDatagram);
+  benchmarkThroughput(LayerReliable);
+  benchmarkThroughput(LayerRouter);
+  benchmarkThroughput(LayerMesh);
+#ifdef RH_ENABLE_ENCRYPTION_MODULE
+  benchmarkThroughput(LayerEncrypted);
+#endif
+  benchmarkLoopback(LayerDriver);
+  benchmarkLoopback(LayerDatagram);
+  benchmarkLoopback(LayerReliable);
+  benchmarkLoopback(LayerRouter);
+  benchmarkLoopback(LayerMesh);
+  benchmarkSerial();
+  benchmarkCRC();
+  for (uint8_t nodes = 2; nodes <= maxNodes; nodes *= 2)
+    benchmarkDiscovery(nodes);
+  benchmarkLatency();
+
+  printResults();
+  Simulator.reset();
+  exit(0);
+}
@@ -0,0 +1,133 @@
+// simulator_dutycycle.pde
+// -*- mode: C++ -*-
+// Example sketch showing how to keep a network within a duty cycle limit with RHDutyCycle.
+// 3 RHMesh nodes are in a line, and each can only hear its neighbours. Each node has a 1% airtime
+// budget, averaged over 1 minute instead of the usual hour so the example does not take long.
+// Node 1 sends messages to node 3 as fast as the budgets allow for 10 minutes of virtual time.
+// Then each node prints how many messages it sent, and its duty cycle, and PASS if no node used more
+// than 1% of the time, else FAIL. Exits with status 1 on FAIL.
+// Tested on Linux
+// Build with
+// cd whatever/RadioHead
+// tools/simEventBuild examples/simulator/simulator_dutycycle/simulator_dutycycle.pde
+// Run with ./simulator_dutycycle [seed]
+
+#include <RHMesh.h>
+#include <RH_Sim.h>
+#include <RHDutyCycle.h>
+#include <RHutil/RHSimulator.h>
+
+#define NODES 3
+
+// Ten minutes
+#define DURATION 600000
+
+uint8_t data[] = "Hello World!";
+
+class DutyCycleNode : public RHSimNode
+{
+public:
+  DutyCycleNode(uint8_t address)
+    : manager(driver, address),
+      budget(60000),
+      sent(0),
+      delivered(0)
+  {
+  }
+
+  void setup()
+  {
+    if (!manager.init())
+      Serial.println("init failed");
+    driver.setModemConfig(RH_Sim::Bw125Cr45Sf128);
+    // 1% on channel 0, the default simulator channel
+    budget.setLimit(0, 0, 100);
+    driver.setDutyCycle(&budget);
+  }
+
+  void loop()
+  {
+    uint8_t len = sizeof(buf);
+    if (manager.thisAddress() != 1)
+    {
+      manager.recvfromAckTimeout(buf, &len, 1000);
+      return;
+    }
+    // Send whenever the budget allows, and process anything received in between
+    uint32_t wait = driver.timeUntilSend(sizeof(data));
+    if (wait)
+    {
+      manager.recvfromAckTimeout(buf, &len, wait > 1000 ? 1000 : wait);
+      return;
+    }
+    sent++;
+    if (manager.sendtoWait(data, sizeof(data), NODES) == RH_ROUTER_ERROR_NONE)
+      delivered++;
+    else
+      manager.recvfromAckTimeout(buf, &len, 1000); // Give the network a rest
+  }
+
+  RH_Sim        driver;
+  RHMesh        manager;
+  RHDutyCycle   budget;
+  uint32_t      sent;
+  uint32_t      delivered;
+  uint8_t       buf[RH_MESH_MAX_MESSAGE_LEN];
+};
+
+DutyCycleNode* nodes[NODES];
+
+void setup()
+{
+  if (_simulator_argc >= 2)
+    Simulator.setSeed(atoi(_simulator_argv[1]));
+
+  uint8_t i;
+  for (i = 0; i < NODES; i++)
+    Simulator.addNode(nodes[i] = new DutyCycleNode(i + 1));
+
+  // Nodes only hear their neighbours, and not always
+  Simulator.setDefaultLink(0.0);
+  for (i = 1; i < NODES; i++)
+  {
+    Simulator.setLink(i, i + 1, 0.9, -100);
+    Simulator.setLink(i + 1, i, 0.9, -100);
+  }
+}
+
+void loop()
+{
+  Simulator.run(DURATION);
+
+  bool pass = true;
+  uint8_t i;
+  for (i = 0; i < NODES; i++)
+  {
+    RHDriverStats stats;
+    nodes[i]->driver.driverStats(&stats);
+    Serial.print("Node ");
+    Serial.print((unsigned int)(i + 1), DEC);
+    if (i == 0)
+    {
+      Serial.print(": sent ");
+      Serial.print(nodes[i]->sent, DEC);
+      Serial.print(", delivered ");
+      Serial.print(nodes[i]->delivered, DEC);
+    }
+    Serial.print(": transmitted ");
+    Serial.print((unsigned int)stats.txGood, DEC);
+    Serial.print(" messages, airtime ");
+    Serial.print(stats.txAirtime, DEC);
+    Serial.print(" ms, duty cycle ");
+    Serial.print((unsigned int)(stats.dutyCycle / 100), DEC);
+    Serial.print(".");
+    Serial.print((unsigned int)(stats.dutyCycle % 100 / 10), DEC);
+    Serial.print((unsigned int)(stats.dutyCycle % 10), DEC);
+    Serial.println("%");
+    // dutyCycle is rounded down, so check the airtime itself
+    if (stats.txAirtime * 100 > stats.elapsed)
+      pass = false;
+  }
+  Serial.println(pass ? "PASS" : "FAIL");
+  exit(pass ? 0 : 1);
+}
@@ -0,0 +1,59 @@
+// simulator_fragmented_datagram_server.pde
+// -*- mode: C++ -*-
+// Example sketch showing how to receive messages larger than the radio can carry
+// with the RHFragmentedDatagram class, using the RH_SIMULATOR driver to control a SIMULATOR radio.
+// It is designed to work with the other example simulator_fragmented_datagram_client
+// Tested on Linux
+// Build with
+// cd whatever/RadioHead 
+// tools/simBuild examples/simulator/simulator_fragmented_datagram_server/simulator_fragmented_datagram_server.pde
+// Run with ./simulator_fragmented_datagram_server
+// Make sure you also have the 'Luminiferous Ether' simulator tools/etherSimulator.pl running
+
+#include <RHFragmentedDatagram.h>
+#include <RH_TCP.h>
+
+#define CLIENT_ADDRESS 1
+#define SERVER_ADDRESS 2
+
+// Singleton instance of the radio driver
+RH_TCP driver;
+
+// Class to manage message delivery and receipt, using the driver declared above
+RHFragmentedDatagram manager(driver, SERVER_ADDRESS);
+
+void setup() 
+{
+  Serial.begin(9600);
+  if (!manager.init())
+    Serial.println("init failed");
+}
+
+// Dont put this on the stack:
+uint8_t buf[RH_FRAGMENT_MAX_MESSAGE_LEN];
+
+void loop()
+{
+  // Wait for a complete message addressed to us from the client
+  uint16_t len = sizeof(buf);
+  uint8_t from;
+  if (manager.recvfromAckTimeout(buf, &len, 1000, &from))
+  {
+      // Check the contents
+      uint16_t i;
+      for (i = 0; i < len; i++)
+	if (buf[i] != (i & 0xff))
+	  break;
+      Serial.print("got request from : 0x");
+      Serial.print(from, HEX);
+      Serial.print(" length: ");
+      Serial.print((unsigned int)len, DEC);
+      Serial.println(i == len ? " OK" : " CORRUPT");
+      
+      // Send a reply back to the originator client
+      uint8_t data[] = "And hello back to you";
+      if (!manager.sendtoWait(data, sizeof(data), from))
+	  Serial.println("sendtoWait failed");
+  }
+}
+
@@ -0,0 +1,89 @@
+// simulator_loopback.pde
+// -*- mode: C++ -*-
+// Example sketch showing how to test RadioHead managers in one process, without any
+// ether simulator server, using RH_Loopback drivers sharing an RHLoopbackMedium.
+// Three RHMesh nodes each run in their own thread. Node 1 sends messages to node 3 over a
+// medium that loses, delays and reorders messages, and reports how many got there and how long it took.
+// Tested on Linux
+// Build with
+// cd whatever/RadioHead 
+// tools/simBuild examples/simulator/simulator_loopback/simulator_loopback.pde
+// Run with ./simulator_loopback [messages] [loss probability]
+
+#include <RHMesh.h>
+#include <RH_Loopback.h>
+#include <thread>
+#include <atomic>
+
+#define NODES 3
+
+RHLoopbackMedium medium;
+RH_Loopback*     drivers[NODES];
+RHMesh*          managers[NODES];
+
+unsigned long    messages = 100;
+float            loss = 0.1;
+std::atomic<bool> done(false);
+std::atomic<unsigned long> received(0);
+
+// The other nodes receive, acknowledge and route messages until node 1 has finished
+void receiver(uint8_t index)
+{
+  uint8_t buf[RH_MESH_MAX_MESSAGE_LEN];
+  while (!done)
+  {
+    uint8_t len = sizeof(buf);
+    if (managers[index]->recvfromAckTimeout(buf, &len, 100))
+      received++;
+  }
+}
+
+void setup() 
+{
+  Serial.begin(9600);
+  if (_simulator_argc >= 2)
+    messages = strtoul(_simulator_argv[1], NULL, 0);
+  if (_simulator_argc >= 3)
+    loss = atof(_simulator_argv[2]);
+
+  medium.setLoss(loss);
+  medium.setDelay(0, 2);
+  medium.setReorder(0.05, 5);
+  for (uint8_t i = 0; i < NODES; i++)
+  {
+    drivers[i] = new RH_Loopback(medium);
+    managers[i] = new RHMesh(*drivers[i], i + 1);
+    if (!managers[i]->init())
+      Serial.println("init failed");
+  }
+}
+
+void loop()
+{
+  std::thread* threads[NODES];
+  for (uint8_t i = 1; i < NODES; i++)
+    threads[i] = new std::thread(receiver, i);
+
+  uint8_t data[] = "Hello World!";
+  unsigned long delivered = 0;
+  unsigned long start = millis();
+  for (unsigned long i = 0; i < messages; i++)
+    if (managers[0]->sendtoWait(data, sizeof(data), NODES) == RH_ROUTER_ERROR_NONE)
+      delivered++;
+  unsigned long elapsed = millis() - start;
+
+  done = true;
+  for (uint8_t i = 1; i < NODES; i++)
+    threads[i]->join();
+
+  Serial.print("sent: ");
+  Serial.print((unsigned int)messages);
+  Serial.print(" acknowledged: ");
+  Serial.print((unsigned int)delivered);
+  Serial.print(" received: ");
+  Serial.print((unsigned int)received);
+  Serial.print(" milliseconds: ");
+  Serial.print((unsigned int)elapsed);
+  Serial.println("");
+  exit(0);
+}
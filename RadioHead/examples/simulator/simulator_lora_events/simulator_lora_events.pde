@@ -0,0 +1,147 @@
+// simulator_lora_events.pde
+// -*- mode: C++ -*-
+// Example sketch showing how to simulate a LoRa star network in one process, in virtual time,
+// with the RHSimulator discrete event simulator and the RH_Sim driver.
+// 20 sensor nodes are placed at random within 100 metres of a gateway, using the same modem
+// configuration as the RH_RF95 default. Each sends a reading to the gateway with RHReliableDatagram
+// every 10 to 20 seconds for an hour of virtual time. The power of each message comes from the 
+// distance between the nodes, and messages that overlap at a receiver collide unless one is
+// strong enough to capture it, so this shows how the retry and timeout settings cope with contention.
+// Tested on Linux
+// Build with
+// cd whatever/RadioHead 
+// tools/simEventBuild examples/simulator/simulator_lora_events/simulator_lora_events.pde
+// Run with ./simulator_lora_events [seed]
+// The same seed always gives the same results
+
+#include <RHReliableDatagram.h>
+#include <RH_Sim.h>
+#include <RHutil/RHSimulator.h>
+#include <math.h>
+
+#define GATEWAY_ADDRESS 1
+#define SENSORS 20
+
+// Metres
+#define RADIUS 100
+
+// One hour
+#define DURATION 3600000
+
+unsigned long sent = 0;
+unsigned long failed = 0;
+unsigned long received = 0;
+unsigned long retransmissions = 0;
+
+uint8_t data[] = "Reading: 1234";
+
+// The gateway just receives and acknowledges readings
+class Gateway : public RHSimNode
+{
+public:
+  Gateway()
+    : manager(driver, GATEWAY_ADDRESS)
+  {
+  }
+
+  void setup()
+  {
+    if (!manager.init())
+      Serial.println("init failed");
+    driver.setModemConfig(RH_Sim::Bw125Cr45Sf128);
+  }
+
+  void loop()
+  {
+    uint8_t len = sizeof(buf);
+    if (manager.recvfromAck(buf, &len))
+      received++;
+    driver.waitAvailable();
+  }
+
+  RH_Sim             driver;
+  RHReliableDatagram manager;
+  uint8_t            buf[RH_SIM_MAX_MESSAGE_LEN];
+};
+
+class Sensor : public RHSimNode
+{
+public:
+  Sensor(uint8_t address)
+    : manager(driver, address),
+      nextSend(0)
+  {
+  }
+
+  void setup()
+  {
+    if (!manager.init())
+      Serial.println("init failed");
+    driver.setModemConfig(RH_Sim::Bw125Cr45Sf128);
+    nextSend = random(0, 10000);
+  }
+
+  void loop()
+  {
+    if (millis() < nextSend)
+      delay(nextSend - millis());
+    if (manager.sendtoWait(data, sizeof(data), GATEWAY_ADDRESS))
+      sent++;
+    else
+      failed++;
+    nextSend = millis() + random(10000, 20000);
+  }
+
+  RH_Sim             driver;
+  RHReliableDatagram manager;
+  unsigned long      nextSend;
+};
+
+void setup() 
+{
+  if (_simulator_argc >= 2)
+    Simulator.setSeed(atoi(_simulator_argv[1]));
+
+  Simulator.addNode(new Gateway());
+  Simulator.setPosition(GATEWAY_ADDRESS, 0, 0);
+  for (uint8_t i = 0; i < SENSORS; i++)
+  {
+    uint8_t address = GATEWAY_ADDRESS + 1 + i;
+    Sensor* sensor = new Sensor(address);
+    Simulator.addNode(sensor);
+    // Spread evenly over the area
+    float distance = RADIUS * sqrt(Simulator.random32() / 4294967296.0);
+    float angle = 2 * M_PI * Simulator.random32() / 4294967296.0;
+    Simulator.setPosition(address, distance * cos(angle), distance * sin(angle));
+  }
+  // Some random variation from message to message
+  Simulator.setPathLoss(RH_SIM_DEFAULT_REFERENCE_LOSS, RH_SIM_DEFAULT_REFERENCE_DISTANCE, RH_SIM_DEFAULT_PATH_LOSS_EXPONENT, 3.0);
+}
+
+void loop()
+{
+  Simulator.run(DURATION);
+
+  Serial.print("Virtual seconds: ");
+  Serial.print((unsigned int)(Simulator.now() / 1000000));
+  Serial.println("");
+  Serial.print("Acknowledged: ");
+  Serial.print((unsigned int)sent);
+  Serial.println("");
+  Serial.print("Failed: ");
+  Serial.print((unsigned int)failed);
+  Serial.println("");
+  Serial.print("Received by gateway: ");
+  Serial.print((unsigned int)received);
+  Serial.println("");
+  Serial.print("Transmissions: ");
+  Serial.print((unsigned int)Simulator.transmitted());
+  Serial.println("");
+  Serial.print("Collisions: ");
+  Serial.print((unsigned int)Simulator.collisions());
+  Serial.println("");
+  Serial.print("Lost while transmitting: ");
+  Serial.print((unsigned int)Simulator.halfDuplexLosses());
+  Serial.println("");
+  exit(0);
+}
@@ -0,0 +1,125 @@
+// simulator_mesh_chain.pde
+// -*- mode: C++ -*-
+// Example sketch showing route discovery over a long chain of RHMesh nodes, and a check that it works.
+// 11 nodes are in a line, and each can only hear its neighbours, so the ends are 10 hops apart,
+// beyond the rings of the expanding ring search that fit in the default ARP timeout. Each node needs a
+// route to every other, so longer chains need RH_ROUTING_TABLE_SIZE defined larger than the default.
+// Node 1 sends to node 11 with sendtoWait(), with the default ARP timeout, until a message is delivered,
+// then sends 10 more over the discovered route.
+// Prints how many attempts and how long the first delivery took, then PASS if it took no more 
+// than 3 attempts and all the later messages were delivered, else FAIL. Exits with status 1 on FAIL.
+// Tested on Linux
+// Build with
+// cd whatever/RadioHead
+// tools/simEventBuild examples/simulator/simulator_mesh_chain/simulator_mesh_chain.pde
+// Run with ./simulator_mesh_chain [seed]
+
+#include <RHMesh.h>
+#include <RH_Sim.h>
+#include <RHutil/RHSimulator.h>
+
+#define NODES 11
+
+// Time allowed to run
+#define DURATION 120000
+
+// Messages sent after the first delivery
+#define MESSAGES 10
+
+uint8_t data[] = "Hello World!";
+
+class ChainNode : public RHSimNode
+{
+public:
+  ChainNode(uint8_t address)
+    : manager(driver, address),
+      attempts(0),
+      firstDelivery(0),
+      sent(0),
+      delivered(0)
+  {
+  }
+
+  void setup()
+  {
+    if (!manager.init())
+      Serial.println("init failed");
+  }
+
+  void loop()
+  {
+    uint8_t len = sizeof(buf);
+    if (manager.thisAddress() != 1)
+    {
+      manager.recvfromAckTimeout(buf, &len, 1000);
+      return;
+    }
+    if (sent >= MESSAGES)
+    {
+      Simulator.stop();
+      return;
+    }
+    bool ok = manager.sendtoWait(data, sizeof(data), NODES) == RH_ROUTER_ERROR_NONE;
+    if (!firstDelivery)
+    {
+      attempts++;
+      if (ok)
+	firstDelivery = millis();
+      else
+	manager.recvfromAckTimeout(buf, &len, RH_MESH_DISCOVERY_HOLDOFF); // Until a new discovery is allowed
+      return;
+    }
+    sent++;
+    if (ok)
+      delivered++;
+  }
+
+  RH_Sim        driver;
+  RHMesh        manager;
+  uint32_t      attempts;
+  unsigned long firstDelivery;
+  uint32_t      sent;
+  uint32_t      delivered;
+  uint8_t       buf[RH_MESH_MAX_MESSAGE_LEN];
+};
+
+ChainNode* nodes[NODES];
+
+void setup()
+{
+  if (_simulator_argc >= 2)
+    Simulator.setSeed(atoi(_simulator_argv[1]));
+
+  // Node 1 last, so the others are listening before it starts
+  uint8_t i;
+  for (i = NODES; i > 0; i--)
+    Simulator.addNode(nodes[i - 1] = new ChainNode(i));
+
+  // Nodes only hear their neighbours
+  Simulator.setDefaultLink(0.0);
+  for (i = 1; i < NODES; i++)
+  {
+    Simulator.setLink(i, i + 1, 1.0);
+    Simulator.setLink(i + 1, i, 1.0);
+  }
+}
+
+void loop()
+{
+  Simulator.run(DURATION);
+
+  ChainNode* n = nodes[0];
+  Serial.print("first delivery after ");
+  Serial.print(n->attempts, DEC);
+  Serial.print(" attempts, ");
+  Serial.print((unsigned int)n->firstDelivery, DEC);
+  Serial.print(" ms, then delivered ");
+  Serial.print(n->delivered, DEC);
+  Serial.print(" of ");
+  Serial.print(n->sent, DEC);
+  Serial.println("");
+
+  bool pass = n->firstDelivery && n->attempts <= 3 && n->sent == MESSAGES && n->delivered == MESSAGES;
+  Serial.println(pass ? "PASS" : "FAIL");
+  exit(pass ? 0 : 1);
+}
@@ -0,0 +1,134 @@
+// simulator_mesh_events.pde
+// -*- mode: C++ -*-
+// Example sketch showing how to simulate a whole RHMesh network in one process, in virtual time,
+// with the RHSimulator discrete event simulator and the RH_Sim driver.
+// 50 nodes are laid out in a 10 by 5 grid, and each can only hear its neighbours.
+// Every node sends a message to a randomly chosen node every 30 to 90 seconds for an hour
+// of virtual time, which takes a few seconds to run.
+// Tested on Linux
+// Build with
+// cd whatever/RadioHead 
+// tools/simEventBuild examples/simulator/simulator_mesh_events/simulator_mesh_events.pde
+// Run with ./simulator_mesh_events [seed]
+// The same seed always gives the same results
+
+#include <RHMesh.h>
+#include <RH_Sim.h>
+#include <RHutil/RHSimulator.h>
+
+#define COLUMNS 10
+#define ROWS 5
+#define NODES (COLUMNS * ROWS)
+
+// One hour
+#define DURATION 3600000
+
+unsigned long sent = 0;
+unsigned long failed = 0;
+unsigned long received = 0;
+
+uint8_t data[] = "Hello World!";
+
+// Each node has its own driver and manager, instead of the globals in a sketch for one node
+class MeshNode : public RHSimNode
+{
+public:
+  MeshNode(uint8_t address)
+    : manager(driver, address),
+      nextSend(0)
+  {
+  }
+
+  void setup()
+  {
+    if (!manager.init())
+      Serial.println("init failed");
+    nextSend = random(30000, 90000);
+  }
+
+  void loop()
+  {
+    uint8_t len = sizeof(buf);
+    if (manager.recvfromAckTimeout(buf, &len, 1000))
+      received++;
+    if (millis() >= nextSend)
+    {
+      uint8_t to = random(1, NODES + 1);
+      if (to != manager.thisAddress())
+      {
+        if (manager.sendtoWait(data, sizeof(data), to) == RH_ROUTER_ERROR_NONE)
+          sent++;
+        else
+          failed++;
+      }
+      nextSend = millis() + random(30000, 90000);
+    }
+  }
+
+  RH_Sim        driver;
+  RHMesh        manager;
+  unsigned long nextSend;
+  uint8_t       buf[RH_MESH_MAX_MESSAGE_LEN];
+};
+
+// Node addresses are numbered from 1, along each row in turn
+uint8_t address(uint8_t column, uint8_t row)
+{
+  return row * COLUMNS + column + 1;
+}
+
+void setup() 
+{
+  if (_simulator_argc >= 2)
+    Simulator.setSeed(atoi(_simulator_argv[1]));
+
+  uint8_t column, row;
+  for (row = 0; row < ROWS; row++)
+    for (column = 0; column < COLUMNS; column++)
+      Simulator.addNode(new MeshNode(address(column, row)));
+
+  // Nodes only hear their neighbours, and not always
+  Simulator.setDefaultLink(0.0);
+  for (row = 0; row < ROWS; row++)
+    for (column = 0; column < COLUMNS; column++)
+    {
+      if (column + 1 < COLUMNS)
+      {
+        Simulator.setLink(address(column, row), address(column + 1, row), 0.95, -70);
+        Simulator.setLink(address(column + 1, row), address(column, row), 0.95, -70);
+      }
+      if (row + 1 < ROWS)
+      {
+        Simulator.setLink(address(column, row), address(column, row + 1), 0.95, -70);
+        Simulator.setLink(address(column, row + 1), address(column, row), 0.95, -70);
+      }
+    }
+}
+
+void loop()
+{
+  Simulator.run(DURATION);
+
+  Serial.print("Virtual seconds: ");
+  Serial.print((unsigned int)(Simulator.now() / 1000000));
+  Serial.println("");
+  Serial.print("Sent to next hop: ");
+  Serial.print((unsigned int)sent);
+  Serial.println("");
+  Serial.print("Failed: ");
+  Serial.print((unsigned int)failed);
+  Serial.println("");
+  Serial.print("Received: ");
+  Serial.print((unsigned int)received);
+  Serial.println("");
+  Serial.print("Transmissions: ");
+  Serial.print((unsigned int)Simulator.transmitted());
+  Serial.println("");
+  Serial.print("Collisions: ");
+  Serial.print((unsigned int)Simulator.collisions());
+  Serial.println("");
+  Serial.print("Lost while transmitting: ");
+  Serial.print((unsigned int)Simulator.halfDuplexLosses());
+  Serial.println("");
+  exit(0);
+}
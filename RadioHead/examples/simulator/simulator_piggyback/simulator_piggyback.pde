@@ -0,0 +1,113 @@
+// simulator_piggyback.pde
+// -*- mode: C++ -*-
+// Example sketch showing how delayed acknowledgements with RHReliableDatagram::setAckDelay() save
+// airtime for request/response traffic, and a check that they do.
+// A client sends requests to a server with sendtoWait(), and waits for each reply with recvfromAckTimeout().
+// The server replies to each request with sendtoWait(). Both hold acknowledgements, so the reply
+// carries the ACK of the request, and the next request carries the ACK of the reply. Each exchange
+// then takes 2 messages instead of 4, with no retransmissions.
+// Prints the counts, and PASS or FAIL. Exits with status 1 on FAIL.
+// Tested on Linux
+// Build with
+// cd whatever/RadioHead
+// tools/simEventBuild examples/simulator/simulator_piggyback/simulator_piggyback.pde
+// Run with ./simulator_piggyback [seed]
+
+#include <RHReliableDatagram.h>
+#include <RH_Sim.h>
+#include <RHutil/RHSimulator.h>
+
+#define CLIENT_ADDRESS 1
+#define SERVER_ADDRESS 2
+
+// One minute
+#define DURATION 60000
+
+// Time to hold acknowledgements, well below the retransmit timeout
+#define ACK_DELAY 100
+
+uint8_t request[] = "Hello World!";
+uint8_t reply[] = "And hello back to you";
+
+class PiggybackNode : public RHSimNode
+{
+public:
+  PiggybackNode(uint8_t address)
+    : manager(driver, address),
+      exchanges(0)
+  {
+  }
+
+  void setup()
+  {
+    if (!manager.init())
+      Serial.println("init failed");
+    manager.setAckDelay(ACK_DELAY);
+  }
+
+  void loop()
+  {
+    uint8_t len = sizeof(buf);
+    uint8_t from;
+    if (manager.thisAddress() == SERVER_ADDRESS)
+    {
+      if (manager.recvfromAckTimeout(buf, &len, 1000, &from))
+	manager.sendtoWait(reply, sizeof(reply), from);
+      return;
+    }
+    if (manager.sendtoWait(request, sizeof(request), SERVER_ADDRESS)
+	&& manager.recvfromAckTimeout(buf, &len, 1000, &from)
+	&& from == SERVER_ADDRESS)
+      exchanges++;
+  }
+
+  RH_Sim             driver;
+  RHReliableDatagram manager;
+  uint32_t           exchanges;
+  uint8_t            buf[RH_MAX_MESSAGE_LEN];
+};
+
+PiggybackNode* client;
+PiggybackNode* server;
+
+void setup()
+{
+  if (_simulator_argc >= 2)
+    Simulator.setSeed(atoi(_simulator_argv[1]));
+
+  // The server first, so it is listening before the first request
+  Simulator.addNode(server = new PiggybackNode(SERVER_ADDRESS));
+  Simulator.addNode(client = new PiggybackNode(CLIENT_ADDRESS));
+}
+
+void loop()
+{
+  Simulator.run(DURATION);
+
+  RHDriverStats clientDriver, serverDriver;
+  client->driver.driverStats(&clientDriver);
+  server->driver.driverStats(&serverDriver);
+  RHReliableStats clientStats, serverStats;
+  client->manager.reliableStats(&clientStats);
+  server->manager.reliableStats(&serverStats);
+  uint32_t messages = clientDriver.txGood + serverDriver.txGood;
+  uint32_t retransmissions = clientStats.retransmissions + serverStats.retransmissions;
+  uint32_t acks = clientStats.acksSent + serverStats.acksSent;
+
+  Serial.print("exchanges ");
+  Serial.print(client->exchanges, DEC);
+  Serial.print(", messages ");
+  Serial.print(messages, DEC);
+  Serial.print(", ACK messages ");
+  Serial.print(acks, DEC);
+  Serial.print(", retransmissions ");
+  Serial.print(retransmissions, DEC);
+  Serial.println("");
+
+  // Every exchange but the one cut off at the end should take exactly 2 messages
+  bool pass =    client->exchanges > 100
+	      && messages <= 2 * client->exchanges + 4
+	      && retransmissions == 0;
+  Serial.println(pass ? "PASS" : "FAIL");
+  exit(pass ? 0 : 1);
+}
@@ -0,0 +1,167 @@
+// simulator_replay.pde
+// -*- mode: C++ -*-
+// Example sketch showing how to capture the messages a node sends and receives with RHPcapCapture,
+// and replay them with RH_Replay as a regression test.
+// First a client and a server run under the RHSimulator discrete event simulator, over a link that
+// loses some messages. The client sends requests to the server with RHReliableDatagram, and the server
+// replies. Everything the server sends and receives is captured in a pcap file.
+// Then a new server is run on an RH_Replay driver, which gives it the messages the first server
+// received, and checks that it sends the same messages the first server sent.
+// Tested on Linux
+// Build with
+// cd whatever/RadioHead 
+// tools/simEventBuild examples/simulator/simulator_replay/simulator_replay.pde
+// Run with ./simulator_replay [capture file]
+// The capture can be viewed with Wireshark, or replayed against a changed stack with RH_Replay
+
+#include <RHReliableDatagram.h>
+#include <RH_Sim.h>
+#include <RH_Replay.h>
+#include <RHCapture.h>
+#include <RHutil/RHSimulator.h>
+
+#define CLIENT_ADDRESS 1
+#define SERVER_ADDRESS 2
+#define MESSAGES 50
+
+const char* filename = "simulator_replay.pcap";
+unsigned long replies = 0;
+
+class ClientNode : public RHSimNode
+{
+public:
+  ClientNode()
+    : manager(driver, CLIENT_ADDRESS),
+      count(0)
+  {
+  }
+
+  void setup()
+  {
+    manager.init();
+  }
+
+  void loop()
+  {
+    if (count >= MESSAGES)
+    {
+      Simulator.stop();
+      delay(1000000);
+      return;
+    }
+    uint8_t data[20];
+    uint8_t len = snprintf((char*)data, sizeof(data), "Request %u", (unsigned int)count++);
+    if (manager.sendtoWait(data, len, SERVER_ADDRESS))
+    {
+      len = sizeof(buf);
+      if (manager.recvfromAckTimeout(buf, &len, 2000))
+	replies++;
+    }
+    delay(random(100, 1000));
+  }
+
+  RH_Sim             driver;
+  RHReliableDatagram manager;
+  unsigned int       count;
+  uint8_t            buf[RH_SIM_MAX_MESSAGE_LEN];
+};
+
+// The server runs on whichever driver it is given
+class ServerNode : public RHSimNode
+{
+public:
+  ServerNode(RHGenericDriver& driver)
+    : manager(driver, SERVER_ADDRESS)
+  {
+  }
+
+  void setup()
+  {
+    manager.init();
+  }
+
+  void loop()
+  {
+    uint8_t len = sizeof(buf) - 10;
+    uint8_t from;
+    if (manager.recvfromAckTimeout(buf + 9, &len, 1000, &from))
+    {
+      memcpy(buf, "Reply to ", 9);
+      manager.sendtoWait(buf, len + 9, from);
+    }
+  }
+
+  RHReliableDatagram manager;
+  uint8_t            buf[RH_SIM_MAX_MESSAGE_LEN];
+};
+
+class ReplayNode : public ServerNode
+{
+public:
+  ReplayNode(RH_Replay& replay)
+    : ServerNode(replay),
+      replay(replay)
+  {
+  }
+
+  void loop()
+  {
+    if (replay.finished())
+    {
+      Simulator.stop();
+      delay(1000000);
+      return;
+    }
+    ServerNode::loop();
+  }
+
+  RH_Replay& replay;
+};
+
+void setup() 
+{
+  if (_simulator_argc >= 2)
+    filename = _simulator_argv[1];
+}
+
+void loop()
+{
+  // Capture the server's messages
+  FILE* file = fopen(filename, "wb");
+  if (!file)
+  {
+    Serial.println("could not create capture file");
+    exit(1);
+  }
+  RHPcapCapture capture(file);
+  RH_Sim serverDriver;
+  serverDriver.setCapture(&capture);
+  Simulator.addNode(new ClientNode());
+  Simulator.addNode(new ServerNode(serverDriver));
+  Simulator.setLink(CLIENT_ADDRESS, SERVER_ADDRESS, 0.9);
+  Simulator.setLink(SERVER_ADDRESS, CLIENT_ADDRESS, 0.9);
+  Simulator.run(3600000);
+  fclose(file);
+  Serial.print("Replies received by the client: ");
+  Serial.print((unsigned int)replies);
+  Serial.println("");
+  Serial.print("Messages sent by the server: ");
+  Serial.print((unsigned int)serverDriver.txGood());
+  Serial.println("");
+
+  // Replay them to a new server
+  Simulator.reset();
+  RH_Replay replay(filename);
+  Simulator.addNode(new ReplayNode(replay));
+  Simulator.run(3600000);
+  Serial.print("Replayed messages sent the same: ");
+  Serial.print((unsigned int)replay.txMatched());
+  Serial.println("");
+  Serial.print("Replayed messages sent differently: ");
+  Serial.print((unsigned int)replay.txMismatches());
+  Serial.println("");
+  Serial.print("Replay complete: ");
+  Serial.println(replay.finished() ? "yes" : "no");
+  Simulator.reset();
+  exit(0);
+}
@@ -0,0 +1,199 @@
+// simulator_rf95_shadow.pde
+// -*- mode: C++ -*-
+// Check that the shadow of the RH_RF95 modem configuration registers is not corrupted by payloads.
+// RH_RF95 runs on the host, connected to a simulated SX1276 that keeps its registers and FIFO, and
+// watches its chip select pin to see where each SPI transaction starts.
+// The node sends a 40 octet message, which goes into the FIFO with one burst write. Then it checks that
+// the radio was set to transmit it and that timeOnAir(), which reads the shadow, is unchanged. Last it
+// calls setSpreadingFactor(), and checks that only the spreading factor changed in the radio's
+// MODEM_CONFIG1 to MODEM_CONFIG3 and preamble length registers.
+// Prints PASS or FAIL. Exits with status 1 on FAIL.
+// Tested on Linux
+// Build with
+// cd whatever/RadioHead
+// tools/simEventBuild examples/simulator/simulator_rf95_shadow/simulator_rf95_shadow.pde
+// Run with ./simulator_rf95_shadow
+
+#include <RH_RF95.h>
+#include <RHGenericSPI.h>
+#include <RHutil/RHSimulator.h>
+
+#define SS_PIN   10
+#define DIO0_PIN 2
+
+#define MESSAGE_LEN 40
+
+// Registers and FIFO of an SX1276 in LoRa mode, as seen over SPI
+class SimulatedSX1276 : public RHGenericSPI
+{
+public:
+  SimulatedSX1276()
+    : address(true),
+      reg(0)
+  {
+    memset(registers, 0, sizeof(registers));
+    memset(fifo, 0, sizeof(fifo));
+    // Power on values of the modem configuration
+    registers[RH_RF95_REG_1D_MODEM_CONFIG1] = 0x72;
+    registers[RH_RF95_REG_1E_MODEM_CONFIG2] = 0x70;
+    registers[RH_RF95_REG_20_PREAMBLE_MSB] = 0x00;
+    registers[RH_RF95_REG_21_PREAMBLE_LSB] = 0x08;
+    registers[RH_RF95_REG_26_MODEM_CONFIG3] = 0x00;
+  }
+
+  uint8_t transfer(uint8_t data)
+  {
+    if (address)
+    {
+      // The first octet of a transaction is the register, with the write bit
+      address = false;
+      reg = data;
+      return 0;
+    }
+    uint8_t r = reg & ~RH_SPI_WRITE_MASK;
+    uint8_t ret = 0;
+    if (r == RH_RF95_REG_00_FIFO)
+    {
+      // The FIFO address pointer moves on, the register does not
+      uint8_t& pointer = registers[RH_RF95_REG_0D_FIFO_ADDR_PTR];
+      if (reg & RH_SPI_WRITE_MASK)
+	fifo[pointer] = data;
+      else
+	ret = fifo[pointer];
+      pointer++;
+      return ret;
+    }
+    if (reg & RH_SPI_WRITE_MASK)
+      registers[r] = data;
+    else
+      ret = registers[r];
+    reg++;
+    return ret;
+  }
+
+  uint8_t transfer2B(uint8_t byte0, uint8_t byte1)
+  {
+    transfer(byte0);
+    return transfer(byte1);
+  }
+
+  uint8_t spiBurstRead(uint8_t reg, uint8_t* dest, uint8_t len)
+  {
+    uint8_t status = transfer(reg & ~RH_SPI_WRITE_MASK);
+    while (len--)
+      *dest++ = transfer(0);
+    return status;
+  }
+
+  uint8_t spiBurstWrite(uint8_t reg, const uint8_t* src, uint8_t len)
+  {
+    uint8_t status = transfer(reg | RH_SPI_WRITE_MASK);
+    while (len--)
+      transfer(*src++);
+    return status;
+  }
+
+  void begin() {}
+  void end() {}
+
+  // Chip select went high: the next octet starts a new transaction
+  void deselected()
+  {
+    address = true;
+  }
+
+  bool    address;
+  uint8_t reg;
+  uint8_t registers[128];
+  uint8_t fifo[256];
+};
+
+SimulatedSX1276 radio;
+
+void chipSelectRising()
+{
+  radio.deselected();
+}
+
+bool pass = true;
+
+// Configuration registers in the shadowed range that sending must not change
+const uint8_t configRegisters[] = 
+{
+  RH_RF95_REG_1D_MODEM_CONFIG1,
+  RH_RF95_REG_1E_MODEM_CONFIG2,
+  RH_RF95_REG_20_PREAMBLE_MSB,
+  RH_RF95_REG_21_PREAMBLE_LSB,
+  RH_RF95_REG_26_MODEM_CONFIG3,
+};
+
+void readConfig(uint8_t* config)
+{
+  for (uint8_t i = 0; i < sizeof(configRegisters); i++)
+    config[i] = radio.registers[configRegisters[i]];
+}
+
+void check(bool ok, const char* what)
+{
+  if (ok)
+    return;
+  Serial.print("FAIL: ");
+  Serial.println(what);
+  pass = false;
+}
+
+class ShadowNode : public RHSimNode
+{
+public:
+  ShadowNode()
+    : driver(SS_PIN, DIO0_PIN, radio)
+  {
+  }
+
+  void setup()
+  {
+    attachInterrupt(SS_PIN, chipSelectRising, RISING);
+    if (!driver.init())
+      Serial.println("init failed");
+  }
+
+  void loop()
+  {
+    uint8_t config[sizeof(configRegisters)];
+    readConfig(config);
+    uint32_t airtime = driver.timeOnAir(MESSAGE_LEN);
+
+    // Every octet differs from the configuration, so any of them taken into the shadow shows
+    uint8_t message[MESSAGE_LEN];
+    memset(message, 0xa5, sizeof(message));
+    driver.send(message, sizeof(message));
+    check((radio.registers[RH_RF95_REG_01_OP_MODE] & 0x07) == RH_RF95_MODE_TX, "not transmitting");
+    check(radio.fifo[RH_RF95_HEADER_LEN + MESSAGE_LEN - 1] == 0xa5, "message not in the FIFO");
+    check(driver.timeOnAir(MESSAGE_LEN) == airtime, "timeOnAir() changed");
+
+    // Read, modify and write through the shadow
+    driver.setSpreadingFactor(9);
+    uint8_t expected[sizeof(configRegisters)];
+    memcpy(expected, config, sizeof(expected));
+    expected[1] = (config[1] & 0x0f) | 0x90; // MODEM_CONFIG2
+    readConfig(config);
+    check(!memcmp(config, expected, sizeof(config)), "setSpreadingFactor() wrote the wrong configuration");
+
+    Serial.println(pass ? "PASS" : "FAIL");
+    exit(pass ? 0 : 1);
+  }
+
+  RH_RF95 driver;
+};
+
+void setup()
+{
+  Simulator.addNode(new ShadowNode());
+}
+
+void loop()
+{
+  Simulator.run(10000);
+  Serial.println("FAIL: did not finish");
+  exit(1);
+}
@@ -0,0 +1,114 @@
+// simulator_stats.pde
+// -*- mode: C++ -*-
+// Example sketch showing how to collect statistics from the layers of a RadioHead stack,
+// and send them over the radio in the compact binary format from RHDatagram::serializeStats().
+// 5 RHMesh nodes are in a line, and each can only hear its neighbours. The nodes at the ends
+// send messages to each other for 10 minutes of virtual time. Then the far node sends its
+// statistics to node 1, which prints them, followed by its own.
+// Tested on Linux
+// Build with
+// cd whatever/RadioHead
+// tools/simEventBuild examples/simulator/simulator_stats/simulator_stats.pde
+// Run with ./simulator_stats [seed]
+
+#include <RHMesh.h>
+#include <RH_Sim.h>
+#include <RHutil/RHSimulator.h>
+
+#define NODES 5
+
+// Ten minutes
+#define DURATION 600000
+
+// Application flag marking a message that carries statistics
+#define STATS_FLAG 0x01
+
+uint8_t data[] = "Hello World!";
+
+class StatsNode : public RHSimNode
+{
+public:
+  StatsNode(uint8_t address)
+    : manager(driver, address),
+      nextSend(0),
+      statsSent(false)
+  {
+  }
+
+  void setup()
+  {
+    if (!manager.init())
+      Serial.println("init failed");
+    driver.setModemConfig(RH_Sim::Bw125Cr45Sf128);
+    nextSend = random(5000, 15000);
+  }
+
+  void loop()
+  {
+    uint8_t len = sizeof(buf);
+    uint8_t from, flags;
+    if (manager.recvfromAckTimeout(buf, &len, 1000, &from, NULL, NULL, &flags) && (flags & STATS_FLAG))
+    {
+      Serial.print("Statistics from node ");
+      Serial.print(from, DEC);
+      Serial.print(", ");
+      Serial.print(len, DEC);
+      Serial.println(" octets:");
+      RHStatsReader::print(buf, len);
+    }
+
+    uint8_t address = manager.thisAddress();
+    if (address != 1 && address != NODES)
+      return;
+    if (millis() < DURATION - 60000 && millis() >= nextSend)
+    {
+      manager.sendtoWait(data, sizeof(data), address == 1 ? NODES : 1);
+      nextSend = millis() + random(5000, 15000);
+    }
+    else if (address == NODES && millis() >= DURATION - 50000 && !statsSent)
+    {
+      // Send our statistics to node 1 in a single message
+      uint16_t statsLen = manager.serializeStats(buf, RH_MESH_MAX_MESSAGE_LEN);
+      statsSent = manager.sendtoWait(buf, statsLen, 1, STATS_FLAG) == RH_ROUTER_ERROR_NONE;
+    }
+  }
+
+  RH_Sim        driver;
+  RHMesh        manager;
+  unsigned long nextSend;
+  bool          statsSent;
+  uint8_t       buf[RH_MESH_MAX_MESSAGE_LEN];
+};
+
+StatsNode* nodes[NODES];
+
+void setup()
+{
+  if (_simulator_argc >= 2)
+    Simulator.setSeed(atoi(_simulator_argv[1]));
+
+  uint8_t i;
+  for (i = 0; i < NODES; i++)
+    Simulator.addNode(nodes[i] = new StatsNode(i + 1));
+
+  // Nodes only hear their neighbours, and not always
+  Simulator.setDefaultLink(0.0);
+  for (i = 1; i < NODES; i++)
+  {
+    Simulator.setLink(i, i + 1, 0.9, -100);
+    Simulator.setLink(i + 1, i, 0.9, -100);
+  }
+}
+
+void loop()
+{
+  Simulator.run(DURATION);
+
+  uint8_t buf[RH_MESH_MAX_MESSAGE_LEN];
+  uint16_t len = nodes[0]->manager.serializeStats(buf, sizeof(buf));
+  Serial.print("Statistics of node 1, ");
+  Serial.print((unsigned int)len, DEC);
+  Serial.println(" octets:");
+  RHStatsReader::print(buf, len);
+  exit(0);
+}
@@ -0,0 +1,109 @@
+// simEventMain.cpp
+// Lets Arduino RadioHead sketches run many simulated nodes in virtual time within a single process
+// See RHutil/RHSimulator.h
+// Copyright (C) 2014 Mike McCauley
+// $Id: simEventMain.cpp,v 1.1 2019/09/06 04:40:40 mikem Exp $
+
+#include <RadioHead.h>
+#if (RH_PLATFORM == RH_PLATFORM_UNIX) 
+
+#include <stdio.h>
+#include <RHutil/simulator.h>
+#include <RHutil/RHSimulator.h>
+
+SerialSimulator Serial;
+RHSimulator     Simulator;
+
+// Functions we expect to find in the sketch
+extern void setup();
+extern void loop();
+
+int    _simulator_argc;
+char** _simulator_argv;
+
+// Run the Arduino standard functions in the main loop.
+// setup() creates the nodes and loop() runs the simulation
+int main(int argc, char** argv)
+{
+    // Let simulated program have access to argc and argv
+    _simulator_argc = argc;
+    _simulator_argv = argv;
+    setup();
+    while (1)
+	loop();
+}
+
+// Arduino equivalent, microseconds of virtual time since the simulation started
+unsigned long micros()
+{
+    Simulator.spin();
+    return Simulator.now();
+}
+
+// Digital pins, shared by all the nodes
+static uint8_t pinLevels[256];
+static void  (*pinInterrupts[256])();
+static int     pinInterruptModes[256];
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+}
+
+void digitalWrite(uint8_t pin, uint8_t val)
+{
+    uint8_t level = val ? HIGH : LOW;
+    if (level == pinLevels[pin])
+	return;
+    pinLevels[pin] = level;
+    int mode = pinInterruptModes[pin];
+    if (pinInterrupts[pin] 
+	&& (mode == CHANGE || (mode == RISING && level == HIGH) || (mode == FALLING && level == LOW)))
+	pinInterrupts[pin]();
+}
+
+int digitalRead(uint8_t pin)
+{
+    return pinLevels[pin];
+}
+
+void attachInterrupt(uint8_t interrupt, void (*isr)(), int mode)
+{
+    pinInterrupts[interrupt] = isr;
+    pinInterruptModes[interrupt] = mode;
+}
+
+void detachInterrupt(uint8_t interrupt)
+{
+    pinInterrupts[interrupt] = NULL;
+}
+
+// Virtual time passes without the node doing anything else
+void delay(unsigned long ms)
+{
+    Simulator.sleepUntil(Simulator.now() + (uint64_t)ms * 1000, false);
+}
+
+// Arduino equivalent, milliseconds of virtual time since the simulation started
+unsigned long millis()
+{
+    Simulator.spin();
+    return Simulator.now() / 1000;
+}
+
+void yield()
+{
+    Simulator.yield();
+}
+
+// Repeatable, from the seed set with Simulator.setSeed()
+long random(long from, long to)
+{
+    return from + (Simulator.random32() % (to - from));
+}
+
+long random(long to)
+{
+    return random(0, to);
+}
+
+#endif
@@ -25,6 +25,7 @@
 #include "nrf_log_default_backends.h"
 #include "nrf_pwr_mgmt.h"
 #include "nrf_drv_spi.h"
+#include "rf95_spim.h"
 
 
 // Register names (LoRa Mode, from table 85)
@@ -321,7 +322,6 @@ typedef enum {
 } DataRate;
 
 volatile RHMode     _mode;
-nrf_drv_spi_config_t spi_config;
 nrf_drv_spi_config_t dwm_spi_config;
 uint8_t _txHeaderFlags = 0;
 volatile uint16_t   _txGood;
@@ -375,12 +375,7 @@ void clearRxBuf() {
 
 // writes one uint8_t value
 void spiWrite(uint8_t reg, uint8_t val) {
-  uint8_t buf[257];
-  buf[0] = 0x80 | reg;
-  memcpy(buf+1, &val, 1);
-  nrf_drv_spi_init(spi_instance, &spi_config, NULL, NULL);
-  ret_code_t err = nrf_drv_spi_transfer(spi_instance, buf, 2, NULL, 0);
-  nrf_drv_spi_uninit(spi_instance);
+  rf95_spim_write(reg, val);
 }
 
 void setModeIdle() {
@@ -390,6 +385,14 @@ void setModeIdle() {
   }
 }
 
+// setModeIdle() for the SPIM interrupt, which cannot wait for a transfer of its own
+void setModeIdleFromInterrupt() {
+  if (_mode != RHModeIdle) {
+    rf95_spim_write_async(RH_RF95_REG_01_OP_MODE, RH_RF95_MODE_STDBY);
+    _mode = RHModeIdle;
+  }
+}
+
 void setModeRx()
 {
     if (_mode != RHModeRx)
@@ -441,36 +444,20 @@ bool recv(uint8_t* buf, uint8_t* len) {
 }
 
 void spiBurstWrite(uint8_t reg, uint8_t* write_buf, size_t len){
-  if (len > 256) return;
-  uint8_t buf[257];
-  buf[0] = 0x80 | reg;
-  memcpy(buf+1, write_buf, len);
-  nrf_drv_spi_init(spi_instance, &spi_config, NULL, NULL);
-  nrf_drv_spi_transfer(spi_instance, buf, len+1, NULL, 0);
-  nrf_drv_spi_uninit(spi_instance);
+  if (len > 255) return;
+  rf95_spim_burst_write(reg, write_buf, len);
 }
 
 
 // reads a buffer of values
 void spiBurstRead(uint8_t reg, uint8_t* read_buf, size_t len){
-  if (len > 256) return;
-  uint8_t readreg = reg;
-  uint8_t buf[257];
-
-  nrf_drv_spi_init(spi_instance, &spi_config, NULL, NULL);
-  nrf_drv_spi_transfer(spi_instance, &readreg, 1, buf, len+1);
-  nrf_drv_spi_uninit(spi_instance);
-
-  memcpy(read_buf, buf+1, len);
+  if (len > 255) return;
+  rf95_spim_burst_read(reg, read_buf, len);
 }
 
 // reads one uint8_t value
 uint8_t spiRead(uint8_t reg) {
-  uint8_t buf[2];
-  nrf_drv_spi_init(spi_instance, &spi_config, NULL, NULL);
-  ret_code_t err = nrf_drv_spi_transfer(spi_instance, &reg, 1, buf, 2);
-  nrf_drv_spi_uninit(spi_instance);
-  return buf[1];
+  return rf95_spim_read(reg);
 }
 
 void setModeTx() {
@@ -534,38 +521,32 @@ bool waitPacketSent() {
 }
 
 
-void handleInterrupts(nrf_drv_gpiote_pin_t pin, nrf_gpiote_polarity_t action) {
-  // Read the interrupt register
-  uint8_t irq_flags = spiRead(RH_RF95_REG_12_IRQ_FLAGS);
-  // Read the RegHopChannel register to check if CRC presence is signalled
-  // in the header. If not it might be a stray (noise) packet.*
-  //uint8_t crc_present = spiRead(RH_RF95_REG_1C_HOP_CHANNEL);
-
+// Called from the SPIM interrupt once the interrupt flags, and any packet, have been read
+// and the flags cleared
+void radioInterrupt(uint8_t irq_flags, const uint8_t* buf, uint8_t len) {
   if (_mode == RHModeRx && irq_flags & RH_RF95_RX_DONE) {
     // Have received a packet
-    uint8_t len = spiRead(RH_RF95_REG_13_RX_NB_BYTES);
-
-    //  Reset the fifo read ptr to the beginning of the packet
-    spiWrite(RH_RF95_REG_0D_FIFO_ADDR_PTR, spiRead(RH_RF95_REG_10_FIFO_RX_CURRENT_ADDR));
-    spiBurstRead(RH_RF95_REG_00_FIFO, _buf, len);
+    memcpy(_buf, buf, len);
     _bufLen = len;
-    spiWrite(RH_RF95_REG_12_IRQ_FLAGS, 0xff); // Clear all IRQ flags
 
     // We have received a message.
     validateRxBuf(); 
     if (_rxBufValid)
-      setModeIdle(); // Got one 
+      setModeIdleFromInterrupt(); // Got one 
   } else if (_mode == RHModeTx && irq_flags & RH_RF95_TX_DONE) {
     _txGood++;
-    setModeIdle();
+    setModeIdleFromInterrupt();
   } else if (_mode == RHModeCad && irq_flags & RH_RF95_CAD_DONE) {
     _cad = irq_flags & RH_RF95_CAD_DETECTED;
-    setModeIdle();
+    setModeIdleFromInterrupt();
   }
-    // Sigh: on some processors, for some unknown reason, doing this only once does not actually
-    // clear the radio's interrupt flag. So we do it twice. Why?
-    spiWrite(RH_RF95_REG_12_IRQ_FLAGS, 0xff); // Clear all IRQ flags
-    spiWrite(RH_RF95_REG_12_IRQ_FLAGS, 0xff); // Clear all IRQ flags
+}
+
+void handleInterrupts(nrf_drv_gpiote_pin_t pin, nrf_gpiote_polarity_t action) {
+  // Read the flags and the packet in one DMA chain, and leave the CPU free meanwhile.
+  // If one is still running, it is run again when it finishes
+  ret_code_t err_code = rf95_spim_irq(radioInterrupt);
+  APP_ERROR_CHECK(err_code);
 }
 
 
@@ -1220,6 +1201,10 @@ int main(void) {
   NRF_LOG_DEFAULT_BACKENDS_INIT();
   printf("Log initialized!\n");
 
+  // The radio has SPIM2 to itself, at 8MHz, so the DWM keeps SPI1. Ready before its interrupts
+  error_code = rf95_spim_init(SPI_SCLK, SPI_MOSI, SPI_MISO, RFM95_CS);
+  APP_ERROR_CHECK(error_code);
+
   // initialize interrupts
   gpio_init();
   // // Our own interrupt handler.
@@ -1230,18 +1215,6 @@ int main(void) {
 
   spi_instance = &instance;
 
-  nrf_drv_spi_config_t config = {
-    .sck_pin = SPI_SCLK,
-    .mosi_pin = SPI_MOSI,
-    .miso_pin = SPI_MISO,
-    .ss_pin = RFM95_CS,
-    .irq_priority = NRFX_SPI_DEFAULT_CONFIG_IRQ_PRIORITY,
-    .orc = 0,
-    .frequency = NRF_DRV_SPI_FREQ_1M,
-    .mode = NRF_DRV_SPI_MODE_0,
-    .bit_order = NRF_DRV_SPI_BIT_ORDER_MSB_FIRST
-  };
-
   nrf_drv_spi_config_t dwm_config = {
     .sck_pin = DWM_SCLK,
     .mosi_pin = DWM_MOSI,
@@ -1254,8 +1227,6 @@ int main(void) {
     .bit_order = NRF_DRV_SPI_BIT_ORDER_MSB_FIRST
   };
 
-  spi_config = config;
-
   dwm_spi_config = dwm_config;
   
 
@@ -21,13 +21,13 @@
 #include "nrf_log_ctrl.h"
 #include "nrf_log_default_backends.h"
 #include "nrf_pwr_mgmt.h"
-#include "nrf_drv_spi.h"
 #include "nrf_drv_gpiote.h"
 #include "nrf_drv_clock.h"
 #include "nrf_drv_power.h"
 #include "nrf_serial.h"
 #include "app_util.h"
 #include "boards.h"
+#include "rf95_spim.h"
 
 
 
@@ -302,7 +302,6 @@ typedef enum {
 char store[1000];
 
 volatile RHMode     _mode;
-nrf_drv_spi_config_t spi_config;
 uint8_t _txHeaderFlags = 0;
 volatile uint16_t   _txGood;
 volatile uint8_t    _bufLen;
@@ -337,8 +336,6 @@ uint8_t             _buf[RH_RF95_MAX_PAYLOAD_LEN+1];
 volatile bool       _rxBufValid;
 
 
-static nrf_drv_spi_t instance = NRF_DRV_SPI_INSTANCE(1);
-const nrf_drv_spi_t* spi_instance;
 #define OP_QUEUES_SIZE          3
 #define APP_TIMER_PRESCALER     NRF_SERIAL_APP_TIMER_PRESCALER
 
@@ -432,12 +429,7 @@ void clearRxBuf() {
 
 // writes one uint8_t value
 void spiWrite(uint8_t reg, uint8_t val) {
-  uint8_t buf[257];
-  buf[0] = 0x80 | reg;
-  memcpy(buf+1, &val, 1);
-  nrf_drv_spi_init(spi_instance, &spi_config, NULL, NULL);
-  ret_code_t err = nrf_drv_spi_transfer(spi_instance, buf, 2, NULL, 0);
-  nrf_drv_spi_uninit(spi_instance);
+  rf95_spim_write(reg, val);
 }
 
 void setModeIdle() {
@@ -448,6 +440,14 @@ void setModeIdle() {
   }
 }
 
+// setModeIdle() for the SPIM interrupt, which cannot wait for a transfer of its own
+void setModeIdleFromInterrupt() {
+  if (_mode != RHModeIdle) {
+    rf95_spim_write_async(RH_RF95_REG_01_OP_MODE, RH_RF95_MODE_STDBY);
+    _mode = RHModeIdle;
+  }
+}
+
 void setModeRx()
 {
     if (_mode != RHModeRx)
@@ -503,37 +503,20 @@ bool recv(uint8_t* buf, uint8_t* len) {
 }
 
 void spiBurstWrite(uint8_t reg, uint8_t* write_buf, size_t len){
-  if (len > 256) return;
-  uint8_t buf[257];
-  buf[0] = 0x80 | reg;
-  memcpy(buf+1, write_buf, len);
-  nrf_drv_spi_init(spi_instance, &spi_config, NULL, NULL);
-  nrf_drv_spi_transfer(spi_instance, buf, len+1, NULL, 0);
-  nrf_drv_spi_uninit(spi_instance);
+  if (len > 255) return;
+  rf95_spim_burst_write(reg, write_buf, len);
 }
 
 
 // reads a buffer of values
 void spiBurstRead(uint8_t reg, uint8_t* read_buf, size_t len){
-  if (len > 256) return;
-  uint8_t readreg = reg;
-  uint8_t buf[257];
-
-  nrf_drv_spi_init(spi_instance, &spi_config, NULL, NULL);
-  nrf_drv_spi_transfer(spi_instance, &readreg, 1, buf, len+1);
-  nrf_drv_spi_uninit(spi_instance);
-
-  buf[len] = 0;
-  memcpy(read_buf, buf+1, len);
+  if (len > 255) return;
+  rf95_spim_burst_read(reg, read_buf, len);
 }
 
 // reads one uint8_t value
 uint8_t spiRead(uint8_t reg) {
-  uint8_t buf[2];
-  nrf_drv_spi_init(spi_instance, &spi_config, NULL, NULL);
-  ret_code_t err = nrf_drv_spi_transfer(spi_instance, &reg, 1, buf, 2);
-  nrf_drv_spi_uninit(spi_instance);
-  return buf[1];
+  return rf95_spim_read(reg);
 }
 
 void setModeTx() {
@@ -651,37 +634,30 @@ bool init() {
 }
 
 
-void handleInterrupts(nrf_drv_gpiote_pin_t pin, nrf_gpiote_polarity_t action) {
-  // Read the interrupt register
-  uint8_t irq_flags = spiRead(RH_RF95_REG_12_IRQ_FLAGS);
-  // Read the RegHopChannel register to check if CRC presence is signalled
-  // in the header. If not it might be a stray (noise) packet.*
-  //uint8_t crc_present = spiRead(RH_RF95_REG_1C_HOP_CHANNEL);
-
+// Called from the SPIM interrupt once the interrupt flags, and any packet, have been read
+// and the flags cleared
+void radioInterrupt(uint8_t irq_flags, const uint8_t* buf, uint8_t len) {
   if (_mode == RHModeRx && irq_flags & RH_RF95_RX_DONE) {
     // Have received a packet
-    uint8_t len = spiRead(RH_RF95_REG_13_RX_NB_BYTES);
-
-    //  Reset the fifo read ptr to the beginning of the packet
-    spiWrite(RH_RF95_REG_0D_FIFO_ADDR_PTR, spiRead(RH_RF95_REG_10_FIFO_RX_CURRENT_ADDR));
-    spiBurstRead(RH_RF95_REG_00_FIFO, _buf, len);
+    memcpy(_buf, buf, len);
     _bufLen = len;
-    spiWrite(RH_RF95_REG_12_IRQ_FLAGS, 0xff); // Clear all IRQ flags
 
     // We have received a message.
     validateRxBuf(); 
     if (_rxBufValid) {
-      setModeIdle(); // Got one 
+      setModeIdleFromInterrupt(); // Got one 
     }
   } else if (_mode == RHModeTx && irq_flags & RH_RF95_TX_DONE) {
     _txGood++;
-    setModeIdle();
+    setModeIdleFromInterrupt();
   }
+}
 
-    // Sigh: on some processors, for some unknown reason, doing this only once does not actually
-    // clear the radio's interrupt flag. So we do it twice. Why?
-    spiWrite(RH_RF95_REG_12_IRQ_FLAGS, 0xff); // Clear all IRQ flags
-    spiWrite(RH_RF95_REG_12_IRQ_FLAGS, 0xff); // Clear all IRQ flags
+void handleInterrupts(nrf_drv_gpiote_pin_t pin, nrf_gpiote_polarity_t action) {
+  // Read the flags and the packet in one DMA chain, and leave the CPU free meanwhile.
+  // If one is still running, it is run again when it finishes
+  ret_code_t err_code = rf95_spim_irq(radioInterrupt);
+  APP_ERROR_CHECK(err_code);
 }
 
 
@@ -818,6 +794,10 @@ int main(void) {
   NRF_LOG_DEFAULT_BACKENDS_INIT();
   printf("Log initialized!\n");
 
+  // The radio has SPIM2 to itself, at 8MHz. Ready before its interrupts
+  error_code = rf95_spim_init(SPI_SCLK, SPI_MOSI, SPI_MISO, RFM95_CS);
+  APP_ERROR_CHECK(error_code);
+
   // initialize GPIO driver/interrupts
   gpio_init();
 
@@ -830,22 +810,6 @@ int main(void) {
   nrf_gpio_pin_set(LED);
   nrf_gpio_pin_clear(SWITCH);
 
-  spi_instance = &instance;
-
-  nrf_drv_spi_config_t config = {
-    .sck_pin = SPI_SCLK,
-    .mosi_pin = SPI_MOSI,
-    .miso_pin = SPI_MISO,
-    .ss_pin = RFM95_CS,
-    .irq_priority = NRFX_SPI_DEFAULT_CONFIG_IRQ_PRIORITY,
-    .orc = 0,
-    .frequency = NRF_DRV_SPI_FREQ_1M,
-    .mode = 0,
-    .bit_order = 0
-  };
-
-  spi_config = config;
-
   nrf_gpio_pin_dir_set(RFM95_RST, NRF_GPIO_PIN_DIR_OUTPUT);
   nrf_gpio_pin_write(RFM95_RST, 1);
   printf("Arduino LoRa RX Test!\n");
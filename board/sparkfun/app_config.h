@@ -35,6 +35,9 @@
 #define NRFX_SPI1_ENABLED 1
 #define SPI_ENABLED 1
 #define SPI1_ENABLED 1
+// SPIM2 is the RFM95's own, see libraries/rf95_spim
+#define NRFX_SPIM2_ENABLED 1
+#define SPI2_ENABLED 1
 
 #define APP_SDCARD_ENABLED 1
 
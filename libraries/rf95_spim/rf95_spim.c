@@ -0,0 +1,310 @@
+// Asynchronous SPIM transport for the RFM95 LoRa module
+//
+// Register and FIFO transactions are queued as chains of descriptors and run by EasyDMA
+
+#include <string.h>
+
+#include "app_util_platform.h"
+#include "nrf.h"
+#include "nrfx_spim.h"
+
+#include "rf95_spim.h"
+
+// Radio registers used here
+#define RF95_REG_FIFO               0x00
+#define RF95_REG_FIFO_ADDR_PTR      0x0d
+#define RF95_REG_FIFO_RX_CURRENT    0x10
+#define RF95_REG_IRQ_FLAGS          0x12
+#define RF95_WRITE                  0x80
+#define RF95_RX_DONE                0x40
+
+static const nrfx_spim_t spim = NRFX_SPIM_INSTANCE(RF95_SPIM_INSTANCE);
+
+// Chains waiting to run. The head is running while running is set
+static rf95_spim_chain_t* volatile head = NULL;
+static rf95_spim_chain_t* volatile tail = NULL;
+static volatile bool running = false;
+
+static void start_xfer(void) {
+  rf95_spim_chain_t* chain = head;
+  ret_code_t err_code = nrfx_spim_xfer(&spim, &chain->xfers[chain->next], 0);
+  APP_ERROR_CHECK(err_code);
+}
+
+static void spim_event_handler(nrfx_spim_evt_t const* p_event, void* p_context) {
+  rf95_spim_chain_t* chain = head;
+  uint8_t next = chain->next + 1;
+  if (chain->step) {
+    next = chain->step(chain, chain->next);
+  }
+  if (next < chain->count) {
+    chain->next = next;
+    start_xfer();
+    return;
+  }
+
+  // This chain is done. Keep the bus busy with the next one before telling anyone
+  bool more;
+  CRITICAL_REGION_ENTER();
+  head = chain->queued;
+  if (!head) {
+    tail = NULL;
+  }
+  more = head != NULL;
+  running = more;
+  CRITICAL_REGION_EXIT();
+  chain->busy = false;
+  if (more) {
+    start_xfer();
+  }
+  if (chain->done) {
+    chain->done(chain);
+  }
+}
+
+ret_code_t rf95_spim_init(uint32_t sck_pin, uint32_t mosi_pin, uint32_t miso_pin, uint32_t ss_pin) {
+  nrfx_spim_config_t config = NRFX_SPIM_DEFAULT_CONFIG;
+  config.sck_pin = sck_pin;
+  config.mosi_pin = mosi_pin;
+  config.miso_pin = miso_pin;
+  config.ss_pin = ss_pin;
+  config.orc = 0;
+  config.frequency = NRF_SPIM_FREQ_8M;
+  config.mode = NRF_SPIM_MODE_0;
+  config.bit_order = NRF_SPIM_BIT_ORDER_MSB_FIRST;
+  return nrfx_spim_init(&spim, &config, spim_event_handler, NULL);
+}
+
+// Add a chain already marked busy to the queue, and start it if the bus is idle
+static void enqueue(rf95_spim_chain_t* chain) {
+  chain->next = 0;
+  chain->queued = NULL;
+
+  bool idle;
+  CRITICAL_REGION_ENTER();
+  if (tail) {
+    tail->queued = chain;
+  } else {
+    head = chain;
+  }
+  tail = chain;
+  idle = !running;
+  running = true;
+  CRITICAL_REGION_EXIT();
+  // Nothing else can start the bus while running is set
+  if (idle) {
+    start_xfer();
+  }
+}
+
+ret_code_t rf95_spim_start(rf95_spim_chain_t* chain) {
+  if (!chain->count) {
+    return NRF_ERROR_INVALID_PARAM;
+  }
+  bool busy;
+  CRITICAL_REGION_ENTER();
+  busy = chain->busy;
+  chain->busy = true;
+  CRITICAL_REGION_EXIT();
+  if (busy) {
+    return NRF_ERROR_BUSY;
+  }
+  enqueue(chain);
+  return NRF_SUCCESS;
+}
+
+// The interrupt chain: read the FIFO address, interrupt flags and length in one burst, point
+// the FIFO at the packet, read it in up to two parts, and clear the flags that were read (twice,
+// as some processors need). Flags raised after the read stay set for the next run
+#define IRQ_XFER_STATUS  0
+#define IRQ_XFER_POINTER 1
+#define IRQ_XFER_FIFO_A  2
+#define IRQ_XFER_FIFO_B  3
+#define IRQ_XFER_CLEAR   4
+#define IRQ_XFERS        6
+
+static uint8_t irq_status_tx[1] = { RF95_REG_FIFO_RX_CURRENT };
+static uint8_t irq_status_rx[5]; // Dummy, RX current address, flags mask, flags, length
+static uint8_t irq_pointer_tx[2] = { RF95_WRITE | RF95_REG_FIFO_ADDR_PTR, 0 };
+static uint8_t irq_fifo_tx[1] = { RF95_REG_FIFO };
+static uint8_t irq_fifo_a[RF95_SPIM_MAX_CHUNK + 1];
+static uint8_t irq_fifo_b[RF95_SPIM_MAX_CHUNK + 1];
+static uint8_t irq_clear_tx[2] = { RF95_WRITE | RF95_REG_IRQ_FLAGS, 0 };
+static uint8_t irq_packet[255];
+static uint8_t irq_len;
+static rf95_spim_irq_callback* irq_callback;
+// Set from rf95_spim_irq() until the chain and its callback are done, and while pending is set
+static volatile bool irq_active = false;
+// Set when rf95_spim_irq() is called while the chain is active, to run it again
+static volatile bool irq_pending = false;
+
+static nrfx_spim_xfer_desc_t irq_xfers[IRQ_XFERS] = {
+  NRFX_SPIM_XFER_TRX(irq_status_tx, sizeof(irq_status_tx), irq_status_rx, sizeof(irq_status_rx)),
+  NRFX_SPIM_XFER_TX(irq_pointer_tx, sizeof(irq_pointer_tx)),
+  NRFX_SPIM_XFER_TRX(irq_fifo_tx, sizeof(irq_fifo_tx), irq_fifo_a, 1),
+  NRFX_SPIM_XFER_TRX(irq_fifo_tx, sizeof(irq_fifo_tx), irq_fifo_b, 1),
+  NRFX_SPIM_XFER_TX(irq_clear_tx, sizeof(irq_clear_tx)),
+  NRFX_SPIM_XFER_TX(irq_clear_tx, sizeof(irq_clear_tx)),
+};
+
+static uint8_t irq_step(rf95_spim_chain_t* chain, uint8_t index) {
+  if (index == IRQ_XFER_STATUS) {
+    irq_len = 0;
+    irq_clear_tx[1] = irq_status_rx[3];
+    if (!(irq_status_rx[3] & RF95_RX_DONE) || !irq_status_rx[4]) {
+      return IRQ_XFER_CLEAR;
+    }
+    // Fill in the rest of the chain from what was just read
+    irq_len = irq_status_rx[4];
+    irq_pointer_tx[1] = irq_status_rx[1];
+    uint8_t a = irq_len > RF95_SPIM_MAX_CHUNK ? RF95_SPIM_MAX_CHUNK : irq_len;
+    irq_xfers[IRQ_XFER_FIFO_A].rx_length = a + 1;
+    irq_xfers[IRQ_XFER_FIFO_B].rx_length = irq_len - a + 1;
+    return IRQ_XFER_POINTER;
+  }
+  if (index == IRQ_XFER_FIFO_A && irq_len <= RF95_SPIM_MAX_CHUNK) {
+    return IRQ_XFER_CLEAR;
+  }
+  return index + 1;
+}
+
+static void irq_done(rf95_spim_chain_t* chain) {
+  // The first byte of each FIFO read was clocked in with the address
+  if (irq_len) {
+    uint8_t a = irq_xfers[IRQ_XFER_FIFO_A].rx_length - 1;
+    memcpy(irq_packet, irq_fifo_a + 1, a);
+    memcpy(irq_packet + a, irq_fifo_b + 1, irq_len - a);
+  }
+  irq_callback(irq_status_rx[3], irq_packet, irq_len);
+
+  // Read the flags again for any interrupt that came while this chain was active
+  bool again;
+  CRITICAL_REGION_ENTER();
+  again = irq_pending;
+  irq_pending = false;
+  irq_active = again;
+  CRITICAL_REGION_EXIT();
+  if (again) {
+    ret_code_t err_code = rf95_spim_start(chain);
+    APP_ERROR_CHECK(err_code);
+  }
+}
+
+static rf95_spim_chain_t irq_chain = {
+  .xfers = irq_xfers,
+  .count = IRQ_XFERS,
+  .step = irq_step,
+  .done = irq_done,
+};
+
+ret_code_t rf95_spim_irq(rf95_spim_irq_callback* callback) {
+  bool active;
+  CRITICAL_REGION_ENTER();
+  active = irq_active;
+  irq_active = true;
+  irq_pending = active;
+  CRITICAL_REGION_EXIT();
+  if (active) {
+    return NRF_SUCCESS; // irq_done() runs it again
+  }
+  irq_callback = callback;
+  ret_code_t err_code = rf95_spim_start(&irq_chain);
+  if (err_code != NRF_SUCCESS) {
+    irq_active = false;
+  }
+  return err_code;
+}
+
+typedef struct {
+  rf95_spim_chain_t chain;
+  nrfx_spim_xfer_desc_t xfer;
+  uint8_t tx[2];
+} async_write_t;
+
+static async_write_t async_writes[RF95_SPIM_ASYNC_WRITES];
+
+ret_code_t rf95_spim_write_async(uint8_t reg, uint8_t val) {
+  async_write_t* write = NULL;
+  CRITICAL_REGION_ENTER();
+  for (uint8_t i = 0; i < RF95_SPIM_ASYNC_WRITES; i++) {
+    if (!async_writes[i].chain.busy) {
+      write = &async_writes[i];
+      // Claim it before leaving the critical region
+      write->chain.busy = true;
+      break;
+    }
+  }
+  CRITICAL_REGION_EXIT();
+  if (!write) {
+    return NRF_ERROR_NO_MEM;
+  }
+  write->tx[0] = RF95_WRITE | reg;
+  write->tx[1] = val;
+  write->xfer = (nrfx_spim_xfer_desc_t) NRFX_SPIM_XFER_TX(write->tx, 2);
+  write->chain.xfers = &write->xfer;
+  write->chain.count = 1;
+  enqueue(&write->chain);
+  return NRF_SUCCESS;
+}
+
+// Queue one transaction and sleep until it is done
+static void run(nrfx_spim_xfer_desc_t* xfer) {
+  rf95_spim_chain_t chain = {
+    .xfers = xfer,
+    .count = 1,
+  };
+  ret_code_t err_code = rf95_spim_start(&chain);
+  APP_ERROR_CHECK(err_code);
+  while (chain.busy) {
+    __WFE();
+  }
+}
+
+uint8_t rf95_spim_read(uint8_t reg) {
+  uint8_t tx[1] = { reg & ~RF95_WRITE };
+  uint8_t rx[2];
+  nrfx_spim_xfer_desc_t xfer = NRFX_SPIM_XFER_TRX(tx, 1, rx, 2);
+  run(&xfer);
+  return rx[1];
+}
+
+void rf95_spim_write(uint8_t reg, uint8_t val) {
+  uint8_t tx[2] = { RF95_WRITE | reg, val };
+  nrfx_spim_xfer_desc_t xfer = NRFX_SPIM_XFER_TX(tx, 2);
+  run(&xfer);
+}
+
+// Reads and writes of the FIFO carry on from the FIFO pointer, so they can be split.
+// Other registers carry on from the next address
+void rf95_spim_burst_read(uint8_t reg, uint8_t* dest, uint8_t len) {
+  uint8_t tx[1];
+  uint8_t rx[RF95_SPIM_MAX_CHUNK + 1];
+  while (len) {
+    uint8_t n = len > RF95_SPIM_MAX_CHUNK ? RF95_SPIM_MAX_CHUNK : len;
+    tx[0] = reg & ~RF95_WRITE;
+    nrfx_spim_xfer_desc_t xfer = NRFX_SPIM_XFER_TRX(tx, 1, rx, n + 1);
+    run(&xfer);
+    memcpy(dest, rx + 1, n);
+    dest += n;
+    len -= n;
+    if (reg != RF95_REG_FIFO) {
+      reg += n;
+    }
+  }
+}
+
+void rf95_spim_burst_write(uint8_t reg, const uint8_t* src, uint8_t len) {
+  uint8_t tx[RF95_SPIM_MAX_CHUNK + 1];
+  while (len) {
+    uint8_t n = len > RF95_SPIM_MAX_CHUNK ? RF95_SPIM_MAX_CHUNK : len;
+    tx[0] = RF95_WRITE | reg;
+    memcpy(tx + 1, src, n);
+    nrfx_spim_xfer_desc_t xfer = NRFX_SPIM_XFER_TX(tx, n + 1);
+    run(&xfer);
+    src += n;
+    len -= n;
+    if (reg != RF95_REG_FIFO) {
+      reg += n;
+    }
+  }
+}
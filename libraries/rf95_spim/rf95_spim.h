@@ -0,0 +1,87 @@
+// Asynchronous SPIM transport for the RFM95 LoRa module
+//
+// Register and FIFO transactions are queued as chains of descriptors and run back to back
+// by EasyDMA at 8 MHz. The SPIM interrupt starts each transaction as the last one finishes,
+// and calls a completion callback at the end of the chain, so the CPU is free while the
+// radio is being read and written.
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "app_error.h"
+#include "nrfx_spim.h"
+
+// SPIM instance used for the radio. Enable it in app_config.h
+#ifndef RF95_SPIM_INSTANCE
+#define RF95_SPIM_INSTANCE 2
+#endif
+
+// Number of single register writes that can be waiting with rf95_spim_write_async()
+#ifndef RF95_SPIM_ASYNC_WRITES
+#define RF95_SPIM_ASYNC_WRITES 4
+#endif
+
+// Longest transaction, after the address byte. EasyDMA on the nRF52832 moves at most 255
+// bytes, so longer FIFO accesses are split into several transactions
+#define RF95_SPIM_MAX_CHUNK 128
+
+typedef struct rf95_spim_chain_s rf95_spim_chain_t;
+
+// Called from the SPIM interrupt after each transaction of a chain, with the index of the one
+// that finished. It may change later transactions (for example a length read by this one).
+// Returns the index of the next transaction to run, or the chain's count to end it
+typedef uint8_t rf95_spim_step_callback(rf95_spim_chain_t* chain, uint8_t index);
+
+// Called from the SPIM interrupt when the last transaction of a chain has finished
+typedef void rf95_spim_done_callback(rf95_spim_chain_t* chain);
+
+// Called from the SPIM interrupt when rf95_spim_irq() has read and cleared the interrupt flags of
+// the radio. If RxDone was set, buf holds the len bytes of the received packet, else len is 0
+typedef void rf95_spim_irq_callback(uint8_t irq_flags, const uint8_t* buf, uint8_t len);
+
+struct rf95_spim_chain_s {
+  nrfx_spim_xfer_desc_t* xfers;   // transactions, each with chip select asserted around it
+  uint8_t count;                  // number of transactions
+  rf95_spim_step_callback* step;  // optional, see above
+  rf95_spim_done_callback* done;  // optional, see above
+  void* context;                  // for the callbacks
+
+  // Used by the driver
+  volatile bool busy;             // queued or running
+  uint8_t next;                   // transaction running
+  rf95_spim_chain_t* queued;      // next chain in the queue
+};
+
+// Initialize the SPIM instance for the radio
+//
+// Returns success or an error code
+ret_code_t rf95_spim_init(uint32_t sck_pin, uint32_t mosi_pin, uint32_t miso_pin, uint32_t ss_pin);
+
+// Queue a chain of transactions. It runs after any chains already queued. The chain and its
+// buffers must stay valid, in RAM, until it is done
+//
+// Returns success, or NRF_ERROR_BUSY if the chain is already queued
+ret_code_t rf95_spim_start(rf95_spim_chain_t* chain);
+
+// Read and clear the interrupt flags of the radio, and the received packet if RxDone is set,
+// in one chain. Only the flags that were read are cleared. Call it from the DIO0 interrupt handler.
+// If the last one has not finished, including its callback, the chain runs again when it has,
+// so flags raised meanwhile are not lost
+//
+// Returns success or an error code
+ret_code_t rf95_spim_irq(rf95_spim_irq_callback* callback);
+
+// Queue a write of one register, without waiting for it. May be called from interrupts,
+// including the callbacks above
+//
+// Returns success, or NRF_ERROR_NO_MEM if RF95_SPIM_ASYNC_WRITES are already waiting
+ret_code_t rf95_spim_write_async(uint8_t reg, uint8_t val);
+
+// These queue a chain and wait for it to finish. Do not call them from an interrupt with
+// a priority as high as the SPIM interrupt, or they will never return
+uint8_t rf95_spim_read(uint8_t reg);
+void    rf95_spim_write(uint8_t reg, uint8_t val);
+void    rf95_spim_burst_read(uint8_t reg, uint8_t* dest, uint8_t len);
+void    rf95_spim_burst_write(uint8_t reg, const uint8_t* src, uint8_t len);